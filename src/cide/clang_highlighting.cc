@@ -21,7 +21,7 @@ bool IsWithinComment(int character, HighlightingASTVisitorData* visitorData) {
 }
 
 void FindCommentMarkerRanges(CXToken* tokens, unsigned numTokens, HighlightingASTVisitorData* visitorData, std::vector<DocumentRange>* ranges) {
-  QStringList commentMarkers = Settings::Instance().GetCommentMarkers();
+  const QStringList& commentMarkers = visitorData->settings->commentMarkers;
   
   // Iterate over all tokens
   for (int t = 0; t < numTokens; ++ t) {
@@ -64,20 +64,20 @@ void FindCommentMarkerRanges(CXToken* tokens, unsigned numTokens, HighlightingAS
   }
 }
 
-void ApplyCommentMarkerRanges(Document* document, const std::vector<DocumentRange>& ranges) {
-  const auto& commentMarkerStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::CommentMarker);
+void ApplyCommentMarkerRanges(HighlightingBuffer* highlighting, const std::vector<DocumentRange>& ranges, HighlightingASTVisitorData* visitorData) {
+  const auto& commentMarkerStyle = visitorData->settings->GetTextStyle(Settings::TextStyle::CommentMarker);
   for (const DocumentRange& range : ranges) {
-    document->AddHighlightRange(range, true, commentMarkerStyle);
+    highlighting->AddHighlightRange(range, true, commentMarkerStyle);
   }
 }
 
-void AddTokenHighlighting(Document* document, CXToken* tokens, unsigned numTokens, HighlightingASTVisitorData* visitorData) {
+void AddTokenHighlighting(HighlightingBuffer* highlighting, CXToken* tokens, unsigned numTokens, HighlightingASTVisitorData* visitorData) {
   constexpr bool kDebug = false;
   
-  const auto& languageKeywordStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::LanguageKeyword);
-  const auto& commentStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::Comment);
-  const auto& extraPunctuationStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::ExtraPunctuation);
-  const auto& preprocessorDirectiveStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::PreprocessorDirective);
+  const auto& languageKeywordStyle = visitorData->settings->GetTextStyle(Settings::TextStyle::LanguageKeyword);
+  const auto& commentStyle = visitorData->settings->GetTextStyle(Settings::TextStyle::Comment);
+  const auto& extraPunctuationStyle = visitorData->settings->GetTextStyle(Settings::TextStyle::ExtraPunctuation);
+  const auto& preprocessorDirectiveStyle = visitorData->settings->GetTextStyle(Settings::TextStyle::PreprocessorDirective);
   
   // Note: "#pragma once" is not reported via cursors at all. So we highlight it here via tokens.
   // The token sequence we need to watch out for is:
@@ -94,14 +94,14 @@ void AddTokenHighlighting(Document* document, CXToken* tokens, unsigned numToken
     
     if (kind == CXToken_Keyword) {
       DocumentRange tokenRange = CXSourceRangeToDocumentRange(clang_getTokenExtent(visitorData->TU, tokens[t]), *visitorData->lineOffsets);
-      document->AddHighlightRange(tokenRange, false, languageKeywordStyle);
+      highlighting->AddHighlightRange(tokenRange, false, languageKeywordStyle);
       
       if (kDebug) {
         qDebug() << "Keyword token: " << ClangString(clang_getTokenSpelling(visitorData->TU, tokens[t])).ToQString();
       }
     } else if (kind == CXToken_Comment) {
       DocumentRange tokenRange = CXSourceRangeToDocumentRange(clang_getTokenExtent(visitorData->TU, tokens[t]), *visitorData->lineOffsets);
-      document->AddHighlightRange(tokenRange, true, commentStyle);
+      highlighting->AddHighlightRange(tokenRange, true, commentStyle);
       
       visitorData->commentRanges.push_back(tokenRange);
       
@@ -114,7 +114,7 @@ void AddTokenHighlighting(Document* document, CXToken* tokens, unsigned numToken
       
       char token = clang_getCString(tokenSpelling)[0];
       if (token == ';' || token == '{' || token == '}') {
-        document->AddHighlightRange(tokenRange, false, extraPunctuationStyle);
+        highlighting->AddHighlightRange(tokenRange, false, extraPunctuationStyle);
       } else if (token == '#') {
         visitorData->pragmaOnceState = 1;
         pragmaOnceStateUpdated = true;
@@ -139,7 +139,7 @@ void AddTokenHighlighting(Document* document, CXToken* tokens, unsigned numToken
           cSpelling[8] == 0) {
         // TODO: "override" only acts as a keyword in the correct context. So we should also only highlight it in this case, instead of highlighting it always.
         DocumentRange tokenRange = CXSourceRangeToDocumentRange(clang_getTokenExtent(visitorData->TU, tokens[t]), *visitorData->lineOffsets);
-        document->AddHighlightRange(tokenRange, false, languageKeywordStyle);
+        highlighting->AddHighlightRange(tokenRange, false, languageKeywordStyle);
       } else if (visitorData->pragmaOnceState == 1 &&
                  cSpelling[0] == 'p' &&
                  cSpelling[1] == 'r' &&
@@ -166,7 +166,7 @@ void AddTokenHighlighting(Document* document, CXToken* tokens, unsigned numToken
           CXTokenKind kind = clang_getTokenKind(tokens[currentToken]);
           if (kind != CXToken_Comment) {
             DocumentRange tokenRange = CXSourceRangeToDocumentRange(clang_getTokenExtent(visitorData->TU, tokens[currentToken]), *visitorData->lineOffsets);
-            document->AddHighlightRange(tokenRange, false, preprocessorDirectiveStyle);
+            highlighting->AddHighlightRange(tokenRange, false, preprocessorDirectiveStyle);
             
             -- tokensToHighlight;
           }
@@ -192,7 +192,7 @@ void AddTokenHighlighting(Document* document, CXToken* tokens, unsigned numToken
 
 CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXCursor parent, CXClientData client_data) {
   HighlightingASTVisitorData* data = reinterpret_cast<HighlightingASTVisitorData*>(client_data);
-  Document* document = data->document;
+  HighlightingBuffer* highlighting = data->highlighting;
   
   // Skip over cursors which are in included files
   CXSourceRange clangExtent = clang_getCursorExtent(cursor);
@@ -218,8 +218,8 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
     
     data->macroExpansionRanges.push_back(std::make_pair(startOffset, endOffset));
     
-    const auto& macroInvocationStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::MacroInvocation);
-    document->AddHighlightRange(CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets), false, macroInvocationStyle);
+    const auto& macroInvocationStyle = data->settings->GetTextStyle(Settings::TextStyle::MacroInvocation);
+    highlighting->AddHighlightRange(CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets), false, macroInvocationStyle);
     return CXChildVisit_Continue;
   }
   
@@ -279,37 +279,37 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
 //   clang_disposeString(spelling);
 //   clang_disposeString(kindSpelling);
   
-  const auto& macroDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::MacroDefinition);
-  const auto& templateParameterDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::TemplateParameterDefinition);
-  const auto& templateParameterUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::TemplateParameterUse);
-  const auto& variableDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::VariableDefinition);
-  const auto& variableUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::VariableUse);
-  const auto& memberVariableUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::MemberVariableUse);
-  const auto& typedefDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::TypedefDefinition);
-  const auto& typedefUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::TypedefUse);
-  const auto& enumConstantDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::EnumConstantDefinition);
-  const auto& enumConstantUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::EnumConstantUse);
-  const auto& constructorOrDestructorDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::ConstructorOrDestructorDefinition);
-  const auto& constructorOrDestructorUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::ConstructorOrDestructorUse);
-  const auto& functionDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::FunctionDefinition);
-  const auto& functionUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::FunctionUse);
-  const auto& unionDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::UnionDefinition);
+  const auto& macroDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::MacroDefinition);
+  const auto& templateParameterDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::TemplateParameterDefinition);
+  const auto& templateParameterUseStyle = data->settings->GetTextStyle(Settings::TextStyle::TemplateParameterUse);
+  const auto& variableDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::VariableDefinition);
+  const auto& variableUseStyle = data->settings->GetTextStyle(Settings::TextStyle::VariableUse);
+  const auto& memberVariableUseStyle = data->settings->GetTextStyle(Settings::TextStyle::MemberVariableUse);
+  const auto& typedefDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::TypedefDefinition);
+  const auto& typedefUseStyle = data->settings->GetTextStyle(Settings::TextStyle::TypedefUse);
+  const auto& enumConstantDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::EnumConstantDefinition);
+  const auto& enumConstantUseStyle = data->settings->GetTextStyle(Settings::TextStyle::EnumConstantUse);
+  const auto& constructorOrDestructorDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::ConstructorOrDestructorDefinition);
+  const auto& constructorOrDestructorUseStyle = data->settings->GetTextStyle(Settings::TextStyle::ConstructorOrDestructorUse);
+  const auto& functionDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::FunctionDefinition);
+  const auto& functionUseStyle = data->settings->GetTextStyle(Settings::TextStyle::FunctionUse);
+  const auto& unionDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::UnionDefinition);
   // TODO: Union use?
-  const auto& enumDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::EnumDefinition);
+  const auto& enumDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::EnumDefinition);
   // TODO: Enum use?
-  const auto& classOrStructDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::ClassOrStructDefinition);
-  const auto& classOrStructUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::ClassOrStructUse);
-  const auto& labelStatementStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::LabelStatement);
-  const auto& labelReferenceStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::LabelReference);
-  const auto& integerLiteralStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::IntegerLiteral);
-  const auto& floatingLiteralStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::FloatingLiteral);
-  const auto& imaginaryLiteralStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::ImaginaryLiteral);
-  const auto& stringLiteralStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::StringLiteral);
-  const auto& characterLiteralStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::CharacterLiteral);
-  const auto& preprocessorDirectiveStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::PreprocessorDirective);
-  const auto& includePathStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::IncludePath);
-  const auto& namespaceDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::NamespaceDefinition);
-  const auto& namespaceUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::NamespaceUse);
+  const auto& classOrStructDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::ClassOrStructDefinition);
+  const auto& classOrStructUseStyle = data->settings->GetTextStyle(Settings::TextStyle::ClassOrStructUse);
+  const auto& labelStatementStyle = data->settings->GetTextStyle(Settings::TextStyle::LabelStatement);
+  const auto& labelReferenceStyle = data->settings->GetTextStyle(Settings::TextStyle::LabelReference);
+  const auto& integerLiteralStyle = data->settings->GetTextStyle(Settings::TextStyle::IntegerLiteral);
+  const auto& floatingLiteralStyle = data->settings->GetTextStyle(Settings::TextStyle::FloatingLiteral);
+  const auto& imaginaryLiteralStyle = data->settings->GetTextStyle(Settings::TextStyle::ImaginaryLiteral);
+  const auto& stringLiteralStyle = data->settings->GetTextStyle(Settings::TextStyle::StringLiteral);
+  const auto& characterLiteralStyle = data->settings->GetTextStyle(Settings::TextStyle::CharacterLiteral);
+  const auto& preprocessorDirectiveStyle = data->settings->GetTextStyle(Settings::TextStyle::PreprocessorDirective);
+  const auto& includePathStyle = data->settings->GetTextStyle(Settings::TextStyle::IncludePath);
+  const auto& namespaceDefinitionStyle = data->settings->GetTextStyle(Settings::TextStyle::NamespaceDefinition);
+  const auto& namespaceUseStyle = data->settings->GetTextStyle(Settings::TextStyle::NamespaceUse);
   
   bool addContext = false;
   
@@ -334,14 +334,15 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
       
       // Determine whether to apply per-variable coloring to this definition.
       QColor overrideColor;
-      if (data->perVariableColoring && kind != CXCursor_FieldDecl && Settings::Instance().GetLocalVariableColorPoolSize() > 0) {
+      const std::vector<QRgb>& localVariableColors = data->settings->localVariableColors;
+      if (data->settings->usePerVariableColoring && kind != CXCursor_FieldDecl && !localVariableColors.empty()) {
         CXCursor parent = clang_getCursorSemanticParent(cursor);
         CXCursorKind parentKind = clang_getCursorKind(parent);
         if (IsFunctionDeclLikeCursorKind(parentKind)) {
           // Apply per-variable coloring.
           unsigned offset;
           clang_getFileLocation(clang_getCursorLocation(cursor), nullptr, nullptr, nullptr, &offset);
-          overrideColor = Settings::Instance().GetLocalVariableColor(data->variableCounterPerFunction % Settings::Instance().GetLocalVariableColorPoolSize());
+          overrideColor = localVariableColors[data->variableCounterPerFunction % localVariableColors.size()];
           data->perVariableColorMap[offset] = overrideColor;
           ++ data->variableCounterPerFunction;
         }
@@ -349,22 +350,22 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
       
       if (overrideColor.isValid()) {
         // We usually override the text color, but do override the background color instead if the style does not affect the text color.
-        document->AddHighlightRange(spellingRange, false, overrideColor, style.bold, style.affectsText, style.affectsBackground, style.affectsText ? style.backgroundColor : overrideColor);
+        highlighting->AddHighlightRange(spellingRange, false, overrideColor, style.bold, style.affectsText, style.affectsBackground, style.affectsText ? style.backgroundColor : overrideColor);
       } else {
-        document->AddHighlightRange(spellingRange, false, style);
+        highlighting->AddHighlightRange(spellingRange, false, style);
       }
     }
   } else if (kind == CXCursor_TypedefDecl) {
     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-    document->AddHighlightRange(spellingRange, false, typedefDefinitionStyle);
+    highlighting->AddHighlightRange(spellingRange, false, typedefDefinitionStyle);
   } else if (kind == CXCursor_EnumConstantDecl) {
     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-    document->AddHighlightRange(spellingRange, false, enumConstantDefinitionStyle);
+    highlighting->AddHighlightRange(spellingRange, false, enumConstantDefinitionStyle);
   } else if (IsFunctionDeclLikeCursorKind(kind)) {
     bool isConstructorOrDestructor = kind == CXCursor_Constructor || kind == CXCursor_Destructor;
     
     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-    document->AddHighlightRange(spellingRange, false, isConstructorOrDestructor ? constructorOrDestructorDefinitionStyle : functionDefinitionStyle);
+    highlighting->AddHighlightRange(spellingRange, false, isConstructorOrDestructor ? constructorOrDestructorDefinitionStyle : functionDefinitionStyle);
     
     data->variableCounterPerFunction = 0;
     data->perVariableColorMap.clear();
@@ -372,7 +373,7 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
     addContext = clang_isCursorDefinition(cursor);
   } else if (kind == CXCursor_UnionDecl || kind == CXCursor_EnumDecl) {
     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-    document->AddHighlightRange(spellingRange, false, (kind == CXCursor_UnionDecl) ? unionDefinitionStyle : enumDefinitionStyle);
+    highlighting->AddHighlightRange(spellingRange, false, (kind == CXCursor_UnionDecl) ? unionDefinitionStyle : enumDefinitionStyle);
     addContext = clang_isCursorDefinition(cursor);
   } else if (kind == CXCursor_ClassTemplate ||
              kind == CXCursor_ClassDecl ||
@@ -391,7 +392,7 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
     } else {
       style = &classOrStructDefinitionStyle;
     }
-    document->AddHighlightRange(spellingRange, false, *style);
+    highlighting->AddHighlightRange(spellingRange, false, *style);
   
     // Add a contexts for definitions (not for forward declarations).
     addContext = kind != CXCursor_TypeRef && clang_isCursorDefinition(cursor);
@@ -400,7 +401,7 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
     CXCursorKind referencedKind = clang_getCursorKind(referencedCursor);
     if (referencedKind == CXCursor_Constructor) {
       DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-      document->AddHighlightRange(spellingRange, false, constructorOrDestructorUseStyle);
+      highlighting->AddHighlightRange(spellingRange, false, constructorOrDestructorUseStyle);
     }
   } else if (kind == CXCursor_MemberRefExpr) {
     // Find out whether the member is a function or an attribute
@@ -408,13 +409,13 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
     CXCursorKind memberKind = clang_getCursorKind(memberCursor);
     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
     if (memberKind == CXCursor_FieldDecl) {
-      document->AddHighlightRange(spellingRange, false, memberVariableUseStyle);
+      highlighting->AddHighlightRange(spellingRange, false, memberVariableUseStyle);
     } else if (memberKind == CXCursor_CXXMethod ||
                memberKind == CXCursor_ConversionFunction ||
                memberKind == CXCursor_OverloadedDeclRef) {
-      document->AddHighlightRange(spellingRange, false, functionUseStyle);
+      highlighting->AddHighlightRange(spellingRange, false, functionUseStyle);
     } else if (memberKind == CXCursor_Destructor){
-      document->AddHighlightRange(spellingRange, false, constructorOrDestructorUseStyle);
+      highlighting->AddHighlightRange(spellingRange, false, constructorOrDestructorUseStyle);
     } else if (memberKind == CXCursor_InvalidFile) {
       // This happens for calling functions on template types, for example
       // for "SomeFunction" here:
@@ -424,7 +425,7 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
       // }
       // In this case, the spelling range is only "T", while the extent
       // is "T.SomeFunction".
-      document->AddHighlightRange(CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets), false, functionUseStyle);
+      highlighting->AddHighlightRange(CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets), false, functionUseStyle);
     } else {
       qDebug() << "Warning: MemberRefExpr cursor to unhandled member type" << memberKind;
     }
@@ -433,18 +434,18 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
     // Constrain the range to the word "if" instead of the whole statement.
 //     range.end.line = range.start.line;
 //     range.end.col = range.start.col + 2;
-//     document->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
+//     highlighting->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
   } else if (kind == CXCursor_WhileStmt) {
 //     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent);
 //     // Constrain the range to the word "while" instead of the whole statement.
 //     range.end.line = range.start.line;
 //     range.end.col = range.start.col + 5;
-//     document->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
+//     highlighting->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
   } else if (kind == CXCursor_ReturnStmt) {
 //     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent);
 //     // Constrain the range to the word "return" instead of the whole statement.
 //     range.end.col = range.start.col + 6;
-//     document->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
+//     highlighting->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
   } else if (kind == CXCursor_DeclRefExpr) {
     // NOTE: These are references to non-members or enum constants.
     CXCursor referencedCursor = clang_getCursorReferenced(cursor);
@@ -452,14 +453,14 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
     
     if (IsFunctionDeclLikeCursorKind(referencedKind)) {
       DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-      document->AddHighlightRange(spellingRange, false, functionUseStyle);
+      highlighting->AddHighlightRange(spellingRange, false, functionUseStyle);
     } else if (referencedKind == CXCursor_EnumConstantDecl) {
       DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-      document->AddHighlightRange(spellingRange, false, enumConstantUseStyle);
+      highlighting->AddHighlightRange(spellingRange, false, enumConstantUseStyle);
     } else if (referencedKind == CXCursor_VarDecl || referencedKind == CXCursor_ParmDecl) {
       QColor color = variableUseStyle.textColor;
       
-      if (data->perVariableColoring) {
+      if (data->settings->usePerVariableColoring) {
         if (!clang_Cursor_isNull(referencedCursor)) {
           CXFile referencedFile;
           unsigned offset;
@@ -475,7 +476,7 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
       
       // We usually override the text color, but do override the background color instead if the style does not affect the text color.
       DocumentRange range = CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets);
-      document->AddHighlightRange(range, false, color, variableUseStyle.bold, variableUseStyle.affectsText, variableUseStyle.affectsBackground, variableUseStyle.affectsText ? variableUseStyle.backgroundColor : color);
+      highlighting->AddHighlightRange(range, false, color, variableUseStyle.bold, variableUseStyle.affectsText, variableUseStyle.affectsBackground, variableUseStyle.affectsText ? variableUseStyle.backgroundColor : color);
     } else {
       qDebug() << "Clang highlighting: Encountered CXCursor_DeclRefExpr cursor which references an unhandled cursor kind: " << ClangString(clang_getCursorKindSpelling(referencedKind)).ToQString();
     }
@@ -495,30 +496,30 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
       qDebug() << "Clang highlighting: Encountered CXCursor_TemplateRef cursor that references an unhandled cursor type: " << ClangString(clang_getCursorKindSpelling(referencedKind)).ToQString();
     }
     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets);
-    document->AddHighlightRange(range, false, *style);
+    highlighting->AddHighlightRange(range, false, *style);
   } else if (kind == CXCursor_LabelStmt || kind == CXCursor_LabelRef) {
     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-    document->AddHighlightRange(spellingRange, false, (kind == CXCursor_LabelStmt) ? labelStatementStyle : labelReferenceStyle);
+    highlighting->AddHighlightRange(spellingRange, false, (kind == CXCursor_LabelStmt) ? labelStatementStyle : labelReferenceStyle);
   } else if (kind == CXCursor_CXXStaticCastExpr ||
              kind == CXCursor_CXXDynamicCastExpr ||
              kind == CXCursor_CXXReinterpretCastExpr ||
              kind == CXCursor_CXXConstCastExpr) {
 //     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0));
-//     document->AddHighlightRange(spellingRange, false, qRgb(0, 0, 0), true);
+//     highlighting->AddHighlightRange(spellingRange, false, qRgb(0, 0, 0), true);
   } else if (kind == CXCursor_CXXBoolLiteralExpr) {
 //     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent);
-//     document->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
+//     highlighting->AddHighlightRange(range, false, qRgb(0, 0, 0), true);
   } else if (kind == CXCursor_IntegerLiteral) {
     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets);
-    document->AddHighlightRange(range, false, integerLiteralStyle);
+    highlighting->AddHighlightRange(range, false, integerLiteralStyle);
   } else if (kind == CXCursor_FloatingLiteral ||
              kind == CXCursor_ImaginaryLiteral) {
     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets);
-    document->AddHighlightRange(range, false, (kind == CXCursor_FloatingLiteral) ? floatingLiteralStyle : imaginaryLiteralStyle);
+    highlighting->AddHighlightRange(range, false, (kind == CXCursor_FloatingLiteral) ? floatingLiteralStyle : imaginaryLiteralStyle);
   } else if (kind == CXCursor_StringLiteral ||
              kind == CXCursor_CharacterLiteral) {
     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets);
-    document->AddHighlightRange(range, true, (kind == CXCursor_StringLiteral) ? stringLiteralStyle : characterLiteralStyle);
+    highlighting->AddHighlightRange(range, true, (kind == CXCursor_StringLiteral) ? stringLiteralStyle : characterLiteralStyle);
   } else if (kind == CXCursor_MacroDefinition) {
 //     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent);
     
@@ -539,19 +540,19 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
 //         defineRange.start = searchStart;
 //         defineRange.end.line = searchStart.line;
 //         defineRange.end.col = searchStart.col + 7;
-//         document->AddHighlightRange(defineRange, false, qRgb(5, 113, 44), false);
+//         highlighting->AddHighlightRange(defineRange, false, qRgb(5, 113, 44), false);
 //       }
 //     }
     
     DocumentRange nameRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-    document->AddHighlightRange(nameRange, false, macroDefinitionStyle);
+    highlighting->AddHighlightRange(nameRange, false, macroDefinitionStyle);
   } else if (kind == CXCursor_InclusionDirective) {
     DocumentRange range = CXSourceRangeToDocumentRange(clangExtent, *data->lineOffsets);
     
     DocumentRange includeRange;
     includeRange.start = range.start;
     includeRange.end.offset = range.start.offset + 8;
-    document->AddHighlightRange(includeRange, false, preprocessorDirectiveStyle);
+    highlighting->AddHighlightRange(includeRange, false, preprocessorDirectiveStyle);
     
     // Highlight the path range. Unfortunately, it seems that we cannot retrieve
     // it directly. Include statements can go over multiple lines (with the \ separator)
@@ -574,13 +575,13 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
           DocumentRange pathRange;
           pathRange.end = range.end;
           pathRange.start = range.end - (rangeText.size() - c);
-          document->AddHighlightRange(pathRange, true, includePathStyle);
+          highlighting->AddHighlightRange(pathRange, true, includePathStyle);
         }
       }
     }
   } else if (kind == CXCursor_Namespace || kind == CXCursor_NamespaceRef) {
     DocumentRange spellingRange = CXSourceRangeToDocumentRange(clang_Cursor_getSpellingNameRange(cursor, 0, 0), *data->lineOffsets);
-    document->AddHighlightRange(spellingRange, false, (kind == CXCursor_Namespace) ? namespaceDefinitionStyle : namespaceUseStyle);
+    highlighting->AddHighlightRange(spellingRange, false, (kind == CXCursor_Namespace) ? namespaceDefinitionStyle : namespaceUseStyle);
   }
   
   if (addContext) {
@@ -642,7 +643,7 @@ CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXC
       }
     }
     
-    document->AddContext(
+    highlighting->AddContext(
         name,
         displayName,
         (namePos >= 0) ? DocumentRange(namePos, namePos + name.size()) : DocumentRange::Invalid(),
@@ -13,14 +13,18 @@
 
 #include "cide/document_range.h"
 
-class Document;
+class HighlightingBuffer;
+struct HighlightingSettings;
 
 
 /// Data that needs to be passed to the visitor function visiting libclang's AST,
 /// VisitClangAST_AddHighlightingAndContexts() (and related functions).
 struct HighlightingASTVisitorData {
-  /// The document being parsed.
-  Document* document;
+  /// Buffer that receives the highlight ranges and contexts.
+  HighlightingBuffer* highlighting;
+  
+  /// Copy of the settings, made in the Qt thread.
+  const HighlightingSettings* settings;
   
   CXTranslationUnit TU;
   CXFile file;
@@ -37,7 +41,6 @@ struct HighlightingASTVisitorData {
   int pragmaOnceState = 0;
   
   // Per-variable coloring for local variables
-  bool perVariableColoring;
   int variableCounterPerFunction = 0;
   /// Maps file offsets of variable definitions to their assigned colors.
   std::unordered_map<unsigned, QColor> perVariableColorMap;
@@ -53,10 +56,10 @@ struct HighlightingASTVisitorData {
 void FindCommentMarkerRanges(CXToken* tokens, unsigned numTokens, HighlightingASTVisitorData* visitorData, std::vector<DocumentRange>* ranges);
 
 /// Adds highlight ranges for the given comment marker ranges found by FindCommentMarkerRanges().
-void ApplyCommentMarkerRanges(Document* document, const std::vector<DocumentRange>& ranges);
+void ApplyCommentMarkerRanges(HighlightingBuffer* highlighting, const std::vector<DocumentRange>& ranges, HighlightingASTVisitorData* visitorData);
 
-/// Adds highlighting ranges to the document based on the given tokens.
-void AddTokenHighlighting(Document* document, CXToken* tokens, unsigned numTokens, HighlightingASTVisitorData* visitorData);
+/// Adds highlighting ranges to the buffer based on the given tokens.
+void AddTokenHighlighting(HighlightingBuffer* highlighting, CXToken* tokens, unsigned numTokens, HighlightingASTVisitorData* visitorData);
 
 /// AST visitor function for libclang to add syntax highlighting ranges and extract "contexts" for navigation.
 CXChildVisitResult VisitClangAST_AddHighlightingAndContexts(CXCursor cursor, CXCursor parent, CXClientData client_data);
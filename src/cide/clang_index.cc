@@ -4,6 +4,8 @@
 
 #include "cide/clang_index.h"
 
+#include <mutex>
+
 ClangIndex::ClangIndex() {
   // excludeDeclarationsFromPCH must be set to 0, otherwise the use of the
   // CXTranslationUnit_PrecompiledPreamble flag for parsing will lead to
@@ -21,3 +23,32 @@ ClangIndex::ClangIndex() {
 ClangIndex::~ClangIndex() {
   clang_disposeIndex(mIndex);
 }
+
+
+static std::mutex currentIndexingSessionMutex;
+static std::shared_ptr<ClangIndexingSession> currentIndexingSession;
+
+std::shared_ptr<ClangIndexingSession> ClangIndexingSession::Get() {
+  std::unique_lock<std::mutex> lock(currentIndexingSessionMutex);
+  if (!currentIndexingSession) {
+    currentIndexingSession.reset(new ClangIndexingSession());
+  }
+  return currentIndexingSession;
+}
+
+void ClangIndexingSession::Reset() {
+  std::unique_lock<std::mutex> lock(currentIndexingSessionMutex);
+  currentIndexingSession.reset();
+}
+
+ClangIndexingSession::ClangIndexingSession() {
+  // Note: In contrast to CXTranslationUnits (see ClangTU), the CXIndexAction
+  //       is intentionally shared between threads, since this is required to
+  //       skip already parsed function bodies. libclang guards the session's
+  //       shared state internally.
+  mAction = clang_IndexAction_create(mIndex.index());
+}
+
+ClangIndexingSession::~ClangIndexingSession() {
+  clang_IndexAction_dispose(mAction);
+}
@@ -4,6 +4,8 @@
 
 #pragma once
 
+#include <memory>
+
 #include <clang-c/Index.h>
 
 /// Wraps a CXIndex instance.
@@ -19,3 +21,33 @@ class ClangIndex {
  private:
   CXIndex mIndex;
 };
+
+/// Wraps a libclang indexing session (CXIndexAction) which is shared by all
+/// files that get indexed in the background with libclang's indexing API. If
+/// indexing is done with the CXIndexOpt_SkipParsedBodiesInSession option,
+/// libclang skips the function bodies in headers that have already been
+/// indexed in the same session.
+class ClangIndexingSession {
+ public:
+  /// Returns the current session. Can be called from any thread.
+  static std::shared_ptr<ClangIndexingSession> Get();
+  
+  /// Starts a new session, such that files indexed afterwards do not skip the
+  /// function bodies seen in the old session anymore. This should be called
+  /// after the background indexing has finished, since the files may be
+  /// modified afterwards. Users of the old session may continue to use it.
+  static void Reset();
+  
+  ~ClangIndexingSession();
+  
+  inline CXIndexAction action() const {
+    return mAction;
+  }
+  
+ private:
+  ClangIndexingSession();
+  
+  
+  ClangIndex mIndex;
+  CXIndexAction mAction;
+};
@@ -4,22 +4,31 @@
 
 #include "cide/clang_parser.h"
 
+#include <chrono>
+#include <cstring>
 #include <iostream>
 
 #include <clang-c/Index.h>
+#include <QDateTime>
+#include <QFile>
 #include <QMessageBox>
 
 #include "cide/clang_highlighting.h"
 #include "cide/clang_index.h"
 #include "cide/clang_utils.h"
 #include "cide/document.h"
+#include "cide/global_symbol_table.h"
 #include "cide/main_window.h"
+#include "cide/parse_statistics.h"
 #include "cide/parse_thread_pool.h"
 #include "cide/problem.h"
 #include "cide/project.h"
 #include "cide/qt_thread.h"
 #include "cide/settings.h"
+#include "cide/target_pch.h"
 #include "cide/text_utils.h"
+#include "cide/tracing.h"
+#include "cide/usr_index_cache.h"
 
 
 void RetrieveDiagnostics(Document* document, CXFile file, const std::shared_ptr<ClangTU>& TU, const std::vector<unsigned>& lineOffsets) {
@@ -38,6 +47,10 @@ void RetrieveDiagnostics(Document* document, CXFile file, const std::shared_ptr<
     // Create the problem and add it to the document
     std::shared_ptr<Problem> newProblem(new Problem(diagnostic, TU->TU(), lineOffsets));
     int problemIndex = document->AddProblem(newProblem);
+    if (problemIndex < 0) {
+      // The location of the problem has been edited since the parse.
+      return newProblem;
+    }
     lastProblems.push_back(newProblem.get());
     
     // Add the problem ranges to the document to underline them
@@ -49,11 +62,14 @@ void RetrieveDiagnostics(Document* document, CXFile file, const std::shared_ptr<
     
     // Since many types of problems do not have ranges associated with them,
     // determine the word that contains the given problem location and add it
-    // as an additional range.
-    // TODO: We would need to transform this location through all edits that
-    //       happened between the parse and now if we apply parse results to
-    //       updated document versions.
+    // as an additional range. Since the word is determined in the current
+    // version of the document, the location needs to be mapped to it first if
+    // the document has been edited since the parse.
     DocumentLocation diagnosticDocLoc = CXSourceLocationToDocumentLocation(diagnosticLoc, lineOffsets);
+    const DocumentEditMapper* mapper = document->GetParseResultMapper();
+    if (mapper && !mapper->MapLocation(&diagnosticDocLoc)) {
+      return newProblem;
+    }
     Document::CharacterIterator charIt(document, diagnosticDocLoc.offset);
     if (diagnosticDocLoc.offset > 0 &&
         charIt.IsValid() &&
@@ -80,7 +96,9 @@ void RetrieveDiagnostics(Document* document, CXFile file, const std::shared_ptr<
       }
       
       // NOTE: Could check for overlaps with existing ranges here and merge
+      document->SetParseResultMapper(nullptr);
       document->AddProblemRange(problemIndex, DocumentRange(wordStartIt.GetCharacterOffset(), wordEndIt.GetCharacterOffset()));
+      document->SetParseResultMapper(mapper);
     }
     
     return newProblem;
@@ -103,6 +121,7 @@ void RetrieveDiagnostics(Document* document, CXFile file, const std::shared_ptr<
       // This note must be attached to the previous non-note diagnostic.
       for (Problem* lastProblem : lastProblems) {
         lastProblem->AddNote(diagnostic, TU->TU(), lineOffsets);
+        document->MapAppendedProblemItem(lastProblem);
       }
       clang_disposeDiagnostic(diagnostic);
       continue;
@@ -171,28 +190,172 @@ void VisitInclusions_GetPathsAndLastModificationTimes(
 }
 
 
+void VisitInclusionsForIndexing(
+    CXFile included_file,
+    CXSourceLocation* /*inclusion_stack*/,
+    unsigned /*include_len*/,
+    CXClientData client_data) {
+  std::unordered_set<QString>* includedPaths = reinterpret_cast<std::unordered_set<QString>*>(client_data);
+  includedPaths->insert(QFileInfo(GetClangFilePath(included_file)).canonicalFilePath());
+}
+
+/// Determines the modification times of the given files for
+/// SourceFile::indexedModificationTimes. Files which were passed to libclang as
+/// unsaved files, and files which were modified after @p readTime (such that
+/// it is unknown which version libclang read), get -1.
+static std::unordered_map<QString, qint64> GetIndexedModificationTimes(
+    const std::unordered_set<QString>& paths,
+    qint64 readTime,
+    const std::vector<std::string>& unsavedFilePaths) {
+  std::unordered_set<QString> unsavedPaths;
+  for (const std::string& path : unsavedFilePaths) {
+    unsavedPaths.insert(QString::fromStdString(path));
+  }
+  
+  std::unordered_map<QString, qint64> result;
+  result.reserve(paths.size());
+  for (const QString& path : paths) {
+    qint64 modificationTime = -1;
+    if (unsavedPaths.count(path) == 0) {
+      QFileInfo info(path);
+      if (info.exists()) {
+        modificationTime = info.lastModified().toMSecsSinceEpoch();
+        if (modificationTime > readTime) {
+          modificationTime = -1;
+        }
+      }
+    }
+    result.insert(std::make_pair(path, modificationTime));
+  }
+  return result;
+}
+
+/// Returns true if any of the @p candidates is contained in @p paths.
+static bool ContainsAnyOf(const std::unordered_set<QString>& paths, const std::vector<QString>& candidates) {
+  for (const QString& candidate : candidates) {
+    if (paths.count(candidate) > 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// Returns the time in seconds that passed since @p start.
+static double SecondsSince(const std::chrono::steady_clock::time_point& start) {
+  return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/// Returns the SourceFile for the given path in the first project that contains
+/// it, or null if it is not a project source file. Must be called from the
+/// main (Qt) thread.
+static SourceFile* FindProjectSourceFile(const QString& canonicalPath, ProjectHost* host, std::shared_ptr<Project>* project) {
+  for (auto& candidateProject : host->GetProjects()) {
+    SourceFile* sourceFile = candidateProject->GetSourceFile(canonicalPath);
+    if (sourceFile) {
+      *project = candidateProject;
+      return sourceFile;
+    }
+  }
+  return nullptr;
+}
+
+/// Returns the canonical paths of the source files that use the given compile
+/// settings, if these are the settings of a group in one of the project's
+/// targets. Must be called from the main (Qt) thread.
+static std::vector<QString> GetSourcePathsForCompileSettings(const CompileSettings* settings, Project* project) {
+  std::vector<QString> result;
+  for (int targetIndex = 0; targetIndex < project->GetNumTargets(); ++ targetIndex) {
+    const Target& target = project->GetTarget(targetIndex);
+    for (int settingsIndex = 0; settingsIndex < target.compileSettings.size(); ++ settingsIndex) {
+      if (&target.compileSettings[settingsIndex] != settings) {
+        continue;
+      }
+      for (const SourceFile& source : target.sources) {
+        if (source.compileSettingsIndex == settingsIndex) {
+          result.push_back(source.path);
+        }
+      }
+      return result;
+    }
+  }
+  return result;
+}
+
+/// Returns the shared precompiled header to use for parsing the given file,
+/// or null if none can be used.
+static std::shared_ptr<TargetPCH> GetTargetPCHForFile(
+    const QString& canonicalPath,
+    const std::vector<QByteArray>& commandLineArgs,
+    CompileSettings::Language language,
+    const std::vector<QString>& groupSourcePaths,
+    const std::vector<CXUnsavedFile>& unsavedFiles) {
+  if (groupSourcePaths.empty()) {
+    return std::shared_ptr<TargetPCH>();
+  }
+  
+  // Get the file's content, taking unsaved changes into account.
+  QByteArray fileText;
+  QByteArray canonicalPathUtf8 = canonicalPath.toUtf8();
+  bool foundUnsavedFile = false;
+  for (const CXUnsavedFile& unsavedFile : unsavedFiles) {
+    if (canonicalPathUtf8 == unsavedFile.Filename) {
+      fileText = QByteArray::fromRawData(unsavedFile.Contents, unsavedFile.Length);
+      foundUnsavedFile = true;
+      break;
+    }
+  }
+  if (!foundUnsavedFile) {
+    QFile file(canonicalPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+      return std::shared_ptr<TargetPCH>();
+    }
+    fileText = file.readAll();
+  }
+  
+  return TargetPCHCache::Instance().GetPCH(commandLineArgs, language, groupSourcePaths, fileText);
+}
+
 /// @p document may be null. In this case, @p canonicalPath must be valid. If
 /// @p document is valid, @p canonicalPath may be empty. @p canonicalPath must
 /// be given if @p alwaysIndex is true.
-void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWindow* mainWindow, bool alwaysIndex) {
+void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, ProjectHost* host, bool alwaysIndex) {
+  CIDE_TRACE_SPAN("ParseAndOrIndexFile");
   std::vector<QByteArray> commandLineArgs;
   std::vector<const char*> commandLineArgPtrs;
   std::vector<CXUnsavedFile> unsavedFiles;
   std::vector<std::string> unsavedFileContents;
   std::vector<std::string> unsavedFilePaths;
+  std::vector<QString> skippedUnsavedFilePaths;
   
   std::vector<unsigned> lineOffsets;
   unsigned utf8FileSize = 0;
   
   CompileSettings* settings = nullptr;
   std::shared_ptr<CompileSettings> settingsDeleter;
+  CompileSettings::Language language = CompileSettings::Language::Other;
+  std::vector<QString> groupSourcePaths;
   std::shared_ptr<ClangTU> TU;
   QString parseSettingsAreGuessedNotification;
   QString parseNotification;
   int parsedDocumentVersion = -1;
-  bool usePerVariableColoring;
+  int parsedDocumentEditCount = -1;
+  HighlightingSettings highlightingSettings;
+  bool useIndexingAPI;
+  bool useTargetPCH;
   bool exit = false;
   
+  // Timings are recorded into the statistics record of the ParseThreadPool
+  // if it provides one.
+  FileParseStatistics unusedStatistics;
+  FileParseStatistics* statistics = ParseStatistics::GetCurrentRecord();
+  if (!statistics) {
+    statistics = &unusedStatistics;
+  }
+  
+  // All files on disk are read by libclang after this point in time. This is
+  // used to tell whether the indexed files changed during indexing.
+  qint64 readTime = QDateTime::currentMSecsSinceEpoch();
+  
   RunInQtThreadBlocking([&]() {
     // If the document has been closed in the meantime, we must not access it or
     // its widget anymore.
@@ -211,12 +374,13 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
     if (document) {
       canonicalPath = QFileInfo(document->path()).canonicalFilePath();
       parsedDocumentVersion = document->version();
+      parsedDocumentEditCount = document->editCount();
     }
     
     // Find the parse settings for the source file
     bool settingsAreGuessed;
     std::shared_ptr<Project> usedProject;
-    settings = FindParseSettingsForFile(canonicalPath, mainWindow->GetProjects(), &usedProject, &settingsAreGuessed);
+    settings = FindParseSettingsForFile(canonicalPath, host->GetProjects(), &usedProject, &settingsAreGuessed);
     
     if (!settings) {
       parseNotification = QObject::tr("Could not find compile settings to parse the file (no project open)");
@@ -225,6 +389,9 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
       settings = settingsDeleter.get();
     } else if (settingsAreGuessed) {
       parseSettingsAreGuessedNotification = QObject::tr("Compile settings for this file are guessed (no #include of this file found in any project yet)");
+    } else if (usedProject) {
+      groupSourcePaths = GetSourcePathsForCompileSettings(settings, usedProject.get());
+      language = settings->language;
     }
     
     
@@ -233,7 +400,7 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
     //       and change the TU later once the file gets saved properly.
     if (canonicalPath.isEmpty()) {
       if (document) {
-        DocumentWidget* widget = mainWindow->GetWidgetForDocument(document);
+        DocumentWidget* widget = host->GetWidgetForDocument(document);
         if (widget) {
           widget->GetContainer()->SetMessage(
               DocumentWidgetContainer::MessageType::ParseSettingsAreGuessedNotification,
@@ -258,22 +425,25 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
     // }
     
     
-    usePerVariableColoring = Settings::Instance().GetUsePerVariableColoring();
+    useIndexingAPI = Settings::Instance().GetUseIndexingAPIForBackgroundIndexing();
+    useTargetPCH = Settings::Instance().GetUseTargetPCH();
     
-    // Get all unsaved files that are opened
     if (document) {
       std::string documentStringUtf8 = document->GetDocumentText().toStdString();
       utf8FileSize = documentStringUtf8.size();
+      
+      // The highlighting is computed in this thread, so it uses a copy of the
+      // settings.
+      highlightingSettings.Read();
     }
     
-    GetAllUnsavedFiles(mainWindow, &unsavedFiles, &unsavedFileContents, &unsavedFilePaths);
-    
     if (document) {
       // Get the newline positions of the main file to be able to map the "line, column"
       // positions given by libclang to offsets in our UTF-16 (QString) version of
       // the document.
-      // NOTE: We could also get this after parsing finished, since currently we
-      //       anyway only use the parsing result if the document has not changed.
+      // NOTE: This must be done before parsing, since the document may change
+      //       during parsing. In this case, the parse results get mapped to the
+      //       changed document using these offsets.
       lineOffsets.resize(document->LineCount());
       Document::LineIterator lineIt(document);
       int lineIndex = 0;
@@ -290,7 +460,7 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
       
       TU = document->GetTUPool()->TakeLeastUpToDateTU();
       if (!TU) {
-        DocumentWidget* widget = mainWindow->GetWidgetForDocument(document);
+        DocumentWidget* widget = host->GetWidgetForDocument(document);
         if (widget) {
           widget->GetContainer()->SetMessage(
               DocumentWidgetContainer::MessageType::ParseSettingsAreGuessedNotification,
@@ -304,10 +474,114 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
         return;
       }
     }
+    
+    // Get the unsaved files that are opened. If the files that belong to the
+    // TU are known from the last parse (or from indexing), only these are
+    // passed to libclang. If the parse turns out to include one of the
+    // skipped files, it is repeated below.
+    const std::unordered_set<QString>* relevantPaths = TU ? TU->GetRelevantUnsavedFilePaths() : nullptr;
+    if (!relevantPaths) {
+      std::shared_ptr<Project> sourceFileProject;
+      SourceFile* sourceFile = FindProjectSourceFile(canonicalPath, host, &sourceFileProject);
+      if (sourceFile && !sourceFile->includedPaths.empty()) {
+        relevantPaths = &sourceFile->includedPaths;
+      }
+    }
+    if (relevantPaths && relevantPaths->count(canonicalPath) == 0) {
+      // The TU was parsed for a different file.
+      relevantPaths = nullptr;
+    }
+    GetAllUnsavedFiles(host, &unsavedFiles, &unsavedFileContents, &unsavedFilePaths, relevantPaths, &skippedUnsavedFilePaths);
   });
   if (exit) {
     return;
   }
+  statistics->wasOpen = document != nullptr;
+  
+  // Indexing and the first parse of a document use the shared precompiled
+  // header of the file's target if possible.
+  std::shared_ptr<TargetPCH> pch;
+  std::vector<QByteArray> pchCommandLineArgs;
+  auto usePCHIfAvailable = [&]() {
+    if (useTargetPCH) {
+      CIDE_TRACE_SPAN("GetTargetPCHForFile");
+      auto pchStartTime = std::chrono::steady_clock::now();
+      pch = GetTargetPCHForFile(canonicalPath, commandLineArgs, language, groupSourcePaths, unsavedFiles);
+      statistics->pchSeconds += SecondsSince(pchStartTime);
+    }
+    if (pch) {
+      pch->AppendCommandLineArgs(&pchCommandLineArgs);
+      for (QByteArray& arg : pchCommandLineArgs) {
+        commandLineArgPtrs.push_back(arg.data());
+      }
+    }
+  };
+  
+  // Files that are not open are only indexed. Unless disabled, this uses
+  // libclang's indexing API, which skips the function bodies in headers that
+  // have been indexed already.
+  if (!document && useIndexingAPI) {
+    usePCHIfAvailable();
+    bool success;
+    bool includesSkippedUnsavedFile;
+    CIDE_TRACE_SPAN("IndexFile_WithIndexingAPI");
+    auto indexStartTime = std::chrono::steady_clock::now();
+    bool isRepeatedPass = false;
+    do {
+      includesSkippedUnsavedFile = false;
+      success = IndexFile_WithIndexingAPI(
+          ClangIndexingSession::Get()->action(),
+          canonicalPath,
+          commandLineArgPtrs,
+          &unsavedFiles,
+          [&](std::unordered_set<QString>&& includedPaths) {
+            // The files within the PCH are not reported by the indexing API.
+            if (pch) {
+              includedPaths.insert(pch->GetIncludedPaths().begin(), pch->GetIncludedPaths().end());
+            }
+            includesSkippedUnsavedFile = ContainsAnyOf(includedPaths, skippedUnsavedFilePaths);
+            if (includesSkippedUnsavedFile) {
+              // The result of this pass is discarded, see below.
+              return false;
+            }
+            std::unordered_map<QString, qint64> modificationTimes = GetIndexedModificationTimes(includedPaths, readTime, unsavedFilePaths);
+            quint64 compileArgumentsHash = ComputeCompileArgumentsHash(commandLineArgs);
+            RunInQtThreadBlocking([&]() {
+              std::shared_ptr<Project> usedProject;
+              SourceFile* sourceFile = FindProjectSourceFile(canonicalPath, host, &usedProject);
+              USRStorage::Instance().Lock();
+              if (sourceFile) {
+                IndexFile_SetInclusions(std::move(includedPaths), sourceFile, usedProject.get(), host);
+                sourceFile->indexedModificationTimes = std::move(modificationTimes);
+                sourceFile->indexedCompileArgumentsHash = compileArgumentsHash;
+              }
+              USRStorage::Instance().Unlock();
+            });
+            return true;
+          },
+          &statistics->tuMemory,
+          !isRepeatedPass);
+      if (success && includesSkippedUnsavedFile) {
+        // The file includes an unsaved file that was not passed to libclang
+        // since it was not included before. Index it again with all of them.
+        // The discarded pass has marked the function bodies of the headers as
+        // parsed in the indexing session, so they must not be skipped in the
+        // repeated pass.
+        RunInQtThreadBlocking([&]() {
+          GetAllUnsavedFiles(host, &unsavedFiles, &unsavedFileContents, &unsavedFilePaths);
+        });
+        skippedUnsavedFilePaths.clear();
+        isRepeatedPass = true;
+      }
+    } while (success && includesSkippedUnsavedFile);
+    statistics->parseSeconds += SecondsSince(indexStartTime);
+    if (success && pch) {
+      // Neither are the declarations within the PCH, so their USRs (which were
+      // collected when building the PCH) are published here.
+      IndexFile_PublishUSRs(pch->GetUSRs());
+    }
+    return;
+  }
   
   if (!TU) {
     // Create a temporary TU for indexing.
@@ -349,8 +623,14 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
         CXTranslationUnit_KeepGoing;
   }
   
+  // The time for getting the PCH is recorded separately, so it is subtracted
+  // from the parse time.
+  auto parseStartTime = std::chrono::steady_clock::now();
+  double pchSecondsBeforeParse = statistics->pchSeconds;
   CXErrorCode parseResult = CXError_Failure;
-  if (TU->CanBeReparsed(canonicalPath, commandLineArgs)) {
+  if (TU->CanBeReparsed(canonicalPath, commandLineArgs) &&
+      (!TU->GetPCH() || TU->GetPCH()->IsUpToDate())) {
+    CIDE_TRACE_SPAN("clang_reparseTranslationUnit");
     parseResult = static_cast<CXErrorCode>(clang_reparseTranslationUnit(
         TU->TU(),
         unsavedFiles.size(),
@@ -358,12 +638,17 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
         clang_defaultReparseOptions(TU->TU())));
     if (parseResult != CXError_Success) {
       qDebug() << "Parse error: failed to reparse.";
+    } else {
+      statistics->reparsed = true;
     }
   }
   
   if (parseResult != CXError_Success) {
     preambleIsLikelyUnchanged = false;
     
+    usePCHIfAvailable();
+    
+    CIDE_TRACE_SPAN("clang_parseTranslationUnit2");
     CXTranslationUnit clangTU;
     parseResult = clang_parseTranslationUnit2(
         TU->index(),
@@ -374,13 +659,35 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
         unsavedFiles.size(),
         parseOptions,
         &clangTU);
-    TU->Set(clangTU, commandLineArgs);
+    TU->Set(clangTU, commandLineArgs, pch);
+  }
+  
+  // If the file now includes an unsaved file that was not passed to libclang
+  // since it did not belong to the TU before, reparse with it.
+  if (parseResult == CXError_Success && TUContainsAnyOf(TU->TU(), skippedUnsavedFilePaths)) {
+    RunInQtThreadBlocking([&]() {
+      GetAllUnsavedFiles(host, &unsavedFiles, &unsavedFileContents, &unsavedFilePaths);
+    });
+    skippedUnsavedFilePaths.clear();
+    CIDE_TRACE_SPAN("clang_reparseTranslationUnit");
+    parseResult = static_cast<CXErrorCode>(clang_reparseTranslationUnit(
+        TU->TU(),
+        unsavedFiles.size(),
+        unsavedFiles.data(),
+        clang_defaultReparseOptions(TU->TU())));
+    if (parseResult != CXError_Success) {
+      qDebug() << "Parse error: failed to reparse with the newly included unsaved files.";
+    }
+  }
+  statistics->parseSeconds += SecondsSince(parseStartTime) - (statistics->pchSeconds - pchSecondsBeforeParse);
+  if (parseResult == CXError_Success) {
+    statistics->tuMemory = GetTUMemoryUsage(TU->TU());
   }
   
   if (parseResult == CXError_Crashed) {
     if (document) {
       RunInQtThreadBlocking([&]() {
-        DocumentWidget* widget = mainWindow->GetWidgetForDocument(document);
+        DocumentWidget* widget = host->GetWidgetForDocument(document);
         if (widget) {
           widget->GetContainer()->SetMessage(
               DocumentWidgetContainer::MessageType::ParseSettingsAreGuessedNotification,
@@ -396,7 +703,7 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
   } else if (parseResult == CXError_InvalidArguments) {
     if (document) {
       RunInQtThreadBlocking([&]() {
-        DocumentWidget* widget = mainWindow->GetWidgetForDocument(document);
+        DocumentWidget* widget = host->GetWidgetForDocument(document);
         if (widget) {
           widget->GetContainer()->SetMessage(
               DocumentWidgetContainer::MessageType::ParseSettingsAreGuessedNotification,
@@ -412,7 +719,7 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
   } else if (parseResult != CXError_Success) {
     if (document) {
       RunInQtThreadBlocking([&]() {
-        DocumentWidget* widget = mainWindow->GetWidgetForDocument(document);
+        DocumentWidget* widget = host->GetWidgetForDocument(document);
         if (widget) {
           widget->GetContainer()->SetMessage(
               DocumentWidgetContainer::MessageType::ParseSettingsAreGuessedNotification,
@@ -427,6 +734,8 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
     return;
   }
   
+  auto indexStartTime = std::chrono::steady_clock::now();
+  
   // (Approximately) determine whether the preamble changed.
   // TODO: It would be great if clang_reparseTranslationUnit() would simply
   //       return this piece of information.
@@ -448,39 +757,55 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
     }
   }
   fileIncludes.swap(newIncludes);
+  if (!preambleIsLikelyUnchanged || !TU->GetRelevantUnsavedFilePaths()) {
+    TU->UpdateRelevantUnsavedFilePaths();
+  }
   
   // (Re-)index the file. Perform the include update in the main thread, but
-  // the USR update in the parsing thread. The include file update is only
-  // necessary if !preambleIsLikelyUnchanged.
+  // the USR update in the parsing thread. The included files only need to be
+  // determined if !preambleIsLikelyUnchanged. Otherwise, only the TU file itself
+  // may have changed, so only its modification time gets updated.
   // TODO: For the likely-unchanged-preamble check, we already collect the
-  //       list of included files. Use that in IndexFile_GetInclusions() instead
-  //       of iterating over the inclusions via libclang again?
+  //       list of included files. Use that here instead of iterating over
+  //       the inclusions via libclang again?
+  std::unordered_set<QString> includedPaths;
   if (!preambleIsLikelyUnchanged) {
-    RunInQtThreadBlocking([&]() {
-      // Note: We do not exit here if the document has been closed in the
-      // meantime, as we always want to update the file's indexing information,
-      // even if it got closed.
-      
-      // First, check whether the file acts as a source file in a project.
-      SourceFile* sourceFile = nullptr;
-      std::shared_ptr<Project> usedProject = nullptr;
-      for (auto& project : mainWindow->GetProjects()) {
-        sourceFile = project->GetSourceFile(canonicalPath);
-        if (sourceFile) {
-          usedProject = project;
-          break;
-        }
-      }
-      // If the file is a project source file, update its list of included files.
+    clang_getInclusions(TU->TU(), &VisitInclusionsForIndexing, &includedPaths);
+    if (TU->GetPCH()) {
+      includedPaths.insert(TU->GetPCH()->GetIncludedPaths().begin(), TU->GetPCH()->GetIncludedPaths().end());
+    }
+  }
+  std::unordered_map<QString, qint64> modificationTimes = GetIndexedModificationTimes(
+      preambleIsLikelyUnchanged ? std::unordered_set<QString>{canonicalPath} : includedPaths,
+      readTime, unsavedFilePaths);
+  quint64 compileArgumentsHash = ComputeCompileArgumentsHash(commandLineArgs);
+  RunInQtThreadBlocking([&]() {
+    // Note: We do not exit here if the document has been closed in the
+    // meantime, as we always want to update the file's indexing information,
+    // even if it got closed.
+    
+    // First, check whether the file acts as a source file in a project.
+    std::shared_ptr<Project> usedProject;
+    SourceFile* sourceFile = FindProjectSourceFile(canonicalPath, host, &usedProject);
+    if (!sourceFile) {
+      return;
+    }
+    
+    // If the file is a project source file, update its list of included files.
+    if (!preambleIsLikelyUnchanged) {
       USRStorage::Instance().Lock();
-      if (sourceFile) {
-        IndexFile_GetInclusions(TU->TU(), sourceFile, usedProject.get(), mainWindow);
-      }
+      IndexFile_SetInclusions(std::move(includedPaths), sourceFile, usedProject.get(), host);
       USRStorage::Instance().Unlock();
       // Note: We cannot leave the USRStorage locked here, since the code below
       // will be executed in another thread.
-    });
-  }
+      sourceFile->indexedModificationTimes = std::move(modificationTimes);
+    } else {
+      for (const auto& item : modificationTimes) {
+        sourceFile->indexedModificationTimes[item.first] = item.second;
+      }
+    }
+    sourceFile->indexedCompileArgumentsHash = compileArgumentsHash;
+  });
   
   // Update USRs with the TU.
   // TODO: For headers, the USR update may be only partial. This is because
@@ -490,10 +815,12 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
   //       defines. For a correct update, we would need to parse the header
   //       with all used configurations after it is edited. But that seems
   //       infeasible.
-  USRStorage::Instance().Lock();
-  IndexFile_StoreUSRs(TU->TU(), preambleIsLikelyUnchanged);
-  // USRStorage::Instance().DebugPrintInfo();
-  USRStorage::Instance().Unlock();
+  {
+    CIDE_TRACE_SPAN("IndexFile_StoreUSRs");
+    IndexFile_StoreUSRs(TU->TU(), preambleIsLikelyUnchanged);
+  }
+  statistics->preambleIsLikelyUnchanged = preambleIsLikelyUnchanged;
+  statistics->indexSeconds += SecondsSince(indexStartTime);
   
   // Indexing finished, so we can return if we do not have a document.
   if (!document) {
@@ -501,13 +828,15 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
   }
   
   // Prepare AST visitor data
+  auto highlightingStartTime = std::chrono::steady_clock::now();
+  HighlightingBuffer highlighting;
   HighlightingASTVisitorData visitorData;
-  visitorData.document = document;
+  visitorData.highlighting = &highlighting;
   visitorData.TU = TU->TU();
   visitorData.file = clang_getFile(TU->TU(), canonicalPath.toUtf8().data());
   visitorData.lineOffsets = &lineOffsets;
   visitorData.prevCursor = clang_getNullCursor();
-  visitorData.perVariableColoring = usePerVariableColoring;
+  visitorData.settings = &highlightingSettings;
   
   // Build a CXSourceRange for the whole document
   CXSourceLocation startLocation = clang_getLocationForOffset(
@@ -525,32 +854,52 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
   std::vector<DocumentRange> commentMarkerRanges;
   FindCommentMarkerRanges(tokens, numTokens, &visitorData, &commentMarkerRanges);
   
+  // Collect the highlighting and contexts in the background thread as well,
+  // such that the Qt thread only needs to swap them into the document.
+  // Tokenize the whole document range in order to get keywords and comments
+  // (which are not reported by clang_visitChildren() unfortunately)
+  // TODO: Check the performance of this approach. If this takes too long,
+  //       it would be possible to restrict the tokenization to smaller ranges
+  //       (or even do it manually).
+  AddTokenHighlighting(&highlighting, tokens, numTokens, &visitorData);
+  clang_disposeTokens(visitorData.TU, tokens, numTokens);
+  ApplyCommentMarkerRanges(&highlighting, commentMarkerRanges, &visitorData);
+  
+  // Visit the resulting AST and extract information for highlighting
+  clang_visitChildren(clang_getTranslationUnitCursor(TU->TU()),
+                      &VisitClangAST_AddHighlightingAndContexts, &visitorData);
+  statistics->highlightingSeconds += SecondsSince(highlightingStartTime);
+  
   RunInQtThreadBlocking([&]() {
     // If the document has been closed in the meantime, we must not access it or
     // its widget anymore.
     if (!ParseThreadPool::Instance().IsDocumentBeingParsed(document)) {
-      clang_disposeTokens(visitorData.TU, tokens, numTokens);
       exit = true;
       return;
     }
+    
+    // If the document has been edited during parsing, map the parse results to
+    // the current version of the document, dropping the results for the edited
+    // parts. The next reparse should already have been triggered. If the edits
+    // are not available anymore, wait for this reparse instead.
+    std::unique_ptr<DocumentEditMapper> mapper;
     if (parsedDocumentVersion != document->version()) {
-      // Do the next reparse instead. It should already have been triggered.
-      // TODO: We could instead try to adjust the ranges to the changes in the
-      //       document here
-      clang_disposeTokens(visitorData.TU, tokens, numTokens);
-      document->GetTUPool()->PutTU(TU, true);
-      exit = true;
-      return;
+      mapper = document->CreateEditMapper(parsedDocumentEditCount, lineOffsets);
+      if (!mapper) {
+        document->GetTUPool()->PutTU(TU, true);
+        exit = true;
+        return;
+      }
     }
     
-    DocumentWidget* widget = mainWindow->GetWidgetForDocument(document);
+    DocumentWidget* widget = host->GetWidgetForDocument(document);
     
     // Re-check the parse settings for this file after the parse in case they were
     // guessed before the parse. If we know them for sure now, compare the settings.
     // If they are equal, we can drop the "parse settings were guessed" warning. If
     // they differ, we schedule a reparse.
     if (!parseSettingsAreGuessedNotification.isEmpty()) {
-      std::vector<std::shared_ptr<Project>>& projects = mainWindow->GetProjects();
+      std::vector<std::shared_ptr<Project>>& projects = host->GetProjects();
       std::shared_ptr<Project> usedProject = nullptr;
       for (auto& project : projects) {
         bool isGuess;
@@ -582,31 +931,18 @@ void ParseAndOrIndexFileImpl(QString canonicalPath, Document* document, MainWind
           DocumentWidgetContainer::MessageType::ParseNotification, parseNotification);
     }
     
-    document->ClearHighlightRanges(/*layer*/ 0);
-    document->ClearContexts();
-    
-    // Tokenize the whole document range in order to get keywords and comments
-    // (which are not reported by clang_visitChildren() unfortunately)
-    // TODO: Check the performance of this approach. If this takes too long,
-    //       it would be possible to restrict the tokenization to smaller ranges
-    //       (or even do it manually).
-    AddTokenHighlighting(document, tokens, numTokens, &visitorData);
-    clang_disposeTokens(visitorData.TU, tokens, numTokens);
-    ApplyCommentMarkerRanges(document, commentMarkerRanges);
-    
-    // Visit the resulting AST, extract information for highlighting, and add it
-    // to the document
-    clang_visitChildren(clang_getTranslationUnitCursor(TU->TU()),
-                        &VisitClangAST_AddHighlightingAndContexts, &visitorData);
+    document->SetParseResultMapper(mapper.get());
+    document->ApplyHighlighting(&highlighting, /*layer*/ 0);
     
     // Retrieve the problems and fix-its
     RetrieveDiagnostics(document, visitorData.file, TU, lineOffsets);
+    document->SetParseResultMapper(nullptr);
     
     // Return the TU back to the pool, signaling that it has been reparsed.
     document->GetTUPool()->PutTU(TU, true);
     
     // Notify the main window about the parse.
-    mainWindow->DocumentParsed(document);
+    host->DocumentParsed(document);
     
     document->FinishedHighlightingChanges();
   });
@@ -644,27 +980,230 @@ CompileSettings* FindParseSettingsForFile(const QString& canonicalPath, const st
   return settings;
 }
 
-void ParseFile(Document* document, MainWindow* mainWindow) {
-  ParseAndOrIndexFileImpl("", document, mainWindow, false);
+void ParseFile(Document* document, ProjectHost* host) {
+  ParseAndOrIndexFileImpl("", document, host, false);
 }
 
-void ParseFileIfOpenElseIndex(const QString& canonicalPath, Document* document, MainWindow* mainWindow) {
-  ParseAndOrIndexFileImpl(canonicalPath, document, mainWindow, true);
+void ParseFileIfOpenElseIndex(const QString& canonicalPath, Document* document, ProjectHost* host) {
+  ParseAndOrIndexFileImpl(canonicalPath, document, host, true);
 }
 
 
+/// USRs found for one file during IndexFile_StoreUSRs().
+struct IndexedFileUSRs {
+  /// Whether USRs are collected for the file. Usually, this is only the case
+  /// if the USRStorage has a USRMap for the file. In any case, the USRs are
+  /// only stored if a USRMap exists when they are published.
+  bool collectUSRs;
+  
+  /// Snapshot of the file's USRs at the time the file was first encountered.
+  /// USRs that are contained in it are not added to newUSRs again. This is
+  /// null for the TU file, since its USRs get replaced completely.
+  std::shared_ptr<const USRDeclMap> existingUSRs;
+  
+  /// USRs which are to be stored for the file.
+  USRDeclMapBuilder newUSRs;
+  
+  /// Reference sites which are to be stored for the file.
+  USRReferenceMapBuilder newReferences;
+  
+  /// Version of the file content that newReferences were collected from.
+  quint64 version = 0;
+};
+
 struct StoreDefinitionsVisitorData {
   bool updateTUFileOnly;
   CXFile TUFile;
   
+  /// If true, USRs are collected for all files, even if no USRMap exists for
+  /// them yet. This is used if the included files get updated only after
+  /// collecting the USRs (which may create the USRMaps).
+  bool collectForFilesWithoutUSRMap;
+  
+  /// If true, no snapshots of the existing USRs are taken, such that all USRs
+  /// are collected, even if they are stored in the USRStorage already. This is
+  /// used for collecting USRs that are published again later.
+  bool ignoreExistingUSRs;
+  
+  /// The unsaved files that were passed to libclang, if any. Used to determine
+  /// the versions of the files' contents.
+  const std::vector<CXUnsavedFile>* unsavedFiles = nullptr;
+  
+  /// If true, the references are collected for all files. Otherwise, they are
+  /// only collected for the TU file, so the reference tables of the other
+  /// files must not be updated.
+  bool referencesForAllFiles = false;
+  
   /// The file of the last visited cursor. The file of a new cursor can be
-  /// compared to this. If equal, the cached lastFileUSRMap can be used.
+  /// compared to this. If equal, the cached lastFileUSRs can be used.
   QString lastFile;
   
-  /// Cached pointer to the USRMap of lastFile.
-  USRMap* lastFileUSRMap;
+  /// Cached pointer to the IndexedFileUSRs of lastFile.
+  IndexedFileUSRs* lastFileUSRs;
+  
+  /// The IndexedFileUSRs of the TU file. Only used by
+  /// VisitClangAST_StoreReferences().
+  IndexedFileUSRs* TUFileUSRs;
+  
+  /// The USRs found for each visited file, indexed by canonical path. These
+  /// are collected without locking the USRStorage and published afterwards.
+  std::unordered_map<QString, IndexedFileUSRs> fileUSRs;
 };
 
+/// Try to reduce the effort / memory use by only storing USRs for certain
+/// cursor kinds.
+static bool IsUSRStoredForCursorKind(CXCursorKind kind) {
+  return IsClassDeclLikeCursorKind(kind) ||
+         kind == CXCursor_FunctionDecl ||
+         kind == CXCursor_FunctionTemplate ||
+         kind == CXCursor_CXXMethod ||
+         kind == CXCursor_Constructor ||
+         kind == CXCursor_Destructor ||
+         kind == CXCursor_ConversionFunction ||
+         kind == CXCursor_FieldDecl ||
+         kind == CXCursor_VarDecl;
+}
+
+/// Returns whether references to the given cursor are stored. These are the
+/// same kinds as for the declarations, except for local variables, which cannot
+/// be referenced from other places.
+static bool IsReferenceStoredForCursor(CXCursor referencedCursor) {
+  CXCursorKind kind = clang_getCursorKind(referencedCursor);
+  if (!IsUSRStoredForCursorKind(kind)) {
+    return false;
+  }
+  return kind != CXCursor_VarDecl ||
+         clang_getCursorLinkage(referencedCursor) != CXLinkage_NoLinkage;
+}
+
+quint64 GetFileVersion(const QString& canonicalPath, const std::vector<CXUnsavedFile>* unsavedFiles) {
+  if (unsavedFiles) {
+    QByteArray canonicalPathUtf8 = canonicalPath.toUtf8();
+    for (const CXUnsavedFile& unsavedFile : *unsavedFiles) {
+      if (canonicalPathUtf8 == unsavedFile.Filename) {
+        return qHashBits(unsavedFile.Contents, unsavedFile.Length);
+      }
+    }
+  }
+  return QFileInfo(canonicalPath).lastModified().toMSecsSinceEpoch();
+}
+
+/// Returns the IndexedFileUSRs in @p data for the given file.
+static IndexedFileUSRs* GetIndexedFileUSRs(CXFile locationFile, StoreDefinitionsVisitorData* data) {
+  IndexedFileUSRs* fileUSRs;
+  QString filePath = GetClangFilePath(locationFile);
+  if (filePath == data->lastFile) {
+    fileUSRs = data->lastFileUSRs;
+  } else {
+    data->lastFile = filePath;
+    filePath = QFileInfo(filePath).canonicalFilePath();
+    
+    auto it = data->fileUSRs.find(filePath);
+    if (it == data->fileUSRs.end()) {
+      // Take a snapshot of the file's existing USRs. This is the only place
+      // where the USRStorage gets locked while collecting the USRs.
+      it = data->fileUSRs.insert(std::make_pair(filePath, IndexedFileUSRs())).first;
+      it->second.version = GetFileVersion(filePath, data->unsavedFiles);
+      USRStorage::Instance().Lock();
+      USRMap* usrMap = USRStorage::Instance().GetUSRMapForFile(filePath);
+      it->second.collectUSRs = (usrMap != nullptr) || data->collectForFilesWithoutUSRMap;
+      if (usrMap && !data->ignoreExistingUSRs) {
+        it->second.existingUSRs = usrMap->map;
+      }
+      USRStorage::Instance().Unlock();
+    }
+    fileUSRs = &it->second;
+    data->lastFileUSRs = fileUSRs;
+    
+    if (!fileUSRs->collectUSRs) {
+      // NOTE: This can happen if a header (that is not listed as a source
+      //       file) is parsed before any source file is parsed that created
+      //       the USRMaps seen by the header. So, this is not an error.
+      //       (But maybe still a situation that we might want to improve:
+      //        perhaps it could be useful to let each open file add their
+      //        own references on USRMaps, not only project source files?)
+      // qDebug() << "ERROR: While indexing, found no USRMap for file " << filePath << " of a cursor -> the USR cannot be stored. The existence of the USRMap should have been ensured in the included file list update.";
+    }
+  }
+  
+  return fileUSRs;
+}
+
+/// Collects the USR of the given cursor in @p data.
+static void StoreUSRForCursor(CXCursor cursor, CXCursorKind kind, StoreDefinitionsVisitorData* data) {
+  // Get the cursor's location.
+  CXSourceLocation location = clang_getCursorLocation(cursor);
+  CXFile locationFile;
+  unsigned line;
+  unsigned column;
+  clang_getFileLocation(
+      location,
+      &locationFile,
+      &line,
+      &column,
+      /*unsigned* offset*/ nullptr);
+  
+  // Get the current file's USRs.
+  IndexedFileUSRs* fileUSRs = GetIndexedFileUSRs(locationFile, data);
+  
+  if (fileUSRs->collectUSRs) {
+    // Build the USR.
+    bool isDefinition =
+        clang_isCursorDefinition(cursor) ||
+        clang_Cursor_isFunctionInlined(cursor);
+    
+    // Store the USR if it does not exist already.
+    bool existsAlready = false;
+    QByteArray USR = ClangString(clang_getCursorUSR(cursor)).ToQByteArray();
+    if (!USR.isEmpty()) {
+      quint32 usrId = USRStringPool::Instance().Intern(USR);
+      existsAlready = fileUSRs->newUSRs.Contains(usrId, line, column) ||
+                      (fileUSRs->existingUSRs && fileUSRs->existingUSRs->Contains(usrId, line, column));
+      if (!existsAlready) {
+        // TODO: This is somewhat duplicated from the context creation code.
+        // Use clang_getCursorPrettyPrinted() to get a "nice" version of the function spelling.
+        // TODO: It would be preferable to get this as a semantic string, the same
+        //       way that code completion results are delivered, such that we can
+        //       easily semantically color the different parts. Not sure how easy
+        //       this is with the current libclang interface though.
+        CXPrintingPolicy printingPolicy = clang_getCursorPrintingPolicy(cursor);
+        clang_PrintingPolicy_setProperty(printingPolicy, CXPrintingPolicy_TerseOutput, 1);  // print declaration only, skip body
+        CXString cursorDisplayName = clang_getCursorPrettyPrinted(cursor, printingPolicy);
+        clang_PrintingPolicy_dispose(printingPolicy);
+        QString displayName = QString::fromUtf8(clang_getCString(cursorDisplayName));
+        clang_disposeString(cursorDisplayName);
+        if (displayName.endsWith(QStringLiteral(" {}"))) {
+          displayName.chop(3);
+        } else if (displayName.endsWith(QStringLiteral(" {\n}"))) {
+          displayName.chop(4);
+        }
+        
+        // Try to find the name within the displayName (TODO: Is there any way to do this without heuristics?).
+        QString name = ClangString(clang_getCursorSpelling(cursor)).ToQString();
+        int namePos = -1;
+        if (!name.isEmpty()) {
+          int from = 0;
+          while (from + name.size() <= displayName.size()) {
+            int pos = displayName.indexOf(name, from, Qt::CaseSensitive);
+            if (pos < 0) {
+              break;
+            }
+            
+            namePos = pos;
+            // If the match seems to be good, stop looking for other matches
+            if (pos > 0 && (displayName[pos - 1] == ' ' || displayName[pos - 1] == ':')) {
+              break;
+            }
+            from = pos + name.size();
+          }
+        }
+        
+        fileUSRs->newUSRs.Add(usrId, displayName, line, column, isDefinition, kind, namePos, name.size());
+      }
+    }
+  }
+}
+
 CXChildVisitResult VisitClangAST_StoreUSRs(CXCursor cursor, CXCursor /*parent*/, CXClientData client_data) {
   StoreDefinitionsVisitorData* data = reinterpret_cast<StoreDefinitionsVisitorData*>(client_data);
   
@@ -679,117 +1218,9 @@ CXChildVisitResult VisitClangAST_StoreUSRs(CXCursor cursor, CXCursor /*parent*/,
     }
   }
   
-  // Try to reduce the effort / memory use by only storing USRs for certain
-  // cursor kinds.
   CXCursorKind kind = clang_getCursorKind(cursor);
-  if (IsClassDeclLikeCursorKind(kind) ||
-      kind == CXCursor_FunctionDecl ||
-      kind == CXCursor_FunctionTemplate ||
-      kind == CXCursor_CXXMethod ||
-      kind == CXCursor_Constructor ||
-      kind == CXCursor_Destructor ||
-      kind == CXCursor_ConversionFunction ||
-      kind == CXCursor_FieldDecl ||
-      kind == CXCursor_VarDecl) {
-    // Get the cursor's location.
-    CXSourceLocation location = clang_getCursorLocation(cursor);
-    CXFile locationFile;
-    unsigned line;
-    unsigned column;
-    clang_getFileLocation(
-        location,
-        &locationFile,
-        &line,
-        &column,
-        /*unsigned* offset*/ nullptr);
-    
-    // Get the current file's USRMap.
-    USRMap* usrMap;
-    QString filePath = GetClangFilePath(locationFile);
-    if (filePath == data->lastFile) {
-      usrMap = data->lastFileUSRMap;
-    } else {
-      data->lastFile = filePath;
-      filePath = QFileInfo(filePath).canonicalFilePath();
-      
-      // Get or create the USR map for the file.
-      usrMap = USRStorage::Instance().GetUSRMapForFile(filePath);
-      data->lastFileUSRMap = usrMap;
-      
-      if (usrMap == nullptr) {
-        // NOTE: This can happen if a header (that is not listed as a source
-        //       file) is parsed before any source file is parsed that created
-        //       the USRMaps seen by the header. So, this is not an error.
-        //       (But maybe still a situation that we might want to improve:
-        //        perhaps it could be useful to let each open file add their
-        //        own references on USRMaps, not only project source files?)
-        // qDebug() << "ERROR: While indexing, found no USRMap for file " << filePath << " of a cursor -> the USR cannot be stored. The existence of the USRMap should have been ensured in the included file list update.";
-      }
-    }
-    
-    if (usrMap) {
-      // Build the USR.
-      bool isDefinition =
-          clang_isCursorDefinition(cursor) ||
-          clang_Cursor_isFunctionInlined(cursor);
-      
-      // Store the USR if it does not exist already.
-      bool existsAlready = false;
-      QByteArray USR = ClangString(clang_getCursorUSR(cursor)).ToQByteArray();
-      if (!USR.isEmpty()) {
-        auto range = usrMap->map.equal_range(USR);
-        for (auto it = range.first; it != range.second; ++ it) {
-          if (it->second.line == line &&
-              it->second.column == column) {
-            existsAlready = true;
-            break;
-          }
-        }
-        if (!existsAlready) {
-          // TODO: This is somewhat duplicated from the context creation code.
-          // Use clang_getCursorPrettyPrinted() to get a "nice" version of the function spelling.
-          // TODO: It would be preferable to get this as a semantic string, the same
-          //       way that code completion results are delivered, such that we can
-          //       easily semantically color the different parts. Not sure how easy
-          //       this is with the current libclang interface though.
-          CXPrintingPolicy printingPolicy = clang_getCursorPrintingPolicy(cursor);
-          clang_PrintingPolicy_setProperty(printingPolicy, CXPrintingPolicy_TerseOutput, 1);  // print declaration only, skip body
-          CXString cursorDisplayName = clang_getCursorPrettyPrinted(cursor, printingPolicy);
-          clang_PrintingPolicy_dispose(printingPolicy);
-          QString displayName = QString::fromUtf8(clang_getCString(cursorDisplayName));
-          clang_disposeString(cursorDisplayName);
-          if (displayName.endsWith(QStringLiteral(" {}"))) {
-            displayName.chop(3);
-          } else if (displayName.endsWith(QStringLiteral(" {\n}"))) {
-            displayName.chop(4);
-          }
-          
-          // Try to find the name within the displayName (TODO: Is there any way to do this without heuristics?).
-          QString name = ClangString(clang_getCursorSpelling(cursor)).ToQString();
-          int namePos = -1;
-          if (!name.isEmpty()) {
-            int from = 0;
-            while (from + name.size() <= displayName.size()) {
-              int pos = displayName.indexOf(name, from, Qt::CaseSensitive);
-              if (pos < 0) {
-                break;
-              }
-              
-              namePos = pos;
-              // If the match seems to be good, stop looking for other matches
-              if (pos > 0 && (displayName[pos - 1] == ' ' || displayName[pos - 1] == ':')) {
-                break;
-              }
-              from = pos + name.size();
-            }
-          }
-          
-          usrMap->map.insert(std::make_pair(
-              USR,
-              USRDecl(displayName, line, column, isDefinition, kind, namePos, name.size())));
-        }
-      }
-    }
+  if (IsUSRStoredForCursorKind(kind)) {
+    StoreUSRForCursor(cursor, kind, data);
   }
   
   //   qDebug() << "Type: " << ClangString(clang_getCursorKindSpelling(clang_getCursorKind(cursor))).ToQString()
@@ -805,43 +1236,392 @@ CXChildVisitResult VisitClangAST_StoreUSRs(CXCursor cursor, CXCursor /*parent*/,
   }
 }
 
+/// Visitor which collects the reference sites within the TU file in
+/// data->fileUSRs. Unlike VisitClangAST_StoreUSRs(), this recurses into all
+/// cursors (including function bodies) of the TU file.
+static CXChildVisitResult VisitClangAST_StoreReferences(CXCursor cursor, CXCursor /*parent*/, CXClientData client_data) {
+  StoreDefinitionsVisitorData* data = reinterpret_cast<StoreDefinitionsVisitorData*>(client_data);
+  
+  CXSourceLocation location = clang_getCursorLocation(cursor);
+  CXFile locationFile;
+  unsigned line;
+  unsigned column;
+  clang_getFileLocation(location, &locationFile, &line, &column, nullptr);
+  if (!clang_File_isEqual(locationFile, data->TUFile)) {
+    return CXChildVisit_Continue;
+  }
+  
+  CXCursorKind kind = clang_getCursorKind(cursor);
+  if (clang_isReference(kind) ||
+      kind == CXCursor_DeclRefExpr ||
+      kind == CXCursor_MemberRefExpr) {
+    CXCursor referencedCursor = clang_getCursorReferenced(cursor);
+    if (!clang_Cursor_isNull(referencedCursor) &&
+        IsReferenceStoredForCursor(referencedCursor)) {
+      QByteArray USR = ClangString(clang_getCursorUSR(referencedCursor)).ToQByteArray();
+      if (!USR.isEmpty()) {
+        data->TUFileUSRs->newReferences.Add(USRStringPool::Instance().Intern(USR), line, column, kind);
+      }
+    }
+  }
+  
+  return CXChildVisit_Recurse;
+}
+
+/// Initializes @p data for collecting the USRs of the given TU file.
+static void InitStoreDefinitionsVisitorData(const QString& TUFilePath, StoreDefinitionsVisitorData* data) {
+  data->lastFileUSRs = nullptr;
+  data->TUFileUSRs = nullptr;
+  
+  // The USRs of the TU file get replaced completely, so no snapshot of its
+  // existing USRs is taken (USRs are only collected for the files that have
+  // not been seen yet).
+  IndexedFileUSRs& TUFileUSRs = data->fileUSRs[TUFilePath];
+  TUFileUSRs.version = GetFileVersion(TUFilePath, data->unsavedFiles);
+  USRStorage::Instance().Lock();
+  TUFileUSRs.collectUSRs =
+      (USRStorage::Instance().GetUSRMapForFile(TUFilePath) != nullptr) ||
+      data->collectForFilesWithoutUSRMap;
+  USRStorage::Instance().Unlock();
+}
+
+/// Called after a new USRDeclMap or USRReferenceMap was stored for the given
+/// file, with the USRStorage being unlocked again. @p updateNumber must have
+/// been obtained from GlobalSymbolTable::GetNextUpdateNumber() while storing the
+/// map.
+static inline void MapPublished(const QString& path, const USRDeclMap& map, quint64 updateNumber) {
+  GlobalSymbolTable::Instance().UpdateFile(path, map, updateNumber);
+}
+
+static inline void MapPublished(const QString& /*path*/, const USRReferenceMap& /*map*/, quint64 /*updateNumber*/) {}
+
+/// Returns the number to pass to MapPublished() for the given map. This must be
+/// called while the USRStorage is locked. Only USRDeclMaps update the
+/// GlobalSymbolTable, so only they take an update number.
+static inline quint64 GetMapUpdateNumber(const USRDeclMap& /*map*/) {
+  return GlobalSymbolTable::Instance().GetNextUpdateNumber();
+}
+
+static inline quint64 GetMapUpdateNumber(const USRReferenceMap& /*map*/) {
+  return 0;
+}
+
+/// Publishes USRs (if T is USRDeclMap) or references (if T is USRReferenceMap)
+/// for the file with the given canonical path in the USRStorage. @p member
+/// selects the corresponding member of USRMap. If @p newMap is given, it
+/// replaces the file's map. Otherwise, the items in @p addedUSRs get merged into
+/// the file's map. If @p versionMember is given, the items in @p addedUSRs
+/// replace the file's map instead if the version of the file that the map was
+/// created for differs from @p version. The USRStorage must not be locked.
+template <typename T>
+static void PublishForFile(const QString& path, std::shared_ptr<const T> USRMap::*member, std::shared_ptr<const T> newMap, const std::shared_ptr<const T>& addedUSRs, quint64 USRMap::*versionMember = nullptr, quint64 version = 0) {
+  // Stored maps are never modified, so readers that took a reference to
+  // the old map can continue to use it. For merging, a copy of the current map
+  // is made outside of the lock; if the map was replaced by another thread in
+  // the meantime, the merge is repeated.
+  while (true) {
+    USRStorage::Instance().Lock();
+    USRMap* usrMap = USRStorage::Instance().GetUSRMapForFile(path);
+    if (usrMap == nullptr) {
+      // The file is not referenced anymore.
+      USRStorage::Instance().Unlock();
+      break;
+    }
+    std::shared_ptr<const T> currentMap = usrMap->*member;
+    if (!newMap && versionMember && usrMap->*versionMember != version) {
+      // The file changed since its map was created, so the items in the map
+      // may be outdated.
+      newMap = addedUSRs;
+    }
+    if (newMap) {
+      usrMap->*member = newMap;
+      if (versionMember) {
+        usrMap->*versionMember = version;
+      }
+      quint64 updateNumber = GetMapUpdateNumber(*newMap);
+      USRStorage::Instance().Unlock();
+      MapPublished(path, *newMap, updateNumber);
+      break;
+    }
+    USRStorage::Instance().Unlock();
+    
+    if (currentMap == addedUSRs || addedUSRs->empty()) {
+      // All items are known already.
+      break;
+    } else if (currentMap->empty()) {
+      newMap = addedUSRs;
+    } else {
+      newMap = T::Merge(*currentMap, *addedUSRs);
+      if (!newMap) {
+        // All items are known already.
+        break;
+      }
+    }
+    
+    // Only publish the merged map if no other thread replaced the map since
+    // it was copied.
+    USRStorage::Instance().Lock();
+    usrMap = USRStorage::Instance().GetUSRMapForFile(path);
+    if (usrMap == nullptr) {
+      USRStorage::Instance().Unlock();
+      break;
+    } else if (usrMap->*member == currentMap &&
+               (!versionMember || usrMap->*versionMember == version)) {
+      usrMap->*member = newMap;
+      quint64 updateNumber = GetMapUpdateNumber(*newMap);
+      USRStorage::Instance().Unlock();
+      MapPublished(path, *newMap, updateNumber);
+      break;
+    }
+    USRStorage::Instance().Unlock();
+    newMap.reset();
+  }
+}
+
+/// Stores the USRs collected in @p data in the USRStorage. The USRStorage must
+/// not be locked.
+static void PublishCollectedUSRs(const QString& TUFilePath, StoreDefinitionsVisitorData* data) {
+  // The TU file's map is simply replaced. For all other files, the new USRs
+  // get merged into the current map, since other TUs may see different parts
+  // of them (for example, due to different preprocessor definitions). For the
+  // references, this only applies as long as the file did not change, since
+  // the old references would have outdated locations otherwise.
+  for (auto& item : data->fileUSRs) {
+    const QString& path = item.first;
+    IndexedFileUSRs& fileUSRs = item.second;
+    if (!fileUSRs.collectUSRs) {
+      continue;
+    }
+    
+    if (path == TUFilePath) {
+      PublishForFile(path, &USRMap::map, fileUSRs.newUSRs.Finish(), std::shared_ptr<const USRDeclMap>());
+      PublishForFile(path, &USRMap::references, fileUSRs.newReferences.Finish(), std::shared_ptr<const USRReferenceMap>(), &USRMap::referencesVersion, fileUSRs.version);
+    } else {
+      if (!fileUSRs.newUSRs.empty()) {
+        PublishForFile(path, &USRMap::map, std::shared_ptr<const USRDeclMap>(), fileUSRs.newUSRs.Finish());
+      }
+      // This is also done if no references were found, such that the
+      // references are removed if the file changed. If the references were
+      // not collected for the file, its reference table is left alone, such
+      // that it is not considered complete for the file's version.
+      if (data->referencesForAllFiles) {
+        PublishForFile(path, &USRMap::references, std::shared_ptr<const USRReferenceMap>(), fileUSRs.newReferences.Finish(), &USRMap::referencesVersion, fileUSRs.version);
+      }
+    }
+  }
+}
+
 void IndexFile_StoreUSRs(CXTranslationUnit clangTU, bool onlyForTUFile) {
-  // Clear USRs of this file.
   QString TUFilePath = QFileInfo(ClangString(clang_getTranslationUnitSpelling(clangTU)).ToQString()).canonicalFilePath();
-  USRStorage::Instance().ClearUSRsForFile(TUFilePath);
+  StoreDefinitionsVisitorData visitorData;
+  visitorData.updateTUFileOnly = onlyForTUFile;
+  visitorData.TUFile = clang_getFile(clangTU, TUFilePath.toUtf8().data());
+  visitorData.collectForFilesWithoutUSRMap = false;
+  visitorData.ignoreExistingUSRs = false;
+  InitStoreDefinitionsVisitorData(TUFilePath, &visitorData);
   
   // Visit the AST to collect definitions / declarations for cross-referencing
   // with the corresponding definitions / declarations seen in other
-  // translations units.
+  // translations units. This is the expensive part, which is done without
+  // holding the USRStorage lock.
+  clang_visitChildren(
+      clang_getTranslationUnitCursor(clangTU),
+      &VisitClangAST_StoreUSRs,
+      &visitorData);
+  
+  // Collect the reference sites within the TU file. The included files are
+  // skipped, since traversing all of their function bodies again for each TU
+  // would be expensive; their references are recorded by the indexing API.
+  visitorData.TUFileUSRs = &visitorData.fileUSRs[TUFilePath];
+  if (visitorData.TUFile && visitorData.TUFileUSRs->collectUSRs) {
+    clang_visitChildren(
+        clang_getTranslationUnitCursor(clangTU),
+        &VisitClangAST_StoreReferences,
+        &visitorData);
+  }
+  
+  PublishCollectedUSRs(TUFilePath, &visitorData);
+}
+
+void IndexFile_CollectUSRs(CXTranslationUnit clangTU, CollectedUSRs* usrs) {
   StoreDefinitionsVisitorData visitorData;
-  visitorData.updateTUFileOnly = onlyForTUFile;
-  visitorData.TUFile = clang_getFile(clangTU, TUFilePath.toUtf8().data());
+  visitorData.updateTUFileOnly = false;
+  visitorData.TUFile = nullptr;
+  visitorData.collectForFilesWithoutUSRMap = true;
+  visitorData.ignoreExistingUSRs = true;
+  visitorData.lastFileUSRs = nullptr;
+  visitorData.TUFileUSRs = nullptr;
+  
   clang_visitChildren(
       clang_getTranslationUnitCursor(clangTU),
       &VisitClangAST_StoreUSRs,
       &visitorData);
+  
+  usrs->clear();
+  for (auto& item : visitorData.fileUSRs) {
+    if (!item.second.newUSRs.empty()) {
+      (*usrs)[item.first] = item.second.newUSRs.Finish();
+    }
+  }
 }
 
-void VisitInclusionsForIndexing(
-    CXFile included_file,
-    CXSourceLocation* /*inclusion_stack*/,
-    unsigned /*include_len*/,
-    CXClientData client_data) {
-  std::unordered_set<QString>* includedPaths = reinterpret_cast<std::unordered_set<QString>*>(client_data);
-  includedPaths->insert(QFileInfo(GetClangFilePath(included_file)).canonicalFilePath());
+void IndexFile_PublishUSRs(const CollectedUSRs& usrs) {
+  for (const auto& item : usrs) {
+    PublishForFile(item.first, &USRMap::map, std::shared_ptr<const USRDeclMap>(), item.second);
+  }
 }
 
-void IndexFile_GetInclusions(CXTranslationUnit clangTU, SourceFile* sourceFile, Project* project, MainWindow* mainWindow) {
-  // Clear included paths
-  std::unordered_set<QString> oldIncludedPaths;
-  oldIncludedPaths.swap(sourceFile->includedPaths);
+struct IndexingAPIClientData {
+  StoreDefinitionsVisitorData usrData;
+  
+  /// Canonical paths of the included files, including the main file.
+  std::unordered_set<QString> includedPaths;
+};
+
+static CXIdxClientFile IndexingAPI_EnteredMainFile(CXClientData client_data, CXFile mainFile, void* /*reserved*/) {
+  IndexingAPIClientData* data = reinterpret_cast<IndexingAPIClientData*>(client_data);
+  data->includedPaths.insert(QFileInfo(GetClangFilePath(mainFile)).canonicalFilePath());
+  return nullptr;
+}
+
+static CXIdxClientFile IndexingAPI_IncludedFile(CXClientData client_data, const CXIdxIncludedFileInfo* info) {
+  IndexingAPIClientData* data = reinterpret_cast<IndexingAPIClientData*>(client_data);
+  data->includedPaths.insert(QFileInfo(GetClangFilePath(info->file)).canonicalFilePath());
+  return nullptr;
+}
+
+static void IndexingAPI_IndexDeclaration(CXClientData client_data, const CXIdxDeclInfo* info) {
+  IndexingAPIClientData* data = reinterpret_cast<IndexingAPIClientData*>(client_data);
+  
+  // VisitClangAST_StoreUSRs() only recurses into namespaces, classes, and
+  // extern "C" blocks. Skip declarations in other scopes (e.g., within function
+  // bodies) accordingly.
+  if (!info->semanticContainer) {
+    return;
+  }
+  CXCursorKind containerKind = clang_getCursorKind(info->semanticContainer->cursor);
+  if (containerKind != CXCursor_TranslationUnit &&
+      containerKind != CXCursor_Namespace &&
+      containerKind != CXCursor_LinkageSpec &&
+      containerKind != CXCursor_UnexposedDecl &&
+      !IsClassDeclLikeCursorKind(containerKind)) {
+    return;
+  }
+  
+  CXCursorKind kind = clang_getCursorKind(info->cursor);
+  if (IsUSRStoredForCursorKind(kind)) {
+    StoreUSRForCursor(info->cursor, kind, &data->usrData);
+  }
+}
+
+static void IndexingAPI_IndexEntityReference(CXClientData client_data, const CXIdxEntityRefInfo* info) {
+  IndexingAPIClientData* data = reinterpret_cast<IndexingAPIClientData*>(client_data);
+  
+  // Implicit references (for example, implicit constructor calls) do not
+  // refer to the entity by name, so they are not stored.
+  if (info->kind == CXIdxEntityRef_Implicit ||
+      !info->referencedEntity ||
+      !info->referencedEntity->USR ||
+      info->referencedEntity->USR[0] == 0 ||
+      !IsReferenceStoredForCursor(info->referencedEntity->cursor)) {
+    return;
+  }
+  
+  CXFile locationFile;
+  unsigned line;
+  unsigned column;
+  clang_indexLoc_getFileLocation(info->loc, nullptr, &locationFile, &line, &column, nullptr);
+  if (!locationFile) {
+    return;
+  }
+  
+  IndexedFileUSRs* fileUSRs = GetIndexedFileUSRs(locationFile, &data->usrData);
+  if (fileUSRs->collectUSRs) {
+    const char* USR = info->referencedEntity->USR;
+    fileUSRs->newReferences.Add(
+        USRStringPool::Instance().Intern(USR, strlen(USR)),
+        line, column, clang_getCursorKind(info->cursor));
+  }
+}
+
+bool IndexFile_WithIndexingAPI(
+    CXIndexAction indexAction,
+    const QString& canonicalPath,
+    const std::vector<const char*>& commandLineArgs,
+    std::vector<CXUnsavedFile>* unsavedFiles,
+    const std::function<bool(std::unordered_set<QString>&&)>& updateInclusions,
+    quint64* tuMemory,
+    bool skipParsedBodies) {
+  IndexingAPIClientData data;
+  data.usrData.updateTUFileOnly = false;
+  data.usrData.TUFile = nullptr;
+  // The USRMaps for newly included files are only created by updateInclusions,
+  // so collect the USRs for all files.
+  data.usrData.collectForFilesWithoutUSRMap = true;
+  data.usrData.ignoreExistingUSRs = false;
+  data.usrData.unsavedFiles = unsavedFiles;
+  data.usrData.referencesForAllFiles = true;
+  InitStoreDefinitionsVisitorData(canonicalPath, &data.usrData);
   
+  IndexerCallbacks callbacks = {};
+  callbacks.enteredMainFile = &IndexingAPI_EnteredMainFile;
+  callbacks.ppIncludedFile = &IndexingAPI_IncludedFile;
+  callbacks.indexDeclaration = &IndexingAPI_IndexDeclaration;
+  callbacks.indexEntityReference = &IndexingAPI_IndexEntityReference;
+  
+  CXTranslationUnit clangTU = nullptr;
+  int result = clang_indexSourceFile(
+      indexAction,
+      &data,
+      &callbacks,
+      sizeof(callbacks),
+      CXIndexOpt_SuppressRedundantRefs |
+          CXIndexOpt_SuppressWarnings |
+          (skipParsedBodies ? CXIndexOpt_SkipParsedBodiesInSession : 0),
+      canonicalPath.toLocal8Bit().data(),
+      commandLineArgs.data(),
+      commandLineArgs.size(),
+      unsavedFiles->data(),
+      unsavedFiles->size(),
+      tuMemory ? &clangTU : nullptr,
+      CXTranslationUnit_Incomplete |
+          CXTranslationUnit_KeepGoing);
+  if (clangTU) {
+    *tuMemory = GetTUMemoryUsage(clangTU);
+    clang_disposeTranslationUnit(clangTU);
+  }
+  if (result != 0) {
+    qDebug() << "Error: clang_indexSourceFile() failed for" << canonicalPath << "with error code" << result;
+    return false;
+  }
+  
+  if (updateInclusions(std::move(data.includedPaths))) {
+    PublishCollectedUSRs(canonicalPath, &data.usrData);
+  }
+  return true;
+}
+
+void IndexFile_GetInclusions(CXTranslationUnit clangTU, SourceFile* sourceFile, Project* project, ProjectHost* host, const std::unordered_set<QString>* additionalIncludedPaths) {
   // Iterate over all file inclusions to collect the list of included files.
-  clang_getInclusions(clangTU, &VisitInclusionsForIndexing, &sourceFile->includedPaths);
+  std::unordered_set<QString> includedPaths;
+  clang_getInclusions(clangTU, &VisitInclusionsForIndexing, &includedPaths);
+  if (additionalIncludedPaths) {
+    includedPaths.insert(additionalIncludedPaths->begin(), additionalIncludedPaths->end());
+  }
+  
+  IndexFile_SetInclusions(std::move(includedPaths), sourceFile, project, host);
+}
+
+void IndexFile_SetInclusions(std::unordered_set<QString>&& includedPaths, SourceFile* sourceFile, Project* project, ProjectHost* host) {
+  std::unordered_set<QString> oldIncludedPaths;
+  oldIncludedPaths.swap(sourceFile->includedPaths);
+  sourceFile->includedPaths = std::move(includedPaths);
   
   // Add references to newly included files
   for (const QString& newPath : sourceFile->includedPaths) {
     if (oldIncludedPaths.count(newPath) == 0) {
+      project->IncludedPathChanged(newPath);
+      
       // Add reference.
       bool newUSRMapCreated = USRStorage::Instance().AddUSRMapReference(newPath);
       
@@ -853,7 +1633,7 @@ void IndexFile_GetInclusions(CXTranslationUnit clangTU, SourceFile* sourceFile,
       if (newUSRMapCreated) {
         Document* document;
         DocumentWidget* widget;
-        if (mainWindow->GetDocumentAndWidgetForPath(newPath, &document, &widget)) {
+        if (host->GetDocumentAndWidgetForPath(newPath, &document, &widget)) {
           std::shared_ptr<ClangTU> includeTU = document->GetTUPool()->TakeMostUpToDateTU();
           if (includeTU) {
             if (includeTU->isInitialized()) {
@@ -892,6 +1672,8 @@ void IndexFile_GetInclusions(CXTranslationUnit clangTU, SourceFile* sourceFile,
   // Remove references to files that had been included, but are not included anymore now
   for (const QString& oldPath : oldIncludedPaths) {
     if (sourceFile->includedPaths.count(oldPath) == 0) {
+      project->IncludedPathChanged(oldPath);
+      
       // Remove reference.
       USRStorage::Instance().RemoveUSRMapReference(oldPath);
     }
@@ -904,12 +1686,23 @@ USRStorage& USRStorage::Instance() {
   return instance;
 }
 
-void USRStorage::ClearUSRsForFile(const QString& canonicalPath) {
-  auto it = USRs.find(canonicalPath.toUtf8());
-  if (it != USRs.end()) {
-    it->second->map.clear();
-    it->second->map.reserve(32);
+USRStorageLockStatistics USRStorage::GetLockStatistics() const {
+  USRStorageLockStatistics statistics;
+  statistics.numLocks = numLocks;
+  statistics.numContendedLocks = numContendedLocks;
+  statistics.waitSeconds = 1e-9 * waitNanoseconds;
+  statistics.holdSeconds = 1e-9 * holdNanoseconds;
+  return statistics;
+}
+
+quint64 USRStorage::GetMemoryUsage() {
+  Lock();
+  quint64 result = 0;
+  for (const auto& item : USRs) {
+    result += sizeof(USRMap) + item.first.size() * sizeof(QChar) + item.second->map->GetMemoryUsage() + item.second->references->GetMemoryUsage();
   }
+  Unlock();
+  return result + USRStringPool::Instance().GetMemoryUsage();
 }
 
 bool USRStorage::AddUSRMapReference(const QString& canonicalPath) {
@@ -920,7 +1713,9 @@ bool USRStorage::AddUSRMapReference(const QString& canonicalPath) {
   } else {
     it->second.reset(new USRMap());
     it->second->referenceCount = 1;
-    it->second->map.reserve(32);
+    it->second->referencesVersion = 0;
+    it->second->map.reset(new USRDeclMap());
+    it->second->references.reset(new USRReferenceMap());
     return true;
   }
 }
@@ -932,6 +1727,7 @@ void USRStorage::RemoveUSRMapReference(const QString& canonicalPath) {
     if (usrMap->referenceCount == 1) {
       // Delete the USRMap.
       USRs.erase(it);
+      GlobalSymbolTable::Instance().RemoveFile(canonicalPath);
     } else {
       -- usrMap->referenceCount;
     }
@@ -968,35 +1764,151 @@ void USRStorage::GetFilesForUSRLookup(const QString& canonicalPath, MainWindow*
   }
 }
 
-void USRStorage::LookupUSRs(const QByteArray& USR, std::unordered_set<QString> relevantFiles, std::vector<std::pair<QString, USRDecl>>* foundDecls) {
-  foundDecls->reserve(8);
-  
-  USRStorage::Instance().Lock();
-  for (const QString& path : relevantFiles) {
-    USRMap* usrMap = USRStorage::Instance().GetUSRMapForFile(path);
-    if (!usrMap) {
-      continue;
-    }
-    
-    auto range = usrMap->map.equal_range(USR);
-    for (auto it = range.first; it != range.second; ++ it) {
+/// Searches the given USR maps for the USR with the given ID, appending the
+/// found declarations to @p foundDecls.
+static void SearchUSRMaps(quint32 usrId, const std::vector<std::pair<QString, std::shared_ptr<const USRDeclMap>>>& maps, std::vector<std::pair<QString, USRDecl>>* foundDecls) {
+  for (const auto& item : maps) {
+    const QString& path = item.first;
+    int begin, end;
+    item.second->EqualRange(usrId, &begin, &end);
+    for (int i = begin; i < end; ++ i) {
       // Found an occurrence of the USR.
       // TODO: Is this redundancy check still necessary? Each file's USRs should only be stored once now, so I think we can drop it.
       bool existsAlready = false;
       for (const std::pair<QString, USRDecl>& existingDecl : *foundDecls) {
         if (existingDecl.first == path &&
-            existingDecl.second.line == it->second.line &&
-            existingDecl.second.column == it->second.column) {
+            existingDecl.second.line == item.second->GetLine(i) &&
+            existingDecl.second.column == item.second->GetColumn(i)) {
           existsAlready = true;
           break;
         }
       }
       
       if (!existsAlready) {
-        // qDebug() << "Adding:" << path << ":" << it->second.line << ":" << it->second.column;
-        foundDecls->push_back(std::make_pair(path, it->second));
+        // qDebug() << "Adding:" << path << ":" << item.second->GetLine(i) << ":" << item.second->GetColumn(i);
+        foundDecls->push_back(std::make_pair(path, item.second->GetDecl(i)));
       }
     }
   }
+}
+
+void USRStorage::LookupUSRs(const QByteArray& USR, std::unordered_set<QString> relevantFiles, std::vector<std::pair<QString, USRDecl>>* foundDecls) {
+  foundDecls->reserve(8);
+  
+  // If the USR is not in the string pool, then it is not stored for any file.
+  quint32 usrId = USRStringPool::Instance().Find(USR);
+  if (usrId == USRStringPool::kInvalidId) {
+    return;
+  }
+  
+  // Only take references to the relevant maps while the USRStorage is locked.
+  // Since the maps are never modified after they were stored, they can be
+  // searched afterwards without holding the lock.
+  std::vector<std::pair<QString, std::shared_ptr<const USRDeclMap>>> relevantMaps;
+  relevantMaps.reserve(relevantFiles.size());
+  USRStorage::Instance().Lock();
+  for (const QString& path : relevantFiles) {
+    USRMap* usrMap = USRStorage::Instance().GetUSRMapForFile(path);
+    if (usrMap) {
+      relevantMaps.push_back(std::make_pair(path, usrMap->map));
+    }
+  }
   USRStorage::Instance().Unlock();
+  
+  SearchUSRMaps(usrId, relevantMaps, foundDecls);
+}
+
+void USRStorage::LookupUSRsInAllFiles(const QByteArray& USR, std::vector<std::pair<QString, USRDecl>>* foundDecls) {
+  quint32 usrId = USRStringPool::Instance().Find(USR);
+  if (usrId == USRStringPool::kInvalidId) {
+    return;
+  }
+  
+  std::vector<std::pair<QString, std::shared_ptr<const USRDeclMap>>> maps;
+  Lock();
+  maps.reserve(USRs.size());
+  for (const auto& item : USRs) {
+    maps.push_back(std::make_pair(item.first, item.second->map));
+  }
+  Unlock();
+  
+  SearchUSRMaps(usrId, maps, foundDecls);
+}
+
+void USRStorage::LookupReferences(const QByteArray& USR, const std::unordered_set<QString>* relevantFiles, std::vector<std::pair<QString, USRReference>>* foundReferences) {
+  // If the USR is not in the string pool, then it is not referenced anywhere.
+  quint32 usrId = USRStringPool::Instance().Find(USR);
+  if (usrId == USRStringPool::kInvalidId) {
+    return;
+  }
+  
+  // As in LookupUSRs(), only take references to the maps while the USRStorage
+  // is locked, and search them afterwards.
+  std::vector<std::pair<QString, std::shared_ptr<const USRReferenceMap>>> referenceMaps;
+  Lock();
+  if (relevantFiles) {
+    referenceMaps.reserve(relevantFiles->size());
+    for (const QString& path : *relevantFiles) {
+      USRMap* usrMap = GetUSRMapForFile(path);
+      if (usrMap && !usrMap->references->empty()) {
+        referenceMaps.push_back(std::make_pair(path, usrMap->references));
+      }
+    }
+  } else {
+    referenceMaps.reserve(USRs.size());
+    for (const auto& item : USRs) {
+      if (!item.second->references->empty()) {
+        referenceMaps.push_back(std::make_pair(item.first, item.second->references));
+      }
+    }
+  }
+  Unlock();
+  
+  for (const auto& item : referenceMaps) {
+    int begin, end;
+    item.second->EqualRange(usrId, &begin, &end);
+    for (int i = begin; i < end; ++ i) {
+      foundReferences->push_back(std::make_pair(item.first, item.second->GetReference(i)));
+    }
+  }
+}
+
+bool USRStorage::AreReferencesCurrent(const QString& canonicalPath, quint64 version) {
+  Lock();
+  USRMap* usrMap = GetUSRMapForFile(canonicalPath);
+  bool result = usrMap && usrMap->referencesVersion != 0 && usrMap->referencesVersion == version;
+  Unlock();
+  return result;
+}
+
+bool USRStorage::LookupUSRInFile(const QByteArray& USR, const QString& canonicalPath, quint64 version, std::vector<USRDecl>* foundDecls, std::vector<USRReference>* foundReferences) {
+  // Take the maps and check their version in one go, such that the returned
+  // references belong to the checked version.
+  Lock();
+  USRMap* usrMap = GetUSRMapForFile(canonicalPath);
+  if (!usrMap || usrMap->referencesVersion == 0 || usrMap->referencesVersion != version) {
+    Unlock();
+    return false;
+  }
+  std::shared_ptr<const USRDeclMap> map = usrMap->map;
+  std::shared_ptr<const USRReferenceMap> references = usrMap->references;
+  Unlock();
+  
+  // If the USR is not in the string pool, then the file neither declares nor
+  // references it.
+  quint32 usrId = USRStringPool::Instance().Find(USR);
+  if (usrId == USRStringPool::kInvalidId) {
+    return true;
+  }
+  
+  int begin, end;
+  map->EqualRange(usrId, &begin, &end);
+  for (int i = begin; i < end; ++ i) {
+    foundDecls->push_back(map->GetDecl(i));
+  }
+  references->EqualRange(usrId, &begin, &end);
+  for (int i = begin; i < end; ++ i) {
+    foundReferences->push_back(references->GetReference(i));
+  }
+  return true;
 }
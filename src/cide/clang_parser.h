@@ -4,6 +4,9 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <unordered_map>
@@ -14,12 +17,14 @@
 #include <QDebug>
 #include <QString>
 
+#include "cide/usr_decl_map.h"
 #include "cide/util.h"
 
 struct CompileSettings;
 class Document;
 class MainWindow;
 class Project;
+class ProjectHost;
 struct SourceFile;
 
 
@@ -27,58 +32,74 @@ CompileSettings* FindParseSettingsForFile(const QString& canonicalPath, const st
 
 /// Perform full parsing of the file corresponding to @p document.
 /// TODO: Not used anymore since it seems better to always use ParseFileIfOpenElseIndex() (in order to index all changes).
-void ParseFile(Document* document, MainWindow* mainWindow);
+void ParseFile(Document* document, ProjectHost* host);
 
 /// If @a document is non-null and remains valid during parsing, parses the file
 /// normally. Otherwise, indexes it only.
-void ParseFileIfOpenElseIndex(const QString& canonicalPath, Document* document, MainWindow* mainWindow);
+void ParseFileIfOpenElseIndex(const QString& canonicalPath, Document* document, ProjectHost* host);
 
 /// Given a parsed TU, extracts indexing information (part 1: inclusions) into @p sourceFile.
+/// If given, @p additionalIncludedPaths are added to the included files (this
+/// is used for the files within a precompiled header).
 /// This function must be called from the main (Qt) thread.
-void IndexFile_GetInclusions(CXTranslationUnit clangTU, SourceFile* sourceFile, Project* project, MainWindow* mainWindow);
+void IndexFile_GetInclusions(CXTranslationUnit clangTU, SourceFile* sourceFile, Project* project, ProjectHost* host, const std::unordered_set<QString>* additionalIncludedPaths = nullptr);
 
-/// Given a parsed TU, extracts indexing information (part 2: USRs).
-/// This function can be called from any thread.
+/// Variant of IndexFile_GetInclusions() which takes the canonical paths of the
+/// included files (including the source file itself) instead of a TU.
+/// This function must be called from the main (Qt) thread.
+void IndexFile_SetInclusions(std::unordered_set<QString>&& includedPaths, SourceFile* sourceFile, Project* project, ProjectHost* host);
+
+/// Given a parsed TU, extracts indexing information (part 2: USRs). Besides the
+/// declarations and definitions, this records the reference sites within the
+/// TU file, replacing its previous reference table.
+/// This function can be called from any thread. The USRStorage must not be
+/// locked when calling it; it is only locked briefly while the new USRs are
+/// published.
 void IndexFile_StoreUSRs(CXTranslationUnit clangTU, bool onlyForTUFile);
 
+/// USRs of a set of files, indexed by canonical file path.
+typedef std::unordered_map<QString, std::shared_ptr<const USRDeclMap>> CollectedUSRs;
 
-/// Stores the location of a definition or declaration together with the "USR"
-/// (a string that uniquely determines the entity and can be used to
-/// cross-reference definitions / declarations across separate translation units.
-struct USRDecl {
-  inline USRDecl(const QString& spelling, int line, int column, bool isDefinition, CXCursorKind kind, int namePos = -1, int nameSize = -1)
-      : spelling(spelling),
-        line(line),
-        column(column),
-        isDefinition(isDefinition),
-        kind(kind),
-        namePos(namePos),
-        nameSize(nameSize) {}
-  
-  
-  /// Spelling of the referenced definition / declaration.
-  QString spelling;
-  
-  /// Line of the definition / declaration (1-based)
-  int line;
-  
-  /// Column of the definition / declaration (1-based)
-  int column;
-  
-  /// True if this represents a definition, false if it represents a declaration
-  bool isDefinition;
-  
-  /// Cursor kind of the USR.
-  CXCursorKind kind;
-  
-  /// If the "name" of this entity is a sub-string within the spelling string,
-  /// this gives the first character of this sub-string. Otherwise, it is set to
-  /// -1.
-  int namePos;
-  
-  /// The length of the "name" sub-string, see @a namePos.
-  int nameSize;
-};
+/// Collects the USRs of all files in the given TU (in the same way as
+/// IndexFile_StoreUSRs()) without storing them in the USRStorage. This allows
+/// to store them later with IndexFile_PublishUSRs(). This function can be
+/// called from any thread.
+void IndexFile_CollectUSRs(CXTranslationUnit clangTU, CollectedUSRs* usrs);
+
+/// Merges the given USRs into the USRMaps of their files. Files without a
+/// USRMap are skipped. This function can be called from any thread. The
+/// USRStorage must not be locked when calling it.
+void IndexFile_PublishUSRs(const CollectedUSRs& usrs);
+
+/// Returns a number that changes when the content of the file with the given
+/// canonical path changes: a hash of the content if the file is contained in
+/// @p unsavedFiles, and its modification time otherwise. This is used to tell
+/// whether the stored reference table of a file is up-to-date.
+quint64 GetFileVersion(const QString& canonicalPath, const std::vector<CXUnsavedFile>* unsavedFiles);
+
+/// Indexes a file with libclang's indexing API (clang_indexSourceFile())
+/// instead of creating a CXTranslationUnit and traversing its AST. This is
+/// used for files that are not open. If the same @p indexAction is used for
+/// several files and @p skipParsedBodies is true, function bodies in headers
+/// that have been indexed already are skipped. First, the included files are
+/// collected and passed to @p updateInclusions (which may create the USRMaps
+/// for them), then the USRs get stored as in IndexFile_StoreUSRs(). If
+/// @p updateInclusions returns false, the file needs to be indexed again (for
+/// example, with different unsaved files), so the USRs are not stored. The
+/// reference sites are recorded for all files (not only the TU file); the
+/// references in included files get merged into their existing reference
+/// tables. This function can be called from any thread. The USRStorage must
+/// not be locked when calling it. Returns false if indexing failed. If
+/// @p tuMemory is non-null, the memory usage of the TU that libclang created
+/// for indexing is returned in it.
+bool IndexFile_WithIndexingAPI(
+    CXIndexAction indexAction,
+    const QString& canonicalPath,
+    const std::vector<const char*>& commandLineArgs,
+    std::vector<CXUnsavedFile>* unsavedFiles,
+    const std::function<bool(std::unordered_set<QString>&&)>& updateInclusions,
+    quint64* tuMemory = nullptr,
+    bool skipParsedBodies = true);
 
 
 /// Stores USRs for one file. The file path is given by the corresponding key in
@@ -89,8 +110,36 @@ struct USRMap {
   /// this file. If this reaches zero, the USRMap can be removed.
   int referenceCount;
   
-  /// Maps USR string -> USRDecl
-  std::unordered_multimap<QByteArray, USRDecl> map;
+  /// The USRs of the file (never null). The USRDeclMap is never modified after
+  /// it has been stored here; updates replace it as a whole. Thus, a copy of
+  /// this pointer that was taken while the USRStorage was locked can still be
+  /// used after unlocking it.
+  std::shared_ptr<const USRDeclMap> map;
+  
+  /// The reference sites in the file (never null). Like the USRDeclMap, this is
+  /// replaced as a whole on updates.
+  std::shared_ptr<const USRReferenceMap> references;
+  
+  /// Version of the file content that the references were recorded for (see
+  /// GetFileVersion() in clang_parser.cc). References from further TUs are
+  /// merged into the map as long as the version stays the same, while a
+  /// different version replaces them.
+  quint64 referencesVersion;
+};
+
+/// Statistics about the locking of the USRStorage.
+struct USRStorageLockStatistics {
+  /// Number of times the lock was taken.
+  quint64 numLocks;
+  
+  /// Number of times that Lock() had to wait for another thread.
+  quint64 numContendedLocks;
+  
+  /// Total time spent waiting for the lock in Lock().
+  double waitSeconds;
+  
+  /// Total time for which the lock was held.
+  double holdSeconds;
 };
 
 
@@ -109,12 +158,27 @@ class USRStorage {
   /// Locks the USRStorage mutex.
   /// NOTE: If combining this with locking the main (Qt) thread, always lock the
   ///       thread first and then the USRStorage to avoid deadlocks.
-  inline void Lock() { lock.lock(); }
+  inline void Lock() {
+    if (!lock.try_lock()) {
+      auto waitStartTime = std::chrono::steady_clock::now();
+      lock.lock();
+      ++ numContendedLocks;
+      waitNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - waitStartTime).count();
+    }
+    ++ numLocks;
+    lockTime = std::chrono::steady_clock::now();
+  }
   
   /// Unlocks the USRStorage mutex.
-  inline void Unlock() { lock.unlock(); }
+  inline void Unlock() {
+    holdNanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - lockTime).count();
+    lock.unlock();
+  }
   
-  void ClearUSRsForFile(const QString& canonicalPath);
+  /// Returns statistics about the locking of the USRStorage, which allow to see
+  /// how much the threads using it block each other. This can be called at any
+  /// time without locking the USRStorage.
+  USRStorageLockStatistics GetLockStatistics() const;
   
   /// Returns true if a new USR map has been created, false if a reference to an
   /// existing map has been added.
@@ -139,6 +203,31 @@ class USRStorage {
   /// Second stage of USR lookup. Returns pairs of file path and USR in @p foundDecls. Does not need to be done in the main thread.
   /// This function internally locks the USRStorage during the operation. It must not be locked already when the function is called.
   void LookupUSRs(const QByteArray& USR, std::unordered_set<QString> relevantFiles, std::vector<std::pair<QString, USRDecl>>* foundDecls);
+  /// Variant of LookupUSRs() which searches all files in the index. Can be
+  /// called from any thread. The USRStorage must not be locked.
+  void LookupUSRsInAllFiles(const QByteArray& USR, std::vector<std::pair<QString, USRDecl>>* foundDecls);
+  
+  /// Returns pairs of file path and reference site for all stored references
+  /// to the given USR in @p foundReferences. If @p relevantFiles is non-null,
+  /// only these files are searched, otherwise all files in the index. This
+  /// only uses the stored reference tables, so it does not need libclang and
+  /// can be called from any thread. The USRStorage must not be locked.
+  /// NOTE: References are only recorded by indexing, so files that have not
+  ///       been indexed yet (or have been edited since) may miss references.
+  void LookupReferences(const QByteArray& USR, const std::unordered_set<QString>* relevantFiles, std::vector<std::pair<QString, USRReference>>* foundReferences);
+  
+  /// Returns whether the reference table of the given file was recorded for
+  /// the file content with the given @p version (see GetFileVersion()). Only
+  /// then, LookupReferences() returns all references in the file that libclang
+  /// reports. Can be called from any thread. The USRStorage must not be locked.
+  bool AreReferencesCurrent(const QString& canonicalPath, quint64 version);
+  
+  /// Returns the declarations of and the references to the given USR in the
+  /// file with the given canonical path, if the reference table of the file
+  /// was recorded for the file content with the given @p version (see
+  /// AreReferencesCurrent()). Returns false otherwise. Can be called from any
+  /// thread. The USRStorage must not be locked.
+  bool LookupUSRInFile(const QByteArray& USR, const QString& canonicalPath, quint64 version, std::vector<USRDecl>* foundDecls, std::vector<USRReference>* foundReferences);
   
   inline USRMap* GetUSRMapForFile(const QString& canonicalPath) {
     auto it = USRs.find(canonicalPath);
@@ -151,6 +240,10 @@ class USRStorage {
   
   inline const std::unordered_map<QString, std::shared_ptr<USRMap>>& GetAllUSRs() const { return USRs; }
   
+  /// Returns the approximate number of bytes used to store the USRs. This
+  /// function internally locks the USRStorage. It must not be locked already.
+  quint64 GetMemoryUsage();
+  
   inline void DebugPrintInfo() {
     qDebug() << "USRStorage: Storing USRMaps for" << USRs.size() << "files";
   }
@@ -166,4 +259,13 @@ class USRStorage {
   std::unordered_map<QString, std::shared_ptr<USRMap>> USRs;
   
   std::mutex lock;
+  
+  /// Time at which the lock was taken. Only accessed while holding the lock.
+  std::chrono::steady_clock::time_point lockTime;
+  
+  // Lock statistics
+  std::atomic<quint64> numLocks = {0};
+  std::atomic<quint64> numContendedLocks = {0};
+  std::atomic<quint64> waitNanoseconds = {0};
+  std::atomic<quint64> holdNanoseconds = {0};
 };
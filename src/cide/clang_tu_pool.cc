@@ -4,10 +4,14 @@
 
 #include "cide/clang_tu_pool.h"
 
+#include <QFileInfo>
+
 #include "cide/clang_utils.h"
+#include "cide/target_pch.h"
 
 ClangTU::ClangTU()
-    : parseStamp(0),
+    : relevantUnsavedFilePathsValid(false),
+      parseStamp(0),
       initialized(false) {}
 
 ClangTU::~ClangTU() {
@@ -35,14 +39,30 @@ bool ClangTU::CanBeReparsed(const QString& path, const std::vector<QByteArray>&
   return true;
 }
 
-void ClangTU::Set(CXTranslationUnit TU, const std::vector<QByteArray>& commandLineArgs) {
+void ClangTU::Set(CXTranslationUnit TU, const std::vector<QByteArray>& commandLineArgs, const std::shared_ptr<TargetPCH>& pch) {
   if (initialized) {
     clang_disposeTranslationUnit(mTU);
   }
   
   mTU = TU;
   mCommandLineArgs = commandLineArgs;
+  mPCH = pch;
   initialized = true;
+  
+  relevantUnsavedFilePaths.clear();
+  relevantUnsavedFilePathsValid = false;
+}
+
+void ClangTU::UpdateRelevantUnsavedFilePaths() {
+  relevantUnsavedFilePaths.clear();
+  relevantUnsavedFilePaths.insert(QFileInfo(GetPath()).canonicalFilePath());
+  for (const IncludeWithModificationTime& include : includesWithModificationTimes) {
+    relevantUnsavedFilePaths.insert(QFileInfo(QString::fromUtf8(include.path)).canonicalFilePath());
+  }
+  if (mPCH) {
+    relevantUnsavedFilePaths.insert(mPCH->GetIncludedPaths().begin(), mPCH->GetIncludedPaths().end());
+  }
+  relevantUnsavedFilePathsValid = true;
 }
 
 QString ClangTU::GetPath() {
@@ -51,7 +71,8 @@ QString ClangTU::GetPath() {
 
 
 ClangTUPool::ClangTUPool(int numTUs)
-    : parseCounter(1),
+    : numTUs(numTUs),
+      parseCounter(1),
       mTUs(numTUs) {
   for (int i = 0; i < numTUs; ++ i) {
     mTUs[i].reset(new ClangTU());
@@ -105,11 +126,15 @@ std::shared_ptr<ClangTU> ClangTUPool::TakeMostUpToDateTU() {
 }
 
 void ClangTUPool::PutTU(const std::shared_ptr<ClangTU>& TU, bool reparsed) {
+  std::unique_lock<std::mutex> lock(accessMutex);
   if (reparsed) {
     TU->SetParseStamp(parseCounter);
     ++ parseCounter;
   }
-  
-  std::unique_lock<std::mutex> lock(accessMutex);
   mTUs.push_back(TU);
 }
+
+unsigned int ClangTUPool::GetLatestParseStamp() {
+  std::unique_lock<std::mutex> lock(accessMutex);
+  return parseCounter - 1;
+}
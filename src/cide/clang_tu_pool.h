@@ -6,12 +6,16 @@
 
 #include <memory>
 #include <mutex>
+#include <unordered_set>
 #include <vector>
 
 #include <clang-c/Index.h>
 #include <QString>
 
 #include "cide/clang_index.h"
+#include "cide/util.h"
+
+class TargetPCH;
 
 /// Wraps a libclang translation unit together with the settings that have been
 /// used to create it.
@@ -38,10 +42,12 @@ class ClangTU {
       const QString& path,
       const std::vector<QByteArray>& commandLineArgs);
   
-  /// Sets the contents of this ClangTU instance.
+  /// Sets the contents of this ClangTU instance. @p commandLineArgs must not
+  /// include the arguments for using @p pch. @p pch may be null.
   void Set(
       CXTranslationUnit TU,
-      const std::vector<QByteArray>& commandLineArgs);
+      const std::vector<QByteArray>& commandLineArgs,
+      const std::shared_ptr<TargetPCH>& pch);
   
   QString GetPath();
   
@@ -54,8 +60,23 @@ class ClangTU {
   inline bool isInitialized() const { return initialized; }
   
   inline std::vector<IncludeWithModificationTime>& GetIncludes() { return includesWithModificationTimes; }
+  
+  /// Must be called after the includes returned by GetIncludes() changed.
+  /// Updates the set returned by GetRelevantUnsavedFilePaths().
+  void UpdateRelevantUnsavedFilePaths();
+  
+  /// Returns the canonical paths of the files that the TU consists of (the
+  /// main file, its includes, and the files in its precompiled header). Only
+  /// unsaved changes to these files are relevant for reparsing the TU, so only
+  /// these should be passed to libclang. Returns null if this is unknown since
+  /// the TU has not been parsed yet.
+  inline const std::unordered_set<QString>* GetRelevantUnsavedFilePaths() const { return relevantUnsavedFilePathsValid ? &relevantUnsavedFilePaths : nullptr; }
+  
   inline const std::vector<QByteArray>& GetCommandLineArgs() const { return mCommandLineArgs; }
   
+  /// Returns the precompiled header that the TU uses, or null.
+  inline const std::shared_ptr<TargetPCH>& GetPCH() const { return mPCH; }
+  
  private:
   /// List of included files and their last modification times as given by
   /// libclang. This may be used to (approximately) check whether the preamble
@@ -63,8 +84,18 @@ class ClangTU {
   /// in front of includes that may change their behavior).
   std::vector<IncludeWithModificationTime> includesWithModificationTimes;
   
+  /// Cached canonical paths of the files in the TU, see
+  /// GetRelevantUnsavedFilePaths().
+  std::unordered_set<QString> relevantUnsavedFilePaths;
+  bool relevantUnsavedFilePathsValid;
+  
   /// Command-line arguments that were used to parse the TU
   std::vector<QByteArray> mCommandLineArgs;
+  
+  /// Precompiled header that was used to parse the TU. Holding a reference
+  /// keeps the PCH file in place for reparsing.
+  std::shared_ptr<TargetPCH> mPCH;
+  
   unsigned int parseStamp;
   CXTranslationUnit mTU;
   bool initialized;
@@ -100,7 +131,16 @@ class ClangTUPool {
   /// functions again.
   void PutTU(const std::shared_ptr<ClangTU>& TU, bool reparsed);
   
+  /// Returns the number of TUs that belong to the pool, including those that
+  /// are currently taken out of it.
+  inline int GetNumTUs() const { return numTUs; }
+  
+  /// Returns the parse stamp of the most recently parsed TU of the pool, or 0
+  /// if no TU has been parsed yet. This changes with each parse.
+  unsigned int GetLatestParseStamp();
+  
  private:
+  int numTUs;
   std::mutex accessMutex;
   unsigned int parseCounter;
   std::vector<std::shared_ptr<ClangTU>> mTUs;
@@ -7,45 +7,72 @@
 #include "cide/main_window.h"
 
 void GetAllUnsavedFiles(
-    MainWindow* mainWindow,
+    ProjectHost* host,
     std::vector<CXUnsavedFile>* unsavedFiles,
     std::vector<std::string>* unsavedFileContents,
-    std::vector<std::string>* unsavedFilePaths) {
-  int numDocuments = mainWindow->GetNumDocuments();
+    std::vector<std::string>* unsavedFilePaths,
+    const std::unordered_set<QString>* relevantPaths,
+    std::vector<QString>* skippedPaths) {
+  int numDocuments = host->GetNumDocuments();
   
-  int numDocumentsWithUnsavedChanges = 0;
-  for (int i = 0; i < numDocuments; ++ i) {
-    Document* document = mainWindow->GetDocument(i).get();
-    if (document->HasUnsavedChanges()) {
-      ++ numDocumentsWithUnsavedChanges;
-    }
+  if (skippedPaths) {
+    skippedPaths->clear();
   }
   
-  unsavedFiles->resize(numDocumentsWithUnsavedChanges);
-  unsavedFileContents->resize(numDocumentsWithUnsavedChanges);
-  unsavedFilePaths->resize(numDocumentsWithUnsavedChanges);
-  
-  int outIndex = 0;
+  std::vector<std::pair<Document*, QString>> documentsWithUnsavedChanges;
   for (int i = 0; i < numDocuments; ++ i) {
-    Document* document = mainWindow->GetDocument(i).get();
+    Document* document = host->GetDocument(i).get();
     if (!document->HasUnsavedChanges()) {
       continue;
     }
     
-    CXUnsavedFile& unsavedFile = (*unsavedFiles)[outIndex];
-    std::string& unsavedFileContent = (*unsavedFileContents)[outIndex];
-    std::string& unsavedFilePath = (*unsavedFilePaths)[outIndex];
+    QString canonicalPath = QFileInfo(document->path()).canonicalFilePath();
+    if (relevantPaths && relevantPaths->count(canonicalPath) == 0) {
+      if (skippedPaths) {
+        skippedPaths->push_back(canonicalPath);
+      }
+      continue;
+    }
+    documentsWithUnsavedChanges.emplace_back(document, canonicalPath);
+  }
+  
+  // Note: The vectors must be resized before taking pointers to the strings.
+  unsavedFiles->resize(documentsWithUnsavedChanges.size());
+  unsavedFileContents->resize(documentsWithUnsavedChanges.size());
+  unsavedFilePaths->resize(documentsWithUnsavedChanges.size());
+  
+  for (std::size_t i = 0; i < documentsWithUnsavedChanges.size(); ++ i) {
+    CXUnsavedFile& unsavedFile = (*unsavedFiles)[i];
+    std::string& unsavedFileContent = (*unsavedFileContents)[i];
+    std::string& unsavedFilePath = (*unsavedFilePaths)[i];
     
-    unsavedFileContent = document->GetDocumentText().toStdString();
-    unsavedFilePath = QFileInfo(document->path()).canonicalFilePath().toStdString();
+    unsavedFileContent = documentsWithUnsavedChanges[i].first->GetDocumentText().toStdString();
+    unsavedFilePath = documentsWithUnsavedChanges[i].second.toStdString();
     unsavedFile.Filename = unsavedFilePath.c_str();
     unsavedFile.Contents = unsavedFileContent.c_str();
     unsavedFile.Length = unsavedFileContent.size();
-    
-    ++ outIndex;
   }
 }
 
+bool TUContainsAnyOf(CXTranslationUnit clangTU, const std::vector<QString>& canonicalPaths) {
+  for (const QString& path : canonicalPaths) {
+    if (clang_getFile(clangTU, path.toUtf8().data()) != nullptr) {
+      return true;
+    }
+  }
+  return false;
+}
+
+quint64 GetTUMemoryUsage(CXTranslationUnit clangTU) {
+  quint64 result = 0;
+  CXTUResourceUsage usage = clang_getCXTUResourceUsage(clangTU);
+  for (unsigned i = 0; i < usage.numEntries; ++ i) {
+    result += usage.entries[i].amount;
+  }
+  clang_disposeCXTUResourceUsage(usage);
+  return result;
+}
+
 
 struct ContinueOrBreakParentSearchVisitorData {
   CXCursor lastForWhileDo;
@@ -4,14 +4,19 @@
 
 #pragma once
 
+#include <string>
+#include <unordered_set>
+#include <vector>
+
 #include <clang-c/Index.h>
 #include <QByteArray>
 #include <QString>
 
 #include "cide/document_location.h"
 #include "cide/document_range.h"
+#include "cide/util.h"
 
-class MainWindow;
+class ProjectHost;
 
 class ClangString {
  public:
@@ -174,11 +179,29 @@ inline QString GetClangText(const CXSourceRange& range, CXTranslationUnit tu) {
   return QString::fromUtf8(text + startOffset, endOffset - startOffset);
 }
 
+/// Returns the contents of all open documents with unsaved changes, for
+/// passing them to libclang. If @p relevantPaths is given, only the documents
+/// whose canonical paths are contained in it are returned. This should be used
+/// to pass only the files that belong to the TU, since libclang needs to check
+/// each unsaved file against the preamble. The canonical paths of the unsaved
+/// documents that are left out are returned in @p skippedPaths if given.
+/// This function must be called from the main (Qt) thread.
 void GetAllUnsavedFiles(
-    MainWindow* mainWindow,
+    ProjectHost* host,
     std::vector<CXUnsavedFile>* unsavedFiles,
     std::vector<std::string>* unsavedFileContents,
-    std::vector<std::string>* unsavedFilePaths);
+    std::vector<std::string>* unsavedFilePaths,
+    const std::unordered_set<QString>* relevantPaths = nullptr,
+    std::vector<QString>* skippedPaths = nullptr);
+
+/// Returns true if any of the files with the given canonical paths is part of
+/// the TU. This is used to check whether a TU includes one of the unsaved files
+/// that were skipped by GetAllUnsavedFiles(), in which case it must be
+/// reparsed with them.
+bool TUContainsAnyOf(CXTranslationUnit clangTU, const std::vector<QString>& canonicalPaths);
+
+/// Returns the total memory in bytes that libclang reports for the TU.
+quint64 GetTUMemoryUsage(CXTranslationUnit clangTU);
 
 /// Attempts to find the while, do, for, or switch statement that the given
 /// break or continue statement cursor refers to. Returns true if successful,
@@ -8,12 +8,25 @@
 #include <QPainter>
 #include <QPaintEvent>
 #include <QScrollBar>
+#include <QTimer>
 
 #include "cide/clang_utils.h"
 #include "cide/document_widget.h"
 #include "cide/settings.h"
 #include "cide/text_utils.h"
 
+/// Items which match fewer than (filter text size - kMaxNonMatchedCharacters)
+/// characters are considered to not match the filter text. They are still
+/// displayed (at the end of the list), but are not rescored when the filter
+/// text gets extended.
+constexpr int kMaxNonMatchedCharacters = 2;
+
+/// Number of items that are scored before the (partial) filter result gets
+/// displayed. The remaining items are scored in further chunks of this size
+/// from the Qt event loop, such that the UI stays responsive for huge item
+/// counts.
+constexpr int kFilterChunkSize = 8192;
+
 CompletionItem::CompletionItem() {}
 
 CompletionItem::CompletionItem(const CXCodeCompleteResults* libclangResults, int index) {
@@ -97,6 +110,18 @@ struct CompletionItemSorter {
     const CompletionItem& itemA = items[indexA];
     const CompletionItem& itemB = items[indexB];
     
+    // Items that cannot match the filter text anymore have not been rescored,
+    // so their scores are not comparable. Always sort them last.
+    if (itemA.isFilterCandidate != itemB.isFilterCandidate) {
+      return itemA.isFilterCandidate;
+    }
+    
+    // Likewise, candidates that have not been scored yet are sorted behind the
+    // scored ones.
+    if (itemA.isScored != itemB.isScored) {
+      return itemA.isScored;
+    }
+    
     // Sort based on the match quality between the items' filter texts and the
     // text input by the user.
     int scoreComparison = itemA.matchScore.Compare(itemB.matchScore);
@@ -123,14 +148,20 @@ struct CompletionItemSorter {
 };
 
 
-CodeCompletionWidget::CodeCompletionWidget(std::vector<CompletionItem>&& items, CXCodeCompleteResults* libclangResults, QPoint invocationPoint, QWidget* parentWidget, QWidget* parent)
+CodeCompletionWidget::CodeCompletionWidget(std::vector<CompletionItem>&& items, const std::shared_ptr<CXCodeCompleteResults>& libclangResults, QPoint invocationPoint, QWidget* parentWidget, QWidget* parent)
     : QWidget(parent, GetCustomTooltipWindowFlags()) {
   mLibclangResults = libclangResults;
   items.swap(mItems);
   mSortOrder.resize(mItems.size());
   for (int i = 0, size = mItems.size(); i < size; ++ i) {
     mSortOrder[i] = i;
+    mItems[i].filterTextSignature = FuzzyTextMatchSignature(mItems[i].lowercaseFilterText);
+    mItems[i].isFilterCandidate = true;
+    mItems[i].isScored = false;
   }
+  mFilterCandidates = mSortOrder;
+  numScoredFilterCandidates = 0;
+  numSortedItems = 0;
   
   setFocusPolicy(Qt::NoFocus);
   setAutoFillBackground(false);
@@ -142,40 +173,118 @@ CodeCompletionWidget::CodeCompletionWidget(std::vector<CompletionItem>&& items,
   invocationPosition = invocationPoint;
 }
 
-CodeCompletionWidget::~CodeCompletionWidget() {
-  clang_disposeCodeCompleteResults(mLibclangResults);
-}
-
 void CodeCompletionWidget::SetFilterText(const QString& text) {
-  QString lowercaseText = text.toLower();
-  
-  // Score each item according to how well it matches the new filter text. Note
-  // that this must be very fast since the number of items may be huge (and we
-  // currently perform the sorting in the foreground thread, i.e., the UI will
-  // lock up for the duration this takes). Even with only some Qt headers
-  // included, the item count was in the range of 10'000 items already!
-  int numItems = mItems.size();
-  #pragma omp parallel for
-  for (int i = 0; i < numItems; ++ i) {
-    CompletionItem& item = mItems[i];
-    ComputeFuzzyTextMatch(text, lowercaseText, item.filterText, item.lowercaseFilterText, &item.matchScore);
+  // Note that filtering must be very fast since the number of items may be huge
+  // (even with only some Qt headers included, the item count was in the range
+  // of 10'000 items already!).
+  // 
+  // If the new filter text is an extension of the previous one, only the
+  // items that may still match need to be rescored. Compared to the old text,
+  // the extended text can only match one character more than the number of
+  // added characters (in case the old text ended within a pair of swapped
+  // characters). So, items that matched fewer than
+  // (filterText.size() - kMaxNonMatchedCharacters - 1) characters of the old
+  // text cannot match the new text.
+  if (text.size() > filterText.size() && text.startsWith(filterText)) {
+    int minMatchedCharacters = filterText.size() - kMaxNonMatchedCharacters - 1;
+    
+    std::vector<int> remainingCandidates;
+    remainingCandidates.reserve(mFilterCandidates.size());
+    for (int i = 0, size = mFilterCandidates.size(); i < size; ++ i) {
+      CompletionItem& item = mItems[mFilterCandidates[i]];
+      // Candidates that have not been scored against the old text yet must be
+      // retained.
+      if (i >= numScoredFilterCandidates ||
+          (item.isFilterCandidate && item.matchScore.matchedCharacters >= minMatchedCharacters)) {
+        remainingCandidates.push_back(mFilterCandidates[i]);
+        item.isScored = false;
+      } else {
+        item.isFilterCandidate = false;
+      }
+    }
+    mFilterCandidates.swap(remainingCandidates);
+  } else {
+    // Rescore all items. Use the current display order such that the items
+    // which are likely to be displayed first also get scored first.
+    for (CompletionItem& item : mItems) {
+      item.isFilterCandidate = true;
+      item.isScored = false;
+    }
+    mFilterCandidates = mSortOrder;
   }
   
-  // Sort the items.
-  numSortedItems = std::min<std::size_t>(maxNumVisibleItems, mSortOrder.size());
-  std::partial_sort(mSortOrder.begin(), mSortOrder.begin() + numSortedItems, mSortOrder.end(), CompletionItemSorter(mItems.data()));
-  
   filterText = text;
+  filterQuery = FuzzyTextMatchQuery(text, text.toLower());
+  numScoredFilterCandidates = 0;
+  numSortedItems = 0;
   
   // We currently never preserve the selection when the filter text changes.
   selectedItem = 0;
   yScroll = 0;
   
+  // Score the first chunk of items right away. If there are more, continue
+  // from the event loop.
+  ScoreFilterCandidates(kFilterChunkSize);
+  if (numScoredFilterCandidates < mFilterCandidates.size() &&
+      !filterContinuationScheduled) {
+    filterContinuationScheduled = true;
+    QTimer::singleShot(0, this, &CodeCompletionWidget::ContinueFiltering);
+  }
+  
+  if (parentWidget) {
+    Relayout();
+  }
+}
+
+void CodeCompletionWidget::ContinueFiltering() {
+  filterContinuationScheduled = false;
+  if (numScoredFilterCandidates >= mFilterCandidates.size()) {
+    return;
+  }
+  
+  ScoreFilterCandidates(kFilterChunkSize);
+  if (numScoredFilterCandidates < mFilterCandidates.size()) {
+    filterContinuationScheduled = true;
+    QTimer::singleShot(0, this, &CodeCompletionWidget::ContinueFiltering);
+  }
+  
   if (parentWidget) {
     Relayout();
   }
 }
 
+void CodeCompletionWidget::ScoreFilterCandidates(int maxCount) {
+  int startIndex = numScoredFilterCandidates;
+  int endIndex = std::min<int>(mFilterCandidates.size(), startIndex + maxCount);
+  
+  // Items that are rejected by the cheap signature test cannot match the
+  // filter text. Note that this rejection remains valid if the filter text is
+  // extended later, since the signature test's bound grows at most by the
+  // number of added characters.
+  int minMatchedCharacters = filterText.size() - kMaxNonMatchedCharacters;
+  
+  #pragma omp parallel for
+  for (int i = startIndex; i < endIndex; ++ i) {
+    CompletionItem& item = mItems[mFilterCandidates[i]];
+    if (!ComputeFuzzyTextMatch(filterQuery, item.filterText, item.lowercaseFilterText, item.filterTextSignature, minMatchedCharacters, &item.matchScore)) {
+      item.isFilterCandidate = false;
+    }
+    item.isScored = true;
+  }
+  numScoredFilterCandidates = endIndex;
+  
+  // Sort the items. If the sorting has been extended already (for the previous
+  // chunk), keep its extent.
+  numSortedItems = std::min<std::size_t>(std::max(numSortedItems, maxNumVisibleItems), mSortOrder.size());
+  std::partial_sort(mSortOrder.begin(), mSortOrder.begin() + numSortedItems, mSortOrder.end(), CompletionItemSorter(mItems.data()));
+}
+
+void CodeCompletionWidget::FinishFiltering() {
+  if (numScoredFilterCandidates < mFilterCandidates.size()) {
+    ScoreFilterCandidates(mFilterCandidates.size() - numScoredFilterCandidates);
+  }
+}
+
 void CodeCompletionWidget::paintEvent(QPaintEvent* event) {
   QPainter painter(this);
   QRect rect = event->rect();
@@ -450,6 +559,23 @@ void CodeCompletionWidget::SetInvocationPoint(const QPoint& point) {
 }
 
 bool CodeCompletionWidget::HasSingleExactMatch() {
+  // An exact match must have a filter text of the same length as the text
+  // input by the user. Only if such a candidate exists, scoring of the
+  // remaining candidates needs to be finished to determine the best match.
+  if (numScoredFilterCandidates < mFilterCandidates.size()) {
+    bool haveCandidateOfEqualLength = false;
+    for (int index : mFilterCandidates) {
+      if (mItems[index].filterText.size() == filterText.size()) {
+        haveCandidateOfEqualLength = true;
+        break;
+      }
+    }
+    if (!haveCandidateOfEqualLength) {
+      return false;
+    }
+    FinishFiltering();
+  }
+  
   if (numSortedItems < 2) {
     ExtendItemSort(2);
     if (numSortedItems < 2) {
@@ -459,7 +585,8 @@ bool CodeCompletionWidget::HasSingleExactMatch() {
   
   // Check whether the best item matches exactly.
   CompletionItem& bestItem = mItems[mSortOrder[0]];
-  if (bestItem.matchScore.matchedCharacters < bestItem.filterText.size() ||
+  if (!bestItem.isFilterCandidate ||
+      bestItem.matchScore.matchedCharacters < bestItem.filterText.size() ||
       bestItem.matchScore.matchedCharacters < filterText.size() ||
       !bestItem.matchScore.matchedCase) {
     return false;
@@ -467,6 +594,7 @@ bool CodeCompletionWidget::HasSingleExactMatch() {
   
   // Verify that there is no other item matching exactly.
   if (mItems.size() > 1 &&
+      mItems[mSortOrder[1]].isFilterCandidate &&
       mItems[mSortOrder[1]].matchScore.matchedCharacters == filterText.size() &&
       mItems[mSortOrder[1]].matchScore.matchedCase) {
     return false;
@@ -487,6 +615,9 @@ bool CodeCompletionWidget::HasSingleExactMatch() {
 }
 
 void CodeCompletionWidget::Accept(DocumentWidget* widget, const DocumentLocation& invocationLoc) {
+  // Accept the item that is displayed as selected. Note that scoring the
+  // remaining filter candidates would re-sort the items, so this is not done
+  // here.
   CompletionItem& item = mItems[mSortOrder[selectedItem]];
   
   // Get the line start offsets, required for CXSourceRangeToDocumentRange.
@@ -522,7 +653,7 @@ void CodeCompletionWidget::Accept(DocumentWidget* widget, const DocumentLocation
   if (item.numFixits > 0) {
     for (int fixitIndex = 0; fixitIndex < item.numFixits; ++ fixitIndex) {
       CXSourceRange fixitRange;
-      CXString replacement = clang_getCompletionFixIt(mLibclangResults, item.clangCompletionIndex, fixitIndex, &fixitRange);
+      CXString replacement = clang_getCompletionFixIt(mLibclangResults.get(), item.clangCompletionIndex, fixitIndex, &fixitRange);
       
       // Transform the range through the replacements applied so far
       DocumentRange docRange = CXSourceRangeToDocumentRange(fixitRange, lineOffsets);
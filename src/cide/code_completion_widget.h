@@ -58,6 +58,10 @@ struct CompletionItem {
   QString filterText;
   QString lowercaseFilterText;
   
+  /// Signature of lowercaseFilterText for quickly rejecting non-matching items.
+  /// This is computed by the CodeCompletionWidget.
+  FuzzyTextMatchSignature filterTextSignature;
+  
   /// Index of the libclang CXCompletionResult, or -1 if this item was not
   /// created from a libclang completion item.
   int clangCompletionIndex;
@@ -76,6 +80,17 @@ struct CompletionItem {
   /// Match quality metric for matching filterText with the text input by the user.
   FuzzyTextMatchScore matchScore;
   
+  /// Whether the item may still match the current filter text. When the filter
+  /// text gets extended, items which cannot reach the match threshold anymore
+  /// are not rescored and are sorted behind all candidate items.
+  bool isFilterCandidate;
+  
+  /// Whether matchScore has been computed for the current filter text. While
+  /// the candidates are scored in chunks, the remaining candidates still have
+  /// their scores for the previous filter text, so they are sorted behind the
+  /// scored ones.
+  bool isScored;
+  
  private:
   void AppendCompletionString(const CXCompletionString& completion, DisplayStyle* currentStyle);
 };
@@ -84,12 +99,10 @@ struct CompletionItem {
 class CodeCompletionWidget : public QWidget {
  Q_OBJECT
  public:
-  /// Creates a completion widget with the given items. The widget takes
-  /// ownership over the libclang results.
-  CodeCompletionWidget(std::vector<CompletionItem>&& items, CXCodeCompleteResults* libclangResults, QPoint invocationPoint, QWidget* parentWidget, QWidget* parent = nullptr);
-  
-  /// Destructor. Frees the libclang results.
-  ~CodeCompletionWidget();
+  /// Creates a completion widget with the given items. The widget shares
+  /// ownership over the libclang results (with the DocumentWidget's completion
+  /// cache).
+  CodeCompletionWidget(std::vector<CompletionItem>&& items, const std::shared_ptr<CXCodeCompleteResults>& libclangResults, QPoint invocationPoint, QWidget* parentWidget, QWidget* parent = nullptr);
   
   /// Updates the filter text (i.e., the text typed by the user) with which the
   /// completions are filtered. Automatically recognizes if the new filter text
@@ -117,6 +130,7 @@ class CodeCompletionWidget : public QWidget {
   
   /// For debugging purposes. Returns the items array in sorted order.
   inline std::vector<CompletionItem> GetSortedItems() {
+    FinishFiltering();
     std::vector<CompletionItem> result(mItems.size());
     for (int i = 0; i < mItems.size(); ++ i) {
       result[i] = mItems[mSortOrder[i]];
@@ -138,6 +152,10 @@ class CodeCompletionWidget : public QWidget {
  private slots:
   void ScrollChanged(int value);
   
+  /// Scores the next chunk of filter candidates. Re-schedules itself until all
+  /// candidates have been scored.
+  void ContinueFiltering();
+  
  private:
   void AppendCompletionString(const CXCompletionString& completion, QString* text, std::vector<DocumentRange>* placeholders, bool skipBracketAndFollowing, bool skipAngleBracketAndFollowing, bool mayAppendSemicolon);
   
@@ -146,12 +164,22 @@ class CodeCompletionWidget : public QWidget {
   /// Extends the sorting of items to at least the given index.
   void ExtendItemSort(int itemIndex);
   
+  /// Scores up to @p maxCount pending filter candidates (in parallel) and
+  /// re-sorts the visible part of the list.
+  void ScoreFilterCandidates(int maxCount);
+  
+  /// Synchronously scores all remaining filter candidates.
+  void FinishFiltering();
+  
   
   /// The text by which the items have been filtered. This corresponds to the
   /// text input by the user in the document after the code completion
   /// invocation location.
   QString filterText;
   
+  /// filterText prepared for matching it against the items.
+  FuzzyTextMatchQuery filterQuery;
+  
   /// Stores all code completion items (in arbitrary order). The first displayed
   /// item is mItems[mSortOrder[0]].
   std::vector<CompletionItem> mItems;
@@ -163,7 +191,7 @@ class CodeCompletionWidget : public QWidget {
   /// The original code completion results provided by libclang. They are
   /// retained here such that the corresponding completion items can still
   /// access this original data instead of having to copy everything.
-  CXCodeCompleteResults* mLibclangResults;
+  std::shared_ptr<CXCodeCompleteResults> mLibclangResults;
   
   /// Indexes into mSortOrder.
   int selectedItem = 0;
@@ -174,6 +202,19 @@ class CodeCompletionWidget : public QWidget {
   /// index gets into the view, the sorting must be extended first.
   int numSortedItems;
   
+  /// Indexes into mItems for the items that must be scored against the current
+  /// filter text. If the filter text is extended, this only retains the items
+  /// that may still match, which makes incremental filtering cheap.
+  std::vector<int> mFilterCandidates;
+  
+  /// Number of items in mFilterCandidates that have been scored against the
+  /// current filter text. Large candidate lists are scored in chunks, showing
+  /// the partial results in-between, such that the UI does not block.
+  int numScoredFilterCandidates;
+  
+  /// Whether a call to ContinueFiltering() is pending in the event loop.
+  bool filterContinuationScheduled = false;
+  
   
   /// Containing widget, used to re-compute the global tooltip position after
   /// widget movements.
@@ -4,6 +4,8 @@
 
 #include "cide/code_info.h"
 
+#include <algorithm>
+
 #include "cide/argument_hint_widget.h"
 #include "cide/clang_utils.h"
 #include "cide/code_info_code_completion.h"
@@ -12,12 +14,20 @@
 #include "cide/code_info_goto_referenced_cursor.h"
 #include "cide/main_window.h"
 #include "cide/qt_thread.h"
+#include "cide/settings.h"
 #include "cide/text_utils.h"
+#include "cide/tracing.h"
 
 
 CodeInfo::CodeInfo() {
   mExit = false;
-  mThread.reset(new std::thread(&CodeInfo::ThreadMain, this));
+  
+  int threadCount = std::max(1, Settings::Instance().GetCodeInfoThreadCount());
+  workers.resize(threadCount);
+  for (int i = 0; i < threadCount; ++ i) {
+    workers[i].reset(new Worker());
+    workers[i]->thread.reset(new std::thread(&CodeInfo::ThreadMain, this, workers[i].get()));
+  }
 }
 
 CodeInfo::~CodeInfo() {
@@ -29,7 +39,7 @@ CodeInfo& CodeInfo::Instance() {
   return instance;
 }
 
-DocumentLocation CodeInfo::RequestCodeCompletion(DocumentWidget* widget) {
+DocumentLocation CodeInfo::FindCodeCompletionInvocationLocation(DocumentWidget* widget) {
   // Find the location to invoke the completion at. It must point directly after
   // the relevant token. For example, for someObject->get^ with the cursor at
   // ^, the completion must be invoked after the "->", not after "get". Thus,
@@ -50,159 +60,211 @@ DocumentLocation CodeInfo::RequestCodeCompletion(DocumentWidget* widget) {
     }
     codeCompletionInvocationLocation = it.IsValid() ? (it.GetCharacterOffset() + 1) : 0;
   }
+  return codeCompletionInvocationLocation;
+}
+
+DocumentLocation CodeInfo::RequestCodeCompletion(DocumentWidget* widget) {
+  DocumentLocation codeCompletionInvocationLocation = FindCodeCompletionInvocationLocation(widget);
   
   std::unique_lock<std::mutex> lock(completeRequestMutex);
-  if (!CheckDiscardPreviousRequest(widget, CodeInfoRequest::Type::CodeCompletion)) {
+  CodeInfoRequest* request = QueueRequest(widget, CodeInfoRequest::Type::CodeCompletion);
+  if (!request) {
     return DocumentLocation::Invalid();
   }
   
-  lastRequest.widget = widget;
-  lastRequest.codeCompletionInvocationLocation = codeCompletionInvocationLocation;
-  lastRequest.invocationCounter = widget->GetCodeCompletionInvocationCounter();
-  lastRequest.type = CodeInfoRequest::Type::CodeCompletion;
-  haveRequest = true;
-  newCodeInfoRequestCondition.notify_one();
+  request->widget = widget;
+  request->codeCompletionInvocationLocation = codeCompletionInvocationLocation;
+  request->invocationCounter = widget->GetCodeCompletionInvocationCounter();
+  request->codeCompletionEditCount = widget->GetDocument()->editCount();
   
   return codeCompletionInvocationLocation;
 }
 
 bool CodeInfo::RequestRightClickInfo(DocumentWidget* widget, DocumentLocation invocationLocation) {
   std::unique_lock<std::mutex> lock(completeRequestMutex);
-  if (!CheckDiscardPreviousRequest(widget, CodeInfoRequest::Type::RightClickInfo)) {
+  CodeInfoRequest* request = QueueRequest(widget, CodeInfoRequest::Type::RightClickInfo);
+  if (!request) {
     return false;
   }
   
-  lastRequest.widget = widget;
-  lastRequest.codeCompletionInvocationLocation = invocationLocation;
-  lastRequest.invocationCounter = widget->GetCodeCompletionInvocationCounter();  // TODO: This value is currently unused here
-  lastRequest.type = CodeInfoRequest::Type::RightClickInfo;
-  haveRequest = true;
-  newCodeInfoRequestCondition.notify_one();
+  request->widget = widget;
+  request->codeCompletionInvocationLocation = invocationLocation;
+  request->invocationCounter = widget->GetCodeCompletionInvocationCounter();  // TODO: This value is currently unused here
   return true;
 }
 
 bool CodeInfo::RequestCodeInfo(DocumentWidget* widget, DocumentLocation invocationLocation) {
   std::unique_lock<std::mutex> lock(completeRequestMutex);
-  if (!CheckDiscardPreviousRequest(widget, CodeInfoRequest::Type::Info)) {
+  CodeInfoRequest* request = QueueRequest(widget, CodeInfoRequest::Type::Info);
+  if (!request) {
     return false;
   }
   
-  lastRequest.widget = widget;
-  lastRequest.codeCompletionInvocationLocation = invocationLocation;
-  lastRequest.pathForReferences = widget->GetDocument()->path();
-  lastRequest.dropUninterestingTokens = true;
-  lastRequest.invocationCounter = widget->GetCodeCompletionInvocationCounter();  // TODO: This value is currently unused here
-  lastRequest.type = CodeInfoRequest::Type::Info;
-  haveRequest = true;
-  newCodeInfoRequestCondition.notify_one();
+  request->widget = widget;
+  request->codeCompletionInvocationLocation = invocationLocation;
+  request->pathForReferences = widget->GetDocument()->path();
+  request->dropUninterestingTokens = true;
+  request->invocationCounter = widget->GetCodeCompletionInvocationCounter();  // TODO: This value is currently unused here
   return true;
 }
 
 bool CodeInfo::RequestCodeInfo(DocumentWidget* widget, const QString& path, int line, int column, const QString& pathForReferences, bool dropUninterestingTokens) {
   std::unique_lock<std::mutex> lock(completeRequestMutex);
-  if (!CheckDiscardPreviousRequest(widget, CodeInfoRequest::Type::Info)) {
+  CodeInfoRequest* request = QueueRequest(widget, CodeInfoRequest::Type::Info);
+  if (!request) {
     return false;
   }
   
-  lastRequest.widget = widget;
-  lastRequest.codeCompletionInvocationLocation = DocumentLocation::Invalid();
-  lastRequest.invocationFile = path;
-  lastRequest.invocationLine = line;
-  lastRequest.invocationColumn = column;
-  lastRequest.pathForReferences = pathForReferences;
-  lastRequest.dropUninterestingTokens = dropUninterestingTokens;
-  lastRequest.invocationCounter = widget->GetCodeCompletionInvocationCounter();  // TODO: This value is currently unused here
-  lastRequest.type = CodeInfoRequest::Type::Info;
-  haveRequest = true;
-  newCodeInfoRequestCondition.notify_one();
+  request->widget = widget;
+  request->codeCompletionInvocationLocation = DocumentLocation::Invalid();
+  request->invocationFile = path;
+  request->invocationLine = line;
+  request->invocationColumn = column;
+  request->pathForReferences = pathForReferences;
+  request->dropUninterestingTokens = dropUninterestingTokens;
+  request->invocationCounter = widget->GetCodeCompletionInvocationCounter();  // TODO: This value is currently unused here
   return true;
 }
 
 bool CodeInfo::GotoReferencedCursor(DocumentWidget* widget, DocumentLocation invocationLocation) {
   std::unique_lock<std::mutex> lock(completeRequestMutex);
-  if (!CheckDiscardPreviousRequest(widget, CodeInfoRequest::Type::GotoReferencedCursor)) {
+  CodeInfoRequest* request = QueueRequest(widget, CodeInfoRequest::Type::GotoReferencedCursor);
+  if (!request) {
     return false;
   }
   
-  lastRequest.widget = widget;
-  lastRequest.codeCompletionInvocationLocation = invocationLocation;
-  lastRequest.invocationCounter = -1;  // unused
-  lastRequest.type = CodeInfoRequest::Type::GotoReferencedCursor;
-  haveRequest = true;
-  newCodeInfoRequestCondition.notify_one();
+  request->widget = widget;
+  request->codeCompletionInvocationLocation = invocationLocation;
+  request->invocationCounter = -1;  // unused
   return true;
 }
 
 void CodeInfo::WidgetRemoved(DocumentWidget* widget) {
   std::unique_lock<std::mutex> lock(completeRequestMutex);
   
-  if (haveRequest && lastRequest.widget == widget) {
-    haveRequest = false;
-  }
+  widgetRequests.erase(widget);
   
-  if (haveRequestInProgress && requestInProgress.widget == widget) {
-    haveRequestInProgress = false;
-    requestInProgress.wasCanceled = true;
+  for (const auto& worker : workers) {
+    if (worker->haveRequestInProgress && worker->requestInProgress.widget == widget) {
+      worker->haveRequestInProgress = false;
+      worker->requestInProgress.wasCanceled = true;
+    }
   }
 }
 
 void CodeInfo::Exit() {
-  if (mThread) {
-    mExit = true;
-    newCodeInfoRequestCondition.notify_all();
-    mThread->join();
-    mThread = nullptr;
+  std::unique_lock<std::mutex> lock(completeRequestMutex);
+  mExit = true;
+  newCodeInfoRequestCondition.notify_all();
+  lock.unlock();
+  
+  for (const auto& worker : workers) {
+    if (worker->thread) {
+      worker->thread->join();
+      worker->thread = nullptr;
+    }
   }
 }
 
-bool CodeInfo::CheckDiscardPreviousRequest(DocumentWidget* widget, CodeInfoRequest::Type newRequestType) {
-  if (!haveRequest) {
-    return true;
-  }
+CodeInfoRequest* CodeInfo::QueueRequest(DocumentWidget* widget, CodeInfoRequest::Type newRequestType) {
+  WidgetRequests& requests = widgetRequests[widget];
   
-  if (static_cast<int>(lastRequest.type) < static_cast<int>(newRequestType)) {
-    // There is a higher-priority request already, discard the new one.
-    return false;
+  if (requests.haveRequest) {
+    if (static_cast<int>(requests.request.type) < static_cast<int>(newRequestType)) {
+      // There is a higher-priority request already, discard the new one.
+      return nullptr;
+    }
+    
+    // Discard the old request in favor of the new one.
+    if (requests.request.type == CodeInfoRequest::Type::CodeCompletion) {
+      widget->CodeCompletionRequestWasDiscarded();
+    }
   }
   
-  // Discard the old request in favor of the new one.
-  if (lastRequest.type == CodeInfoRequest::Type::CodeCompletion) {
-    widget->CodeCompletionRequestWasDiscarded();
+  // Each request in progress holds one TU of the document. Keep one TU
+  // available for reparsing the document.
+  requests.maxRequestsInProgress = std::max(1, widget->GetDocument()->GetTUPool()->GetNumTUs() - 1);
+  
+  requests.haveRequest = true;
+  requests.requestNumber = requestCounter;
+  ++ requestCounter;
+  requests.request.type = newRequestType;
+  newCodeInfoRequestCondition.notify_one();
+  return &requests.request;
+}
+
+DocumentWidget* CodeInfo::FindNextRequest() {
+  DocumentWidget* result = nullptr;
+  const WidgetRequests* resultRequests = nullptr;
+  
+  for (const auto& item : widgetRequests) {
+    const WidgetRequests& requests = item.second;
+    if (!requests.haveRequest ||
+        requests.numRequestsInProgress >= requests.maxRequestsInProgress) {
+      continue;
+    }
+    
+    if (!resultRequests ||
+        static_cast<int>(requests.request.type) < static_cast<int>(resultRequests->request.type) ||
+        (requests.request.type == resultRequests->request.type && requests.requestNumber < resultRequests->requestNumber)) {
+      result = item.first;
+      resultRequests = &requests;
+    }
   }
-  return true;
+  
+  return result;
 }
 
-void CodeInfo::ThreadMain() {
+void CodeInfo::ThreadMain(Worker* worker) {
+  SetTraceThreadName("Code info");
+  
   while (true) {
     std::unique_lock<std::mutex> lock(completeRequestMutex);
     if (mExit) {
       return;
     }
-    while (!haveRequest) {
+    DocumentWidget* widget;
+    while (!(widget = FindNextRequest())) {
       newCodeInfoRequestCondition.wait(lock);
       if (mExit) {
         return;
       }
     }
-    requestInProgress = lastRequest;
-    requestInProgress.wasCanceled = false;
-    haveRequest = false;
-    haveRequestInProgress = true;
+    WidgetRequests& requests = widgetRequests.at(widget);
+    worker->requestInProgress = requests.request;
+    worker->requestInProgress.wasCanceled = false;
+    worker->haveRequestInProgress = true;
+    requests.haveRequest = false;
+    ++ requests.numRequestsInProgress;
     lock.unlock();
     
+    const CodeInfoRequest& request = worker->requestInProgress;
+    
     // Perform the code completion
-    if (requestInProgress.type == CodeInfoRequest::Type::CodeCompletion) {
+    if (request.type == CodeInfoRequest::Type::CodeCompletion) {
+      CIDE_TRACE_SPAN("CodeCompletion");
       CodeCompletionOperation operation;
-      LockTUForOperation(requestInProgress, true, &operation);
-    } else if (requestInProgress.type == CodeInfoRequest::Type::Info) {
+      LockTUForOperation(request, true, &operation);
+    } else if (request.type == CodeInfoRequest::Type::Info) {
+      CIDE_TRACE_SPAN("GetInfo");
       GetInfoOperation operation;
-      LockTUForOperation(requestInProgress, false, &operation);
-    } else if (requestInProgress.type == CodeInfoRequest::Type::RightClickInfo) {
+      LockTUForOperation(request, false, &operation);
+    } else if (request.type == CodeInfoRequest::Type::RightClickInfo) {
+      CIDE_TRACE_SPAN("GetRightClickInfo");
       GetRightClickInfoOperation operation;
-      LockTUForOperation(requestInProgress, false, &operation);
-    } else if (requestInProgress.type == CodeInfoRequest::Type::GotoReferencedCursor) {
+      LockTUForOperation(request, false, &operation);
+    } else if (request.type == CodeInfoRequest::Type::GotoReferencedCursor) {
+      CIDE_TRACE_SPAN("GotoReferencedCursor");
       GotoReferencedCursorOperation operation;
-      LockTUForOperation(requestInProgress, false, &operation);
+      LockTUForOperation(request, false, &operation);
+    }
+    
+    // If the widget was removed in the meantime, its entry in widgetRequests
+    // has been removed as well.
+    lock.lock();
+    if (worker->haveRequestInProgress) {
+      worker->haveRequestInProgress = false;
+      -- widgetRequests.at(widget).numRequestsInProgress;
     }
   }
 }
@@ -223,7 +285,7 @@ void CodeInfo::LockTUForOperation(
   RunInQtThreadBlocking([&]() {
     // If the document has been closed in the meantime, we must not access its
     // widget anymore.
-    if (!haveRequestInProgress) {
+    if (request.wasCanceled) {
       exit = true;
       return;
     }
@@ -257,8 +319,8 @@ void CodeInfo::LockTUForOperation(
     }
     
     if (getUnsavedFileContents) {
-      // Get all unsaved files that are opened
-      GetAllUnsavedFiles(request.widget->GetMainWindow(), &unsavedFiles, &unsavedFileContents, &unsavedFilePaths);
+      // Get the unsaved files that are opened and belong to the TU
+      GetAllUnsavedFiles(request.widget->GetMainWindow(), &unsavedFiles, &unsavedFileContents, &unsavedFilePaths, TU->GetRelevantUnsavedFilePaths());
     }
     
     operation->InitializeInQtThread(request, TU, canonicalFilePath, invocationLine, invocationCol, unsavedFiles);
@@ -275,7 +337,7 @@ void CodeInfo::LockTUForOperation(
   RunInQtThreadBlocking([&]() {
     // If the document has been closed in the meantime, we must not access its
     // widget anymore.
-    if (!haveRequestInProgress) {
+    if (request.wasCanceled) {
       exit = true;
       return;
     }
@@ -9,6 +9,8 @@
 #include <functional>
 #include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <vector>
 
 #include "cide/document_widget.h"
 
@@ -29,6 +31,9 @@ struct CodeInfoRequest {
   DocumentWidget* widget;
   DocumentLocation codeCompletionInvocationLocation;
   int invocationCounter;
+  /// For code completion: The document's editCount() at the time the
+  /// invocation location was determined.
+  int codeCompletionEditCount;
   Type type;
   bool wasCanceled;
   
@@ -93,9 +98,15 @@ struct TUOperationBase {
 };
 
 
-/// Singleton class maintaining a thread that performs operations on the
-/// most up-to-date libclang translation unit, such as code completion or
-/// querying the AST (abstract syntax tree) for information about the code.
+/// Singleton class maintaining a pool of threads that perform operations on
+/// the most up-to-date libclang translation units of the open documents, such
+/// as code completion or querying the AST (abstract syntax tree) for
+/// information about the code.
+/// 
+/// Each document widget has a single slot for a pending request. Requests for
+/// different documents are processed in parallel. Within a document, a new
+/// request replaces a pending lower-priority one. The number of requests that
+/// run concurrently for a document is limited by the size of its TU pool.
 class CodeInfo {
  public:
   ~CodeInfo();
@@ -103,6 +114,10 @@ class CodeInfo {
   /// Returns the singleton instance.
   static CodeInfo& Instance();
   
+  /// Returns the location at which code completion must be invoked for the
+  /// current cursor position of the given widget.
+  static DocumentLocation FindCodeCompletionInvocationLocation(DocumentWidget* widget);
+  
   /// Requests code completion for the given widget (at the current cursor
   /// position) in the background thread.
   /// If the request was rejected because there is a higher-priority request already, returns an invalid location.
@@ -126,20 +141,53 @@ class CodeInfo {
   /// Returns true if the request was accepted, false otherwise (if there was a higher-priority request already).
   bool GotoReferencedCursor(DocumentWidget* widget, DocumentLocation invocationLocation);
   
-  /// Notifies the background thread about the given @p widget being
-  /// removed, such that it will not try to access it anymore.
+  /// Notifies the background threads about the given @p widget being
+  /// removed, such that they will not try to access it anymore.
   void WidgetRemoved(DocumentWidget* widget);
   
   void Exit();
   
  private:
+  /// Requests of a single document widget.
+  struct WidgetRequests {
+    /// Request which was made, but is not being worked on yet
+    bool haveRequest = false;
+    CodeInfoRequest request;
+    
+    /// Value of requestCounter when the request was made. Among the pending
+    /// requests with the highest priority, the oldest one is handled first.
+    quint64 requestNumber;
+    
+    /// Number of requests for this widget that are being worked on, and the
+    /// maximum number of such requests (derived from the size of the
+    /// document's TU pool).
+    int numRequestsInProgress = 0;
+    int maxRequestsInProgress = 1;
+  };
+  
+  /// A thread of the pool, together with the request that it is working on.
+  struct Worker {
+    std::shared_ptr<std::thread> thread;
+    
+    bool haveRequestInProgress = false;
+    CodeInfoRequest requestInProgress;
+  };
+  
   CodeInfo();
   
-  /// Checks whether the new request type will discard the potentially already queued old request.
-  /// Returns true if the new request can be made, false if the old request has higher priority.
-  bool CheckDiscardPreviousRequest(DocumentWidget* widget, CodeInfoRequest::Type newRequestType);
+  /// Prepares the pending request slot of @p widget for a new request of the
+  /// given type and wakes up a worker for it. Returns the slot, which the
+  /// caller must fill in, if the new request can be made, or null if the
+  /// pending request has a higher priority. Must be called with
+  /// completeRequestMutex locked (and the request filled in before unlocking).
+  CodeInfoRequest* QueueRequest(DocumentWidget* widget, CodeInfoRequest::Type newRequestType);
+  
+  /// Returns the widget whose pending request should be worked on next, or
+  /// null if there is no pending request that may be started now. Must be
+  /// called with completeRequestMutex locked.
+  DocumentWidget* FindNextRequest();
   
-  void ThreadMain();
+  void ThreadMain(Worker* worker);
   
   void LockTUForOperation(
       const CodeInfoRequest& request,
@@ -147,18 +195,14 @@ class CodeInfo {
       TUOperationBase* operation);
   
   
-  /// Request which was made, but is not being worked on yet
-  bool haveRequest = false;
-  CodeInfoRequest lastRequest;
+  /// Pending and in-progress requests per widget.
+  std::unordered_map<DocumentWidget*, WidgetRequests> widgetRequests;
+  quint64 requestCounter = 0;
   
-  /// Request which is being worked on
-  bool haveRequestInProgress = false;
-  CodeInfoRequest requestInProgress;
+  std::vector<std::unique_ptr<Worker>> workers;
   
   std::atomic<bool> mExit;
   
   std::mutex completeRequestMutex;
   std::condition_variable newCodeInfoRequestCondition;
-  
-  std::shared_ptr<std::thread> mThread;
 };
@@ -0,0 +1,36 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/code_info_cache.h"
+
+CodeInfoCache::CodeInfoCache(int maxNumEntries)
+    : maxNumEntries(maxNumEntries) {}
+
+const CodeInfoCacheEntry* CodeInfoCache::Lookup(const DocumentLocation& location, unsigned int parseStamp, int documentEditCount) {
+  for (auto it = entries.begin(); it != entries.end(); ) {
+    if (it->parseStamp != parseStamp || it->documentEditCount != documentEditCount) {
+      it = entries.erase(it);
+      continue;
+    }
+    
+    if (it->tokenRange.ContainsCharacter(location.offset)) {
+      // Move the entry to the front.
+      entries.splice(entries.begin(), entries, it);
+      return &entries.front();
+    }
+    ++ it;
+  }
+  return nullptr;
+}
+
+void CodeInfoCache::Insert(CodeInfoCacheEntry&& entry) {
+  entries.push_front(std::move(entry));
+  while (entries.size() > maxNumEntries) {
+    entries.pop_back();
+  }
+}
+
+void CodeInfoCache::Clear() {
+  entries.clear();
+}
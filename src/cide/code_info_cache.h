@@ -0,0 +1,57 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <list>
+#include <vector>
+
+#include <QString>
+#include <QUrl>
+
+#include "cide/document_location.h"
+#include "cide/document_range.h"
+
+/// Result of a code info request (as shown in the hover tooltip) for a token.
+struct CodeInfoCacheEntry {
+  /// Parse stamp of the TU that the result was computed with.
+  unsigned int parseStamp;
+  
+  /// The document's editCount() at the time the result was stored.
+  int documentEditCount;
+  
+  /// Range of the token that the result is for.
+  DocumentRange tokenRange;
+  
+  QString htmlString;
+  QUrl helpUrl;
+  std::vector<DocumentRange> referenceRanges;
+};
+
+/// Least-recently-used cache of the code info results for a document, such
+/// that hovering over the same tokens again does not require libclang calls.
+/// Entries are only valid as long as the document's TUs are not reparsed and
+/// the document is not edited.
+class CodeInfoCache {
+ public:
+  CodeInfoCache(int maxNumEntries = 64);
+  
+  /// Returns the entry whose token range contains @p location, or null if
+  /// there is none. Entries that were created for a different parse stamp or
+  /// edit count than the given ones are dropped. @p parseStamp should be the
+  /// stamp of the most up-to-date TU of the document.
+  const CodeInfoCacheEntry* Lookup(const DocumentLocation& location, unsigned int parseStamp, int documentEditCount);
+  
+  /// Inserts an entry, dropping the least recently used entry if the cache is
+  /// full.
+  void Insert(CodeInfoCacheEntry&& entry);
+  
+  void Clear();
+  
+ private:
+  /// Ordered from the most recently to the least recently used entry.
+  std::list<CodeInfoCacheEntry> entries;
+  
+  int maxNumEntries;
+};
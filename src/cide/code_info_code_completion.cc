@@ -9,6 +9,7 @@
 #include "cide/cpp_utils.h"
 #include "cide/main_window.h"
 #include "cide/qt_thread.h"
+#include "cide/tracing.h"
 
 bool IsCursorOutsideOfAnyClassOrFunctionDefinition(CXCursor cursor) {
   CXCursor currentCursor = cursor;
@@ -65,6 +66,7 @@ CodeCompletionOperation::Result CodeCompletionOperation::OperateOnTU(
   // TODO: Should we only do this if we know that the corresponding header changed since the last parse?
   if (cursorIsOutsideOfAnyClassOrFunctionDefinition) {
     // qDebug() << "Implementation completion debug: Triggering reparse since code completion is invoked outside of a context";
+    CIDE_TRACE_SPAN("CodeCompletionReparse");
     CXErrorCode parseResult = static_cast<CXErrorCode>(clang_reparseTranslationUnit(
         TU->TU(),
         unsavedFiles.size(),
@@ -82,14 +84,17 @@ CodeCompletionOperation::Result CodeCompletionOperation::OperateOnTU(
       CXCodeComplete_IncludeBriefComments |
       CXCodeComplete_SkipPreamble |
       CXCodeComplete_IncludeCompletionsWithFixIts;
-  results = clang_codeCompleteAt(
-      TU->TU(),
-      canonicalFilePath.toUtf8().data(),
-      invocationLine + 1,  // cursorLine + 1,
-      invocationCol + 1,  // std::min(layoutLines[cursorLine].size() + 1, cursorCol + 1),
-      unsavedFiles.data(),
-      unsavedFiles.size(),
-      options);
+  {
+    CIDE_TRACE_SPAN("clang_codeCompleteAt");
+    results = clang_codeCompleteAt(
+        TU->TU(),
+        canonicalFilePath.toUtf8().data(),
+        invocationLine + 1,  // cursorLine + 1,
+        invocationCol + 1,  // std::min(layoutLines[cursorLine].size() + 1, cursorCol + 1),
+        unsavedFiles.data(),
+        unsavedFiles.size(),
+        options);
+  }
   // Obtain an up-to-date CXFile after the possible re-parse
   if (correspondingHeaderPath.isEmpty()) {
     correspondingHeader = nullptr;
@@ -116,34 +121,23 @@ void CodeCompletionOperation::FinalizeInQtThread(const CodeInfoRequest& request)
     return;
   }
   
+  // Cache the results, also if they are outdated: the completion may be
+  // invoked at the same location again, for example after a request that was
+  // started speculatively when typing ".", "->", or "::". Ownership of the
+  // results is passed on to the cache (and the completion widget) here.
+  std::shared_ptr<CXCodeCompleteResults> sharedResults(results, &clang_disposeCodeCompleteResults);
+  success = true;
+  request.widget->CacheCodeCompletion(request.codeCompletionInvocationLocation, request.codeCompletionEditCount, std::move(items), sharedResults, std::move(hints), currentParameter);
+  
   // If the request is not up-to-date anymore (the document's invocation
-  // counter differs), discard the results.
+  // counter differs), do not show the results.
   if (request.widget->GetCodeCompletionInvocationCounter() != request.invocationCounter) {
     // Here, there is no need to call request.widget->CloseCodeCompletion(), as
     // a new request should be on the way already.
     return;
   }
   
-  if (results->NumResults == 0) {
-    request.widget->CloseCodeCompletion();
-    return;
-  }
-  
-  // Show or close code completion
-  if (items.empty()) {
-    request.widget->CloseCodeCompletion();
-  } else {
-    request.widget->ShowCodeCompletion(request.codeCompletionInvocationLocation, std::move(items), results);
-  }
-  
-  // Show or close argument hint
-  if (hints.empty()) {
-    request.widget->CloseArgumentHint();
-  } else {
-    request.widget->ShowArgumentHint(request.codeCompletionInvocationLocation, std::move(hints), currentParameter);
-  }
-  
-  success = true;
+  request.widget->ShowCachedCodeCompletion();
 }
 
 void CodeCompletionOperation::CreateCodeCompletionItems() {
@@ -1160,6 +1160,7 @@ GetInfoOperation::Result GetInfoOperation::OperateOnTU(
   
   // Set the infoTokenRange output variable to null
   infoTokenRange = clang_getNullRange();
+  parseStamp = TU->GetParseStamp();
   
   // Try to get a cursor for the given source location
   CXFile clangFile = clang_getFile(TU->TU(), canonicalFilePath.toUtf8().data());
@@ -1757,6 +1758,21 @@ void GetInfoOperation::FinalizeInQtThread(const CodeInfoRequest& request) {
     }
   }
   
+  // Cache the results of hover requests (which are made for locations within
+  // the widget's document).
+  if (request.codeCompletionInvocationLocation.IsValid() &&
+      tokenDocumentRange.IsValid() &&
+      !htmlString.isEmpty()) {
+    CodeInfoCacheEntry entry;
+    entry.parseStamp = parseStamp;
+    entry.documentEditCount = document->editCount();
+    entry.tokenRange = tokenDocumentRange;
+    entry.htmlString = htmlString;
+    entry.helpUrl = helpUrl;
+    entry.referenceRanges = referenceDocumentRanges;
+    request.widget->GetCodeInfoCache()->Insert(std::move(entry));
+  }
+  
   // Make the gathered information available to the DocumentWidget
   request.widget->SetCodeTooltip(tokenDocumentRange, htmlString, helpUrl, referenceDocumentRanges);
 }
@@ -13,6 +13,9 @@ struct GetInfoOperation : public TUOperationBase {
   std::vector<CXSourceRange> referenceRanges;
   QUrl helpUrl;
   
+  /// Parse stamp of the TU that the information was obtained from.
+  unsigned int parseStamp;
+  
   Result OperateOnTU(
       const CodeInfoRequest& request,
       const std::shared_ptr<ClangTU>& TU,
@@ -6,6 +6,7 @@
 
 #include "cide/document.h"
 #include "cide/main_window.h"
+#include "cide/tracing.h"
 
 CrashBackup& CrashBackup::Instance() {
   static CrashBackup instance;
@@ -211,6 +212,8 @@ void CrashBackup::CreateBackup(const BackupRequest& request) {
 }
 
 void CrashBackup::ThreadMain() {
+  SetTraceThreadName("Crash backup");
+  
   while (true) {
     std::unique_lock<std::mutex> lock(backupMutex);
     if (mExit) {
@@ -230,6 +233,7 @@ void CrashBackup::ThreadMain() {
     lock.unlock();
     
     // Make the backup
+    CIDE_TRACE_SPAN("CrashBackup");
     CreateBackup(request);
   }
 }
@@ -4,10 +4,12 @@
 
 #include "cide/document.h"
 
+#include <algorithm>
 #include <iostream>
 #include <unordered_set>
 
 #include <QFile>
+#include <QFileInfo>
 
 #include "cide/qt_thread.h"
 #include "cide/settings.h"
@@ -391,6 +393,100 @@ void Document::CharacterAndStyleIterator::operator++() {
 }
 
 
+DocumentEditMapper::DocumentEditMapper(
+    std::vector<DocumentEdit>&& edits,
+    const std::vector<unsigned>& oldLineOffsets,
+    std::vector<unsigned>&& currentLineOffsets)
+    : edits(std::move(edits)),
+      oldLineOffsets(oldLineOffsets),
+      currentLineOffsets(std::move(currentLineOffsets)) {}
+
+bool DocumentEditMapper::MapLocation(DocumentLocation* location) const {
+  for (const DocumentEdit& edit : edits) {
+    // Note that text inserted at the location is treated as coming before it.
+    if (*location >= edit.range.end) {
+      *location += edit.newTextSize - edit.range.size();
+    } else if (*location <= edit.range.start) {
+      continue;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DocumentEditMapper::MapRange(DocumentRange* range, bool allowEditsInside) const {
+  if (range->IsInvalid()) {
+    return true;
+  }
+  
+  for (const DocumentEdit& edit : edits) {
+    int shift = edit.newTextSize - edit.range.size();
+    if (range->end <= edit.range.start) {
+      // The edit is after the range.
+      continue;
+    } else if (range->start >= edit.range.end) {
+      // The edit is before the range.
+      range->start += shift;
+      range->end += shift;
+    } else if (allowEditsInside &&
+               range->start <= edit.range.start &&
+               range->end >= edit.range.end) {
+      range->end += shift;
+    } else {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool DocumentEditMapper::MapLine(int* line) const {
+  if (*line < 0 || *line >= oldLineOffsets.size()) {
+    return false;
+  }
+  DocumentLocation lineStart(oldLineOffsets[*line]);
+  if (!MapLocation(&lineStart)) {
+    return false;
+  }
+  *line = (std::upper_bound(currentLineOffsets.begin(), currentLineOffsets.end(), static_cast<unsigned>(lineStart.offset)) - currentLineOffsets.begin()) - 1;
+  return *line >= 0;
+}
+
+bool DocumentEditMapper::MapLineAndColumn(int* line, int column, int* offsetShift) const {
+  if (*line < 0 || *line >= oldLineOffsets.size()) {
+    return false;
+  }
+  DocumentLocation lineStart(oldLineOffsets[*line]);
+  DocumentRange linePrefix(lineStart, lineStart + column);
+  if (!MapLocation(&lineStart) ||
+      (column > 0 && !MapRange(&linePrefix, /*allowEditsInside*/ false))) {
+    return false;
+  }
+  *offsetShift = lineStart.offset - oldLineOffsets[*line];
+  *line = (std::upper_bound(currentLineOffsets.begin(), currentLineOffsets.end(), static_cast<unsigned>(lineStart.offset)) - currentLineOffsets.begin()) - 1;
+  return *line >= 0;
+}
+
+
+HighlightingBuffer::HighlightingBuffer()
+    : ranges(1) {}
+
+void HighlightingBuffer::AddHighlightRange(const DocumentRange& range, bool isNonCodeRange, const QColor& textColor, bool bold, bool affectsText, bool affectsBackground, const QColor& backgroundColor) {
+  if (range.IsInvalid() || range.IsEmpty()) {
+    return;
+  }
+  
+  ranges.emplace_back(
+      range,
+      affectsText,
+      textColor,
+      bold,
+      affectsBackground,
+      backgroundColor,
+      isNonCodeRange);
+}
+
+
 Document::Document(NewlineFormat newlineFormat, int desiredBlockSize)
     : mVersion(0),
       mSavedVersion(0),
@@ -438,6 +534,8 @@ void Document::AssignTextAndStyles(const Document& other) {
   for (int layer = 0; layer < TextBlock::kLayerCount; ++ layer) {
     mRanges[layer] = other.mRanges[layer];
   }
+  
+  ResetEditLog();
 }
 
 bool Document::Open(const QString& path) {
@@ -684,6 +782,15 @@ void Document::Replace(const DocumentRange& range, const QString& newText, bool
     qDebug() << "-------------------";
   }
   
+  // Record the edit in the edit log. Once the log gets too large, its older
+  // half is dropped.
+  constexpr int kMaxEditLogSize = 4096;
+  if (mEditLog.size() >= kMaxEditLogSize) {
+    mEditLog.erase(mEditLog.begin(), mEditLog.begin() + kMaxEditLogSize / 2);
+    mEditLogStart += kMaxEditLogSize / 2;
+  }
+  mEditLog.push_back(DocumentEdit{range, newText.size()});
+  
   int shift = newText.size() - range.size();
   DocumentLocation newRangeEnd = range.start + newText.size();
   
@@ -1422,6 +1529,9 @@ void Document::SetLineAttributes(int l, int attributes) {
 }
 
 void Document::AddLineAttributes(int l, int attributes) {
+  if (mParseResultMapper && !mParseResultMapper->MapLine(&l)) {
+    return;
+  }
   LineIterator it(this, l);
   if (it.IsValid()) {
     it.AddAttributes(attributes);
@@ -1439,8 +1549,12 @@ void Document::RemoveLineAttributes(int l, int attributes) {
   }
 }
 
-void Document::AddHighlightRange(const DocumentRange& range, bool isNonCodeRange, const QColor& textColor, bool bold, bool affectsText, bool affectsBackground, const QColor& backgroundColor, int layer) {
-  if (range.IsInvalid() || range.IsEmpty()) {
+void Document::AddHighlightRange(const DocumentRange& originalRange, bool isNonCodeRange, const QColor& textColor, bool bold, bool affectsText, bool affectsBackground, const QColor& backgroundColor, int layer) {
+  if (originalRange.IsInvalid() || originalRange.IsEmpty()) {
+    return;
+  }
+  DocumentRange range = originalRange;
+  if (mParseResultMapper && !mParseResultMapper->MapRange(&range, /*allowEditsInside*/ false)) {
     return;
   }
   
@@ -1471,20 +1585,105 @@ void Document::ClearHighlightRanges(int layer) {
   ReapplyHighlightRanges(layer);
 }
 
+void Document::ApplyHighlighting(HighlightingBuffer* highlighting, int layer) {
+  // Swap in the new ranges, keeping the default style.
+  highlighting->ranges[0] = mRanges[layer][0];
+  if (mParseResultMapper) {
+    highlighting->ranges.erase(std::remove_if(highlighting->ranges.begin() + 1, highlighting->ranges.end(), [&](HighlightRange& range) {
+      return !mParseResultMapper->MapRange(&range.range, /*allowEditsInside*/ false);
+    }), highlighting->ranges.end());
+  }
+  mRanges[layer].swap(highlighting->ranges);
+  highlighting->ranges.resize(1);
+  ReapplyHighlightRanges(layer);
+  
+  // Swap in the new contexts.
+  if (mParseResultMapper) {
+    mContexts.clear();
+    for (const Context& context : highlighting->contexts) {
+      AddContext(context.name, context.description, context.nameInDescriptionRange, context.range);
+    }
+  } else {
+    mContexts.swap(highlighting->contexts);
+  }
+  highlighting->contexts.clear();
+}
+
 void Document::FinishedHighlightingChanges() {
   emit HighlightingChanged();
 }
 
+/// Maps the location of @p item with @p mapper if the item refers to the file
+/// with the given canonical path. Returns false if the location cannot be
+/// mapped. The locations of the item's children are mapped as well, removing
+/// those children that cannot be mapped.
+static bool MapProblemItem(Problem::Item* item, const QString& canonicalPath, const DocumentEditMapper& mapper) {
+  for (auto it = item->children.begin(); it != item->children.end(); ) {
+    if (MapProblemItem(&*it, canonicalPath, mapper)) {
+      ++ it;
+    } else {
+      it = item->children.erase(it);
+    }
+  }
+  
+  if (QFileInfo(item->filePath).canonicalFilePath() != canonicalPath) {
+    return true;
+  }
+  
+  // Notice that the column counts UTF-8 bytes for libclang's diagnostics, so
+  // it may overestimate the number of characters before the location.
+  int line = static_cast<int>(item->line) - 1;
+  int offsetShift;
+  if (!mapper.MapLineAndColumn(&line, std::max(0, static_cast<int>(item->col) - 1), &offsetShift)) {
+    return false;
+  }
+  item->line = line + 1;
+  item->offset += offsetShift;
+  return true;
+}
+
 int Document::AddProblem(const std::shared_ptr<Problem>& problem) {
+  if (mParseResultMapper) {
+    // If the problem's own location has been edited, it is dropped. The next
+    // parse will report it again if it still exists.
+    QString canonicalPath = QFileInfo(path()).canonicalFilePath();
+    std::vector<Problem::Item>& items = problem->items();
+    for (auto it = items.begin(); it != items.end(); ) {
+      if (MapProblemItem(&*it, canonicalPath, *mParseResultMapper)) {
+        ++ it;
+      } else if (it == items.begin()) {
+        return -1;
+      } else {
+        it = items.erase(it);
+      }
+    }
+    
+    std::vector<Problem::FixIt>& fixits = problem->fixits();
+    fixits.erase(std::remove_if(fixits.begin(), fixits.end(), [&](Problem::FixIt& fixit) {
+      return !mParseResultMapper->MapRange(&fixit.range, /*allowEditsInside*/ false);
+    }), fixits.end());
+  }
   mProblems.push_back(problem);
   return mProblems.size() - 1;
 }
 
+void Document::MapAppendedProblemItem(Problem* problem) {
+  std::vector<Problem::Item>& items = problem->items();
+  if (mParseResultMapper && !items.empty() &&
+      !MapProblemItem(&items.back(), QFileInfo(path()).canonicalFilePath(), *mParseResultMapper)) {
+    items.pop_back();
+  }
+}
+
 void Document::AddProblemRange(int problemIndex, const DocumentRange& range) {
-  if (!range.IsValid()) {
+  if (problemIndex < 0 || !range.IsValid()) {
     return;
   }
-  mProblemRanges.insert(ProblemRange(range, problemIndex));
+  DocumentRange mappedRange = range;
+  if (mParseResultMapper && !mParseResultMapper->MapRange(&mappedRange, /*allowEditsInside*/ false)) {
+    return;
+  }
+  mProblemRanges.insert(ProblemRange(mappedRange, problemIndex));
 }
 
 void Document::RemoveProblem(const std::shared_ptr<Problem>& problem) {
@@ -1519,7 +1718,7 @@ void Document::ClearProblems() {
 
 ClangTUPool* Document::GetTUPool() {
   if (!mTUPool) {
-    mTUPool.reset(new ClangTUPool(2));
+    mTUPool.reset(new ClangTUPool(std::max(2, Settings::Instance().GetTUsPerDocument())));
   }
   return mTUPool.get();
 }
@@ -1652,6 +1851,48 @@ void Document::ClearVersionGraph() {
   versionGraphRoot = new DocumentVersion(mVersion, nullptr);
 }
 
+std::unique_ptr<DocumentEditMapper> Document::CreateEditMapper(int oldEditCount, const std::vector<unsigned>& oldLineOffsets) {
+  if (oldEditCount < mEditLogStart || oldEditCount > editCount()) {
+    return std::unique_ptr<DocumentEditMapper>();
+  }
+  
+  std::vector<unsigned> currentLineOffsets(LineCount());
+  LineIterator lineIt(this);
+  int lineIndex = 0;
+  while (lineIt.IsValid() && lineIndex < currentLineOffsets.size()) {
+    currentLineOffsets[lineIndex] = lineIt.GetLineStart().offset;
+    ++ lineIndex;
+    ++ lineIt;
+  }
+  
+  return std::unique_ptr<DocumentEditMapper>(new DocumentEditMapper(
+      std::vector<DocumentEdit>(mEditLog.begin() + (oldEditCount - mEditLogStart), mEditLog.end()),
+      oldLineOffsets,
+      std::move(currentLineOffsets)));
+}
+
+bool Document::IsTextBeforeUnchangedSince(int oldEditCount, const DocumentLocation& location) const {
+  if (oldEditCount < mEditLogStart || oldEditCount > editCount()) {
+    return false;
+  }
+  
+  // Edits that start at or after the location do not move it, so each edit
+  // can be compared to the location directly.
+  for (int i = oldEditCount - mEditLogStart; i < mEditLog.size(); ++ i) {
+    if (mEditLog[i].range.start < location) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void Document::ResetEditLog() {
+  // Advance the edit count, such that no mapper can be created for any
+  // previous edit count.
+  mEditLogStart = editCount() + 1;
+  mEditLog.clear();
+}
+
 void Document::ReadTextFromFile(QFile* file) {
   // Read lines from file
   QString fileText = QString::fromUtf8(file->readAll());  // TODO: Allow reading other formats than UTF-8 only
@@ -1685,6 +1926,8 @@ void Document::ReadTextFromFile(QFile* file) {
     setNewlineFormat(NewlineFormat::Lf);
   }
   
+  ResetEditLog();
+  
   // Convert text to blocks
   int numBlocks = std::max(1, (fileText.size() + desiredBlockSize / 2) / desiredBlockSize);
   mBlocks.resize(numBlocks);
@@ -1701,7 +1944,11 @@ void Document::ClearContexts() {
 }
 
 void Document::AddContext(const QString& name, const QString& description, const DocumentRange& nameInDescriptionRange, const DocumentRange& range) {
-  mContexts.insert(Context(name, description, nameInDescriptionRange, range));
+  DocumentRange mappedRange = range;
+  if (mParseResultMapper && !mParseResultMapper->MapRange(&mappedRange, /*allowEditsInside*/ true)) {
+    return;
+  }
+  mContexts.insert(Context(name, description, nameInDescriptionRange, mappedRange));
 }
 
 std::vector<Context> Document::GetContextsAt(const DocumentLocation& location) {
@@ -6,6 +6,7 @@
 
 #include <functional>
 #include <map>
+#include <memory>
 #include <set>
 #include <vector>
 
@@ -215,6 +216,87 @@ struct DocumentVersion {
 };
 
 
+/// A text change that is recorded in the edit log of a Document.
+struct DocumentEdit {
+  /// The range that was replaced, in the document before the edit.
+  DocumentRange range;
+  
+  /// Length of the text that the range was replaced with.
+  int newTextSize;
+};
+
+/// Maps locations, ranges, and lines from an older version of a document to
+/// the current version by transforming them through the edits that were made
+/// in between. This is used to apply parse results to a document that has been
+/// edited while the parse was running.
+class DocumentEditMapper {
+ public:
+  /// Creates a mapper for the given @p edits (in the order in which they were
+  /// made). @p oldLineOffsets and @p currentLineOffsets are the offsets of the
+  /// line starts in the old and the current version of the document; they are
+  /// only required for MapLine().
+  DocumentEditMapper(
+      std::vector<DocumentEdit>&& edits,
+      const std::vector<unsigned>& oldLineOffsets,
+      std::vector<unsigned>&& currentLineOffsets);
+  
+  /// Maps @p location to the current version. Returns false if the location
+  /// lies within a range that has been replaced.
+  bool MapLocation(DocumentLocation* location) const;
+  
+  /// Maps @p range to the current version. Returns false if the range
+  /// overlaps an edit. If @p allowEditsInside is true, edits that lie
+  /// completely within the range are allowed and grow or shrink the range.
+  /// Invalid ranges are left as they are.
+  bool MapRange(DocumentRange* range, bool allowEditsInside) const;
+  
+  /// Maps the (0-based) @p line to the current version. Returns false if the
+  /// start of the line lies within a range that has been replaced.
+  bool MapLine(int* line) const;
+  
+  /// Maps the position at the (0-based) @p line and the (0-based) @p column to
+  /// the current version. The column must stay the same for this, so this
+  /// returns false if the text between the line start and the position has
+  /// been edited. Otherwise, @p offsetShift is set to the number of characters
+  /// by which the position moved.
+  bool MapLineAndColumn(int* line, int column, int* offsetShift) const;
+  
+ private:
+  std::vector<DocumentEdit> edits;
+  std::vector<unsigned> oldLineOffsets;
+  std::vector<unsigned> currentLineOffsets;
+};
+
+
+/// Highlight ranges and contexts that are collected outside of a Document,
+/// such that this can be done in a background thread. They are then applied
+/// to the document at once with Document::ApplyHighlighting().
+class HighlightingBuffer {
+ friend class Document;
+ public:
+  HighlightingBuffer();
+  
+  /// Analogous to Document::AddHighlightRange().
+  void AddHighlightRange(const DocumentRange& range, bool isNonCodeRange, const QColor& textColor, bool bold, bool affectsText = true, bool affectsBackground = false, const QColor& backgroundColor = qRgb(255, 255, 255));
+  inline void AddHighlightRange(const DocumentRange& range, bool isNonCodeRange, const Settings::ConfigurableTextStyle& style) {
+    AddHighlightRange(range, isNonCodeRange, style.textColor, style.bold, style.affectsText, style.affectsBackground, style.backgroundColor);
+  }
+  
+  /// Analogous to Document::AddContext().
+  inline void AddContext(const QString& name, const QString& description, const DocumentRange& nameInDescriptionRange, const DocumentRange& range) {
+    contexts.insert(Context(name, description, nameInDescriptionRange, range));
+  }
+  
+ private:
+  /// The highlight ranges. The first element is a placeholder for the default
+  /// style of the document, such that the vector can be swapped into the
+  /// document without re-allocation.
+  std::vector<HighlightRange> ranges;
+  
+  std::set<Context> contexts;
+};
+
+
 /// A text document.
 class Document : public QObject {
  Q_OBJECT
@@ -473,6 +555,31 @@ class Document : public QObject {
   /// from when the document was last accessed.
   inline int version() const { return mVersion; }
   
+  /// Returns the number of text edits that have been made to the document.
+  /// Unlike version(), this is never decreased by undo steps.
+  inline int editCount() const { return mEditLogStart + mEditLog.size(); }
+  
+  /// Creates a mapper from the document state at the time editCount() returned
+  /// @p oldEditCount to the current state. @p oldLineOffsets must be the
+  /// offsets of the line starts at that time. Returns null if the edits are not
+  /// available anymore (only a limited number of edits is stored, and the
+  /// document might have been re-loaded from disk in the meantime).
+  std::unique_ptr<DocumentEditMapper> CreateEditMapper(int oldEditCount, const std::vector<unsigned>& oldLineOffsets);
+  
+  /// Returns true if all edits made since editCount() returned @p oldEditCount
+  /// start at or after @p location, i.e., the text before @p location did not
+  /// change. Returns false if the edits are not available anymore.
+  bool IsTextBeforeUnchangedSince(int oldEditCount, const DocumentLocation& location) const;
+  
+  /// Sets a mapper that is applied to the lines given to AddLineAttributes(),
+  /// and to the ranges given to AddHighlightRange(), ApplyHighlighting(),
+  /// AddProblem() (for the fix-its), AddProblemRange(), and AddContext(). Everything that cannot be
+  /// mapped is dropped. This allows to apply parse results to the document that
+  /// refer to an older version of it. Pass null to unset the mapper. The mapper
+  /// is not owned by the document.
+  inline void SetParseResultMapper(const DocumentEditMapper* mapper) { mParseResultMapper = mapper; }
+  inline const DocumentEditMapper* GetParseResultMapper() const { return mParseResultMapper; }
+  
   /// Highlight ranges.
   void AddHighlightRange(const DocumentRange& range, bool isNonCodeRange, const QColor& textColor, bool bold, bool affectsText = true, bool affectsBackground = false, const QColor& backgroundColor = qRgb(255, 255, 255), int layer = 0);
   inline void AddHighlightRange(const DocumentRange& range, bool isNonCodeRange, const Settings::ConfigurableTextStyle& style, int layer = 0) {
@@ -480,13 +587,26 @@ class Document : public QObject {
   }
   void ClearHighlightRanges(int layer);
   inline std::vector<HighlightRange>& GetHighlightRanges(int layer) { return mRanges[layer]; }
+  /// Replaces all highlight ranges in the given layer and all contexts with
+  /// those in @p highlighting. This is faster than clearing them and adding
+  /// the new ranges one by one. Afterwards, @p highlighting is empty.
+  void ApplyHighlighting(HighlightingBuffer* highlighting, int layer);
   /// To be called after adding/clearing highlight ranges.
   void FinishedHighlightingChanges();
   
   // Problems.
   /// Adds a problem to the document. Returns the problem index. Note that the
-  /// indices become invalid when using RemoveProblem().
+  /// indices become invalid when using RemoveProblem(). If a parse result
+  /// mapper is set, the locations of the problem's items are mapped with it,
+  /// and the problem is not added if its location has been edited. Then, -1 is
+  /// returned, which may be passed to AddProblemRange().
   int AddProblem(const std::shared_ptr<Problem>& problem);
+  
+  /// Maps the location of the last item of @p problem with the parse result
+  /// mapper (if set). This must be used for items that are appended to the
+  /// problem after adding it with AddProblem(). The item is removed if its
+  /// location has been edited.
+  void MapAppendedProblemItem(Problem* problem);
   void AddProblemRange(int problemIndex, const DocumentRange& range);
   void RemoveProblem(const std::shared_ptr<Problem>& problem);
   void ClearProblems();
@@ -543,6 +663,10 @@ class Document : public QObject {
   /// Deletes all non-root nodes in the version graph.
   void ClearVersionGraph();
   
+  /// Clears the edit log such that no mappers can be created for the previous
+  /// edits. Used if the whole text gets replaced.
+  void ResetEditLog();
+  
   /// Reads the document text from the given open file and converts it to blocks.
   void ReadTextFromFile(QFile* file);
   
@@ -609,6 +733,17 @@ class Document : public QObject {
   /// Used for accumulating undo steps if creatingCombinedUndoStep is true.
   std::vector<Replacement> combinedUndoReplacements;
   
+  /// The most recent text edits, used for creating DocumentEditMappers. Note
+  /// that the version graph cannot be used for this, since merging undo steps
+  /// drops the intermediate versions.
+  std::vector<DocumentEdit> mEditLog;
+  
+  /// The edit count corresponding to the first edit in mEditLog.
+  int mEditLogStart = 0;
+  
+  /// See SetParseResultMapper(). Not owned.
+  const DocumentEditMapper* mParseResultMapper = nullptr;
+  
   /// Translation unit pool for parsing with libclang.
   std::unique_ptr<ClangTUPool> mTUPool;
   
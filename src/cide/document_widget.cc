@@ -33,6 +33,7 @@
 #include "cide/scroll_bar_minimap.h"
 #include "cide/settings.h"
 #include "cide/text_utils.h"
+#include "cide/tracing.h"
 #include "cide/util.h"
 
 
@@ -181,6 +182,14 @@ DocumentWidget::DocumentWidget(const std::shared_ptr<Document>& document, Docume
     
     codeInfoRequestRect = GetTextRect(GetWordForCharacter(offset));
     
+    // Hovering over a token again is answered from the cache, unless the
+    // document was edited or reparsed in the meantime.
+    const CodeInfoCacheEntry* cachedInfo = codeInfoCache.Lookup(DocumentLocation(offset), document->GetTUPool()->GetLatestParseStamp(), document->editCount());
+    if (cachedInfo) {
+      SetCodeTooltip(cachedInfo->tokenRange, cachedInfo->htmlString, cachedInfo->helpUrl, cachedInfo->referenceRanges);
+      return;
+    }
+    
     CodeInfo::Instance().RequestCodeInfo(this, DocumentLocation(offset));
   });
   
@@ -496,7 +505,7 @@ void DocumentWidget::CloseCodeCompletion() {
   codeCompletionInvocationLocation = DocumentLocation::Invalid();
 }
 
-void DocumentWidget::ShowCodeCompletion(DocumentLocation invocationLocation, std::vector<CompletionItem>&& items, CXCodeCompleteResults* libclangResults) {
+void DocumentWidget::ShowCodeCompletion(DocumentLocation invocationLocation, std::vector<CompletionItem>&& items, const std::shared_ptr<CXCodeCompleteResults>& libclangResults) {
   if (codeCompletionInvocationLocation.IsInvalid()) {
     qDebug() << "ShowCodeCompletion(): codeCompletionInvocationLocation is invalid";
     return;
@@ -514,13 +523,60 @@ void DocumentWidget::ShowCodeCompletion(DocumentLocation invocationLocation, std
   
   // Open the new widget.
   QPoint invocationPoint = GetTextRect(DocumentRange(invocationLocation, invocationLocation)).bottomLeft() + QPoint(0, 1);
-  // NOTE: Ownership of "results" is passed on to the widget here.
   codeCompletionWidget = new CodeCompletionWidget(std::move(items), libclangResults, invocationPoint, this);
   connect(codeCompletionWidget, &CodeCompletionWidget::Accepted, this, &DocumentWidget::AcceptCodeCompletion);
   codeCompletionWidget->SetFilterText(document->TextForRange(DocumentRange(codeCompletionInvocationLocation, cursorLoc)));
   codeCompletionWidget->show();
 }
 
+void DocumentWidget::CacheCodeCompletion(DocumentLocation invocationLocation, int editCount, std::vector<CompletionItem>&& items, const std::shared_ptr<CXCodeCompleteResults>& libclangResults, std::vector<ArgumentHintItem>&& hints, int currentParameter) {
+  cachedCodeCompletionLocation = invocationLocation;
+  cachedCodeCompletionEditCount = editCount;
+  cachedCompletionItems = std::move(items);
+  cachedCompletionResults = libclangResults;
+  cachedArgumentHints = std::move(hints);
+  cachedArgumentHintCurrentParameter = currentParameter;
+}
+
+bool DocumentWidget::HaveCachedCodeCompletion(DocumentLocation invocationLocation) const {
+  return cachedCompletionResults &&
+         cachedCodeCompletionLocation == invocationLocation &&
+         document->IsTextBeforeUnchangedSince(cachedCodeCompletionEditCount, invocationLocation);
+}
+
+void DocumentWidget::ShowCachedCodeCompletion() {
+  if (cachedCompletionResults->NumResults == 0) {
+    CloseCodeCompletion();
+    return;
+  }
+  
+  // The items are copied since the widget modifies them while filtering.
+  if (cachedCompletionItems.empty()) {
+    CloseCodeCompletion();
+  } else {
+    ShowCodeCompletion(cachedCodeCompletionLocation, std::vector<CompletionItem>(cachedCompletionItems), cachedCompletionResults);
+  }
+  
+  if (cachedArgumentHints.empty()) {
+    CloseArgumentHint();
+  } else {
+    // The cached current-parameter index from libclang is only used if the
+    // document did not change since. Otherwise, it may not fit the current
+    // text anymore (the cache only checks the text before the invocation
+    // location), so it is re-determined from the text.
+    if (document->editCount() == cachedCodeCompletionEditCount) {
+      ShowArgumentHint(cachedCodeCompletionLocation, std::vector<ArgumentHintItem>(cachedArgumentHints), cachedArgumentHintCurrentParameter);
+    } else {
+      int currentParameter = FindCurrentParameter(cachedCodeCompletionLocation);
+      if (currentParameter < 0) {
+        CloseArgumentHint();
+      } else {
+        ShowArgumentHint(cachedCodeCompletionLocation, std::vector<ArgumentHintItem>(cachedArgumentHints), currentParameter);
+      }
+    }
+  }
+}
+
 void DocumentWidget::CodeCompletionRequestWasDiscarded() {
   // Set the invocation location to invalid in order not to expect
   // getting code completion results anymore. This enables making
@@ -1206,6 +1262,18 @@ void DocumentWidget::SetReparseOnNextActivation() {
 
 void DocumentWidget::InvokeCodeCompletion() {
   ++ codeCompletionInvocationCounter;
+  
+  // If the completion was computed for the same location before, and the text
+  // before it did not change since, re-use the cached results instead of
+  // invoking libclang again. Only the filtering has to be re-done then.
+  DocumentLocation invocationLocation = CodeInfo::FindCodeCompletionInvocationLocation(this);
+  if (HaveCachedCodeCompletion(invocationLocation)) {
+    codeCompletionInvocationLocation = invocationLocation;
+    argumentHintInvocationLocation = invocationLocation;
+    ShowCachedCodeCompletion();
+    return;
+  }
+  
   codeCompletionInvocationLocation = CodeInfo::Instance().RequestCodeCompletion(this);
   argumentHintInvocationLocation = codeCompletionInvocationLocation;
 }
@@ -2273,6 +2341,34 @@ void DocumentWidget::UpdateArgumentHintWidget(const DocumentRange& range, bool a
   }
 }
 
+int DocumentWidget::FindCurrentParameter(DocumentLocation location) const {
+  // TODO: As in UpdateArgumentHintWidget(), commas within template argument
+  //       lists are not handled.
+  int numCommas = 0;
+  int depth = 0;
+  Document::CharacterAndStyleIterator charIt(document.get(), location.offset);
+  -- charIt;
+  while (charIt.IsValid()) {
+    if (!charIt.GetStyleOfLayer(0).isNonCodeRange) {
+      QChar character = charIt.GetChar();
+      if (character == ')' || character == ']' || character == '}') {
+        ++ depth;
+      } else if (character == '(' || character == '[' || character == '{') {
+        if (depth == 0) {
+          return (character == '(') ? numCommas : -1;
+        }
+        -- depth;
+      } else if (character == ';' && depth == 0) {
+        return -1;
+      } else if (character == ',' && depth == 0) {
+        ++ numCommas;
+      }
+    }
+    -- charIt;
+  }
+  return -1;
+}
+
 void DocumentWidget::TabPressed(bool shiftHeld) {
   auto project = mainWindow->GetCurrentProject();
   
@@ -2630,6 +2726,7 @@ void DocumentWidget::resizeEvent(QResizeEvent* /*event*/) {
 }
 
 void DocumentWidget::paintEvent(QPaintEvent* event) {
+  CIDE_TRACE_SPAN("DocumentWidget::paintEvent");
   auto& settings = Settings::Instance();
   
   QRgb editorBackgroundColor = settings.GetConfiguredColor(Settings::Color::EditorBackground);
@@ -3414,8 +3511,18 @@ void DocumentWidget::keyPressEvent(QKeyEvent* event) {
       // qDebug() << "Considering code completion invocation. widget:" << codeCompletionWidget
       //          << ", inv-loc is valid:" << codeCompletionInvocationLocation.IsValid()
       //          << ", codeCompletionWasOpen:" << codeCompletionWasOpen;
+      // After a member access or scope operator (".", "->", "::"), the request
+      // is always made, also if a completion was open before, such that the
+      // results are (being) computed in the background while the member name
+      // is typed. They are cached, so they can also be re-used if completion
+      // is invoked at this location again.
+      bool isAfterScopeOperator = false;
+      if (text[0] == ':') {
+        DocumentLocation cursorLoc = MapCursorToDocument();
+        isAfterScopeOperator = cursorLoc.offset >= 2 && document->TextForRange(DocumentRange(cursorLoc - 2, cursorLoc)) == QStringLiteral("::");
+      }
       if (!(codeCompletionWidget || codeCompletionInvocationLocation.IsValid()) &&
-          (!codeCompletionWasOpen || (text[0] == '>') || (text[0] == '(')  || (text[0] == '.')  || (text[0] == '['))) {
+          (!codeCompletionWasOpen || (text[0] == '>') || (text[0] == '(')  || (text[0] == '.')  || (text[0] == '[') || isAfterScopeOperator)) {
         bool invokeCodeCompletion =
             !text[0].isSpace() &&
             text[0] != '\n' &&
@@ -12,6 +12,7 @@
 
 #include "cide/argument_hint_widget.h"
 #include "cide/code_completion_widget.h"
+#include "cide/code_info_cache.h"
 #include "cide/document.h"
 #include "cide/document_location.h"
 #include "cide/document_range.h"
@@ -116,9 +117,24 @@ class DocumentWidget : public QWidget {
   /// Closes the code completion widget (in case it is open).
   void CloseCodeCompletion();
   
-  /// Shows the code completion widget. To be called after the code completion
-  /// thread finishes.
-  void ShowCodeCompletion(DocumentLocation invocationLocation, std::vector<CompletionItem>&& items, CXCodeCompleteResults* libclangResults);
+  /// Shows the code completion widget.
+  void ShowCodeCompletion(DocumentLocation invocationLocation, std::vector<CompletionItem>&& items, const std::shared_ptr<CXCodeCompleteResults>& libclangResults);
+  
+  /// Stores code completion results for @p invocationLocation in the
+  /// completion cache, replacing the previously cached results. @p editCount
+  /// must be the document's editCount() at the time its text was passed to
+  /// libclang. To be called after the code completion thread finishes, also if
+  /// the results are outdated.
+  void CacheCodeCompletion(DocumentLocation invocationLocation, int editCount, std::vector<CompletionItem>&& items, const std::shared_ptr<CXCodeCompleteResults>& libclangResults, std::vector<ArgumentHintItem>&& hints, int currentParameter);
+  
+  /// Returns whether the completion cache contains results for
+  /// @p invocationLocation, and the text before this location did not change
+  /// since they were computed.
+  bool HaveCachedCodeCompletion(DocumentLocation invocationLocation) const;
+  
+  /// Shows the code completion and argument hint widgets for the cached
+  /// results.
+  void ShowCachedCodeCompletion();
   
   /// This is called by the CodeInfo class if it discards a code completion request
   /// after it was initially made successfully. This happens when a higher-priority
@@ -146,6 +162,9 @@ class DocumentWidget : public QWidget {
   
   inline int GetCodeCompletionInvocationCounter() const { return codeCompletionInvocationCounter; }
   
+  /// Returns the cache for the code info results of hovered tokens.
+  inline CodeInfoCache* GetCodeInfoCache() { return &codeInfoCache; }
+  
   inline const std::shared_ptr<Document> GetDocument() const { return document; }
   inline DocumentWidgetContainer* GetContainer() const { return container; }
   inline MainWindow* GetMainWindow() const { return mainWindow; }
@@ -293,6 +312,11 @@ class DocumentWidget : public QWidget {
   /// that is highlighted in the argument hint widget, or to close the widget.
   void UpdateArgumentHintWidget(const DocumentRange& range, bool afterwards);
   
+  /// Determines the index of the function call argument at @p location by
+  /// counting the commas between the enclosing '(' and the location. Returns
+  /// -1 if the location does not seem to be within a function call.
+  int FindCurrentParameter(DocumentLocation location) const;
+  
   void TabPressed(bool shiftHeld);
   
   void BookmarksChanged();
@@ -355,6 +379,8 @@ class DocumentWidget : public QWidget {
   QFrame* tooltipProblemsFrame;
   
   QRect codeInfoRequestRect;
+  /// Code info results of hovered tokens.
+  CodeInfoCache codeInfoCache;
   QString tooltipCodeHtml;
   QLabel* tooltipCodeHtmlLabel;
   QScrollArea* tooltipCodeHtmlScrollArea;
@@ -388,6 +414,13 @@ class DocumentWidget : public QWidget {
   /// Counter that can be used by the completion thread to identify cases where
   /// its completion results are outdated.
   int codeCompletionInvocationCounter = 0;
+  /// Results of the last code completion request, see CacheCodeCompletion().
+  DocumentLocation cachedCodeCompletionLocation = DocumentLocation::Invalid();
+  int cachedCodeCompletionEditCount;
+  std::vector<CompletionItem> cachedCompletionItems;
+  std::shared_ptr<CXCodeCompleteResults> cachedCompletionResults;
+  std::vector<ArgumentHintItem> cachedArgumentHints;
+  int cachedArgumentHintCurrentParameter;
   
   // Argument hint.
   ArgumentHintWidget* argumentHintWidget = nullptr;
@@ -4,6 +4,10 @@
 
 #include "cide/find_and_replace_in_files.h"
 
+#include <algorithm>
+#include <cstring>
+#include <unordered_set>
+
 #include <QDialog>
 #include <QDialogButtonBox>
 #include <QDockWidget>
@@ -12,12 +16,35 @@
 #include <QLineEdit>
 #include <QMessageBox>
 #include <QMouseEvent>
-#include <QProgressDialog>
 #include <QPushButton>
+#include <QTimer>
 #include <QTreeWidget>
 
 #include "cide/main_window.h"
 #include "cide/settings.h"
+#include "cide/text_utils.h"
+#include "cide/util.h"
+
+/// Files that are larger than this are not searched, such that the memory
+/// used by each search thread stays bounded (the files are read into memory
+/// as a whole). Such files are usually not text files anyway, for example
+/// git pack files or build artifacts.
+constexpr qint64 kMaxSearchFileSize = 64 * 1024 * 1024;
+
+
+/// Returns the number of UTF-16 code units that the given UTF-8 text decodes to.
+static int CountUTF16CodeUnits(const char* data, qint64 size) {
+  int count = 0;
+  for (qint64 i = 0; i < size; ++ i) {
+    unsigned char c = data[i];
+    if ((c & 0xC0) != 0x80) {
+      // Lead byte. Four-byte sequences encode characters outside of the BMP,
+      // which take a surrogate pair in UTF-16.
+      count += (c >= 0xF0) ? 2 : 1;
+    }
+  }
+  return count;
+}
 
 
 class LabelWithClickedSignal : public QLabel {
@@ -39,6 +66,15 @@ class LabelWithClickedSignal : public QLabel {
 };
 
 
+FindAndReplaceInFiles::~FindAndReplaceInFiles() {
+  // Only stop the search threads here, since the widgets might have been
+  // destroyed already.
+  if (searchThread.joinable()) {
+    cancelSearch = true;
+    searchThread.join();
+  }
+}
+
 QAction* FindAndReplaceInFiles::Initialize(MainWindow* mainWindow) {
   this->mainWindow = mainWindow;
   
@@ -63,6 +99,9 @@ void FindAndReplaceInFiles::CreateDockWidget() {
   findAndReplaceEdit->setMinimumWidth(400);
   findAndReplaceReplaceButton = new QPushButton(tr("Replace"));
   connect(findAndReplaceReplaceButton, &QPushButton::clicked, this, &FindAndReplaceInFiles::ReplaceClicked);
+  findAndReplaceCancelButton = new QPushButton(tr("Cancel search"));
+  findAndReplaceCancelButton->setVisible(false);
+  connect(findAndReplaceCancelButton, &QPushButton::clicked, this, &FindAndReplaceInFiles::CancelSearch);
   
   findAndReplaceResultsTree = new QTreeWidget();
   findAndReplaceResultsTree->setColumnCount(1);
@@ -77,6 +116,7 @@ void FindAndReplaceInFiles::CreateDockWidget() {
   QHBoxLayout* topLayout = new QHBoxLayout();
   topLayout->setContentsMargins(0, 0, 0, 0);
   topLayout->addWidget(findAndReplaceResultsLabel, 1);
+  topLayout->addWidget(findAndReplaceCancelButton);
   topLayout->addWidget(findAndReplaceReplacementLabel);
   topLayout->addWidget(findAndReplaceEdit);
   topLayout->addWidget(findAndReplaceReplaceButton);
@@ -98,6 +138,11 @@ void FindAndReplaceInFiles::ShowDialog(const QString& initialPath) {
     return;
   }
   
+  // Cancel a previous search that might still be running. This must be done
+  // before running any event loop, since the results of the previous search
+  // must not be displayed with the new search settings.
+  CancelSearch();
+  
   if (!findAndReplaceInFilesDock) {
     CreateDockWidget();
   } else if (!findAndReplaceInFilesDock->isVisible()) {
@@ -109,95 +154,127 @@ void FindAndReplaceInFiles::ShowDialog(const QString& initialPath) {
     QMessageBox::warning(mainWindow, tr("Find in files"), tr("Search directory does not exist."));
     return;
   }
+  if (findText.isEmpty()) {
+    QMessageBox::warning(mainWindow, tr("Find in files"), tr("The text to search for is empty."));
+    return;
+  }
   
-  findAndReplaceResultsTree->clear();
   findAndReplaceEdit->setEnabled(false);
   findAndReplaceReplaceButton->setEnabled(false);
+  findAndReplaceResultsTree->clear();
+  findAndReplaceCancelButton->setVisible(true);
+  findAndReplaceResultsLabel->setText(tr("Collecting files to search in ..."));
+  filesWithOccurrencesPaths.clear();
   
-  QProgressDialog progress(tr("Searching in files..."), "Abort", 0, 0, mainWindow);
-  progress.setWindowModality(Qt::WindowModal);
-  progress.setMinimumDuration(200);
+  // Open documents are searched in their current state, which might differ
+  // from the files on disk. Since the documents may only be accessed in the Qt
+  // thread, take a snapshot of their text for the search threads.
+  openDocumentTexts.clear();
+  for (int i = 0; i < mainWindow->GetNumDocuments(); ++ i) {
+    std::shared_ptr<Document> document = mainWindow->GetDocument(i);
+    openDocumentTexts[QFileInfo(document->path()).canonicalFilePath()] = document->GetDocumentText().toUtf8();
+  }
   
-  // Count the number of files to search in to be able to show a progress estimate.
-  // Also cache all the paths to the files to avoid iterating over the directories again.
-  int numFilesToSearch = 0;
-  filePaths.clear();
-  filesWithOccurrencesPaths.clear();
+  searchStartDir = startDir;
+  searchStartTime = std::chrono::steady_clock::now();
+  numOccurrences = 0;
+  cancelSearch = false;
+  searchFinished = false;
+  numFilesToSearch = 0;
+  numFilesSearched = 0;
+  numFilesSkipped = 0;
+  
+  // The search thread gets its own copies of the search settings, since these
+  // attributes are overwritten when the search dialog is shown again. It uses
+  // as many threads as the ParseThreadPool.
+  searchThread = std::thread(&FindAndReplaceInFiles::SearchThreadMain, this, startDir, findText, caseSensitivity, Settings::Instance().GetParseThreadCount());
+  
+  if (!searchResultsTimer) {
+    searchResultsTimer = new QTimer(this);
+    connect(searchResultsTimer, &QTimer::timeout, this, &FindAndReplaceInFiles::ProcessSearchResults);
+  }
+  searchResultsTimer->start(100);
+}
+
+void FindAndReplaceInFiles::CancelSearch() {
+  if (!searchThread.joinable()) {
+    return;
+  }
   
-  std::vector<QDir> doneList;
-  std::vector<QDir> workList = {startDir};
-  while (!workList.empty()) {
-    qDebug() << "workList iteration (size: " << workList.size() << ")";
-    progress.setValue(0);
-    // According to the documentation of QProgressDialog, it should call processEvents()
-    // itself during setValue() if set to modal, but that does not seem to be the case,
-    // at least if the progress dialog has an unspecified maximum value (maximum set to 0).
-    // Probably this is because the progress value always stays at 0 then.
-    QCoreApplication::processEvents();
-    if (progress.wasCanceled()) {
-      findAndReplaceResultsLabel->setText(tr("Search canceled."));
-      return;
-    }
-    
-    QDir dir = workList.back();
-    workList.pop_back();
-    doneList.push_back(dir);
-    
-    for (const QFileInfo& fileInfo : dir.entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Readable | QDir::Hidden)) {
-      if (fileInfo.isDir()) {
-        // Add this directory to the list of directories to search in if we did
-        // not visit it yet (which might be the case if there was a symlink).
-        bool alreadyVisited = false;
-        QDir childDir(fileInfo.filePath());
-        for (const QDir& doneDir : doneList) {
-          if (doneDir == childDir) {
-            alreadyVisited = true;
-            break;
-          }
-        }
-        if (!alreadyVisited) {
-          workList.push_back(childDir);
-        }
-      } else {
-        ++ numFilesToSearch;
-        filePaths.push_back(fileInfo.filePath());
-      }
-    }
+  // The search threads never wait for the Qt thread, so they can be joined
+  // here directly.
+  cancelSearch = true;
+  searchThread.join();
+  searchResultsTimer->stop();
+  
+  // Show the results that were found until the search was canceled.
+  std::vector<FileResult> results;
+  std::unique_lock<std::mutex> lock(resultsMutex);
+  results.swap(pendingResults);
+  lock.unlock();
+  for (const FileResult& result : results) {
+    AddFileResult(result);
   }
   
-  progress.setMaximum(numFilesToSearch);
+  openDocumentTexts.clear();
+  findAndReplaceCancelButton->setVisible(false);
+  findAndReplaceResultsLabel->setText(tr("Search canceled. Found %1 occurrences in %2 files (replacing only affects these).").arg(numOccurrences).arg(filesWithOccurrencesPaths.size()) + SkippedFilesText());
   
-  // Perform the actual search.
-  QTreeWidgetItem* lastFileItem = nullptr;
-  QString lastFilePath;
-  int numFilesSearched = 0;
-  int numOccurrences = 0;
-  int occurrencesInFile = 0;
+  // Replacing is possible for the occurrences found so far.
+  findAndReplaceEdit->setEnabled(true);
+  findAndReplaceReplaceButton->setEnabled(true);
+}
+
+QString FindAndReplaceInFiles::SkippedFilesText() const {
+  int filesSkipped = numFilesSkipped;
+  if (filesSkipped == 0) {
+    return QString();
+  }
+  return tr(" Skipped %1 files larger than %2 MiB.").arg(filesSkipped).arg(kMaxSearchFileSize / (1024 * 1024));
+}
+
+void FindAndReplaceInFiles::ProcessSearchResults() {
+  if (!searchThread.joinable()) {
+    return;
+  }
   
-  for (const QString& filePath : filePaths) {
-    progress.setValue(numFilesSearched);
-    if (progress.wasCanceled()) {
-      findAndReplaceResultsLabel->setText(tr("Search canceled."));
-      return;
-    }
-    
-    ++ numFilesSearched;
-    
-    Document* fileDocument;
-    DocumentWidget* fileWidget;
-    if (mainWindow->GetDocumentAndWidgetForPath(filePath, &fileDocument, &fileWidget)) {
-      SearchInDocument(fileDocument, startDir, filePath, lastFileItem, lastFilePath, occurrencesInFile, numOccurrences);
-    } else {
-      SearchInFile(startDir, filePath, lastFileItem, lastFilePath, occurrencesInFile, numOccurrences);
-    }
+  // Read the finished flag before fetching the results, such that all results
+  // are fetched if the search is finished.
+  bool finished = searchFinished;
+  
+  std::vector<FileResult> results;
+  std::unique_lock<std::mutex> lock(resultsMutex);
+  results.swap(pendingResults);
+  lock.unlock();
+  
+  for (const FileResult& result : results) {
+    AddFileResult(result);
   }
-  if (lastFileItem) {
-    SetLastFileItem(startDir, lastFileItem, lastFilePath, occurrencesInFile);
+  
+  if (finished) {
+    searchThread.join();
+    searchResultsTimer->stop();
+    openDocumentTexts.clear();
+    
+    findAndReplaceCancelButton->setVisible(false);
+    findAndReplaceResultsLabel->setText(tr("Found %1 occurrences of %2 in %3.").arg(numOccurrences).arg(findText).arg(searchFolderPath) + SkippedFilesText());
+    findAndReplaceEdit->setEnabled(true);
+    findAndReplaceReplaceButton->setEnabled(true);
+    return;
   }
   
-  findAndReplaceResultsLabel->setText(tr("Found %1 occurrences of %2 in %3.").arg(numOccurrences).arg(findText).arg(searchFolderPath));
-  findAndReplaceEdit->setEnabled(true);
-  findAndReplaceReplaceButton->setEnabled(true);
+  int filesToSearch = numFilesToSearch;
+  if (filesToSearch == 0) {
+    return;
+  }
+  int filesSearched = numFilesSearched;
+  double elapsedSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - searchStartTime).count();
+  findAndReplaceResultsLabel->setText(
+      tr("Searching ... %1 / %2 files (%3 files/s), found %4 occurrences")
+          .arg(filesSearched)
+          .arg(filesToSearch)
+          .arg(static_cast<int>(filesSearched / std::max(elapsedSeconds, 1e-3)))
+          .arg(numOccurrences));
 }
 
 bool FindAndReplaceInFiles::ShowDialogInternal(const QString initialPath) {
@@ -316,138 +393,225 @@ void FindAndReplaceInFiles::ShowDialogWithDefaultSettings() {
   ShowDialog();
 }
 
-void FindAndReplaceInFiles::SetLastFileItem(const QDir& startDir, QTreeWidgetItem* lastFileItem, QString lastFilePath, int occurrencesInFile) {
-  findAndReplaceResultsTree->setItemWidget(
-      lastFileItem, 0,
-      new QLabel(QStringLiteral("<b>%1</b>: %2 matches").arg(startDir.relativeFilePath(lastFilePath).toHtmlEscaped()).arg(occurrencesInFile)));
+void FindAndReplaceInFiles::SearchThreadMain(QDir startDir, QString findText, Qt::CaseSensitivity caseSensitivity, int threadCount) {
+  std::vector<QString> filePaths;
+  if (!CollectFilePaths(startDir, &filePaths)) {
+    searchFinished = true;
+    return;
+  }
+  numFilesToSearch = filePaths.size();
+  
+  UTF8TextSearcher searcher(findText, caseSensitivity);
+  
+  ParallelFor(filePaths.size(), threadCount, [&]() { return static_cast<bool>(cancelSearch); }, [&](int pathIndex) {
+    FileResult result;
+    SearchInFile(filePaths[pathIndex], searcher, findText, caseSensitivity, &result);
+    if (!result.lines.empty()) {
+      std::unique_lock<std::mutex> lock(resultsMutex);
+      pendingResults.push_back(std::move(result));
+    }
+    
+    ++ numFilesSearched;
+  });
+  
+  searchFinished = true;
 }
 
-void FindAndReplaceInFiles::SearchInDocument(Document* document, const QDir& startDir, const QString& filePath, QTreeWidgetItem*& lastFileItem, QString& lastFilePath, int& occurrencesInFile, int& numOccurrences) {
-  bool haveOccurrenceInFile = false;
-  QTreeWidgetItem* lastLineItem = nullptr;
-  std::vector<int> occurrenceColumns;  // zero-based
-  int line = 0;  // one-based
-  
-  Document::LineIterator lineIt(document);
-  while (lineIt.IsValid()) {
-    ++ line;
-    QString lineText = document->TextForRange(lineIt.GetLineRange());
-    ++ lineIt;
+bool FindAndReplaceInFiles::CollectFilePaths(const QDir& startDir, std::vector<QString>* paths) {
+  // Canonical paths of the directories that were visited already, to prevent
+  // visiting directories twice if there are symlinks.
+  std::unordered_set<QString> visitedDirs = {startDir.canonicalPath()};
+  std::vector<QDir> workList = {startDir};
+  while (!workList.empty()) {
+    if (cancelSearch) {
+      return false;
+    }
+    
+    QDir dir = workList.back();
+    workList.pop_back();
     
-    SearchInLine(
-        line,
-        lineText,
-        haveOccurrenceInFile,
-        lastLineItem,
-        occurrenceColumns,
-        startDir,
-        filePath,
-        lastFileItem,
-        lastFilePath,
-        occurrencesInFile,
-        numOccurrences);
+    for (const QFileInfo& fileInfo : dir.entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Readable | QDir::Hidden)) {
+      if (fileInfo.isDir()) {
+        if (visitedDirs.insert(fileInfo.canonicalFilePath()).second) {
+          workList.push_back(QDir(fileInfo.filePath()));
+        }
+      } else {
+        paths->push_back(fileInfo.filePath());
+      }
+    }
   }
+  return true;
 }
 
-void FindAndReplaceInFiles::SearchInFile(const QDir& startDir, const QString& filePath, QTreeWidgetItem*& lastFileItem, QString& lastFilePath, int& occurrencesInFile, int& numOccurrences) {
+void FindAndReplaceInFiles::SearchInFile(const QString& filePath, const UTF8TextSearcher& searcher, const QString& findText, Qt::CaseSensitivity caseSensitivity, FileResult* result) {
+  result->path = filePath;
+  
+  if (!openDocumentTexts.empty()) {
+    auto it = openDocumentTexts.find(QFileInfo(filePath).canonicalFilePath());
+    if (it != openDocumentTexts.end()) {
+      SearchInText(it->second.constData(), it->second.size(), searcher, findText, caseSensitivity, result);
+      return;
+    }
+  }
+  
   QFile file(filePath);
-  if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
+  if (!file.open(QIODevice::ReadOnly)) {
     return;
   }
   
-  bool haveOccurrenceInFile = false;
-  QTreeWidgetItem* lastLineItem = nullptr;
-  std::vector<int> occurrenceColumns;  // zero-based
-  int line = 0;  // one-based
-  
-  // TODO: Do not process the file line by line to allow for find texts that span multiple lines
-  while (!file.atEnd()) {
-    ++ line;
-    QString lineText = QString::fromUtf8(file.readLine());  // TODO: Allow reading other formats than UTF-8 only
-    
-    SearchInLine(
-        line,
-        lineText,
-        haveOccurrenceInFile,
-        lastLineItem,
-        occurrenceColumns,
-        startDir,
-        filePath,
-        lastFileItem,
-        lastFilePath,
-        occurrencesInFile,
-        numOccurrences);
+  // Read the whole file with a single large read. Memory-mapping is not used,
+  // since accessing a mapping of a file that gets truncated while it is being
+  // searched raises SIGBUS. A file that changes during the read is simply
+  // searched in the state that was read. Special files might report a size of
+  // zero, so the size is only used to skip large files early; the read itself
+  // is limited to kMaxSearchFileSize + 1 bytes to detect files that grew.
+  if (file.size() > kMaxSearchFileSize) {
+    ++ numFilesSkipped;
+    return;
+  }
+  QByteArray contents = file.read(kMaxSearchFileSize + 1);
+  if (contents.size() > kMaxSearchFileSize) {
+    ++ numFilesSkipped;
+    return;
+  }
+  if (!contents.isEmpty()) {
+    SearchInText(contents.constData(), contents.size(), searcher, findText, caseSensitivity, result);
   }
 }
 
-void FindAndReplaceInFiles::SearchInLine(
-    int line,
-    QString lineText,
-    bool& haveOccurrenceInFile,
-    QTreeWidgetItem*& lastLineItem,
-    std::vector<int>& occurrenceColumns,
-    const QDir& startDir,
-    const QString& filePath,
-    QTreeWidgetItem*& lastFileItem,
-    QString& lastFilePath,
-    int& occurrencesInFile,
-    int& numOccurrences) {
-  occurrenceColumns.clear();
-  int column = 0;
-  while ((column = lineText.indexOf(findText, column, caseSensitivity)) != -1) {
-    // Found an occurrence at (line, column)
-    occurrenceColumns.push_back(column);
-    
-    column += findText.size();
+void FindAndReplaceInFiles::SearchInText(const char* data, qint64 size, const UTF8TextSearcher& searcher, const QString& findText, Qt::CaseSensitivity caseSensitivity, FileResult* result) {
+  auto addOccurrence = [&](int line, const QString& lineText, int column) {
+    if (result->lines.empty() || result->lines.back().line != line) {
+      result->lines.emplace_back();
+      result->lines.back().line = line;
+      result->lines.back().text = lineText;
+      if (result->lines.back().text.endsWith('\r')) {
+        result->lines.back().text.chop(1);
+      }
+    }
+    result->lines.back().columns.push_back(column);
+    ++ result->numOccurrences;
+  };
+  
+  if (!searcher.IsSupported()) {
+    // Case-insensitive search for non-ASCII text requires to decode the text.
+    // TODO: Allow reading other formats than UTF-8 only
+    QString text = QString::fromUtf8(data, size);
+    int line = 1;
+    int lineStart = 0;
+    while (lineStart < text.size()) {
+      int lineEnd = text.indexOf('\n', lineStart);
+      if (lineEnd < 0) {
+        lineEnd = text.size();
+      }
+      QString lineText = text.mid(lineStart, lineEnd - lineStart);
+      int column = 0;
+      while ((column = lineText.indexOf(findText, column, caseSensitivity)) != -1) {
+        addOccurrence(line, lineText, column);
+        column += findText.size();
+      }
+      ++ line;
+      lineStart = lineEnd + 1;
+    }
+    return;
   }
   
-  if (!occurrenceColumns.empty()) {
-    if (!haveOccurrenceInFile) {
-      // Insert the top-level tree widget item for the file.
-      if (lastFileItem) {
-        SetLastFileItem(startDir, lastFileItem, lastFilePath, occurrencesInFile);
+  // Search the bytes directly. Lines are only counted (and decoded) up to the
+  // occurrences.
+  int line = 1;  // one-based
+  qint64 lineStart = 0;
+  qint64 countedUntil = 0;
+  QString lineText;
+  int lineTextLine = 0;
+  // Byte offset in the current line up to which the column has been computed,
+  // and the corresponding column.
+  qint64 columnStart = 0;
+  int column = 0;
+  qint64 pos = 0;
+  while ((pos = searcher.Find(data, size, pos)) >= 0) {
+    while (countedUntil < pos) {
+      const char* newline = static_cast<const char*>(memchr(data + countedUntil, '\n', pos - countedUntil));
+      if (!newline) {
+        countedUntil = pos;
+        break;
       }
-      occurrencesInFile = 0;
-      lastFileItem = new QTreeWidgetItem(findAndReplaceResultsTree, lastFileItem);
-      lastFilePath = filePath;
-      lastFileItem->setExpanded(true);
-      
-      filesWithOccurrencesPaths.push_back(filePath);
-      
-      haveOccurrenceInFile = true;
+      ++ line;
+      lineStart = countedUntil = newline - data + 1;
     }
     
-    numOccurrences += occurrenceColumns.size();
-    occurrencesInFile += occurrenceColumns.size();
+    if (lineTextLine != line) {
+      const char* lineEnd = static_cast<const char*>(memchr(data + lineStart, '\n', size - lineStart));
+      qint64 lineSize = (lineEnd ? (lineEnd - data) : size) - lineStart;
+      lineText = QString::fromUtf8(data + lineStart, lineSize);  // TODO: Allow reading other formats than UTF-8 only
+      lineTextLine = line;
+      columnStart = lineStart;
+      column = 0;
+    }
     
-    lastLineItem = new QTreeWidgetItem(lastFileItem, lastLineItem);
+    // The column is given in UTF-16 code units, as in the documents. It is
+    // advanced from the previous occurrence in the same line.
+    column += CountUTF16CodeUnits(data + columnStart, pos - columnStart);
+    columnStart = pos;
+    addOccurrence(line, lineText, column);
+    pos += searcher.GetPatternSize();
+  }
+}
+
+void FindAndReplaceInFiles::AddFileResult(const FileResult& result) {
+  // Insert the item for the file such that the files remain sorted by path.
+  // Since the paths of the file items are not stored in Qt::UserRole (which
+  // contains the location to jump to on activation), they are stored in the
+  // next role.
+  constexpr int kPathRole = Qt::UserRole + 1;
+  int insertIndex = 0;
+  int endIndex = findAndReplaceResultsTree->topLevelItemCount();
+  while (insertIndex < endIndex) {
+    int middle = (insertIndex + endIndex) / 2;
+    if (findAndReplaceResultsTree->topLevelItem(middle)->data(0, kPathRole).toString() < result.path) {
+      insertIndex = middle + 1;
+    } else {
+      endIndex = middle;
+    }
+  }
+  
+  QTreeWidgetItem* fileItem = new QTreeWidgetItem();
+  fileItem->setData(0, kPathRole, result.path);
+  findAndReplaceResultsTree->insertTopLevelItem(insertIndex, fileItem);
+  findAndReplaceResultsTree->setItemWidget(
+      fileItem, 0,
+      new QLabel(QStringLiteral("<b>%1</b>: %2 matches").arg(searchStartDir.relativeFilePath(result.path).toHtmlEscaped()).arg(result.numOccurrences)));
+  fileItem->setExpanded(true);
+  
+  filesWithOccurrencesPaths.push_back(result.path);
+  numOccurrences += result.numOccurrences;
+  
+  QTreeWidgetItem* lastLineItem = nullptr;
+  for (const LineResult& lineResult : result.lines) {
+    lastLineItem = new QTreeWidgetItem(fileItem, lastLineItem);
     lastLineItem->setFlags(lastLineItem->flags() | Qt::ItemNeverHasChildren);
-    lastLineItem->setData(0, Qt::UserRole, QStringLiteral("file://%1:%2:%3").arg(filePath).arg(line).arg(occurrenceColumns[0] + 1));
+    lastLineItem->setData(0, Qt::UserRole, QStringLiteral("file://%1:%2:%3").arg(result.path).arg(lineResult.line).arg(lineResult.columns[0] + 1));
     
     // Highlight the occurrences in the text
-    if (lineText.endsWith('\n')) {
-      lineText.chop(1);
-    }
-    
     QString markupText;
     int cursor = 0;
-    for (int column : occurrenceColumns) {
-      markupText += lineText.mid(cursor, column - cursor).toHtmlEscaped();
+    for (int column : lineResult.columns) {
+      markupText += lineResult.text.mid(cursor, column - cursor).toHtmlEscaped();
       markupText += QStringLiteral("<b style=\"background-color:#efedec;\">");
-      markupText += lineText.mid(column, findText.size()).toHtmlEscaped();
+      markupText += lineResult.text.mid(column, findText.size()).toHtmlEscaped();
       markupText += QStringLiteral("</b>");
       cursor = column + findText.size();
     }
-    markupText += lineText.mid(cursor).toHtmlEscaped();
+    markupText += lineResult.text.mid(cursor).toHtmlEscaped();
     
-    LabelWithClickedSignal* lineLabel = new LabelWithClickedSignal(tr("<span style=\"color:gray;\">Line %1:</span> %2").arg(line).arg(markupText));
+    LabelWithClickedSignal* lineLabel = new LabelWithClickedSignal(tr("<span style=\"color:gray;\">Line %1:</span> %2").arg(lineResult.line).arg(markupText));
+    QTreeWidgetItem* lineItem = lastLineItem;
     connect(lineLabel, &LabelWithClickedSignal::clicked, [=]() {
       // Invoke the itemActivated() signal of the QTreeWidget for this item.
       QMetaObject::invokeMethod(
           findAndReplaceResultsTree,
           "itemActivated",
           Qt::DirectConnection,
-          Q_ARG(QTreeWidgetItem*, lastLineItem),
+          Q_ARG(QTreeWidgetItem*, lineItem),
           Q_ARG(int, 0));
     });
     findAndReplaceResultsTree->setItemWidget(lastLineItem, 0, lineLabel);
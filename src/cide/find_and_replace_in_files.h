@@ -4,23 +4,56 @@
 
 #pragma once
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <QByteArray>
+#include <QDir>
 #include <QObject>
+#include <QString>
 
 class Document;
 class DocumentWidget;
 class MainWindow;
 class QAction;
-class QDir;
 class QDockWidget;
 class QLabel;
 class QLineEdit;
 class QPushButton;
+class QTimer;
 class QTreeWidget;
 class QTreeWidgetItem;
+class UTF8TextSearcher;
 
 class FindAndReplaceInFiles : public QObject {
  Q_OBJECT
  public:
+  /// Occurrences of the search text within one line of a file.
+  struct LineResult {
+    /// 1-based line number
+    int line;
+    
+    /// Text of the line, without the line ending.
+    QString text;
+    
+    /// 0-based columns of the occurrences within the line.
+    std::vector<int> columns;
+  };
+  
+  /// Occurrences of the search text within one file.
+  struct FileResult {
+    QString path;
+    std::vector<LineResult> lines;
+    int numOccurrences = 0;
+  };
+  
+  
+  ~FindAndReplaceInFiles();
+  
   /// Returns the QAction which shows the find-and-replace window.
   QAction* Initialize(MainWindow* mainWindow);
   
@@ -31,9 +64,19 @@ class FindAndReplaceInFiles : public QObject {
   
   void ReplaceClicked();
   
+  /// Cancels the running search (if any). The results found so far remain
+  /// shown.
+  void CancelSearch();
+  
  private slots:
   void ShowDialogWithDefaultSettings();
   
+  /// Called periodically in the Qt thread while a search is running. Moves the
+  /// results found by the search threads since the last call into the results
+  /// tree, updates the progress display, and finishes the search once all
+  /// files have been searched.
+  void ProcessSearchResults();
+  
  private:
   /// Shows the search dialog that allows entering the text to serach for, set
   /// the search directory, etc. Returns true if the dialog was accepted. The
@@ -41,24 +84,31 @@ class FindAndReplaceInFiles : public QObject {
   /// class (findText, searchFolderPath).
   bool ShowDialogInternal(const QString initialPath);
   
-  void SetLastFileItem(const QDir& startDir, QTreeWidgetItem* lastFileItem, QString lastFilePath, int occurrencesInFile);
-  
-  void SearchInDocument(Document* document, const QDir& startDir, const QString& filePath, QTreeWidgetItem*& lastFileItem, QString& lastFilePath, int& occurrencesInFile, int& numOccurrences);
-  void SearchInFile(const QDir& startDir, const QString& filePath, QTreeWidgetItem*& lastFileItem, QString& lastFilePath, int& occurrencesInFile, int& numOccurrences);
-  
-  // TODO: Support finding strings that go beyond a single line. So, make a SearchInDocumentText() instead.
-  void SearchInLine(
-      int line,
-      QString lineText,
-      bool& haveOccurrenceInFile,
-      QTreeWidgetItem*& lastLineItem,
-      std::vector<int>& occurrenceColumns,
-      const QDir& startDir,
-      const QString& filePath,
-      QTreeWidgetItem*& lastFileItem,
-      QString& lastFilePath,
-      int& occurrencesInFile,
-      int& numOccurrences);
+  /// Runs in the search thread: collects the files within @p startDir, then
+  /// searches them in parallel on @p threadCount threads (with the search
+  /// thread being one of them; 0 means one per CPU core).
+  void SearchThreadMain(QDir startDir, QString findText, Qt::CaseSensitivity caseSensitivity, int threadCount);
+  
+  /// Collects the paths of all files within @p startDir into @p paths. Returns
+  /// false if the search was canceled.
+  bool CollectFilePaths(const QDir& startDir, std::vector<QString>* paths);
+  
+  /// Searches a single file, using the snapshot of its text in
+  /// openDocumentTexts if it is open, and otherwise reading it. This is called
+  /// by the worker threads.
+  void SearchInFile(const QString& filePath, const UTF8TextSearcher& searcher, const QString& findText, Qt::CaseSensitivity caseSensitivity, FileResult* result);
+  
+  /// Searches the given UTF-8 text for the search text, appending the
+  /// occurrences to @p result.
+  static void SearchInText(const char* data, qint64 size, const UTF8TextSearcher& searcher, const QString& findText, Qt::CaseSensitivity caseSensitivity, FileResult* result);
+  
+  /// Returns a note about the files that were skipped because of their size
+  /// for the results label, or an empty string if no file was skipped.
+  QString SkippedFilesText() const;
+  
+  /// Adds the tree widget items for the given file result. Must be called in
+  /// the Qt thread.
+  void AddFileResult(const FileResult& result);
   
   void ReplaceInDocument(DocumentWidget* widget, const QString& replacementText);
   void ReplaceInFile(const QString& filePath, const QString& replacementText, QString* errorMessages);
@@ -68,6 +118,7 @@ class FindAndReplaceInFiles : public QObject {
   QLabel* findAndReplaceResultsLabel;
   QLineEdit* findAndReplaceEdit;
   QPushButton* findAndReplaceReplaceButton;
+  QPushButton* findAndReplaceCancelButton;
   QTreeWidget* findAndReplaceResultsTree;
   
   /// Text that should be searched for.
@@ -79,11 +130,34 @@ class FindAndReplaceInFiles : public QObject {
   /// Path of the root folder for the search.
   QString searchFolderPath;
   
-  /// Paths of all files in which the search / replace should be done.
-  std::vector<QString> filePaths;
-  
   /// Paths of all files in which occurrences were found.
   std::vector<QString> filesWithOccurrencesPaths;
   
+  // Search thread. The search and worker threads do not access the Qt thread;
+  // instead, they append their results to pendingResults (with resultsMutex
+  // locked), from where ProcessSearchResults() fetches them in batches.
+  std::thread searchThread;
+  std::atomic<bool> cancelSearch = {false};
+  std::atomic<bool> searchFinished = {false};
+  std::atomic<int> numFilesToSearch = {0};
+  std::atomic<int> numFilesSearched = {0};
+  
+  /// Number of files that were not searched since they exceed the size limit.
+  std::atomic<int> numFilesSkipped = {0};
+  
+  std::mutex resultsMutex;
+  std::vector<FileResult> pendingResults;
+  
+  /// UTF-8 encoded text of the open documents, indexed by canonical path. This
+  /// is set in the Qt thread before starting a search and only read during the
+  /// search.
+  std::unordered_map<QString, QByteArray> openDocumentTexts;
+  
+  // State of the running search in the Qt thread.
+  QTimer* searchResultsTimer = nullptr;
+  QDir searchStartDir;
+  std::chrono::steady_clock::time_point searchStartTime;
+  int numOccurrences = 0;
+  
   MainWindow* mainWindow;
 };
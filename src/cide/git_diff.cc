@@ -11,6 +11,7 @@
 #include "cide/main_window.h"
 #include "cide/qt_thread.h"
 #include "cide/scroll_bar_minimap.h"
+#include "cide/tracing.h"
 
 GitDiff& GitDiff::Instance() {
   static GitDiff instance;
@@ -68,6 +69,8 @@ GitDiff::~GitDiff() {
 }
 
 void GitDiff::ThreadMain() {
+  SetTraceThreadName("Git diff");
+  
   while (true) {
     std::unique_lock<std::mutex> lock(diffMutex);
     documentBeingDiffed = nullptr;
@@ -85,6 +88,7 @@ void GitDiff::ThreadMain() {
     documentBeingDiffed = request.document;
     lock.unlock();
     
+    CIDE_TRACE_SPAN("GitDiff");
     CreateDiff(request);
   }
 }
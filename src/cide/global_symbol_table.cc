@@ -0,0 +1,127 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/global_symbol_table.h"
+
+#include <QObject>
+
+#include "cide/clang_parser.h"
+#include "cide/clang_utils.h"
+
+QString GlobalSymbol::GetDisplayText(const QString& path) const {
+  return QObject::tr("%1 at %2:%3:%4").arg(spelling).arg(path).arg(line).arg(column);
+}
+
+
+GlobalSymbolTable& GlobalSymbolTable::Instance() {
+  static GlobalSymbolTable instance;
+  return instance;
+}
+
+void GlobalSymbolTable::UpdateFile(const QString& canonicalPath, const USRDeclMap& usrs, quint64 updateNumber) {
+  // Extract the symbols outside of the lock.
+  std::shared_ptr<GlobalSymbolFile> newFile(new GlobalSymbolFile());
+  newFile->path = canonicalPath;
+  
+  for (int i = 0; i < usrs.size(); ++ i) {
+    if (usrs.GetNamePos(i) < 0) {
+      continue;
+    }
+    CXCursorKind kind = usrs.GetKind(i);
+    bool isClassDeclLike = IsClassDeclLikeCursorKind(kind);
+    if (!isClassDeclLike && !IsFunctionDeclLikeCursorKind(kind)) {
+      continue;
+    }
+    if (isClassDeclLike && !usrs.IsDefinition(i)) {
+      continue;
+    }
+    
+    USRDecl decl = usrs.GetDecl(i);
+    newFile->symbols.emplace_back();
+    GlobalSymbol& symbol = newFile->symbols.back();
+    symbol.spelling = decl.spelling;
+    symbol.name = decl.spelling.mid(decl.namePos, decl.nameSize);
+    symbol.namePos = decl.namePos;
+    symbol.line = decl.line;
+    symbol.column = decl.column;
+  }
+  
+  StoreFile(newFile, updateNumber);
+}
+
+void GlobalSymbolTable::SetFileSymbols(const QString& canonicalPath, std::vector<GlobalSymbol>&& symbols) {
+  std::shared_ptr<GlobalSymbolFile> newFile(new GlobalSymbolFile());
+  newFile->path = canonicalPath;
+  newFile->symbols = std::move(symbols);
+  StoreFile(newFile, GetNextUpdateNumber());
+}
+
+void GlobalSymbolTable::StoreFile(const std::shared_ptr<GlobalSymbolFile>& newFile, quint64 updateNumber) {
+  for (GlobalSymbol& symbol : newFile->symbols) {
+    symbol.lowercaseName = symbol.name.toLower();
+    symbol.nameSignature = FuzzyTextMatchSignature(symbol.lowercaseName);
+    newFile->nameIndex.AddItem(symbol.lowercaseName);
+  }
+  newFile->nameIndex.Finish();
+  
+  std::unique_lock<std::mutex> lock(mutex);
+  bool isOutdated = false;
+  auto it = lastUpdateNumbers.find(newFile->path);
+  if (it == lastUpdateNumbers.end()) {
+    lastUpdateNumbers[newFile->path] = updateNumber;
+  } else if (it->second > updateNumber) {
+    isOutdated = true;
+  } else {
+    it->second = updateNumber;
+  }
+  
+  // If no other update is pending, all future updates will have larger numbers
+  // than the ones that were applied, so these do not need to be remembered.
+  if (-- numPendingUpdates == 0) {
+    lastUpdateNumbers.clear();
+  }
+  
+  if (isOutdated) {
+    return;
+  }
+  if (newFile->symbols.empty()) {
+    if (files.erase(newFile->path) == 0) {
+      return;
+    }
+  } else {
+    files[newFile->path] = newFile;
+  }
+  snapshot.reset();
+  ++ version;
+}
+
+void GlobalSymbolTable::RemoveFile(const QString& canonicalPath) {
+  std::unique_lock<std::mutex> lock(mutex);
+  // Pending updates that were numbered before the removal must be dropped.
+  // Since the removal number is taken before checking for pending updates, all
+  // such updates are counted in numPendingUpdates.
+  quint64 removalNumber = nextUpdateNumber.fetch_add(1);
+  if (numPendingUpdates == 0) {
+    lastUpdateNumbers.erase(canonicalPath);
+  } else {
+    lastUpdateNumbers[canonicalPath] = removalNumber;
+  }
+  if (files.erase(canonicalPath) > 0) {
+    snapshot.reset();
+    ++ version;
+  }
+}
+
+std::shared_ptr<const GlobalSymbolTableSnapshot> GlobalSymbolTable::GetSnapshot() {
+  std::unique_lock<std::mutex> lock(mutex);
+  if (!snapshot) {
+    std::shared_ptr<GlobalSymbolTableSnapshot> newSnapshot(new GlobalSymbolTableSnapshot());
+    newSnapshot->reserve(files.size());
+    for (const auto& item : files) {
+      newSnapshot->push_back(item.second);
+    }
+    snapshot = newSnapshot;
+  }
+  return snapshot;
+}
@@ -0,0 +1,132 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <QString>
+
+#include "cide/clang_parser.h"
+#include "cide/text_utils.h"
+#include "cide/util.h"
+
+/// A function or class listed in the global symbol search.
+struct GlobalSymbol {
+  /// Returns the text that is displayed for this symbol in the search list.
+  /// Since only few symbols are displayed at a time, this is formatted on
+  /// demand instead of being stored.
+  QString GetDisplayText(const QString& path) const;
+  
+  /// Pretty-printed declaration of the symbol.
+  QString spelling;
+  
+  /// Name of the symbol, which the user input is matched to.
+  QString name;
+  QString lowercaseName;
+  
+  /// Signature of lowercaseName for quickly rejecting non-matching symbols.
+  FuzzyTextMatchSignature nameSignature;
+  
+  /// Position of the name within the spelling.
+  int namePos;
+  
+  /// Line of the symbol (1-based).
+  int line;
+  
+  /// Column of the symbol (1-based).
+  int column;
+};
+
+/// Stores the global symbols within one file. Instances are never modified
+/// after they have been added to the GlobalSymbolTable, so they can be used
+/// without locking.
+struct GlobalSymbolFile {
+  /// Canonical path of the file.
+  QString path;
+  
+  std::vector<GlobalSymbol> symbols;
+  
+  /// Index over the lowercase names of the symbols.
+  FuzzyTextMatchIndex nameIndex;
+};
+
+typedef std::vector<std::shared_ptr<const GlobalSymbolFile>> GlobalSymbolTableSnapshot;
+
+/// Singleton class which stores the symbols that are listed in the global
+/// symbol search. It is updated incrementally from the USRStorage while files
+/// get indexed, such that the search can be opened without having to go over
+/// all stored USRs (and without having to lock the USRStorage).
+class GlobalSymbolTable {
+ public:
+  static GlobalSymbolTable& Instance();
+  
+  /// Returns a number for passing to UpdateFile(). It must be obtained while
+  /// the USRStorage is locked, together with storing the USRs that are passed
+  /// to UpdateFile(), such that the numbers are ordered like the updates of the
+  /// USRStorage. Each number must be passed to UpdateFile() eventually.
+  inline quint64 GetNextUpdateNumber() {
+    ++ numPendingUpdates;
+    return nextUpdateNumber.fetch_add(1);
+  }
+  
+  /// Re-extracts the symbols for the given file from its USRs. This should be
+  /// called after unlocking the USRStorage. Since updates for the same file may
+  /// thus arrive out of order, an update is dropped if an update with a larger
+  /// @p updateNumber (see GetNextUpdateNumber()) was applied already.
+  void UpdateFile(const QString& canonicalPath, const USRDeclMap& usrs, quint64 updateNumber);
+  
+  /// Replaces the symbols of the given file. This is used for files that are
+  /// not indexed via USRs (GLSL files). Only the spelling, name, namePos, line,
+  /// and column of the symbols need to be set.
+  void SetFileSymbols(const QString& canonicalPath, std::vector<GlobalSymbol>&& symbols);
+  
+  /// Removes all symbols of the given file. For files indexed via USRs, the
+  /// USRStorage must be locked while calling this, such that earlier updates
+  /// passed to UpdateFile() afterwards are dropped.
+  void RemoveFile(const QString& canonicalPath);
+  
+  /// Returns the current state of the symbol table. This is cheap, since the
+  /// per-file symbol lists are shared with the table.
+  std::shared_ptr<const GlobalSymbolTableSnapshot> GetSnapshot();
+  
+  /// Returns a number that changes each time the symbol table is modified.
+  inline int GetVersion() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return version;
+  }
+  
+ private:
+  GlobalSymbolTable() = default;
+  
+  /// Indexes the symbols of @p newFile and stores it, unless a later update
+  /// was stored for the file already.
+  void StoreFile(const std::shared_ptr<GlobalSymbolFile>& newFile, quint64 updateNumber);
+  
+  
+  /// Maps canonical file path --> symbols of that file.
+  std::unordered_map<QString, std::shared_ptr<const GlobalSymbolFile>> files;
+  
+  /// Maps canonical file path --> number of the last update or removal that
+  /// was applied for that file. This is only required to order the updates that
+  /// are pending, so the entries are erased once no update is pending anymore.
+  std::unordered_map<QString, quint64> lastUpdateNumbers;
+  
+  std::atomic<quint64> nextUpdateNumber = {0};
+  
+  /// Number of update numbers that were returned by GetNextUpdateNumber(), but
+  /// have not been applied by StoreFile() yet.
+  std::atomic<int> numPendingUpdates = {0};
+  
+  /// Cached snapshot, which is reset when the table changes.
+  std::shared_ptr<const GlobalSymbolTableSnapshot> snapshot;
+  
+  int version = 0;
+  
+  std::mutex mutex;
+};
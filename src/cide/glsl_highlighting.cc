@@ -15,12 +15,12 @@ using namespace glslang;
 
 class GLSLTraverser : public glslang::TIntermTraverser {
  public:
-  inline GLSLTraverser(Document* document, const QString& documentContent, const std::vector<unsigned>& lineOffsets)
-      : document(document),
+  inline GLSLTraverser(HighlightingBuffer* highlighting, const HighlightingSettings& settings, const QString& documentContent, const std::string& documentPath, const std::vector<unsigned>& lineOffsets)
+      : highlighting(highlighting),
+        settings(settings),
         documentContent(documentContent),
         lineOffsets(lineOffsets),
-        documentPath(document->path().toStdString()),
-        perVariableColoring(Settings::Instance().GetUsePerVariableColoring()) {}
+        documentPath(documentPath) {}
   
   // The functions below must return true to have the external traversal
   // continue on to the children. If they would traverse the children themselves,
@@ -56,8 +56,8 @@ class GLSLTraverser : public glslang::TIntermTraverser {
     if (node->getLoc().line == 0) { return true; }  // seemingly no valid location information
     if (strcmp(node->getLoc().getFilenameStr(), documentPath.c_str()) != 0) { return false; }
     
-    const auto& functionDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::FunctionDefinition);
-    const auto& functionUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::FunctionUse);
+    const auto& functionDefinitionStyle = settings.GetTextStyle(Settings::TextStyle::FunctionDefinition);
+    const auto& functionUseStyle = settings.GetTextStyle(Settings::TextStyle::FunctionUse);
     
     DocumentRange range;
     switch (node->getOp()) {
@@ -89,7 +89,7 @@ class GLSLTraverser : public glslang::TIntermTraverser {
         range.start = documentContent.lastIndexOf(nodeName, LocToOffset(node->getLoc()), Qt::CaseSensitive);
         if (range.start >= 0) {
           range.end = range.start + nodeName.size();
-          document->AddHighlightRange(range, false, functionDefinitionStyle);
+          highlighting->AddHighlightRange(range, false, functionDefinitionStyle);
         }
       }
       break; }
@@ -459,7 +459,7 @@ class GLSLTraverser : public glslang::TIntermTraverser {
     case EOpCooperativeMatrixMulAdd:
     case EOpIsHelperInvocation:
     case EOpDebugPrintf:
-      document->AddHighlightRange(FindFunctionCallRangeHeuristic(node), false, functionUseStyle); break;
+      highlighting->AddHighlightRange(FindFunctionCallRangeHeuristic(node), false, functionUseStyle); break;
     
     default:
       qDebug() << "Unhandled GLSL aggregate case: " << node->getOp();
@@ -503,7 +503,9 @@ class GLSLTraverser : public glslang::TIntermTraverser {
     if (!newColor) {
       overrideColor = it->second;
     } else {
-      overrideColor = Settings::Instance().GetLocalVariableColor(variableCounterPerFunction % Settings::Instance().GetLocalVariableColorPoolSize());
+      if (!settings.localVariableColors.empty()) {
+        overrideColor = settings.localVariableColors[variableCounterPerFunction % settings.localVariableColors.size()];
+      }
       perVariableColorMap[node->getId()] = overrideColor;
       ++ variableCounterPerFunction;
     }
@@ -522,8 +524,8 @@ class GLSLTraverser : public glslang::TIntermTraverser {
       isDefinition = false;
     }
     
-    const auto& variableDefinitionStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::VariableDefinition);
-    const auto& variableUseStyle = Settings::Instance().GetConfiguredTextStyle(Settings::TextStyle::VariableUse);
+    const auto& variableDefinitionStyle = settings.GetTextStyle(Settings::TextStyle::VariableDefinition);
+    const auto& variableUseStyle = settings.GetTextStyle(Settings::TextStyle::VariableUse);
     const Settings::ConfigurableTextStyle* style = isDefinition ? &variableDefinitionStyle : &variableUseStyle;
     
     // Heuristic: If the first character of the name range that we obtain is '(',
@@ -540,11 +542,11 @@ class GLSLTraverser : public glslang::TIntermTraverser {
     }
     // qDebug() << "Symbol named " << QString::fromUtf8(node->getName().c_str()) << " has range: " << documentContent.mid(nameRange.start.offset, nameRange.end.offset - nameRange.start.offset);
     
-    if (perVariableColoring) {
+    if (settings.usePerVariableColoring && overrideColor.isValid()) {
       // We usually override the text color, but do override the background color instead if the style does not affect the text color.
-      document->AddHighlightRange(nameRange, false, overrideColor, style->bold, style->affectsText, style->affectsBackground, style->affectsText ? style->backgroundColor : overrideColor);
+      highlighting->AddHighlightRange(nameRange, false, overrideColor, style->bold, style->affectsText, style->affectsBackground, style->affectsText ? style->backgroundColor : overrideColor);
     } else {
-      document->AddHighlightRange(nameRange, false, *style);
+      highlighting->AddHighlightRange(nameRange, false, *style);
     }
     
     // qDebug() << "Symbol: '" << node->getName().c_str() << "' (" << node->getCompleteString().c_str() << ") at: " << node->getLoc().line << ", " << node->getLoc().column;
@@ -677,15 +679,14 @@ class GLSLTraverser : public glslang::TIntermTraverser {
   std::unordered_map<int, QColor> perVariableColorMap;
   int variableCounterPerFunction = 0;
   
-  Document* document;
+  HighlightingBuffer* highlighting;
+  const HighlightingSettings& settings;
   const QString& documentContent;
   const std::vector<unsigned>& lineOffsets;
   std::string documentPath;
-  
-  bool perVariableColoring;
 };
 
-void AddGLSLHighlighting(Document* document, const QString& documentContent, glslang::TIntermediate* ast, const std::vector<unsigned>& lineOffsets) {
+void AddGLSLHighlighting(HighlightingBuffer* highlighting, const HighlightingSettings& settings, const QString& documentContent, const std::string& documentPath, glslang::TIntermediate* ast, const std::vector<unsigned>& lineOffsets) {
   if (!ast->getTreeRoot()) {
     return;
   }
@@ -697,7 +698,7 @@ void AddGLSLHighlighting(Document* document, const QString& documentContent, gls
   TPoolAllocator* builtInPoolAllocator = new TPoolAllocator;
   SetThreadPoolAllocator(builtInPoolAllocator);
   
-  GLSLTraverser traverser(document, documentContent, lineOffsets);
+  GLSLTraverser traverser(highlighting, settings, documentContent, documentPath, lineOffsets);
   ast->getTreeRoot()->traverse(&traverser);
   
   delete builtInPoolAllocator;
@@ -4,13 +4,17 @@
 
 #pragma once
 
+#include <string>
 #include <vector>
 
-class Document;
+class HighlightingBuffer;
+struct HighlightingSettings;
 namespace glslang {
   class TIntermediate;  // glslang AST
 }
 class QString;
 
-/// Adds highlighting ranges to the document based on the given TIntermediate AST.
-void AddGLSLHighlighting(Document* document, const QString& documentContent, glslang::TIntermediate* ast, const std::vector<unsigned>& lineOffsets);
+/// Adds highlighting ranges to the buffer based on the given TIntermediate AST.
+/// @p documentPath must be the path that was passed to glslang as the name of
+/// the document's source. @p settings must have been read in the Qt thread.
+void AddGLSLHighlighting(HighlightingBuffer* highlighting, const HighlightingSettings& settings, const QString& documentContent, const std::string& documentPath, glslang::TIntermediate* ast, const std::vector<unsigned>& lineOffsets);
@@ -40,13 +40,24 @@
 
 #include "cide/glsl_parser.h"
 
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+
+#include "glslang/MachineIndependent/localintermediate.h"
 #include "glslang/Public/ShaderLang.h"
 
 #include "cide/document.h"
+#include "cide/global_symbol_table.h"
 #include "cide/glsl_highlighting.h"
 #include "cide/main_window.h"
+#include "cide/parse_statistics.h"
 #include "cide/parse_thread_pool.h"
 #include "cide/qt_thread.h"
+#include "cide/settings.h"
+#include "cide/tracing.h"
 
 // NOTE: Copied from third_party/glslang/StandAlone/ResourceLimits.cpp
 const TBuiltInResource DefaultTBuiltInResource = {
@@ -164,7 +175,7 @@ ParserGlobal::ParserGlobal() {
   glslang::InitializeProcess();
 }
 
-static void RetrieveDiagnostics(Document* document, const char* infoLog, const std::vector<unsigned>& lineOffsets) {
+static void RetrieveDiagnostics(Document* document, const char* infoLog, const std::vector<unsigned>& lineOffsets, int documentLength) {
   document->ClearProblems();
   
   // Clear warning/error line attributes
@@ -228,7 +239,7 @@ static void RetrieveDiagnostics(Document* document, const char* infoLog, const s
           if (lineNumber + 1 < lineOffsets.size()) {
             lineEndOffset = lineOffsets[lineNumber + 1] - 1;
           } else {
-            lineEndOffset = document->FullDocumentRange().end.offset;
+            lineEndOffset = documentLength;
           }
           QString errorString = line.mid(errorStringStart).trimmed().toString();
           
@@ -276,17 +287,69 @@ static void RetrieveDiagnostics(Document* document, const char* infoLog, const s
   }
 }
 
+GLSLIncludeFileCache& GLSLIncludeFileCache::Instance() {
+  static GLSLIncludeFileCache instance;
+  return instance;
+}
+
+std::shared_ptr<const std::string> GLSLIncludeFileCache::GetFileContent(const QString& canonicalPath) {
+  QFileInfo fileInfo(canonicalPath);
+  if (!fileInfo.exists()) {
+    return std::shared_ptr<const std::string>();
+  }
+  QDateTime lastModified = fileInfo.lastModified();
+  qint64 size = fileInfo.size();
+  
+  std::unique_lock<std::mutex> lock(mutex);
+  auto it = entries.find(canonicalPath);
+  if (it != entries.end() &&
+      it->second.lastModified == lastModified &&
+      it->second.size == size) {
+    return it->second.content;
+  }
+  lock.unlock();
+  
+  QFile file(canonicalPath);
+  if (!file.open(QFile::ReadOnly | QFile::Text)) {
+    return std::shared_ptr<const std::string>();
+  }
+  std::shared_ptr<const std::string> content(new std::string(QString::fromUtf8(file.readAll()).toStdString()));  // TODO: Support other encodings than UTF-8
+  
+  lock.lock();
+  auto oldIt = entries.find(canonicalPath);
+  if (oldIt != entries.end()) {
+    totalContentSize -= oldIt->second.content->size();
+    entries.erase(oldIt);
+  }
+  if (totalContentSize + content->size() > kMaxTotalContentSize) {
+    // Start over instead of tracking the usage of the entries. This should
+    // rarely happen since the included files are usually few and small.
+    entries.clear();
+    totalContentSize = 0;
+  }
+  Entry& newEntry = entries[canonicalPath];
+  newEntry.lastModified = lastModified;
+  newEntry.size = size;
+  newEntry.content = content;
+  totalContentSize += content->size();
+  return content;
+}
+
+
 class GLSLIncluder : public glslang::TShader::Includer {
  public:
-  GLSLIncluder(MainWindow* mainWindow)
-      : mainWindow(mainWindow) {}
+  /// @p unsavedFilePaths contains the canonical paths of the open documents
+  /// with unsaved changes. The content of these documents is fetched from
+  /// @p host in the Qt thread when they get included. All other files are
+  /// read from disk.
+  GLSLIncluder(const std::unordered_set<QString>* unsavedFilePaths, ProjectHost* host)
+      : unsavedFilePaths(unsavedFilePaths),
+        host(host) {}
   
   IncludeResult* includeSystem(const char* headerName, const char* includerName, size_t inclusionDepth) override {
     // Prevent infinite recursion
     if (inclusionDepth > 20) {
-      std::string* errorMsg = new std::string("Inclusion depth is larger than 20. Failing GLSL inclusion to prevent possible infinite recursion.");
-      // Leaving the headerName field of the IncludeResult empty is interpreted as returning an error message.
-      return new IncludeResult(/*headerName*/ "", errorMsg->c_str(), errorMsg->size(), /*userData*/ errorMsg);
+      return CreateErrorResult("Inclusion depth is larger than 20. Failing GLSL inclusion to prevent possible infinite recursion.");
     }
     
     // Build the included path
@@ -307,78 +370,254 @@ class GLSLIncluder : public glslang::TShader::Includer {
     // qDebug() << "GLSL includer includerName:" << includerName;
     // qDebug() << "GLSL includer includedPath:" << includedPath;
     
-    // Try to find the included file among the open documents
-    std::string* includedText;
-    bool includeResolved = false;
+    // Prefer the unsaved content of open documents, otherwise use the file on
+    // disk.
+    std::shared_ptr<const std::string> includedText;
+    if (unsavedFilePaths->count(includedPath) > 0) {
+      includedText = GetUnsavedFileContent(includedPath);
+    }
+    if (!includedText && !includedPath.isEmpty()) {
+      includedText = GLSLIncludeFileCache::Instance().GetFileContent(includedPath);
+    }
     
+    if (!includedText) {
+      return CreateErrorResult("Could not open file: " + includedPath.toStdString());
+    }
+    
+    std::string includedPathString = includedPath.toStdString();
+    includedFiles[includedPathString] = includedText;
+    return new IncludeResult(includedPathString, includedText->data(), includedText->size(), /*userData*/ new std::shared_ptr<const std::string>(includedText));
+  }
+  
+  void releaseInclude(IncludeResult* result) override {
+    if (result) {
+      delete reinterpret_cast<std::shared_ptr<const std::string>*>(result->userData);
+      delete result;
+    }
+  }
+  
+  /// Returns the files that were included, mapping their canonical paths to
+  /// their content.
+  inline const std::unordered_map<std::string, std::shared_ptr<const std::string>>& GetIncludedFiles() const { return includedFiles; }
+  
+ private:
+  IncludeResult* CreateErrorResult(const std::string& message) {
+    std::shared_ptr<const std::string>* errorMsg = new std::shared_ptr<const std::string>(new std::string(message));
+    // Leaving the headerName field of the IncludeResult empty is interpreted as returning an error message.
+    return new IncludeResult(/*headerName*/ "", (*errorMsg)->c_str(), (*errorMsg)->size(), /*userData*/ errorMsg);
+  }
+  
+  /// Returns the current content of the open document with the given
+  /// canonical path, or null if it is not open anymore.
+  std::shared_ptr<const std::string> GetUnsavedFileContent(const QString& canonicalPath) {
+    // Use the same content if the file is included multiple times.
+    auto it = includedFiles.find(canonicalPath.toStdString());
+    if (it != includedFiles.end()) {
+      return it->second;
+    }
+    
+    std::shared_ptr<const std::string> content;
     RunInQtThreadBlocking([&]() {
-      Document* includedDocument = nullptr;
-      DocumentWidget* includedDocumentWidget = nullptr;
-      if (mainWindow->GetDocumentAndWidgetForPath(includedPath, &includedDocument, &includedDocumentWidget)) {
-        includedText = new std::string(includedDocument->GetDocumentText().toStdString());
-        includeResolved = true;
+      for (int i = 0; i < host->GetNumDocuments(); ++ i) {
+        Document* openDocument = host->GetDocument(i).get();
+        if (QFileInfo(openDocument->path()).canonicalFilePath() == canonicalPath) {
+          content.reset(new std::string(openDocument->GetDocumentText().toStdString()));
+          return;
+        }
       }
     });
+    return content;
+  }
+  
+  const std::unordered_set<QString>* unsavedFilePaths;
+  ProjectHost* host;
+  std::unordered_map<std::string, std::shared_ptr<const std::string>> includedFiles;
+};
+
+
+/// Collects the function definitions in a glslang AST for the global symbol
+/// search, grouped by the file that they are in.
+class GLSLSymbolCollector : public glslang::TIntermTraverser {
+ public:
+  /// @p fileContents maps the canonical paths of all files that were passed to
+  /// glslang to their content.
+  inline GLSLSymbolCollector(const std::unordered_map<std::string, const std::string*>& fileContents)
+      : fileContents(fileContents) {}
+  
+  virtual bool visitAggregate(glslang::TVisit, glslang::TIntermAggregate* node) override {
+    if (node->getOp() == glslang::EOpLinkerObjects) {
+      return false;
+    } else if (node->getOp() != glslang::EOpFunction) {
+      return true;
+    }
     
-    // If the file was not among the open documents, try to load it from disk
-    if (!includeResolved) {
-      QFile includedFile(includedPath);
-      if (includedFile.open(QFile::ReadOnly | QFile::Text)) {
-        includedText = new std::string(QString::fromUtf8(includedFile.readAll()).toStdString());  // TODO: Support other encodings than UTF-8
-        includeResolved = true;
-      }
+    // As in GLSLTraverser, the loc is usually right before the closing brace
+    // of the parameter list, so we search back from it to find the name.
+    const glslang::TSourceLoc& loc = node->getLoc();
+    auto fileIt = fileContents.find(loc.getFilenameStr());
+    std::string name = node->getName().c_str();
+    std::size_t openBraceInName = name.find('(');
+    if (loc.line == 0 || fileIt == fileContents.end() || openBraceInName == std::string::npos) {
+      return false;
     }
+    name.resize(openBraceInName);
     
-    if (includeResolved) {
-      return new IncludeResult(includedPath.toStdString(), includedText->data(), includedText->size(), /*userData*/ includedText);
-    } else {
-      std::string* errorMsg = new std::string("Could not open file: ");
-      *errorMsg += includedPath.toStdString();
-      // Leaving the headerName field of the IncludeResult empty is interpreted as returning an error message.
-      return new IncludeResult(/*headerName*/ "", errorMsg->c_str(), errorMsg->size(), /*userData*/ errorMsg);
+    const std::string& text = *fileIt->second;
+    const std::vector<std::size_t>& lineOffsets = GetLineOffsets(fileIt->first, text);
+    std::size_t locOffset = std::min(text.size(), lineOffsets[std::min<std::size_t>(lineOffsets.size(), loc.line) - 1] + std::max(0, loc.column - 1));
+    std::size_t nameStart = text.rfind(name, locOffset);
+    if (nameStart == std::string::npos) {
+      return false;
+    }
+    
+    // Use the source text from the start of the line up to the end of the
+    // parameter list as the spelling.
+    int lineIndex = std::upper_bound(lineOffsets.begin(), lineOffsets.end(), nameStart) - lineOffsets.begin() - 1;
+    std::size_t lineStart = lineOffsets[lineIndex];
+    std::size_t spellingEnd = text.find(')', nameStart);
+    spellingEnd = (spellingEnd == std::string::npos) ? (nameStart + name.size()) : (spellingEnd + 1);
+    
+    GlobalSymbol symbol;
+    QString prefix = QString::fromUtf8(text.data() + lineStart, nameStart - lineStart).simplified();
+    symbol.spelling = prefix;
+    if (!prefix.isEmpty()) {
+      symbol.spelling += ' ';
     }
+    symbol.namePos = symbol.spelling.size();
+    symbol.spelling += QString::fromUtf8(text.data() + nameStart, spellingEnd - nameStart).simplified();
+    symbol.name = QString::fromStdString(name);
+    symbol.line = lineIndex + 1;
+    symbol.column = nameStart - lineStart + 1;
+    symbols[QString::fromStdString(fileIt->first)].push_back(symbol);
+    
+    // Function definitions cannot be nested.
+    return false;
   }
   
-  void releaseInclude(IncludeResult* result) override {
-    if (result) {
-      delete reinterpret_cast<std::string*>(result->userData);
-      delete result;
+  /// Maps canonical file path --> symbols in that file.
+  std::unordered_map<QString, std::vector<GlobalSymbol>> symbols;
+  
+ private:
+  const std::vector<std::size_t>& GetLineOffsets(const std::string& path, const std::string& text) {
+    std::vector<std::size_t>& offsets = lineOffsets[path];
+    if (offsets.empty()) {
+      offsets.push_back(0);
+      for (std::size_t i = 0; i < text.size(); ++ i) {
+        if (text[i] == '\n') {
+          offsets.push_back(i + 1);
+        }
+      }
     }
+    return offsets;
   }
   
- private:
-  MainWindow* mainWindow;
+  const std::unordered_map<std::string, const std::string*>& fileContents;
+  std::unordered_map<std::string, std::vector<std::size_t>> lineOffsets;
 };
 
-void ParseGLSLFile(const QString& /*canonicalPath*/, Document* document, MainWindow* mainWindow) {
-  if (!document) {
-    qDebug() << "Null document passed to ParseGLSLFile()";
+/// Maps the canonical path of each shader that published global symbols to
+/// the canonical paths of the files whose symbols it published (the shader
+/// itself and the files included by it). Protected by publishedGLSLSymbolsMutex.
+static std::unordered_map<QString, std::unordered_set<QString>> publishedGLSLSymbols;
+static std::mutex publishedGLSLSymbolsMutex;
+
+/// Publishes the function definitions in the given AST of the shader with the
+/// canonical path @p shaderPath to the global symbol table. Each file in
+/// @p fileContents gets its symbols replaced, such that functions which were
+/// removed from the file disappear from the table.
+static void PublishGLSLSymbols(const QString& shaderPath, glslang::TIntermediate* ast, const std::unordered_map<std::string, const std::string*>& fileContents) {
+  GLSLSymbolCollector collector(fileContents);
+  if (ast && ast->getTreeRoot()) {
+    // The traverser allocates from glslang's pool allocator (see
+    // AddGLSLHighlighting()).
+    glslang::TPoolAllocator& previousAllocator = glslang::GetThreadPoolAllocator();
+    glslang::TPoolAllocator* traversalPoolAllocator = new glslang::TPoolAllocator;
+    glslang::SetThreadPoolAllocator(traversalPoolAllocator);
+    
+    ast->getTreeRoot()->traverse(&collector);
+    
+    delete traversalPoolAllocator;
+    glslang::SetThreadPoolAllocator(&previousAllocator);
+  }
+  
+  std::unique_lock<std::mutex> lock(publishedGLSLSymbolsMutex);
+  std::unordered_set<QString>& publishedPaths = publishedGLSLSymbols[shaderPath];
+  publishedPaths.clear();
+  for (const auto& item : fileContents) {
+    QString path = QString::fromStdString(item.first);
+    GlobalSymbolTable::Instance().SetFileSymbols(path, std::move(collector.symbols[path]));
+    publishedPaths.insert(path);
+  }
+}
+
+void RemoveGLSLSymbols(const QString& canonicalPath) {
+  std::unique_lock<std::mutex> lock(publishedGLSLSymbolsMutex);
+  auto it = publishedGLSLSymbols.find(canonicalPath);
+  if (it == publishedGLSLSymbols.end()) {
     return;
   }
+  std::unordered_set<QString> publishedPaths;
+  publishedPaths.swap(it->second);
+  publishedGLSLSymbols.erase(it);
   
+  // Keep the symbols of files that are included by other shaders.
+  for (const QString& path : publishedPaths) {
+    bool publishedByOtherShader = false;
+    for (const auto& item : publishedGLSLSymbols) {
+      if (item.second.count(path) > 0) {
+        publishedByOtherShader = true;
+        break;
+      }
+    }
+    if (!publishedByOtherShader) {
+      GlobalSymbolTable::Instance().RemoveFile(path);
+    }
+  }
+}
+
+void ParseGLSLFile(const QString& canonicalPath, Document* document, ProjectHost* host) {
+  CIDE_TRACE_SPAN("ParseGLSLFile");
   int parsedDocumentVersion = -1;
+  int parsedDocumentEditCount = -1;
   QString documentContentQString;
-  std::string documentFilePath;
+  std::string documentFilePath = canonicalPath.toStdString();
   std::vector<unsigned> lineOffsets;
+  std::unordered_set<QString> unsavedFilePaths;
+  HighlightingSettings highlightingSettings;
   bool exit = false;
   
   // Get the current document version and document text
   RunInQtThreadBlocking([&]() {
+    // Remember which documents have unsaved changes for resolving includes.
+    // Their text is only fetched if they actually get included, since most of
+    // them usually are not shaders.
+    for (int i = 0; i < host->GetNumDocuments(); ++ i) {
+      Document* openDocument = host->GetDocument(i).get();
+      if (openDocument->HasUnsavedChanges()) {
+        unsavedFilePaths.insert(QFileInfo(openDocument->path()).canonicalFilePath());
+      }
+    }
+    
     // If the document has been closed in the meantime, we must not access it or
-    // its widget anymore.
-    if (!ParseThreadPool::Instance().IsDocumentBeingParsed(document)) {
-      exit = true;
+    // its widget anymore. Then, only index the file.
+    if (document && !ParseThreadPool::Instance().IsDocumentBeingParsed(document)) {
+      document = nullptr;
+    }
+    if (!document) {
       return;
     }
     
     parsedDocumentVersion = document->version();
+    parsedDocumentEditCount = document->editCount();
     documentContentQString = document->GetDocumentText();
     documentFilePath = QFileInfo(document->path()).canonicalFilePath().toStdString();
+    highlightingSettings.Read();
     
     // Get the newline positions of the main file to be able to map the "line, column"
     // positions to offsets in our UTF-16 (QString) version of the document.
-    // NOTE: We could also get this after parsing finished, since currently we
-    //       anyway only use the parsing result if the document has not changed.
+    // NOTE: This must be done before parsing, since the document may change
+    //       during parsing. In this case, the parse results get mapped to the
+    //       changed document using these offsets.
     lineOffsets.resize(document->LineCount());
     Document::LineIterator lineIt(document);
     int lineIndex = 0;
@@ -392,8 +631,10 @@ void ParseGLSLFile(const QString& /*canonicalPath*/, Document* document, MainWin
       qDebug() << "Error: Line iterator returned a different line count than Document::LineCount().";
     }
   });
-  if (exit) {
-    return;
+  
+  FileParseStatistics* statistics = ParseStatistics::GetCurrentRecord();
+  if (statistics) {
+    statistics->wasOpen = document != nullptr;
   }
   
   // Determine the shader stage from the filename
@@ -432,17 +673,35 @@ void ParseGLSLFile(const QString& /*canonicalPath*/, Document* document, MainWin
   } else if (shaderStageString.endsWith(QStringLiteral(".task"), Qt::CaseInsensitive)) {
     shaderStage = EShLangTaskNV;
   } else {
-    qDebug() << "Failed to determine the shader stage based on the file extension of the file: " << QString::fromStdString(documentFilePath);
+    // Files without a stage (for example, files that are only included) are
+    // indexed as part of the shaders that include them.
+    if (document) {
+      qDebug() << "Failed to determine the shader stage based on the file extension of the file: " << QString::fromStdString(documentFilePath);
+    }
     return;
   }
   
-  // Ensure that glslang is initialized
+  // Ensure that glslang is initialized. Note that glslang keeps the built-in
+  // symbol tables for each combination of version, profile, and stage that it
+  // encountered until it gets finalized, so these are only created once.
   ParserGlobal::Instance();
   
+  // Get the content of the file to index if it is not open.
+  std::string documentContent;
+  if (document) {
+    documentContent = documentContentQString.toStdString();
+  } else {
+    QFile file(canonicalPath);
+    if (!file.open(QFile::ReadOnly | QFile::Text)) {
+      qDebug() << "Error: Cannot read GLSL file for indexing:" << canonicalPath;
+      return;
+    }
+    documentContent = QString::fromUtf8(file.readAll()).toStdString();  // TODO: Support other encodings than UTF-8
+  }
+  
   // Parse the file
   glslang::TShader shader(shaderStage);
   
-  std::string documentContent = documentContentQString.toStdString();
   const char* sourceStrings = documentContent.c_str();
   int sourceLengths = documentContent.size();
   const char* sourceNames = documentFilePath.c_str();
@@ -465,19 +724,46 @@ void ParseGLSLFile(const QString& /*canonicalPath*/, Document* document, MainWin
   // TODO: Allow the user to configure a config file to load the resource limits from
   TBuiltInResource resources = DefaultTBuiltInResource;
   
-  GLSLIncluder includer(mainWindow);
+  GLSLIncluder includer(&unsavedFilePaths, host);
   
+  auto parseStartTime = std::chrono::steady_clock::now();
   /*bool parseSuccess =*/ shader.parse(
       &resources,
       /*defaultVersion*/ 110,  // default shader version used when there is no "#version" in the shader itself
       /*forwardCompatible*/ false,  // if true, use of deprecated features results in errors
       /*messages*/ static_cast<EShMessages>(EShMsgDefault | EShMsgSpvRules | EShMsgVulkanRules | EShMsgKeepUncalled | EShMsgCascadingErrors),  // TODO: What are the best flags to use here? EShMsgRelaxedErrors?
       includer);
+  if (statistics) {
+    statistics->parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - parseStartTime).count();
+  }
   
   // For debugging:
   // qDebug() << "GLSL parse success: " << parseSuccess;
   // qDebug() << "GLSL info log:\n" << shader.getInfoLog();
   
+  // Update the global symbols of the file and its includes.
+  std::unordered_map<std::string, const std::string*> fileContents;
+  fileContents[documentFilePath] = &documentContent;
+  for (const auto& item : includer.GetIncludedFiles()) {
+    fileContents[item.first] = item.second.get();
+  }
+  if (!documentFilePath.empty()) {
+    PublishGLSLSymbols(QString::fromStdString(documentFilePath), shader.getIntermediate(), fileContents);
+  }
+  
+  if (!document) {
+    return;
+  }
+  
+  // Collect the highlighting in the background thread, such that the Qt thread
+  // only needs to swap it into the document.
+  auto highlightingStartTime = std::chrono::steady_clock::now();
+  HighlightingBuffer highlighting;
+  AddGLSLHighlighting(&highlighting, highlightingSettings, documentContentQString, documentFilePath, shader.getIntermediate(), lineOffsets);
+  if (statistics) {
+    statistics->highlightingSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - highlightingStartTime).count();
+  }
+  
   RunInQtThreadBlocking([&]() {
     // If the document has been closed in the meantime, we must not access it or
     // its widget anymore.
@@ -485,22 +771,28 @@ void ParseGLSLFile(const QString& /*canonicalPath*/, Document* document, MainWin
       exit = true;
       return;
     }
+    
+    // If the document has been edited during parsing, map the parse results to
+    // the current version of the document (see ParseAndOrIndexFileImpl()).
+    std::unique_ptr<DocumentEditMapper> mapper;
     if (parsedDocumentVersion != document->version()) {
-      // Do the next reparse instead. It should already have been triggered.
-      // TODO: We could instead try to adjust the ranges to the changes in the
-      //       document here
-      exit = true;
-      return;
+      mapper = document->CreateEditMapper(parsedDocumentEditCount, lineOffsets);
+      if (!mapper) {
+        // Do the next reparse instead. It should already have been triggered.
+        exit = true;
+        return;
+      }
     }
     
-    // DocumentWidget* widget = mainWindow->GetWidgetForDocument(document);
+    // DocumentWidget* widget = host->GetWidgetForDocument(document);
+    
+    document->SetParseResultMapper(mapper.get());
     
-    RetrieveDiagnostics(document, shader.getInfoLog(), lineOffsets);
+    RetrieveDiagnostics(document, shader.getInfoLog(), lineOffsets, documentContentQString.size());
     
-    document->ClearHighlightRanges(/*layer*/ 0);
-    document->ClearContexts();
+    document->ApplyHighlighting(&highlighting, /*layer*/ 0);
     
-    AddGLSLHighlighting(document, documentContentQString, shader.getIntermediate(), lineOffsets);
+    document->SetParseResultMapper(nullptr);
   });
   if (exit) {
     return;
@@ -4,10 +4,18 @@
 
 #pragma once
 
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+#include <QDateTime>
 #include <QString>
 
+#include "cide/util.h"
+
 class Document;
-class MainWindow;
+class ProjectHost;
 
 /// Singleton class used to do global resource initialization of glslang
 class ParserGlobal {
@@ -23,4 +31,46 @@ class ParserGlobal {
   ParserGlobal();
 };
 
-void ParseGLSLFile(const QString& canonicalPath, Document* document, MainWindow* mainWindow);
+/// Singleton class which caches the content of files that are included by GLSL
+/// shaders. Since shaders usually share their includes, this avoids reading
+/// the same files from disk for each shader that gets parsed or indexed.
+class GLSLIncludeFileCache {
+ public:
+  static GLSLIncludeFileCache& Instance();
+  
+  /// Returns the content of the file with the given canonical path, or null if
+  /// it cannot be read. The file is re-read if it has been modified since it
+  /// was cached. Can be called from any thread.
+  std::shared_ptr<const std::string> GetFileContent(const QString& canonicalPath);
+  
+ private:
+  struct Entry {
+    QDateTime lastModified;
+    qint64 size;
+    std::shared_ptr<const std::string> content;
+  };
+  
+  /// If the cached content exceeds this size, the cache is cleared.
+  static constexpr std::size_t kMaxTotalContentSize = 64 * 1024 * 1024;
+  
+  GLSLIncludeFileCache() = default;
+  
+  
+  /// Maps canonical file path --> cached file.
+  std::unordered_map<QString, Entry> entries;
+  std::size_t totalContentSize = 0;
+  
+  std::mutex mutex;
+};
+
+/// Parses the GLSL file corresponding to @p document and applies the results
+/// to the document. If @p document is null, the file with the given canonical
+/// path is only indexed. In both cases, the functions defined in the file and
+/// its includes are stored in the GlobalSymbolTable.
+void ParseGLSLFile(const QString& canonicalPath, Document* document, ProjectHost* host);
+
+/// Removes the global symbols that were stored by ParseGLSLFile() for the
+/// shader with the given canonical path. The symbols of included files are only
+/// removed if no other shader includes them. This is used when the shader's
+/// project gets closed.
+void RemoveGLSLSymbols(const QString& canonicalPath);
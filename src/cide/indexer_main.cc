@@ -0,0 +1,179 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+// Headless indexer: Indexes all source files of a CIDE project with the same
+// code that CIDE uses, writes the result to the project's USR index cache file
+// (which CIDE loads on opening the project), and prints throughput statistics.
+// This allows to pre-warm the index (e.g., on CI machines) and to benchmark
+// indexing without starting the GUI.
+//
+// Usage: cide-index [--no-cache] <project.yaml>
+//
+// With --no-cache, the existing cache file is ignored, such that all files get
+// indexed. Otherwise, only the files that are not up-to-date in the cache are.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <git2.h>
+#include <QApplication>
+#include <QEventLoop>
+
+#include "cide/clang_index.h"
+#include "cide/clang_parser.h"
+#include "cide/parse_thread_pool.h"
+#include "cide/project.h"
+#include "cide/project_host.h"
+#include "cide/usr_index_cache.h"
+#include "cide/util.h"
+
+/// ProjectHost without any open documents.
+class HeadlessProjectHost : public ProjectHost {
+ public:
+  std::vector<std::shared_ptr<Project>>& GetProjects() override { return projects; }
+  int GetNumDocuments() const override { return 0; }
+  std::shared_ptr<Document> GetDocument(int /*index*/) override { return nullptr; }
+  DocumentWidget* GetWidgetForDocument(Document* /*document*/) const override { return nullptr; }
+  bool GetDocumentAndWidgetForPath(const QString& /*canonicalPath*/, Document** /*document*/, DocumentWidget** /*widget*/) const override { return false; }
+  void DocumentParsed(Document* /*document*/) override {}
+  
+ private:
+  std::vector<std::shared_ptr<Project>> projects;
+};
+
+static int IndexProject(const QString& projectPath, bool useCache) {
+  HeadlessProjectHost host;
+  
+  std::shared_ptr<Project> project(new Project());
+  if (!project->Load(projectPath)) {
+    std::cout << "Error: Could not load project file: " << projectPath.toStdString() << std::endl;
+    return 1;
+  }
+  host.GetProjects().push_back(project);
+  
+  QString errorReason;
+  QString warnings;
+  bool errorDisplayedAlready;
+  if (!project->Configure(&errorReason, &warnings, &errorDisplayedAlready, nullptr, /*interactive*/ false)) {
+    std::cout << "Error: The project failed to configure. Reason: " << errorReason.toStdString() << std::endl;
+    return 1;
+  }
+  if (!warnings.isEmpty()) {
+    std::cout << "Warning(s) while configuring the project:\n" << warnings.toStdString() << std::endl;
+  }
+  
+  int numRestoredFiles = useCache ? LoadUSRIndexCache(project.get()) : 0;
+  
+  // Index all remaining files in the ParseThreadPool, just like CIDE does.
+  auto startTime = std::chrono::steady_clock::now();
+  int numRequests = project->IndexAllNewFiles(&host);
+  std::cout << "Indexing " << numRequests << " files (" << numRestoredFiles << " files restored from the cache) ..." << std::endl;
+  
+  QEventLoop eventLoop;
+  QObject::connect(&ParseThreadPool::Instance(), &ParseThreadPool::IndexingRequestFinished, &eventLoop, [&]() {
+    if (ParseThreadPool::Instance().GetNumFinishedIndexingRequests() >= numRequests) {
+      eventLoop.quit();
+    }
+  });
+  if (ParseThreadPool::Instance().GetNumFinishedIndexingRequests() < numRequests) {
+    eventLoop.exec();
+  }
+  double indexSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  ClangIndexingSession::Reset();
+  
+  // Count the USRs and references of all files in the index, including the
+  // files restored from the cache. For comparison with the memory usage of the
+  // index, also sum up the size of the USR and spelling strings as if each
+  // decl stored its own copies (instead of referring to interned strings).
+  WaitForUSRIndexCacheLoading();
+  quint64 numUSRs = 0;
+  quint64 numReferences = 0;
+  quint64 uninternedStringBytes = 0;
+  USRStringPool& stringPool = USRStringPool::Instance();
+  USRStorage::Instance().Lock();
+  int numIndexedFiles = USRStorage::Instance().GetAllUSRs().size();
+  for (const auto& item : USRStorage::Instance().GetAllUSRs()) {
+    const USRDeclMap& map = *item.second->map;
+    numUSRs += map.size();
+    numReferences += item.second->references->size();
+    for (int i = 0; i < map.size(); ++ i) {
+      uninternedStringBytes += stringPool.Get(map.GetUSRId(i)).size() + stringPool.Get(map.GetSpellingId(i)).size();
+    }
+  }
+  USRStorage::Instance().Unlock();
+  quint64 indexMemory = USRStorage::Instance().GetMemoryUsage();
+  
+  if (!SaveUSRIndexCache(project.get())) {
+    std::cout << "Error: Failed to write the index cache file: " << GetUSRIndexCachePath(project.get()).toStdString() << std::endl;
+    return 1;
+  }
+  
+  std::cout << "Indexed " << numRequests << " source files in " << indexSeconds << " s"
+            << " (" << (numRequests / std::max(indexSeconds, 1e-9)) << " files/s)" << std::endl;
+  std::cout << "Index: " << numIndexedFiles << " files (including headers) with " << numUSRs << " USRs"
+            << " (" << (numUSRs / std::max(indexSeconds, 1e-9)) << " USRs/s) and " << numReferences << " references" << std::endl;
+  std::cout << "Index memory: " << (indexMemory / (1024 * 1024)) << " MiB with " << stringPool.GetSize() << " interned strings"
+            << " (the strings alone would take " << (uninternedStringBytes / (1024 * 1024)) << " MiB without interning)" << std::endl;
+  USRStorageLockStatistics lockStatistics = USRStorage::Instance().GetLockStatistics();
+  std::cout << "USRStorage lock: taken " << lockStatistics.numLocks << " times (" << lockStatistics.numContendedLocks << " contended),"
+            << " waited " << lockStatistics.waitSeconds << " s, held " << lockStatistics.holdSeconds << " s in total" << std::endl;
+  std::cout << "Peak resident memory: " << (GetProcessPeakResidentMemory() / (1024 * 1024)) << " MiB" << std::endl;
+  std::cout << "Wrote index cache file: " << GetUSRIndexCachePath(project.get()).toStdString() << std::endl;
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  // Initialize libgit2
+  git_libgit2_init();
+  
+  // CIDEBaseLib requires a QApplication, even though no windows are shown
+  // here. Unless configured otherwise, use the offscreen platform such that no
+  // display is required.
+  if (qgetenv("QT_QPA_PLATFORM").isEmpty()) {
+    qputenv("QT_QPA_PLATFORM", "offscreen");
+  }
+  
+  // Initialize Qt. Use the same settings as CIDE.
+  QApplication qapp(argc, argv);
+  QCoreApplication::setOrganizationName("PuzzlePaint");
+  QCoreApplication::setOrganizationDomain("puzzlepaint.net");
+  QCoreApplication::setApplicationName("CIDE");
+  
+  // Parse command-line arguments
+  bool useCache = true;
+  QString projectPath;
+  for (int i = 1; i < argc; ++ i) {
+    if (std::string(argv[i]) == "--no-cache") {
+      useCache = false;
+    } else {
+      projectPath = QString::fromLocal8Bit(argv[i]);
+    }
+  }
+  if (projectPath.isEmpty()) {
+    std::cout << "Usage: " << argv[0] << " [--no-cache] <project.yaml>" << std::endl;
+    return 1;
+  }
+  
+  int result = IndexProject(projectPath, useCache);
+  
+  // Clean up. The parse threads may still need the Qt thread while exiting,
+  // so keep processing events until they are finished.
+  std::atomic<bool> exitFinished;
+  exitFinished = false;
+  std::thread exitThread([&]() {
+    ParseThreadPool::Instance().ExitAllThreads();
+    exitFinished = true;
+  });
+  QEventLoop exitEventLoop;
+  while (!exitFinished) {
+    exitEventLoop.processEvents();
+  }
+  exitThread.join();
+  
+  return result;
+}
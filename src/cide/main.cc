@@ -16,6 +16,8 @@
 #include "cide/parse_thread_pool.h"
 #include "cide/settings.h"
 #include "cide/startup_dialog.h"
+#include "cide/tracing.h"
+#include "cide/usr_index_cache.h"
 #include "cide/util.h"
 
 
@@ -29,6 +31,7 @@ void CleanUp() {
   exitFinished = false;
   std::thread exitThread([&]() {
     ParseThreadPool::Instance().ExitAllThreads();
+    WaitForUSRIndexCacheLoading();
     CodeInfo::Instance().Exit();
     CrashBackup::Instance().Exit();
     GitDiff::Instance().Exit();
@@ -90,6 +93,7 @@ int main(int argc, char** argv) {
   // the next wheelEvent() that "got through", which could have been a long
   // time after the first one, resulting in choppy scrolling.
   qapp.setAttribute(Qt::AA_CompressHighFrequencyEvents, false);
+  SetTraceThreadName("Qt thread");
   
   // Print used libclang version
   qDebug() << "CIDE using libclang" << GetLibclangVersion();
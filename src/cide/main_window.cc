@@ -27,14 +27,18 @@
 #include "cide/about_dialog.h"
 #include "cide/build_target_selector.h"
 #include "cide/cpp_utils.h"
+#include "cide/clang_index.h"
 #include "cide/clang_parser.h"
 #include "cide/clang_utils.h"
 #include "cide/crash_backup.h"
 #include "cide/new_project_dialog.h"
+#include "cide/parse_statistics_widget.h"
 #include "cide/parse_thread_pool.h"
 #include "cide/project_settings.h"
 #include "cide/search_bar.h"
 #include "cide/settings.h"
+#include "cide/tracing.h"
+#include "cide/usr_index_cache.h"
 #include "cide/util.h"
 
 constexpr int maxBuildIssueCount = 200;  // TODO: Make configurable
@@ -219,6 +223,8 @@ MainWindow::MainWindow(QWidget* parent)
   viewMenu->addAction(showProjectFilesDockAction);
   showProjectFilesDockAction->setCheckable(true);
   showProjectFilesDockAction->setChecked(true);
+  showParseStatisticsDockAction = viewMenu->addAction(tr("Show parse statistics dock"), this, &MainWindow::ShowParseStatisticsDock);
+  showParseStatisticsDockAction->setCheckable(true);
   menuBar->addMenu(viewMenu);
   
   QMenu* projectMenu = new QMenu(tr("Project"));
@@ -250,6 +256,13 @@ MainWindow::MainWindow(QWidget* parent)
   connect(runGitkAction, &QAction::triggered, this, &MainWindow::RunGitk);
   toolsMenu->addAction(runGitkAction);
   toolsMenu->addAction(tr("Program settings..."), this, &MainWindow::ShowProgramSettings);
+  toolsMenu->addSeparator();
+  QAction* recordTraceAction = toolsMenu->addAction(tr("Record trace"));
+  recordTraceAction->setCheckable(true);
+  connect(recordTraceAction, &QAction::toggled, [](bool checked) {
+    SetTracingEnabled(checked);
+  });
+  toolsMenu->addAction(tr("Save trace..."), this, &MainWindow::SaveTrace);
   menuBar->addMenu(toolsMenu);
   
   QMenu* helpMenu = new QMenu(tr("Help"));
@@ -453,7 +466,9 @@ bool MainWindow::LoadProject(const QString& path, QWidget* parent) {
   
   UpdateBuildTargetSelector();
   
-  // Start indexing
+  // Restore the indexing information that is still up-to-date, then start
+  // indexing
+  LoadUSRIndexCache(newProject.get());
   if (newProject->GetIndexAllProjectFiles()) {
     numIndexingRequestsCreated += newProject->IndexAllNewFiles(this);
     UpdateIndexingStatus();
@@ -735,6 +750,7 @@ void MainWindow::ReconfigureProject(const std::shared_ptr<Project>& project, QWi
     QMessageBox::warning(parent, tr("Warning"), tr("Configuring the project generated the following warning(s):\n\n%1").arg(warnings));
   }
   
+  LoadUSRIndexCache(project.get());
   if (project->GetIndexAllProjectFiles()) {
     numIndexingRequestsCreated += project->IndexAllNewFiles(this);
     UpdateIndexingStatus();
@@ -1009,6 +1025,12 @@ void MainWindow::CloseProject() {
     return;
   }
   
+  // Files of the closed projects do not need to be indexed anymore.
+  ParseThreadPool::Instance().CancelIndexingRequests();
+  
+  for (const auto& project : projects) {
+    SaveUSRIndexCache(project.get());
+  }
   projects.clear();
   
   emit OpenProjectsChanged();
@@ -1369,6 +1391,10 @@ void MainWindow::UpdateIndexingStatus() {
   
   if (progressPercentage == 100) {
     statusTextLabel->setVisible(false);
+    
+    // Files may be edited from now on, so the function bodies that were
+    // skipped while indexing must not be skipped anymore.
+    ClangIndexingSession::Reset();
   } else {
     statusTextLabel->setVisible(true);
     statusTextLabel->setText(tr("Indexing (%1)").arg(QString::number(progressPercentage) + QStringLiteral("%")));
@@ -2035,6 +2061,39 @@ void MainWindow::ShowDocumentationDock(const QUrl& url) {
   }
 }
 
+void MainWindow::ShowParseStatisticsDock() {
+  if (!parseStatisticsDock) {
+    parseStatisticsDock = new QDockWidget(tr("Parse statistics"));
+    parseStatisticsDock->setWidget(new ParseStatisticsWidget());
+    connect(parseStatisticsDock, &QDockWidget::visibilityChanged, [&]() {
+      showParseStatisticsDockAction->setChecked(parseStatisticsDock->isVisible());
+    });
+  }
+  
+  if (!parseStatisticsDock->isVisible()) {
+    addDockWidget(Qt::BottomDockWidgetArea, parseStatisticsDock);
+    parseStatisticsDock->show();
+  } else {
+    removeDockWidget(parseStatisticsDock);
+    parseStatisticsDock->hide();
+  }
+  showParseStatisticsDockAction->setChecked(parseStatisticsDock->isVisible());
+}
+
+void MainWindow::SaveTrace() {
+  QString path = QFileDialog::getSaveFileName(
+      this,
+      tr("Save trace"),
+      QString(),
+      tr("Trace files (*.json)"));
+  if (path.isEmpty()) {
+    return;
+  }
+  if (!WriteTraceJSON(path)) {
+    QMessageBox::warning(this, tr("Error"), tr("Cannot write file: %1").arg(path));
+  }
+}
+
 void MainWindow::RunGitk() {
   // TODO: Allow choosing the project
   if (projects.empty()) {
@@ -2266,6 +2325,12 @@ void MainWindow::closeEvent(QCloseEvent* event) {
     project->Save(project->GetYAMLFilePath());
   }
   
+  // Save the indexing information, such that it does not need to be recomputed
+  // on the next start
+  for (const auto& project : projects) {
+    SaveUSRIndexCache(project.get());
+  }
+  
   // Save the session (list of open documents)
   SaveSession();
   
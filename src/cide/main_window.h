@@ -19,6 +19,7 @@
 #include "cide/document_widget_container.h"
 #include "cide/find_and_replace_in_files.h"
 #include "cide/project.h"
+#include "cide/project_host.h"
 #include "cide/project_tree_view.h"
 #include "cide/run_gdb.h"
 #include "cide/tab_bar.h"
@@ -34,7 +35,7 @@ class QTreeWidget;
 class SearchBar;
 class WidgetWithRightClickSignal;
 
-class MainWindow : public QMainWindow {
+class MainWindow : public QMainWindow, public ProjectHost {
  Q_OBJECT
  public:
   MainWindow(QWidget* parent = nullptr);
@@ -51,7 +52,7 @@ class MainWindow : public QMainWindow {
   
   /// Returns the DocumentWidget for the given document, or null if the document
   /// is not open.
-  DocumentWidget* GetWidgetForDocument(Document* document) const;
+  DocumentWidget* GetWidgetForDocument(Document* document) const override;
   
   /// Returns the current project. This is the project that the current file
   /// is probably associated with, or an unspecified open project if there is
@@ -59,25 +60,25 @@ class MainWindow : public QMainWindow {
   std::shared_ptr<Project> GetCurrentProject();
   
   /// Returns the number of open documents.
-  inline int GetNumDocuments() const { return tabBar->count(); }
+  inline int GetNumDocuments() const override { return tabBar->count(); }
   
   /// Returns the open document with the given index in [0, GetNumOpenDocuments()[.
-  std::shared_ptr<Document> GetDocument(int index);
+  std::shared_ptr<Document> GetDocument(int index) override;
   
   /// Returns whether the given file is open in any tab.
   bool IsFileOpen(const QString& canonicalPath) const;
   
   /// If the file is open in any tab, returns its Document and DocumentWidget.
   /// Returns true if successful, false otherwise.
-  bool GetDocumentAndWidgetForPath(const QString& canonicalPath, Document** document, DocumentWidget** widget) const;
+  bool GetDocumentAndWidgetForPath(const QString& canonicalPath, Document** document, DocumentWidget** widget) const override;
   
-  inline std::vector<std::shared_ptr<Project>>& GetProjects() { return projects; }
+  inline std::vector<std::shared_ptr<Project>>& GetProjects() override { return projects; }
   
   inline const QString& GetCurrentFrameCanonicalPath() const { return currentFrameCanonicalPath; }
   inline int GetCurrentFrameLine() const { return currentFrameLine; }
   
   /// Notifies the main window about a parse iteration being finished for the document.
-  void DocumentParsed(Document* document);
+  void DocumentParsed(Document* document) override;
   
   /// Returns the default newline format: If a project is open and a specific format has been configured for it,
   /// returns this format, otherwise returns the program-wide setting.
@@ -169,9 +170,15 @@ class MainWindow : public QMainWindow {
   
   void ShowDocumentationDock(const QUrl& url);
   
+  /// Shows or hides the dock with the ParseStatisticsWidget.
+  void ShowParseStatisticsDock();
+  
   void RunGitk();
   void ShowProgramSettings();
   
+  /// Asks for a file path and saves the recorded trace to it.
+  void SaveTrace();
+  
   void ShowAboutDialog();
   
   /// Expects an URL like "file://filepath:line:column". If the file is open in
@@ -326,6 +333,10 @@ class MainWindow : public QMainWindow {
   QPushButton* documentationBackButton;
   QPushButton* documentationForwardButton;
   
+  // Parse statistics dock widget
+  QDockWidget* parseStatisticsDock = nullptr;
+  QAction* showParseStatisticsDockAction;
+  
   /// Contains all document widgets. Indices correspond to those in tabBar.
   QStackedLayout* documentLayout;
 };
@@ -0,0 +1,100 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/parse_statistics.h"
+
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+/// Record of the parse that runs in the current thread, see
+/// ParseStatistics::GetCurrentRecord().
+static thread_local FileParseStatistics* currentRecord = nullptr;
+
+ParseStatistics& ParseStatistics::Instance() {
+  static ParseStatistics instance;
+  return instance;
+}
+
+FileParseStatistics* ParseStatistics::GetCurrentRecord() {
+  return currentRecord;
+}
+
+void ParseStatistics::SetCurrentRecord(FileParseStatistics* record) {
+  currentRecord = record;
+}
+
+void ParseStatistics::AddRecord(const FileParseStatistics& record) {
+  std::unique_lock<std::mutex> lock(mutex);
+  records[record.path] = record;
+  ++ version;
+}
+
+void ParseStatistics::Clear() {
+  std::unique_lock<std::mutex> lock(mutex);
+  records.clear();
+  ++ version;
+}
+
+std::vector<FileParseStatistics> ParseStatistics::GetRecords() {
+  std::unique_lock<std::mutex> lock(mutex);
+  std::vector<FileParseStatistics> result;
+  result.reserve(records.size());
+  for (const auto& item : records) {
+    result.push_back(item.second);
+  }
+  return result;
+}
+
+QByteArray ParseStatistics::ToCSV(const std::vector<FileParseStatistics>& records) {
+  QByteArray result =
+      "path,finish_time_ms,was_open,reparsed,preamble_likely_unchanged,"
+      "queue_seconds,parse_seconds,pch_seconds,index_seconds,highlighting_seconds,qt_thread_seconds,total_seconds,"
+      "tu_memory_bytes,estimated_memory_bytes\n";
+  for (const FileParseStatistics& record : records) {
+    // Quote the path, doubling any quotes within it.
+    QByteArray path = record.path.toUtf8();
+    path.replace('"', "\"\"");
+    result += '"' + path + '"';
+    
+    result += ',' + QByteArray::number(record.finishTime);
+    result += ',' + QByteArray::number(record.wasOpen ? 1 : 0);
+    result += ',' + QByteArray::number(record.reparsed ? 1 : 0);
+    result += ',' + QByteArray::number(record.preambleIsLikelyUnchanged ? 1 : 0);
+    result += ',' + QByteArray::number(record.queueSeconds);
+    result += ',' + QByteArray::number(record.parseSeconds);
+    result += ',' + QByteArray::number(record.pchSeconds);
+    result += ',' + QByteArray::number(record.indexSeconds);
+    result += ',' + QByteArray::number(record.highlightingSeconds);
+    result += ',' + QByteArray::number(record.qtThreadSeconds);
+    result += ',' + QByteArray::number(record.totalSeconds);
+    result += ',' + QByteArray::number(record.tuMemory);
+    result += ',' + QByteArray::number(record.estimatedMemory);
+    result += '\n';
+  }
+  return result;
+}
+
+QByteArray ParseStatistics::ToJSON(const std::vector<FileParseStatistics>& records) {
+  QJsonArray array;
+  for (const FileParseStatistics& record : records) {
+    QJsonObject object;
+    object["path"] = record.path;
+    object["finish_time_ms"] = static_cast<double>(record.finishTime);
+    object["was_open"] = record.wasOpen;
+    object["reparsed"] = record.reparsed;
+    object["preamble_likely_unchanged"] = record.preambleIsLikelyUnchanged;
+    object["queue_seconds"] = record.queueSeconds;
+    object["parse_seconds"] = record.parseSeconds;
+    object["pch_seconds"] = record.pchSeconds;
+    object["index_seconds"] = record.indexSeconds;
+    object["highlighting_seconds"] = record.highlightingSeconds;
+    object["qt_thread_seconds"] = record.qtThreadSeconds;
+    object["total_seconds"] = record.totalSeconds;
+    object["tu_memory_bytes"] = static_cast<double>(record.tuMemory);
+    object["estimated_memory_bytes"] = static_cast<double>(record.estimatedMemory);
+    array.append(object);
+  }
+  return QJsonDocument(array).toJson();
+}
@@ -0,0 +1,111 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+
+#include "cide/util.h"
+
+/// Timings and memory usage of one parse or indexing run of a file. All times
+/// are in seconds, all sizes in bytes.
+struct FileParseStatistics {
+  /// Canonical path of the file.
+  QString path;
+  
+  /// Time at which the parse finished, in milliseconds since the epoch.
+  qint64 finishTime = 0;
+  
+  /// True if the file was open (and thus parsed fully), false if it was only
+  /// indexed.
+  bool wasOpen = false;
+  
+  /// True if an existing TU was reparsed instead of being created from scratch.
+  bool reparsed = false;
+  
+  /// True if the includes of the file did not change, such that the preamble
+  /// was likely reused and the inclusions did not need to be updated.
+  bool preambleIsLikelyUnchanged = false;
+  
+  /// Time that the request waited in the ParseThreadPool queue.
+  double queueSeconds = 0;
+  
+  /// Time in clang_parseTranslationUnit2(), clang_reparseTranslationUnit(),
+  /// or libclang's indexing API (respectively, glslang for GLSL files).
+  double parseSeconds = 0;
+  
+  /// Time for building or checking the precompiled header.
+  double pchSeconds = 0;
+  
+  /// Time for extracting the inclusions and storing the USRs.
+  double indexSeconds = 0;
+  
+  /// Time for the token and AST visitation that yields the highlighting.
+  double highlightingSeconds = 0;
+  
+  /// Time spent in RunInQtThreadBlocking(), including the time for applying
+  /// the results to the document in the Qt thread.
+  double qtThreadSeconds = 0;
+  
+  /// Total time of the parse, excluding queueSeconds.
+  double totalSeconds = 0;
+  
+  /// Memory used by the libclang TU, as reported by clang_getCXTUResourceUsage().
+  quint64 tuMemory = 0;
+  
+  /// Memory usage of the parse that the ParseThreadPool estimated for admitting
+  /// it, based on the tuMemory of previous parses.
+  quint64 estimatedMemory = 0;
+};
+
+/// Singleton class which records the FileParseStatistics of the parses done by
+/// the ParseThreadPool, keeping the latest record for each file.
+class ParseStatistics {
+ public:
+  static ParseStatistics& Instance();
+  
+  /// Returns the record that the parse running in the calling thread should
+  /// fill in, or null if no statistics are recorded for the calling thread.
+  static FileParseStatistics* GetCurrentRecord();
+  
+  /// Sets the record returned by GetCurrentRecord() for the calling thread.
+  static void SetCurrentRecord(FileParseStatistics* record);
+  
+  /// Stores the record, replacing any previous record for the same file. Can
+  /// be called from any thread.
+  void AddRecord(const FileParseStatistics& record);
+  
+  /// Removes all records.
+  void Clear();
+  
+  /// Returns a copy of all records. Can be called from any thread.
+  std::vector<FileParseStatistics> GetRecords();
+  
+  /// Returns a number that changes each time the records are modified.
+  inline int GetVersion() {
+    std::unique_lock<std::mutex> lock(mutex);
+    return version;
+  }
+  
+  /// Formats the records as CSV, with one line per record after a header line.
+  static QByteArray ToCSV(const std::vector<FileParseStatistics>& records);
+  
+  /// Formats the records as a JSON array of objects.
+  static QByteArray ToJSON(const std::vector<FileParseStatistics>& records);
+  
+ private:
+  ParseStatistics() = default;
+  
+  /// Maps canonical file path --> latest record for that file.
+  std::unordered_map<QString, FileParseStatistics> records;
+  
+  int version = 0;
+  
+  std::mutex mutex;
+};
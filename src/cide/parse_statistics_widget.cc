@@ -0,0 +1,181 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/parse_statistics_widget.h"
+
+#include <QBoxLayout>
+#include <QDateTime>
+#include <QFile>
+#include <QFileDialog>
+#include <QFileInfo>
+#include <QHeaderView>
+#include <QMessageBox>
+#include <QPushButton>
+#include <QTimer>
+#include <QTreeWidget>
+
+#include "cide/parse_statistics.h"
+
+/// Tree widget item that sorts numerically by the numbers in its DisplayRole
+/// data instead of comparing the displayed strings.
+class ParseStatisticsItem : public QTreeWidgetItem {
+ public:
+  bool operator< (const QTreeWidgetItem& other) const override {
+    int column = treeWidget()->sortColumn();
+    QVariant a = data(column, Qt::DisplayRole);
+    QVariant b = other.data(column, Qt::DisplayRole);
+    if (a.type() == QVariant::Double && b.type() == QVariant::Double) {
+      return a.toDouble() < b.toDouble();
+    }
+    return QTreeWidgetItem::operator<(other);
+  }
+};
+
+enum class ParseStatisticsColumn {
+  Path = 0,
+  FinishTime,
+  WasOpen,
+  Reparsed,
+  PreambleUnchanged,
+  Queue,
+  Parse,
+  PCH,
+  Index,
+  Highlighting,
+  QtThread,
+  Total,
+  TUMemory,
+  EstimatedMemory,
+  Count
+};
+
+ParseStatisticsWidget::ParseStatisticsWidget(QWidget* parent)
+    : QWidget(parent) {
+  tree = new QTreeWidget();
+  tree->setRootIsDecorated(false);
+  tree->setUniformRowHeights(true);
+  tree->setColumnCount(static_cast<int>(ParseStatisticsColumn::Count));
+  tree->setHeaderLabels(QStringList{
+      tr("File"),
+      tr("Finished"),
+      tr("Open"),
+      tr("Reparsed"),
+      tr("Preamble unchanged"),
+      tr("Queue [ms]"),
+      tr("Parse [ms]"),
+      tr("PCH [ms]"),
+      tr("Index [ms]"),
+      tr("Highlighting [ms]"),
+      tr("Qt thread [ms]"),
+      tr("Total [ms]"),
+      tr("TU memory [MiB]"),
+      tr("Estimated memory [MiB]")});
+  tree->setSortingEnabled(true);
+  tree->sortByColumn(static_cast<int>(ParseStatisticsColumn::Total), Qt::DescendingOrder);
+  
+  QPushButton* clearButton = new QPushButton(tr("Clear"));
+  connect(clearButton, &QPushButton::clicked, this, &ParseStatisticsWidget::ClearClicked);
+  QPushButton* exportButton = new QPushButton(tr("Export..."));
+  connect(exportButton, &QPushButton::clicked, this, &ParseStatisticsWidget::ExportClicked);
+  
+  QHBoxLayout* buttonsLayout = new QHBoxLayout();
+  buttonsLayout->setContentsMargins(0, 0, 0, 0);
+  buttonsLayout->addWidget(clearButton);
+  buttonsLayout->addStretch(1);
+  buttonsLayout->addWidget(exportButton);
+  
+  QVBoxLayout* layout = new QVBoxLayout();
+  layout->addLayout(buttonsLayout);
+  layout->addWidget(tree, 1);
+  setLayout(layout);
+  
+  // Poll for changes while the widget is visible, as the statistics are
+  // recorded by the parse threads.
+  updateTimer = new QTimer(this);
+  updateTimer->setInterval(1000);
+  connect(updateTimer, &QTimer::timeout, this, &ParseStatisticsWidget::UpdateIfChanged);
+}
+
+void ParseStatisticsWidget::UpdateIfChanged() {
+  int version = ParseStatistics::Instance().GetVersion();
+  if (version == shownVersion) {
+    return;
+  }
+  shownVersion = version;
+  
+  std::vector<FileParseStatistics> records = ParseStatistics::Instance().GetRecords();
+  
+  tree->setSortingEnabled(false);
+  tree->clear();
+  QList<QTreeWidgetItem*> items;
+  items.reserve(records.size());
+  for (const FileParseStatistics& record : records) {
+    ParseStatisticsItem* item = new ParseStatisticsItem();
+    auto setMilliseconds = [&](ParseStatisticsColumn column, double seconds) {
+      item->setData(static_cast<int>(column), Qt::DisplayRole, 0.1 * qRound(10000 * seconds));
+    };
+    auto setMebibytes = [&](ParseStatisticsColumn column, quint64 bytes) {
+      item->setData(static_cast<int>(column), Qt::DisplayRole, 0.1 * qRound(10 * bytes / (1024. * 1024.)));
+    };
+    
+    item->setText(static_cast<int>(ParseStatisticsColumn::Path), QFileInfo(record.path).fileName());
+    item->setToolTip(static_cast<int>(ParseStatisticsColumn::Path), record.path);
+    item->setText(static_cast<int>(ParseStatisticsColumn::FinishTime), QDateTime::fromMSecsSinceEpoch(record.finishTime).toString(QStringLiteral("hh:mm:ss.zzz")));
+    item->setText(static_cast<int>(ParseStatisticsColumn::WasOpen), record.wasOpen ? tr("yes") : tr("no"));
+    item->setText(static_cast<int>(ParseStatisticsColumn::Reparsed), record.reparsed ? tr("yes") : tr("no"));
+    item->setText(static_cast<int>(ParseStatisticsColumn::PreambleUnchanged), record.preambleIsLikelyUnchanged ? tr("yes") : tr("no"));
+    setMilliseconds(ParseStatisticsColumn::Queue, record.queueSeconds);
+    setMilliseconds(ParseStatisticsColumn::Parse, record.parseSeconds);
+    setMilliseconds(ParseStatisticsColumn::PCH, record.pchSeconds);
+    setMilliseconds(ParseStatisticsColumn::Index, record.indexSeconds);
+    setMilliseconds(ParseStatisticsColumn::Highlighting, record.highlightingSeconds);
+    setMilliseconds(ParseStatisticsColumn::QtThread, record.qtThreadSeconds);
+    setMilliseconds(ParseStatisticsColumn::Total, record.totalSeconds);
+    setMebibytes(ParseStatisticsColumn::TUMemory, record.tuMemory);
+    setMebibytes(ParseStatisticsColumn::EstimatedMemory, record.estimatedMemory);
+    items.append(item);
+  }
+  tree->addTopLevelItems(items);
+  tree->setSortingEnabled(true);
+  tree->resizeColumnToContents(static_cast<int>(ParseStatisticsColumn::Path));
+}
+
+void ParseStatisticsWidget::ClearClicked() {
+  ParseStatistics::Instance().Clear();
+  UpdateIfChanged();
+}
+
+void ParseStatisticsWidget::ExportClicked() {
+  QString path = QFileDialog::getSaveFileName(
+      this,
+      tr("Export parse statistics"),
+      QString(),
+      tr("CSV files (*.csv);;JSON files (*.json)"));
+  if (path.isEmpty()) {
+    return;
+  }
+  
+  std::vector<FileParseStatistics> records = ParseStatistics::Instance().GetRecords();
+  QByteArray data = path.endsWith(QStringLiteral(".json"), Qt::CaseInsensitive) ?
+                        ParseStatistics::ToJSON(records) :
+                        ParseStatistics::ToCSV(records);
+  
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly)) {
+    QMessageBox::warning(this, tr("Error"), tr("Cannot write file: %1").arg(path));
+    return;
+  }
+  file.write(data);
+}
+
+void ParseStatisticsWidget::showEvent(QShowEvent* event) {
+  QWidget::showEvent(event);
+  UpdateIfChanged();
+  updateTimer->start();
+}
+
+void ParseStatisticsWidget::hideEvent(QHideEvent* event) {
+  QWidget::hideEvent(event);
+  updateTimer->stop();
+}
@@ -0,0 +1,36 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <QWidget>
+
+class QTimer;
+class QTreeWidget;
+
+/// Shows the ParseStatistics in a sortable table, with buttons to clear and to
+/// export them. The table is updated periodically while the widget is visible.
+class ParseStatisticsWidget : public QWidget {
+ Q_OBJECT
+ public:
+  explicit ParseStatisticsWidget(QWidget* parent = nullptr);
+  
+ public slots:
+  /// Updates the table if the statistics changed since the last update.
+  void UpdateIfChanged();
+  
+  void ClearClicked();
+  void ExportClicked();
+  
+ protected:
+  void showEvent(QShowEvent* event) override;
+  void hideEvent(QHideEvent* event) override;
+  
+ private:
+  QTreeWidget* tree;
+  QTimer* updateTimer;
+  
+  /// ParseStatistics version that is shown, or -1 if none is shown yet.
+  int shownVersion = -1;
+};
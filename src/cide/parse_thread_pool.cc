@@ -4,20 +4,54 @@
 
 #include "cide/parse_thread_pool.h"
 
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+#include <QDateTime>
+#include <QFileInfo>
+
 #include "cide/clang_parser.h"
 #include "cide/document.h"
 #include "cide/document_widget.h"
 #include "cide/glsl_parser.h"
 #include "cide/main_window.h"
+#include "cide/parse_statistics.h"
 #include "cide/qt_thread.h"
+#include "cide/settings.h"
+#include "cide/tracing.h"
+#include "cide/util.h"
+
+/// Estimated memory usage of a parse before any parse has been measured.
+/// Parses of large TUs peak at 1 - 2 GiB.
+constexpr quint64 kDefaultParseMemoryEstimate = 1536ull * 1024 * 1024;
+
+/// Fraction of the physical memory that is used as memory budget by default.
+constexpr double kDefaultMemoryBudgetFraction = 0.6;
 
 ParseThreadPool::ParseThreadPool() {
   mExit = false;
   numFinishedIndexingRequests = 0;
   
-  constexpr int kThreadCount = 8;  // TODO: Make configurable
-  mThreads.resize(kThreadCount);
-  for (int i = 0; i < kThreadCount; ++ i) {
+  int threadCount = Settings::Instance().GetParseThreadCount();
+  if (threadCount <= 0) {
+    threadCount = std::max<int>(1, std::thread::hardware_concurrency());
+  }
+  
+  int memoryBudgetMiB = Settings::Instance().GetParseMemoryBudgetMiB();
+  if (memoryBudgetMiB > 0) {
+    memoryBudget = static_cast<quint64>(memoryBudgetMiB) * 1024 * 1024;
+  } else {
+    quint64 physicalMemory = GetPhysicalMemorySize();
+    if (physicalMemory > 0) {
+      memoryBudget = static_cast<quint64>(kDefaultMemoryBudgetFraction * physicalMemory);
+    } else {
+      memoryBudget = std::numeric_limits<quint64>::max();
+    }
+  }
+  
+  mThreads.resize(threadCount);
+  for (int i = 0; i < threadCount; ++ i) {
     mThreads[i].reset(new std::thread(&ParseThreadPool::ThreadMain, this));
   }
 }
@@ -31,67 +65,110 @@ ParseThreadPool& ParseThreadPool::Instance() {
   return instance;
 }
 
-void ParseThreadPool::RequestParse(const std::shared_ptr<Document>& document, ParseRequest::Language language, DocumentWidget* widget, MainWindow* mainWindow) {
-  std::unique_lock<std::mutex> lock(parseRequestMutex);
-  for (const ParseRequest& request : parseRequests) {
-    if (request.document.get() == document.get()) {
-      // There is already a queued parse request for this document.
-      return;
-    }
+/// Returns the key under which requests for the given file are queued.
+static QString GetRequestKey(const QString& canonicalPath, const Document* document) {
+  if (canonicalPath.isEmpty()) {
+    // Documents which have not been saved yet do not have a path.
+    return QStringLiteral("unsaved:") + QString::number(reinterpret_cast<quintptr>(document));
   }
-  
+  return canonicalPath;
+}
+
+/// Returns the canonical version of a document path, such that requests for
+/// the same file are keyed identically. If the file does not exist (anymore),
+/// the path is returned unchanged.
+static QString CanonicalizeDocumentPath(const QString& path) {
+  if (path.isEmpty()) {
+    return path;
+  }
+  QString canonicalPath = QFileInfo(path).canonicalFilePath();
+  return canonicalPath.isEmpty() ? path : canonicalPath;
+}
+
+/// Returns the current time in milliseconds, used for ordering the requests.
+static qint64 GetQueueTime() {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void ParseThreadPool::RequestParse(const std::shared_ptr<Document>& document, ParseRequest::Language language, DocumentWidget* widget, ProjectHost* host) {
   ParseRequest newRequest;
   newRequest.language = language;
   newRequest.mode = ParseRequest::Mode::ParseIfOpen;
   newRequest.document = document;
-  newRequest.canonicalPath = document->path();
-  newRequest.mainWindow = mainWindow;
+  newRequest.canonicalPath = CanonicalizeDocumentPath(document->path());
+  newRequest.host = host;
   newRequest.widget = widget;
-  newRequest.isIndexingRequest = false;
-  parseRequests.push_back(newRequest);
+  
+  std::unique_lock<std::mutex> lock(parseRequestMutex);
+  QueueRequest(newRequest, 0);
   lock.unlock();
   newParseRequestCondition.notify_one();
 }
 
-void ParseThreadPool::RequestParseIfOpenElseIndex(const QString& canonicalPath, MainWindow* mainWindow) {
-  std::unique_lock<std::mutex> lock(parseRequestMutex);
-  
+void ParseThreadPool::RequestParseIfOpenElseIndex(const QString& canonicalPath, ProjectHost* host, ParseRequest::Language language) {
   ParseRequest newRequest;
-  newRequest.language = ParseRequest::Language::CorCXX;
+  newRequest.language = language;
   newRequest.mode = ParseRequest::Mode::ParseIfOpenElseIndex;
   newRequest.canonicalPath = canonicalPath;
   newRequest.document = nullptr;
   newRequest.widget = nullptr;
-  if (mainWindow) {
-    for (int i = 0; i < mainWindow->GetNumDocuments(); ++ i) {
-      if (mainWindow->GetDocument(i)->path() == canonicalPath) {
-        newRequest.document = mainWindow->GetDocument(i);
-        newRequest.widget = mainWindow->GetWidgetForDocument(newRequest.document.get());
+  if (host) {
+    for (int i = 0; i < host->GetNumDocuments(); ++ i) {
+      if (CanonicalizeDocumentPath(host->GetDocument(i)->path()) == canonicalPath) {
+        newRequest.document = host->GetDocument(i);
+        newRequest.widget = host->GetWidgetForDocument(newRequest.document.get());
       }
     }
   }
-  newRequest.mainWindow = mainWindow;
-  newRequest.isIndexingRequest = true;
+  newRequest.host = host;
   
-  parseRequests.push_back(newRequest);
+  std::unique_lock<std::mutex> lock(parseRequestMutex);
+  QueueRequest(newRequest, 1);
   lock.unlock();
   newParseRequestCondition.notify_one();
 }
 
 void ParseThreadPool::SetOpenAndCurrentDocuments(const QString& currentDocument, const QStringList& openDocuments) {
+  QString canonicalCurrentDocument = CanonicalizeDocumentPath(currentDocument);
+  std::vector<QString> canonicalOpenDocuments;
+  canonicalOpenDocuments.reserve(openDocuments.size());
+  for (const QString& path : openDocuments) {
+    canonicalOpenDocuments.push_back(CanonicalizeDocumentPath(path));
+  }
+  
   std::unique_lock<std::mutex> lock(parseRequestMutex);
-  currentDocumentPath = currentDocument;
-  openDocumentPaths = openDocuments;
+  
+  // Collect the paths whose priority may change.
+  std::unordered_set<QString> changedPaths = openDocumentPaths;
+  changedPaths.insert(currentDocumentPath);
+  changedPaths.insert(canonicalCurrentDocument);
+  
+  currentDocumentPath = canonicalCurrentDocument;
+  openDocumentPaths.clear();
+  for (const QString& path : canonicalOpenDocuments) {
+    openDocumentPaths.insert(path);
+    changedPaths.insert(path);
+  }
+  
+  for (const QString& path : changedPaths) {
+    auto it = queuedRequests.find(path);
+    if (it == queuedRequests.end()) {
+      continue;
+    }
+    QueuedRequest* queued = it->second.get();
+    int newPriority = GetPriority(path);
+    if (newPriority != queued->priority) {
+      queued->priority = newPriority;
+      HeapUpdate(queued);
+    }
+  }
 }
 
 bool ParseThreadPool::DoesAParseRequestExistForDocument(const Document* document) {
+  QString key = GetRequestKey(CanonicalizeDocumentPath(document->path()), document);
   std::unique_lock<std::mutex> lock(parseRequestMutex);
-  for (const ParseRequest& request : parseRequests) {
-    if (request.document.get() == document) {
-      return true;
-    }
-  }
-  return false;
+  auto it = queuedRequests.find(key);
+  return it != queuedRequests.end() && it->second->request.document.get() == document;
 }
 
 bool ParseThreadPool::IsDocumentBeingParsed(const Document* document) {
@@ -107,11 +184,24 @@ bool ParseThreadPool::IsDocumentBeingParsed(const Document* document) {
 void ParseThreadPool::WidgetRemoved(DocumentWidget* widget) {
   std::unique_lock<std::mutex> lock(parseRequestMutex);
   
-  for (auto it = parseRequests.begin(); it != parseRequests.end(); ) {
-    if (it->widget == widget) {
-      it = parseRequests.erase(it);
-    } else {
+  // Note: This iterates over all queued requests (instead of looking up the
+  //       request by the document path) since the path of the document may
+  //       have changed after the request was queued.
+  for (auto it = queuedRequests.begin(); it != queuedRequests.end(); ) {
+    QueuedRequest* queued = it->second.get();
+    if (queued->request.widget != widget) {
       ++ it;
+    } else if (queued->numIndexingRequests > 0) {
+      // Keep the request for indexing the file.
+      queued->request.document = nullptr;
+      queued->request.widget = nullptr;
+      queued->request.mode = ParseRequest::Mode::ParseIfOpenElseIndex;
+      ++ it;
+    } else {
+      if (queued->heapIndex >= 0) {
+        HeapRemove(queued);
+      }
+      it = queuedRequests.erase(it);
     }
   }
   
@@ -124,98 +214,291 @@ void ParseThreadPool::WidgetRemoved(DocumentWidget* widget) {
   }
 }
 
+void ParseThreadPool::CancelIndexingRequests() {
+  std::unique_lock<std::mutex> lock(parseRequestMutex);
+  
+  int numCancelledRequests = 0;
+  for (auto it = queuedRequests.begin(); it != queuedRequests.end(); ) {
+    QueuedRequest* queued = it->second.get();
+    if (queued->numIndexingRequests == 0) {
+      ++ it;
+      continue;
+    }
+    
+    numCancelledRequests += queued->numIndexingRequests;
+    queued->numIndexingRequests = 0;
+    if (queued->request.document) {
+      // Keep parsing the open document.
+      ++ it;
+    } else {
+      if (queued->heapIndex >= 0) {
+        HeapRemove(queued);
+      }
+      it = queuedRequests.erase(it);
+    }
+  }
+  
+  lock.unlock();
+  
+  if (numCancelledRequests > 0) {
+    numFinishedIndexingRequests += numCancelledRequests;
+    emit IndexingRequestFinished();
+  }
+}
+
 void ParseThreadPool::ExitAllThreads() {
+  parseRequestMutex.lock();
   mExit = true;
+  parseRequestMutex.unlock();
   newParseRequestCondition.notify_all();
+  parseFinishedCondition.notify_all();
   for (int i = 0; i < mThreads.size(); ++ i) {
     mThreads[i]->join();
   }
   mThreads.clear();
 }
 
-int ParseThreadPool::FindRequestToParse() {
-  // Priorities:
-  // 0 - no special prioritization
-  // 1 - document is open
-  // 2 - document is current
-  int bestPriority = -1;
-  constexpr int bestPossiblePriority = 2;
-  int bestIndex = -1;
+void ParseThreadPool::QueueRequest(const ParseRequest& request, int numIndexingRequests) {
+  QString key = GetRequestKey(request.canonicalPath, request.document.get());
   
-  // Iterate over all pending parse requests
-  for (std::size_t i = 0; i < parseRequests.size(); ++ i) {
-    const ParseRequest& candidateRequest = parseRequests[i];
-    
-    // If the document is being parsed, do not start parsing it again before the
-    // first parse exits.
-    bool isBeingParsed = false;
-    for (const std::shared_ptr<Document>& document : documentsBeingParsed) {
-      if (document.get() == candidateRequest.document.get()) {
-        isBeingParsed = true;
-        break;
-      }
+  auto it = queuedRequests.find(key);
+  if (it != queuedRequests.end()) {
+    // Merge the request into the existing one. The merged request keeps its
+    // place in the queue.
+    QueuedRequest* queued = it->second.get();
+    if (request.document) {
+      queued->request.document = request.document;
+      queued->request.widget = request.widget;
     }
-    if (isBeingParsed) {
-      continue;
+    if (request.mode == ParseRequest::Mode::ParseIfOpenElseIndex) {
+      queued->request.mode = ParseRequest::Mode::ParseIfOpenElseIndex;
     }
-    
-    // Determine the priority
-    int priority = 0;
-    if (candidateRequest.canonicalPath == currentDocumentPath) {
-      priority = 2;
-    } else if (openDocumentPaths.contains(candidateRequest.canonicalPath)) {
-      priority = 1;
+    queued->request.language = request.language;
+    queued->request.host = request.host;
+    queued->numIndexingRequests += numIndexingRequests;
+    return;
+  }
+  
+  QueuedRequest* queued = new QueuedRequest();
+  queued->request = request;
+  queued->key = key;
+  queued->numIndexingRequests = numIndexingRequests;
+  queued->priority = GetPriority(request.canonicalPath);
+  queued->queueTime = GetQueueTime();
+  queued->sequenceNumber = nextSequenceNumber;
+  ++ nextSequenceNumber;
+  queued->heapIndex = -1;
+  queuedRequests[key].reset(queued);
+  
+  // If the file is being parsed, do not start parsing it again before the
+  // first parse exits. The request gets added to the heap once this is done.
+  if (keysBeingParsed.count(key) == 0) {
+    HeapPush(queued);
+  }
+}
+
+int ParseThreadPool::GetPriority(const QString& canonicalPath) const {
+  if (canonicalPath.isEmpty()) {
+    return 0;
+  } else if (canonicalPath == currentDocumentPath) {
+    return 2;
+  } else if (openDocumentPaths.count(canonicalPath) > 0) {
+    return 1;
+  }
+  return 0;
+}
+
+bool ParseThreadPool::IsBefore(const QueuedRequest* a, const QueuedRequest* b) {
+  // The priority is strict, such that the current document is reparsed
+  // promptly also during long indexing runs. The waiting time only orders
+  // requests within the same priority level.
+  if (a->priority != b->priority) {
+    return a->priority > b->priority;
+  }
+  if (a->queueTime != b->queueTime) {
+    return a->queueTime < b->queueTime;
+  }
+  return a->sequenceNumber < b->sequenceNumber;
+}
+
+void ParseThreadPool::HeapPush(QueuedRequest* request) {
+  requestHeap.push_back(request);
+  request->heapIndex = requestHeap.size() - 1;
+  HeapSiftUp(request->heapIndex);
+}
+
+void ParseThreadPool::HeapRemove(QueuedRequest* request) {
+  int index = request->heapIndex;
+  QueuedRequest* last = requestHeap.back();
+  requestHeap.pop_back();
+  request->heapIndex = -1;
+  if (last != request) {
+    HeapSet(index, last);
+    HeapUpdate(last);
+  }
+}
+
+void ParseThreadPool::HeapUpdate(QueuedRequest* request) {
+  if (request->heapIndex < 0) {
+    return;
+  }
+  HeapSiftUp(request->heapIndex);
+  HeapSiftDown(request->heapIndex);
+}
+
+void ParseThreadPool::HeapSiftUp(int index) {
+  QueuedRequest* request = requestHeap[index];
+  while (index > 0) {
+    int parentIndex = (index - 1) / 2;
+    if (!IsBefore(request, requestHeap[parentIndex])) {
+      break;
     }
-    
-    // New best request?
-    if (priority > bestPriority) {
-      bestPriority = priority;
-      bestIndex = i;
-      if (bestPriority == bestPossiblePriority) {
-        // No further search necessary
-        break;
-      }
+    HeapSet(index, requestHeap[parentIndex]);
+    index = parentIndex;
+  }
+  HeapSet(index, request);
+}
+
+void ParseThreadPool::HeapSiftDown(int index) {
+  QueuedRequest* request = requestHeap[index];
+  int size = requestHeap.size();
+  while (true) {
+    int childIndex = 2 * index + 1;
+    if (childIndex >= size) {
+      break;
+    }
+    if (childIndex + 1 < size && IsBefore(requestHeap[childIndex + 1], requestHeap[childIndex])) {
+      ++ childIndex;
     }
+    if (!IsBefore(requestHeap[childIndex], request)) {
+      break;
+    }
+    HeapSet(index, requestHeap[childIndex]);
+    index = childIndex;
+  }
+  HeapSet(index, request);
+}
+
+void ParseThreadPool::HeapSet(int index, QueuedRequest* request) {
+  requestHeap[index] = request;
+  request->heapIndex = index;
+}
+
+quint64 ParseThreadPool::EstimateParseMemory(const QString& canonicalPath) {
+  auto it = measuredParseMemory.find(canonicalPath);
+  if (it != measuredParseMemory.end()) {
+    return it->second;
+  } else if (numMeasuredParses > 0) {
+    return totalMeasuredParseMemory / numMeasuredParses;
+  } else {
+    return kDefaultParseMemoryEstimate;
+  }
+}
+
+bool ParseThreadPool::CanAdmitParse(quint64 estimatedMemory) {
+  // Always allow one parse, even if it exceeds the budget on its own.
+  if (runningParses.empty()) {
+    return true;
   }
   
-  return bestIndex;
+  quint64 reservedMemory = estimatedMemory;
+  for (const RunningParse& parse : runningParses) {
+    reservedMemory += parse.estimatedMemory;
+  }
+  return reservedMemory <= memoryBudget;
 }
 
 void ParseThreadPool::ThreadMain() {
+  SetTraceThreadName("Parse thread");
+  
   while (true) {
     std::unique_lock<std::mutex> lock(parseRequestMutex);
     if (mExit) {
       return;
     }
-    int parseRequestIndex;
-    while ((parseRequestIndex = FindRequestToParse()) == -1) {
+    quint64 estimatedMemory;
+    while (true) {
+      if (!requestHeap.empty()) {
+        estimatedMemory = EstimateParseMemory(requestHeap.front()->request.canonicalPath);
+        if (CanAdmitParse(estimatedMemory)) {
+          break;
+        }
+      }
       newParseRequestCondition.wait(lock);
       if (mExit) {
         return;
       }
     }
-    ParseRequest request = parseRequests[parseRequestIndex];
-    parseRequests.erase(parseRequests.begin() + parseRequestIndex);
+    QueuedRequest* queued = requestHeap.front();
+    HeapRemove(queued);
+    ParseRequest request = queued->request;
+    QString key = queued->key;
+    int numIndexingRequests = queued->numIndexingRequests;
+    qint64 queueTime = queued->queueTime;
+    queuedRequests.erase(key);  // deletes queued
+    keysBeingParsed.insert(key);
     if (request.document) {
       documentsBeingParsed.push_back(request.document);
     }
+    
+    RunningParse newParse;
+    newParse.id = nextParseId;
+    ++ nextParseId;
+    newParse.canonicalPath = request.canonicalPath;
+    newParse.estimatedMemory = estimatedMemory;
+    runningParses.push_back(newParse);
     lock.unlock();
     
+    // Record statistics about the parse. ParseAndOrIndexFileImpl() fills in
+    // the details.
+    FileParseStatistics statistics;
+    statistics.path = request.canonicalPath;
+    statistics.wasOpen = request.document != nullptr;
+    statistics.queueSeconds = 0.001 * (GetQueueTime() - queueTime);
+    statistics.estimatedMemory = estimatedMemory;
+    ParseStatistics::SetCurrentRecord(&statistics);
+    double qtThreadStartSeconds = GetRunInQtThreadBlockingSeconds();
+    auto parseStartTime = std::chrono::steady_clock::now();
+    
     // Perform the parsing.
     if (request.language == ParseRequest::Language::CorCXX) {
       if (request.mode == ParseRequest::Mode::ParseIfOpen || /* TODO ) {
-        ParseFile(request.document ? request.document.get() : nullptr, request.mainWindow);
+        ParseFile(request.document ? request.document.get() : nullptr, request.host);
       } else if (*/ request.mode == ParseRequest::Mode::ParseIfOpenElseIndex) {
-        ParseFileIfOpenElseIndex(request.canonicalPath, request.document ? request.document.get() : nullptr, request.mainWindow);
+        ParseFileIfOpenElseIndex(request.canonicalPath, request.document ? request.document.get() : nullptr, request.host);
       } else {
         qDebug() << "Error: Parse request mode not handled:" << static_cast<int>(request.mode);
       }
     } else if (request.language == ParseRequest::Language::GLSL) {
-      ParseGLSLFile(request.canonicalPath, request.document ? request.document.get() : nullptr, request.mainWindow);
+      ParseGLSLFile(request.canonicalPath, request.document ? request.document.get() : nullptr, request.host);
     } else {
       qDebug() << "Error: Parse request language not handled:" << static_cast<int>(request.language);
     }
     
+    ParseStatistics::SetCurrentRecord(nullptr);
+    statistics.totalSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - parseStartTime).count();
+    statistics.qtThreadSeconds = GetRunInQtThreadBlockingSeconds() - qtThreadStartSeconds;
+    statistics.finishTime = QDateTime::currentMSecsSinceEpoch();
+    
+    lock.lock();
+    RecordParseMemory(newParse.id, statistics.tuMemory);
+    
+    // A request for the same file that was queued during the parse can be
+    // parsed now.
+    keysBeingParsed.erase(key);
+    auto blockedIt = queuedRequests.find(key);
+    if (blockedIt != queuedRequests.end() && blockedIt->second->heapIndex < 0) {
+      HeapPush(blockedIt->second.get());
+    }
+    lock.unlock();
+    // The finished parse may allow other parses to be admitted.
+    newParseRequestCondition.notify_all();
+    parseFinishedCondition.notify_all();
+    
+    if (!statistics.path.isEmpty()) {
+      ParseStatistics::Instance().AddRecord(statistics);
+    }
+    
     if (request.document && request.widget) {
       RunInQtThreadBlocking([&]() {
         // If the document has been closed in the meantime, we must not access its
@@ -228,8 +511,8 @@ void ParseThreadPool::ThreadMain() {
       });
     }
     
-    if (request.isIndexingRequest) {
-      ++ numFinishedIndexingRequests;
+    if (numIndexingRequests > 0) {
+      numFinishedIndexingRequests += numIndexingRequests;
       emit IndexingRequestFinished();
     }
     
@@ -242,10 +525,61 @@ void ParseThreadPool::ThreadMain() {
         }
       }
       lock.unlock();
-      
-      // Removing the current document from documentsBeingParsed may cause another
-      // parse request to become un-blocked, so wake up another thread.
-      newParseRequestCondition.notify_one();
     }
   }
 }
+
+int ParseThreadPool::StartExternalParse(const QString& canonicalPath, const std::function<bool()>& isCanceled) {
+  std::unique_lock<std::mutex> lock(parseRequestMutex);
+  quint64 estimatedMemory = EstimateParseMemory(canonicalPath);
+  while (!CanAdmitParse(estimatedMemory)) {
+    // The cancel condition is not notified, so it is polled.
+    parseFinishedCondition.wait_for(lock, std::chrono::milliseconds(50));
+    if (isCanceled() || mExit) {
+      return -1;
+    }
+  }
+  
+  RunningParse newParse;
+  newParse.id = nextParseId;
+  ++ nextParseId;
+  newParse.canonicalPath = canonicalPath;
+  newParse.estimatedMemory = estimatedMemory;
+  runningParses.push_back(newParse);
+  return newParse.id;
+}
+
+void ParseThreadPool::FinishExternalParse(int parseId, quint64 tuMemory) {
+  std::unique_lock<std::mutex> lock(parseRequestMutex);
+  RecordParseMemory(parseId, tuMemory);
+  lock.unlock();
+  newParseRequestCondition.notify_all();
+  parseFinishedCondition.notify_all();
+}
+
+void ParseThreadPool::RecordParseMemory(int parseId, quint64 tuMemory) {
+  for (std::size_t i = 0; i < runningParses.size(); ++ i) {
+    RunningParse& parse = runningParses[i];
+    if (parse.id != parseId) {
+      continue;
+    }
+    
+    // The memory of the TU is reported by libclang for each TU individually,
+    // so concurrent parses do not affect it. It is zero if the parse failed.
+    // Keep the maximum that was measured for the file, since underestimating
+    // is worse than overestimating: it may exhaust the memory.
+    if (tuMemory > 0) {
+      quint64& measuredMemory = measuredParseMemory[parse.canonicalPath];
+      if (measuredMemory == 0) {
+        ++ numMeasuredParses;
+      }
+      if (tuMemory > measuredMemory) {
+        totalMeasuredParseMemory += tuMemory - measuredMemory;
+        measuredMemory = tuMemory;
+      }
+    }
+    
+    runningParses.erase(runningParses.begin() + i);
+    return;
+  }
+}
@@ -6,8 +6,12 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <functional>
 #include <memory>
+#include <mutex>
 #include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
 #include <QObject>
@@ -15,7 +19,7 @@
 
 class Document;
 class DocumentWidget;
-class MainWindow;
+class ProjectHost;
 
 struct ParseRequest {
   enum class Language {
@@ -42,22 +46,38 @@ struct ParseRequest {
   std::shared_ptr<Document> document;
   QString canonicalPath;
   DocumentWidget* widget;
-  MainWindow* mainWindow;
-  bool isIndexingRequest;
+  ProjectHost* host;
 };
 
+/// Runs parse requests in a pool of threads. The number of concurrent parses is
+/// additionally limited by a memory budget: each parse gets admitted only if
+/// the estimated peak memory usage of all running parses, including the new
+/// one, stays within the budget. The estimates are based on the memory usage
+/// that libclang reported for the TUs of previous parses of the same file (or,
+/// for files that have not been parsed yet, on the average over all files).
+/// 
+/// Queued requests are stored in a binary heap. There is at most one queued
+/// request per file: further requests for the same file are merged into the
+/// existing one. Requests for the current document are preferred over requests
+/// for other open documents, which in turn are preferred over all other
+/// requests. Within the same priority, requests are handled in the order in
+/// which they were queued, so the longest-waiting request goes first. Since
+/// there is at most one request per file and a file is not parsed by several
+/// threads at once, each open document occupies at most one parse thread.
 class ParseThreadPool : public QObject {
  Q_OBJECT
  public:
   static ParseThreadPool& Instance();
   
-  void RequestParse(const std::shared_ptr<Document>& document, ParseRequest::Language language, DocumentWidget* widget, MainWindow* mainWindow);
+  void RequestParse(const std::shared_ptr<Document>& document, ParseRequest::Language language, DocumentWidget* widget, ProjectHost* host);
   
-  /// Assumes C/C++ language.
-  void RequestParseIfOpenElseIndex(const QString& canonicalPath, MainWindow* mainWindow);
+  /// Parses the file if it is open, otherwise indexes it. For GLSL files,
+  /// indexing extracts the symbols for the global symbol search.
+  void RequestParseIfOpenElseIndex(const QString& canonicalPath, ProjectHost* host, ParseRequest::Language language = ParseRequest::Language::CorCXX);
   
   /// Notifies the ParseThreadPool about the current and open documents, which
-  /// it uses for prioritizing parse requests.
+  /// it uses for prioritizing parse requests. Queued requests for documents
+  /// whose state changed are re-prioritized.
   void SetOpenAndCurrentDocuments(const QString& currentDocument, const QStringList& openDocuments);
   
   bool DoesAParseRequestExistForDocument(const Document* document);
@@ -68,18 +88,103 @@ class ParseThreadPool : public QObject {
   /// that parse threads will not try to access it anymore.
   void WidgetRemoved(DocumentWidget* widget);
   
+  /// Cancels all queued indexing requests (requests that are currently being
+  /// parsed are not affected). Queued parse requests for open documents are
+  /// kept. The cancelled requests are counted as finished.
+  void CancelIndexingRequests();
+  
   void ExitAllThreads();
   
   inline int GetNumFinishedIndexingRequests() const { return numFinishedIndexingRequests; }
   
+  inline int GetThreadCount() const { return mThreads.size(); }
+  
+  /// Subjects a parse that is done outside of the pool (for example, by the
+  /// rename dialog's search) to the memory budget: blocks until the parse of
+  /// the given file may start, and reserves its estimated memory. Returns -1 if
+  /// @p isCanceled returned true while waiting. Otherwise, FinishExternalParse()
+  /// must be called with the returned id once the TU has been disposed.
+  int StartExternalParse(const QString& canonicalPath, const std::function<bool()>& isCanceled);
+  
+  /// Releases the memory reserved by StartExternalParse(), recording the TU
+  /// memory usage that libclang reported for the parse (0 if unknown).
+  void FinishExternalParse(int parseId, quint64 tuMemory);
+  
  signals:
   void IndexingRequestFinished();
   
  private:
+  /// A parse that is currently running.
+  struct RunningParse {
+    int id;
+    QString canonicalPath;
+    
+    /// The memory usage that was estimated when admitting the parse.
+    quint64 estimatedMemory;
+  };
+  
+  /// A queued parse request, which may result from merging several requests
+  /// for the same file.
+  struct QueuedRequest {
+    ParseRequest request;
+    
+    /// Key of the request in queuedRequests (see GetRequestKey()).
+    QString key;
+    
+    /// Number of indexing requests that have been merged into this request.
+    int numIndexingRequests;
+    
+    /// 2 if the document is current, 1 if it is open, 0 otherwise.
+    int priority;
+    
+    /// Time at which the request was queued (see GetQueueTime()).
+    qint64 queueTime;
+    
+    /// Sequential number of the request, used as tie-breaker such that requests
+    /// with equal ordering keys are handled in the order in which they were
+    /// queued.
+    quint64 sequenceNumber;
+    
+    /// Index in requestHeap, or -1 if the request is not in the heap since a
+    /// request for the same file is currently being parsed.
+    int heapIndex;
+  };
+  
   ParseThreadPool();
   ~ParseThreadPool();
   
-  int FindRequestToParse();
+  /// Queues the request, or merges it into an existing request for the same
+  /// file. parseRequestMutex must be locked.
+  void QueueRequest(const ParseRequest& request, int numIndexingRequests);
+  
+  /// Returns the priority for a request for the given file.
+  /// parseRequestMutex must be locked.
+  int GetPriority(const QString& canonicalPath) const;
+  
+  /// Returns true if request @p a should be parsed before request @p b.
+  static bool IsBefore(const QueuedRequest* a, const QueuedRequest* b);
+  
+  // Binary heap operations on requestHeap.
+  // parseRequestMutex must be locked.
+  void HeapPush(QueuedRequest* request);
+  void HeapRemove(QueuedRequest* request);
+  void HeapUpdate(QueuedRequest* request);
+  void HeapSiftUp(int index);
+  void HeapSiftDown(int index);
+  void HeapSet(int index, QueuedRequest* request);
+  
+  /// Returns the estimated peak memory usage for parsing the given file.
+  /// parseRequestMutex must be locked.
+  quint64 EstimateParseMemory(const QString& canonicalPath);
+  
+  /// Returns whether a parse with the given estimated memory usage may start
+  /// now. parseRequestMutex must be locked.
+  bool CanAdmitParse(quint64 estimatedMemory);
+  
+  /// Removes the running parse with the given id, and records the TU memory
+  /// usage that libclang reported for it (0 if unknown) as the measured memory
+  /// usage of its file. parseRequestMutex must be locked.
+  void RecordParseMemory(int parseId, quint64 tuMemory);
   
   void ThreadMain();
   
@@ -88,14 +193,35 @@ class ParseThreadPool : public QObject {
   
   // For request prioritization
   QString currentDocumentPath;
-  QStringList openDocumentPaths;
+  std::unordered_set<QString> openDocumentPaths;
   
   std::atomic<bool> mExit;
   
   std::mutex parseRequestMutex;
   std::condition_variable newParseRequestCondition;
-  std::vector<ParseRequest> parseRequests;
+  /// Notified when a parse finishes, which may allow an external parse to
+  /// start (see StartExternalParse()).
+  std::condition_variable parseFinishedCondition;
   std::vector<std::shared_ptr<Document>> documentsBeingParsed;
   
+  // Request queue. Protected by parseRequestMutex.
+  /// Maps the request key to the queued request for it.
+  std::unordered_map<QString, std::unique_ptr<QueuedRequest>> queuedRequests;
+  /// Binary heap of the queued requests whose files are not being parsed. The
+  /// request to parse next is at the front.
+  std::vector<QueuedRequest*> requestHeap;
+  /// Keys of the requests that are currently being parsed.
+  std::unordered_set<QString> keysBeingParsed;
+  quint64 nextSequenceNumber = 0;
+  
+  // Admission control. Protected by parseRequestMutex.
+  quint64 memoryBudget;
+  std::vector<RunningParse> runningParses;
+  int nextParseId = 0;
+  /// Maximum memory measured for parses of each file.
+  std::unordered_map<QString, quint64> measuredParseMemory;
+  quint64 totalMeasuredParseMemory = 0;
+  int numMeasuredParses = 0;
+  
   std::vector<std::shared_ptr<std::thread>> mThreads;
 };
@@ -83,6 +83,7 @@ class Problem {
   inline Type type() const { return mType; }
   
   inline const std::vector<Item>& items() const { return mItems; }
+  inline std::vector<Item>& items() { return mItems; }
   
   inline const std::vector<FixIt>& fixits() const { return fixIts; }
   inline std::vector<FixIt>& fixits() { return fixIts; }
@@ -15,6 +15,8 @@
 #include "cide/clang_index.h"
 #include "cide/clang_utils.h"
 #include "cide/clang_parser.h"
+#include "cide/cpp_utils.h"
+#include "cide/glsl_parser.h"
 #include "cide/main_window.h"
 #include "cide/parse_thread_pool.h"
 #include "cide/qt_thread.h"
@@ -169,6 +171,16 @@ Project::~Project() {
       }
     }
     USRStorage::Instance().Unlock();
+    
+    // Shaders are indexed with glslang instead of via USRs, so their global
+    // symbols are removed separately.
+    for (Target& oldTarget : targets) {
+      for (SourceFile& oldSource : oldTarget.sources) {
+        if (oldSource.compileSettingsIndex < 0 && IsGLSLFile(oldSource.path)) {
+          RemoveGLSLSymbols(oldSource.path);
+        }
+      }
+    }
   });
 }
 
@@ -398,7 +410,7 @@ bool Project::Save(const QString& path) {
   return true;
 }
 
-bool Project::Configure(QString* errorReason, QString* warnings, bool* errorDisplayedAlready, QWidget* parent) {
+bool Project::Configure(QString* errorReason, QString* warnings, bool* errorDisplayedAlready, QWidget* parent, bool interactive) {
   // This uses the CMake file API. See:
   // https://cmake.org/cmake/help/latest/manual/cmake-file-api.7.html
   
@@ -456,10 +468,20 @@ bool Project::Configure(QString* errorReason, QString* warnings, bool* errorDisp
           (cmakeVersionNumberParts[0].toInt() == 3 && cmakeVersionNumberParts[1].toInt() >= 14);
     }
     if (!versionIsAtLeast3_14) {
-      QMessageBox::warning(parent, tr("CMake version too old"), tr("The version of the CMake binary used for configuring (%1) is too old. At least version 3.14 is required for CIDE, since it uses the CMake file API.").arg(cmakeVersionString));
+      QString message = tr("The version of the CMake binary used for configuring (%1) is too old. At least version 3.14 is required for CIDE, since it uses the CMake file API.").arg(cmakeVersionString);
+      if (interactive) {
+        QMessageBox::warning(parent, tr("CMake version too old"), message);
+      } else {
+        *warnings += message + QStringLiteral("\n");
+      }
     }
   } else {
-    QMessageBox::warning(parent, tr("Cannot determine CMake version"), tr("Failed to parse the CMake version, thus cannot determine whether it is supported by CIDE. Continuing, but be aware that building might not work. The first line in the output of cmake --version is: %1").arg(firstLine));
+    QString message = tr("Failed to parse the CMake version, thus cannot determine whether it is supported by CIDE. Continuing, but be aware that building might not work. The first line in the output of cmake --version is: %1").arg(firstLine);
+    if (interactive) {
+      QMessageBox::warning(parent, tr("Cannot determine CMake version"), message);
+    } else {
+      *warnings += message + QStringLiteral("\n");
+    }
   }
   
   // Determine the arguments to pass to CMake
@@ -507,9 +529,11 @@ bool Project::Configure(QString* errorReason, QString* warnings, bool* errorDisp
     operationWasCanceled = true;
   });
   
-  progress.resize(std::max(800, progress.width()), std::max(600, progress.height()));
-  progress.show();
-  QCoreApplication::processEvents();
+  if (interactive) {
+    progress.resize(std::max(800, progress.width()), std::max(600, progress.height()));
+    progress.show();
+    QCoreApplication::processEvents();
+  }
   
   // Run CMake
   std::shared_ptr<QProcess> cmakeProcess(new QProcess());
@@ -575,12 +599,12 @@ bool Project::Configure(QString* errorReason, QString* warnings, bool* errorDisp
     abortButton->setText(QObject::tr("Close"));
     progressBar->setRange(0, 1);
     progressBar->setValue(1);
-    while (!operationWasCanceled) {
+    while (interactive && !operationWasCanceled) {
       eventLoop.processEvents();
       QThread::msleep(1);
     }
     
-    *errorDisplayedAlready = true;
+    *errorDisplayedAlready = interactive;
     *errorReason = errorString + (errorDetailsString.isEmpty() ? "" : (" " + errorDetailsString));
     return false;
   }
@@ -1026,11 +1050,12 @@ bool Project::Configure(QString* errorReason, QString* warnings, bool* errorDisp
   USRStorage::Instance().Unlock();
   
   mayRequireReconfiguration = false;
+  fileList.reset();
   emit ProjectConfigured();
   return true;
 }
 
-int Project::IndexAllNewFiles(MainWindow* mainWindow) {
+int Project::IndexAllNewFiles(ProjectHost* host) {
   if (!indexAllProjectFiles) {
     return 0;
   }
@@ -1038,12 +1063,21 @@ int Project::IndexAllNewFiles(MainWindow* mainWindow) {
   int numRequestsCreated = 0;
   for (Target& target : targets) {
     for (SourceFile& source : target.sources) {
-      if (source.compileSettingsIndex < 0 ||
-          source.hasBeenIndexed) {
+      if (source.hasBeenIndexed) {
         continue;
       }
       
-      ParseThreadPool::Instance().RequestParseIfOpenElseIndex(source.path, mainWindow);
+      // Shaders are not compiled as part of the target, but they are indexed
+      // with glslang.
+      ParseRequest::Language language = ParseRequest::Language::CorCXX;
+      if (source.compileSettingsIndex < 0) {
+        if (!IsGLSLFile(source.path)) {
+          continue;
+        }
+        language = ParseRequest::Language::GLSL;
+      }
+      
+      ParseThreadPool::Instance().RequestParseIfOpenElseIndex(source.path, host, language);
       ++ numRequestsCreated;
       source.hasBeenIndexed = true;
     }
@@ -1094,6 +1128,54 @@ SourceFile * Project::GetSourceFile(const QString& canonicalPath) {
   return nullptr;
 }
 
+std::shared_ptr<const ProjectFileList> Project::GetFileList() {
+  if (fileList) {
+    return fileList;
+  }
+  
+  std::shared_ptr<ProjectFileList> newFileList(new ProjectFileList());
+  std::unordered_set<QString> addedPaths;
+  auto addPath = [&](const QString& path) {
+    if (addedPaths.insert(path).second) {
+      newFileList->files.emplace_back();
+      ProjectFilePath& file = newFileList->files.back();
+      file.path = path;
+      file.lowercasePath = path.toLower();
+      file.lowercasePathSignature = FuzzyTextMatchSignature(file.lowercasePath);
+      file.basenameOffset = path.lastIndexOf('/') + 1;
+      newFileList->index.AddItem(file.lowercasePath);
+    }
+  };
+  
+  QString projectDirPath = GetDir();
+  for (const Target& target : targets) {
+    for (const SourceFile& source : target.sources) {
+      addPath(source.path);
+      
+      for (const QString& includedPath : source.includedPaths) {
+        // Do not include external headers.
+        // TODO: Maybe these could be included as well as an option.
+        if (!includedPath.startsWith(projectDirPath)) {
+          continue;
+        }
+        
+        addPath(includedPath);
+      }
+    }
+  }
+  
+  newFileList->index.Finish();
+  fileList = newFileList;
+  return fileList;
+}
+
+void Project::IncludedPathChanged(const QString& changedPath) {
+  // Only files within the project directory are listed.
+  if (fileList && changedPath.startsWith(GetDir())) {
+    fileList.reset();
+  }
+}
+
 CompileSettings* Project::FindSettingsForFile(const QString& canonicalPath, bool* isGuess, int* guessQuality) {
   // TODO: Enter file paths into an unordered_map for faster lookup?
   
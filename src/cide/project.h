@@ -15,11 +15,12 @@
 #include <QString>
 
 #include "cide/settings.h"
+#include "cide/text_utils.h"
 #include "cide/util.h"
 
 
-class MainWindow;
 class Project;
+class ProjectHost;
 
 
 struct CompileSettings {
@@ -63,6 +64,8 @@ struct SourceFile {
   inline void TransferInformationTo(SourceFile* dest) {
     dest->hasBeenIndexed = hasBeenIndexed;
     dest->includedPaths = includedPaths;
+    dest->indexedModificationTimes = indexedModificationTimes;
+    dest->indexedCompileArgumentsHash = indexedCompileArgumentsHash;
   }
   
   
@@ -84,6 +87,17 @@ struct SourceFile {
   /// that this is only known to be correct if no changes to the file were made
   /// after indexing.
   std::unordered_set<QString> includedPaths;
+  
+  /// Modification times (in milliseconds since the epoch) of the files in
+  /// includedPaths at the time they were read for indexing. Files whose state
+  /// on disk was not what got indexed (since they were open with unsaved
+  /// changes, or were modified during indexing) have -1. This is used to
+  /// determine whether the file's entry in the USR index cache is up-to-date.
+  std::unordered_map<QString, qint64> indexedModificationTimes;
+  
+  /// Hash of the compile arguments that were used for indexing, see
+  /// ComputeCompileArgumentsHash() in usr_index_cache.h. 0 if unknown.
+  quint64 indexedCompileArgumentsHash = 0;
 };
 
 
@@ -126,6 +140,30 @@ struct Target {
 };
 
 
+/// A file listed in the file search.
+struct ProjectFilePath {
+  /// Canonical path of the file.
+  QString path;
+  QString lowercasePath;
+  
+  /// Signature of lowercasePath.
+  FuzzyTextMatchSignature lowercasePathSignature;
+  
+  /// Index of the first character of the file name within path.
+  int basenameOffset;
+};
+
+/// The files of a project that are listed in the file search: the source files
+/// of all targets, and the files within the project directory that are included
+/// by them. Instances are not modified after their creation.
+struct ProjectFileList {
+  std::vector<ProjectFilePath> files;
+  
+  /// Index over the lowercase paths of the files.
+  FuzzyTextMatchIndex index;
+};
+
+
 class Project : public QObject {
  Q_OBJECT
  public:
@@ -154,12 +192,14 @@ class Project : public QObject {
   bool Save(const QString& path);
   
   /// Attempts to get the required information for correct code parsing from the
-  /// build system. Returns true if successful, false otherwise.
-  bool Configure(QString* errorReason, QString* warnings, bool* errorDisplayedAlready, QWidget* parent);
+  /// build system. Returns true if successful, false otherwise. If
+  /// @p interactive is false, no dialogs are shown (for use without a GUI), and
+  /// all problems are reported via @p errorReason and @p warnings.
+  bool Configure(QString* errorReason, QString* warnings, bool* errorDisplayedAlready, QWidget* parent, bool interactive = true);
   
   /// Requests indexing for all source files (which will happen in the
   /// background parse threads). Returns the number of requests created.
-  int IndexAllNewFiles(MainWindow* mainWindow);
+  int IndexAllNewFiles(ProjectHost* host);
   
   /// Returns whether the project contains the file with the given path.
   bool ContainsFile(const QString& canonicalPath);
@@ -174,6 +214,16 @@ class Project : public QObject {
   /// correspond to a source file of this project.
   SourceFile* GetSourceFile(const QString& canonicalPath);
   
+  /// Returns the list of files for the file search. The list is cached, and
+  /// only rebuilt after the project has been reconfigured or the included
+  /// files of a source file have changed. Must be called from the Qt thread.
+  std::shared_ptr<const ProjectFileList> GetFileList();
+  
+  /// Must be called (from the Qt thread) after the includedPaths of a source
+  /// file of this project have changed. @p changedPath is one of the paths that
+  /// have been added or removed.
+  void IncludedPathChanged(const QString& changedPath);
+  
   /// Attempts to find the compile settings for the given file. If no concrete
   /// information is available, tries to guess and sets isGuess to true. In this
   /// case, guessQuality is set to a quality measure for the guess (larger is
@@ -239,6 +289,7 @@ class Project : public QObject {
   
   inline int GetNumTargets() const { return targets.size(); }
   inline const Target& GetTarget(int i) const { return targets[i]; }
+  inline Target& GetTarget(int i) { return targets[i]; }
   
   /// Returns true if the project thinks that its configuration files may have
   /// changed and it thus may require to be reconfigured to be up-to-date.
@@ -328,4 +379,7 @@ class Project : public QObject {
   // --- State / watcher ---
   QFileSystemWatcher cmakeFileWatcher;
   bool mayRequireReconfiguration;
+  
+  /// Cached result of GetFileList(), or null if it must be rebuilt.
+  std::shared_ptr<const ProjectFileList> fileList;
 };
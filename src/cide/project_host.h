@@ -0,0 +1,42 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <QString>
+
+class Document;
+class DocumentWidget;
+class Project;
+
+/// Provides the open projects and documents to the parsing and indexing code.
+/// This is implemented by MainWindow. Programs without a GUI (such as the
+/// headless indexer) implement it without any documents. All functions are
+/// only called from the main (Qt) thread.
+class ProjectHost {
+ public:
+  virtual ~ProjectHost() = default;
+  
+  virtual std::vector<std::shared_ptr<Project>>& GetProjects() = 0;
+  
+  /// Returns the number of open documents.
+  virtual int GetNumDocuments() const = 0;
+  
+  /// Returns the open document with the given index in [0, GetNumDocuments()[.
+  virtual std::shared_ptr<Document> GetDocument(int index) = 0;
+  
+  /// Returns the DocumentWidget for the given document, or null if the document
+  /// is not open.
+  virtual DocumentWidget* GetWidgetForDocument(Document* document) const = 0;
+  
+  /// If the file is open, returns its Document and DocumentWidget. Returns true
+  /// if successful, false otherwise.
+  virtual bool GetDocumentAndWidgetForPath(const QString& canonicalPath, Document** document, DocumentWidget** widget) const = 0;
+  
+  /// Notifies the host about a parse iteration being finished for the document.
+  virtual void DocumentParsed(Document* document) = 0;
+};
@@ -5,6 +5,7 @@
 #include "cide/qt_thread.h"
 
 #include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <functional>
 #include <iostream>
@@ -16,6 +17,28 @@
 #include <QThread>
 #include <QTimer>
 
+#include "cide/tracing.h"
+
+/// Time that the current thread has spent in RunInQtThreadBlocking().
+static thread_local double runInQtThreadBlockingSeconds = 0;
+
+/// Adds the time between its construction and destruction to
+/// runInQtThreadBlockingSeconds.
+struct RunInQtThreadBlockingTimer {
+  inline RunInQtThreadBlockingTimer()
+      : startTime(std::chrono::steady_clock::now()) {}
+  
+  inline ~RunInQtThreadBlockingTimer() {
+    runInQtThreadBlockingSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  }
+  
+  std::chrono::steady_clock::time_point startTime;
+};
+
+double GetRunInQtThreadBlockingSeconds() {
+  return runInQtThreadBlockingSeconds;
+}
+
 bool RunInQtThreadBlocking(
     const std::function<void()>& f) {
   // If there is no qApp, we cannot run the function.
@@ -31,6 +54,8 @@ bool RunInQtThreadBlocking(
   }
   
   // Use a queued connection to run the function.
+  CIDE_TRACE_SPAN("RunInQtThreadBlocking");
+  RunInQtThreadBlockingTimer blockingTimer;
   std::mutex done_mutex;
   std::condition_variable done_condition;
   std::atomic<bool> done;
@@ -40,7 +65,10 @@ bool RunInQtThreadBlocking(
   timer->moveToThread(qApp->thread());
   timer->setSingleShot(true);
   QObject::connect(timer, &QTimer::timeout, [&]() {
-    f();
+    {
+      CIDE_TRACE_SPAN("QtThreadFunction");
+      f();
+    }
     timer->deleteLater();
     
     std::lock_guard<std::mutex> lock(done_mutex);
@@ -79,6 +107,8 @@ bool RunInQtThreadBlocking(
   }
   
   // Use a queued connection to run the function.
+  CIDE_TRACE_SPAN("RunInQtThreadBlocking");
+  RunInQtThreadBlockingTimer blockingTimer;
   std::mutex done_mutex;
   std::mutex* mutexToUse = abortedMutex ? abortedMutex : &done_mutex;
   std::condition_variable done_condition;
@@ -110,7 +140,10 @@ bool RunInQtThreadBlocking(
       return;
     }
     
-    f();
+    {
+      CIDE_TRACE_SPAN("QtThreadFunction");
+      f();
+    }
     
     timer->deleteLater();
     
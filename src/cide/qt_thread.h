@@ -14,6 +14,12 @@
 bool RunInQtThreadBlocking(
     const std::function<void()>& f);
 
+/// Returns the total time in seconds that the calling thread has spent in
+/// RunInQtThreadBlocking() (in any of its versions), i.e., waiting for the Qt
+/// thread to become available and to run the functions. This is used for
+/// profiling.
+double GetRunInQtThreadBlockingSeconds();
+
 struct RunInQtThreadAbortData {
   inline RunInQtThreadAbortData()
       : aborted(false) {}
@@ -4,6 +4,8 @@
 
 #include "rename_dialog.h"
 
+#include <algorithm>
+
 #include <clang-c/Index.h>
 #include <QBoxLayout>
 #include <QIcon>
@@ -23,6 +25,9 @@
 #include "cide/main_window.h"
 #include "cide/parse_thread_pool.h"
 #include "cide/qt_thread.h"
+#include "cide/settings.h"
+#include "cide/tracing.h"
+#include "cide/util.h"
 
 RenameDialog::RenameDialog(DocumentWidget* widget, const QString& itemUSR, const QString& itemSpelling, bool itemHasLocalDefinition, const DocumentRange& initialCursorOrSelectionRange, QWidget* parent)
     : QDialog(parent),
@@ -212,6 +217,8 @@ void RenameDialog::Rename() {
 }
 
 void RenameDialog::ThreadMain() {
+  SetTraceThreadName("Rename search");
+  
   while (true) {
     SearchMode thisSearchMode;
     
@@ -229,7 +236,10 @@ void RenameDialog::ThreadMain() {
     thisSearchMode = searchMode;
     lock.unlock();
     
-    PerformSearch(thisSearchMode);
+    {
+      CIDE_TRACE_SPAN("RenameSearch");
+      PerformSearch(thisSearchMode);
+    }
     
     lock.lock();
     if (!haveNewSearchRequest) {
@@ -245,6 +255,14 @@ void RenameDialog::PerformSearch(SearchMode mode) {
   
   RunInQtThreadBlocking([&]() {
     searchInProgressLabel->setText(tr("<b>Search in progress ...</b>"));
+    
+    projectDir = QDir::root();
+    auto project = widget->GetMainWindow()->GetCurrentProject();
+    if (project) {
+      projectDir = QFileInfo(project->GetYAMLFilePath()).dir();
+    }
+    
+    searchThreadCount = Settings::Instance().GetParseThreadCount();
   });
   
   switch (mode) {
@@ -260,46 +278,13 @@ void RenameDialog::PerformSearch(SearchMode mode) {
   }
   
   RunInQtThreadBlocking([&]() {
-    // If there is already a new search request, do not add our results.
+    // If there is already a new search request, the results are outdated.
     if (haveNewSearchRequest) {
       return;
     }
     
-    QDir projectDir = QDir::root();
-    auto project = widget->GetMainWindow()->GetCurrentProject();
-    if (project) {
-      projectDir = QFileInfo(project->GetYAMLFilePath()).dir();
-    }
-    
-    // Create tree widget items
-    QTreeWidgetItem* lastFileItem = nullptr;
-    for (const auto& fileAndMap : occurrenceMap) {
-      QString path = fileAndMap.first;
-      const std::vector<Occurrence>& occurrences = *fileAndMap.second;
-      
-      lastFileItem = new QTreeWidgetItem(occurrencesTree, lastFileItem);
-      occurrencesTree->setItemWidget(
-          lastFileItem, 0,
-          new QLabel(QStringLiteral("<b>%1</b>: %2 matches").arg(projectDir.relativeFilePath(path).toHtmlEscaped()).arg(occurrences.size())));
-      lastFileItem->setExpanded(true);
-      
-      // TODO: Merge multiple occurrences in the same line into a single QTreeWidgetItem
-      QTreeWidgetItem* lastLineItem = nullptr;
-      for (const Occurrence& occ : occurrences) {
-        lastLineItem = new QTreeWidgetItem(lastFileItem, lastLineItem);
-        lastLineItem->setFlags(lastLineItem->flags() | Qt::ItemNeverHasChildren);
-        lastLineItem->setData(0, Qt::UserRole, QStringLiteral("file://%1:%2:%3").arg(path).arg(occ.line + 1).arg(occ.column + 1));
-        QString labelText =
-            tr("<span style=\"color:gray;\">Line %1:</span> %2").arg(occ.line + 1).arg(
-                occ.lineText.left(occ.column).toHtmlEscaped() +
-                QStringLiteral("<b style=\"background-color:#efedec;\">") + occ.lineText.mid(occ.column, occ.length).toHtmlEscaped() + QStringLiteral("</b>") +
-                occ.lineText.right(occ.lineText.size() - (occ.column + occ.length)).toHtmlEscaped());
-        QLabel* lineLabel = new QLabel(labelText);
-        occurrencesTree->setItemWidget(lastLineItem, 0, lineLabel);
-      }
-    }
-    
-    // Update other widgets
+    // Update other widgets (the occurrences have been added to the tree
+    // widget as they were found)
     searchInProgressLabel->hide();
     renameButton->setEnabled(true);
     
@@ -535,87 +520,342 @@ void RenameDialog::PerformGlobalSearch() {
       }
     }
   });
+  
+  // Start from the canonical path, and list the canonical paths of the
+  // subdirectories, such that the found file paths can be compared to the
+  // canonical paths in the index.
+  QString canonicalRootDir = QFileInfo(rootDir).canonicalFilePath();
+  if (!canonicalRootDir.isEmpty()) {
+    rootDir = canonicalRootDir;
+  }
 
   if (kDebug) {
     qDebug() << "Global search root dir:" << rootDir;
   }
   
-  // Find all C/C++ files within this directory and its subdirectories
-  std::unordered_set<QString> paths;
-  std::vector<QDir> doneList;
-  std::vector<QDir> workList = {rootDir};
-  while (!workList.empty()) {
+  // Find all C/C++ files within this directory and its subdirectories. The
+  // directories of each level of the directory tree are listed in parallel.
+  auto isCanceled = [&]() { return haveNewSearchRequest; };
+  std::vector<QString> candidatePaths;
+  std::unordered_set<QString> visitedDirs = {rootDir};
+  std::vector<QString> levelDirs = {rootDir};
+  while (!levelDirs.empty()) {
+    std::vector<std::vector<QString>> childDirs(levelDirs.size());
+    std::vector<std::vector<QString>> childFiles(levelDirs.size());
+    ParallelFor(levelDirs.size(), searchThreadCount, isCanceled, [&](int dirIndex) {
+      for (const QFileInfo& fileInfo : QDir(levelDirs[dirIndex]).entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Readable | QDir::Hidden)) {
+        if (fileInfo.isDir()) {
+          childDirs[dirIndex].push_back(fileInfo.canonicalFilePath());
+        } else if (GuessIsCFile(fileInfo.filePath())) {
+          childFiles[dirIndex].push_back(fileInfo.filePath());
+        }
+      }
+    });
     if (haveNewSearchRequest) {
       return;
     }
-    QDir dir = workList.back();
-    workList.pop_back();
-    doneList.push_back(dir);
     
-    for (const QFileInfo& fileInfo : dir.entryInfoList(QDir::Dirs | QDir::Files | QDir::NoDotAndDotDot | QDir::Readable | QDir::Hidden)) {
-      if (fileInfo.isDir()) {
-        // Add this directory to the list of directories to search in if we did
-        // not visit it yet (which might be the case if there was a symlink).
-        if (kDebug) {
-          qDebug() << "Considering child dir:" << fileInfo.filePath();
-        }
-        bool alreadyVisited = false;
-        QDir childDir(fileInfo.filePath());
-        for (const QDir& doneDir : doneList) {
-          if (doneDir == childDir) {
-            alreadyVisited = true;
-            break;
-          }
-        }
-        if (!alreadyVisited) {
-          workList.push_back(childDir);
-        }
-      } else if (GuessIsCFile(fileInfo.filePath())) {
-        // Read the file to see whether it contains the search term.
-        if (kDebug) {
-          qDebug() << "Considering file:" << fileInfo.filePath();
-        }
-        QFile file(fileInfo.filePath());
-        if (file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-          bool found = false;
-          while (!file.atEnd()) {
-            QString lineText = QString::fromUtf8(file.readLine());  // TODO: Allow reading other formats than UTF-8 only?
-            if (lineText.contains(itemSpelling, Qt::CaseSensitive)) {
-              found = true;
-              break;
-            }
-          }
-          if (found) {
-            paths.insert(fileInfo.filePath());
-            qDebug() << "--> Adding file to search set:" << fileInfo.filePath();
+    std::vector<QString> nextLevelDirs;
+    for (std::size_t dirIndex = 0; dirIndex < levelDirs.size(); ++ dirIndex) {
+      // Only search in directories that were not visited yet (which might be
+      // the case if there was a symlink).
+      for (const QString& childDir : childDirs[dirIndex]) {
+        if (!childDir.isEmpty() && visitedDirs.insert(childDir).second) {
+          if (kDebug) {
+            qDebug() << "Considering child dir:" << childDir;
           }
+          nextLevelDirs.push_back(childDir);
         }
       }
+      candidatePaths.insert(candidatePaths.end(), childFiles[dirIndex].begin(), childFiles[dirIndex].end());
+    }
+    levelDirs.swap(nextLevelDirs);
+  }
+  
+  // Read the files in parallel to see whether they contain the search term.
+  QByteArray itemSpellingUtf8 = itemSpelling.toUtf8();
+  std::vector<char> containsSpelling(candidatePaths.size(), 0);
+  ParallelFor(candidatePaths.size(), searchThreadCount, isCanceled, [&](int pathIndex) {
+    QFile file(candidatePaths[pathIndex]);
+    if (file.open(QIODevice::ReadOnly)) {
+      // TODO: Allow reading other formats than UTF-8 only?
+      containsSpelling[pathIndex] = file.readAll().contains(itemSpellingUtf8) ? 1 : 0;
+    }
+  });
+  if (haveNewSearchRequest) {
+    return;
+  }
+  
+  std::unordered_set<QString> paths;
+  for (std::size_t pathIndex = 0; pathIndex < candidatePaths.size(); ++ pathIndex) {
+    if (containsSpelling[pathIndex]) {
+      paths.insert(candidatePaths[pathIndex]);
+      if (kDebug) {
+        qDebug() << "--> Adding file to search set:" << candidatePaths[pathIndex];
+      }
     }
   }
   
+  // Only parse the files that may contain references according to the index,
+  // and take the occurrences from the index where possible.
+  FilterFilesUsingIndex(&paths);
+  SearchUsingIndex(&paths);
+  
   // Search in the resulting files.
   SearchInFiles(paths, true);
 }
 
-void RenameDialog::SearchInFiles(const std::unordered_set<QString>& paths, bool searchInIncludedFiles) {
-  // TODO: Search in multiple files simultaneously with multithreading
-  int numPaths = paths.size();
-  int searchedPaths = 0;
+void RenameDialog::FilterFilesUsingIndex(std::unordered_set<QString>* paths) {
+  // Find the files that declare or define the search item via its USR. All
+  // indexed files are considered, since the global search may find files
+  // outside of the targets that the current file belongs to.
+  std::vector<std::pair<QString, USRDecl>> foundDecls;  // pair of file path and USR
+  USRStorage::Instance().LookupUSRsInAllFiles(itemUSR.toUtf8(), &foundDecls);
   
-  for (const QString& path : paths) {
-    if (haveNewSearchRequest) {
+  std::unordered_set<QString> filesWithDeclarations;
+  for (const auto& item : foundDecls) {
+    filesWithDeclarations.insert(item.first);
+  }
+  if (filesWithDeclarations.empty()) {
+    // The index does not know the item (yet), so it cannot be used.
+    return;
+  }
+  
+  // Find the files with recorded references to the item.
+  std::vector<std::pair<QString, USRReference>> foundReferences;
+  USRStorage::Instance().LookupReferences(itemUSR.toUtf8(), nullptr, &foundReferences);
+  std::unordered_set<QString> filesWithReferences;
+  for (const auto& item : foundReferences) {
+    filesWithReferences.insert(item.first);
+  }
+  
+  // Open documents may differ from the indexed file content, so they are
+  // always searched.
+  std::unordered_set<QString> openDocumentPaths;
+  GetOpenDocumentPaths(&openDocumentPaths);
+  
+  // Drop the files whose reference tables are up-to-date and contain no
+  // reference to the item. The remaining files either reference or declare
+  // the item, or have not been indexed in their current version. The paths
+  // are canonical (see PerformGlobalSearch()), so they can be compared with
+  // the paths in the index directly.
+  for (auto it = paths->begin(); it != paths->end(); ) {
+    if (filesWithDeclarations.count(*it) == 0 &&
+        filesWithReferences.count(*it) == 0 &&
+        openDocumentPaths.count(*it) == 0 &&
+        USRStorage::Instance().AreReferencesCurrent(*it, GetFileVersion(*it, nullptr))) {
+      it = paths->erase(it);
+    } else {
+      ++ it;
+    }
+  }
+  
+  // Add the files that declare or reference the item according to the index,
+  // in case the text search did not find them.
+  for (const std::unordered_set<QString>* indexedPaths : {&filesWithDeclarations, &filesWithReferences}) {
+    for (const QString& path : *indexedPaths) {
+      if (paths->count(path) == 0 && QFileInfo(path).exists()) {
+        paths->insert(path);
+      }
+    }
+  }
+}
+
+/// Returns whether all occurrences of items with the given cursor kind are
+/// recorded in the index: either as a declaration, or as a reference. This is
+/// not the case for classes, since the names of their constructors and
+/// destructors are not recorded as references to them. Conversion functions
+/// and templates are excluded as well, since their names may differ from their
+/// spelling, or their uses may refer to specializations.
+static bool AreOccurrencesIndexedForKind(CXCursorKind kind) {
+  return kind == CXCursor_FunctionDecl ||
+         kind == CXCursor_CXXMethod ||
+         kind == CXCursor_FieldDecl ||
+         kind == CXCursor_VarDecl;
+}
+
+void RenameDialog::SearchUsingIndex(std::unordered_set<QString>* paths) {
+  std::vector<std::pair<QString, USRDecl>> foundDecls;  // pair of file path and USR
+  USRStorage::Instance().LookupUSRsInAllFiles(itemUSR.toUtf8(), &foundDecls);
+  if (foundDecls.empty()) {
+    return;
+  }
+  for (const auto& item : foundDecls) {
+    if (!AreOccurrencesIndexedForKind(item.second.kind)) {
       return;
     }
+  }
+  
+  // Open documents may differ from the indexed file content, so they are
+  // always parsed.
+  std::unordered_set<QString> openDocumentPaths;
+  GetOpenDocumentPaths(&openDocumentPaths);
+  
+  std::vector<QString> pathVector;
+  for (const QString& path : *paths) {
+    if (openDocumentPaths.count(path) == 0) {
+      pathVector.push_back(path);
+    }
+  }
+  
+  std::vector<char> searchedUsingIndex(pathVector.size(), 0);
+  ParallelFor(pathVector.size(), searchThreadCount, [&]() { return haveNewSearchRequest; }, [&](int pathIndex) {
+    searchedUsingIndex[pathIndex] = SearchInFileUsingIndex(pathVector[pathIndex]) ? 1 : 0;
+  });
+  
+  for (std::size_t pathIndex = 0; pathIndex < pathVector.size(); ++ pathIndex) {
+    if (searchedUsingIndex[pathIndex]) {
+      paths->erase(pathVector[pathIndex]);
+    }
+  }
+}
+
+bool RenameDialog::SearchInFileUsingIndex(const QString& path) {
+  std::vector<USRDecl> decls;
+  std::vector<USRReference> references;
+  if (!USRStorage::Instance().LookupUSRInFile(itemUSR.toUtf8(), path, GetFileVersion(path, nullptr), &decls, &references)) {
+    return false;
+  }
+  
+  // Get the (1-based) positions of the occurrences, sorted by line and column.
+  std::vector<std::pair<int, int>> positions;
+  for (const USRDecl& decl : decls) {
+    positions.emplace_back(decl.line, decl.column);
+  }
+  for (const USRReference& reference : references) {
+    positions.emplace_back(reference.line, reference.column);
+  }
+  std::sort(positions.begin(), positions.end());
+  positions.erase(std::unique(positions.begin(), positions.end()), positions.end());
+  if (positions.empty()) {
+    return true;
+  }
+  
+  QFile file(path);
+  if (!file.open(QIODevice::ReadOnly)) {
+    return false;
+  }
+  // TODO: Allow reading other formats than UTF-8 only?
+  QByteArray text = file.readAll();
+  QByteArray itemSpellingUtf8 = itemSpelling.toUtf8();
+  
+  std::vector<Occurrence> occurrences;
+  int line = 1;
+  int lineStart = 0;
+  for (const auto& position : positions) {
+    while (line < position.first) {
+      int lineEnd = text.indexOf('\n', lineStart);
+      if (lineEnd < 0) {
+        return false;
+      }
+      lineStart = lineEnd + 1;
+      ++ line;
+    }
+    int lineEnd = text.indexOf('\n', lineStart);
+    if (lineEnd < 0) {
+      lineEnd = text.size();
+    }
+    
+    // If the file does not contain the spelling of the item at the recorded
+    // position (for example, since the reference is within a macro expansion),
+    // parse the file instead.
+    int offset = lineStart + position.second - 1;
+    if (position.second < 1 ||
+        offset + itemSpellingUtf8.size() > lineEnd ||
+        text.mid(offset, itemSpellingUtf8.size()) != itemSpellingUtf8) {
+      return false;
+    }
+    
+    occurrences.emplace_back(line - 1, position.second - 1, itemSpelling.size(), QString::fromUtf8(text.constData() + lineStart, lineEnd - lineStart));
+  }
+  
+  AddOccurrences(path, std::move(occurrences));
+  return true;
+}
+
+void RenameDialog::GetOpenDocumentPaths(std::unordered_set<QString>* paths) {
+  RunInQtThreadBlocking([&]() {
+    MainWindow* mainWindow = widget->GetMainWindow();
+    for (int i = 0; i < mainWindow->GetNumDocuments(); ++ i) {
+      paths->insert(QFileInfo(mainWindow->GetDocument(i)->path()).canonicalFilePath());
+    }
+  });
+}
+
+void RenameDialog::SearchInFiles(const std::unordered_set<QString>& paths, bool searchInIncludedFiles) {
+  std::vector<QString> pathVector(paths.begin(), paths.end());
+  int numPaths = pathVector.size();
+  std::atomic<int> numSearchedPaths(0);
+  
+  // Use as many threads as the ParseThreadPool, with the search thread
+  // being one of them.
+  ParallelFor(numPaths, searchThreadCount, [&]() { return haveNewSearchRequest; }, [&](int pathIndex) {
+    SearchInFile(pathVector[pathIndex], searchInIncludedFiles);
+    
+    int searchedPaths = ++ numSearchedPaths;
     RunInQtThreadBlocking([&]() {
-      searchInProgressLabel->setText(tr("<b>Search in progress (%1%) ...</b>").arg((searchedPaths * 100) / numPaths));
+      if (!haveNewSearchRequest) {
+        searchInProgressLabel->setText(tr("<b>Search in progress (%1%) ...</b>").arg((searchedPaths * 100) / numPaths));
+      }
     });
-    
-    SearchInFile(path, searchInIncludedFiles);
-    ++ searchedPaths;
+  });
+}
+
+void RenameDialog::AddOccurrences(const QString& path, std::vector<Occurrence>&& occurrences) {
+  // TODO: We could already have a result from another TU. Due to different
+  //       preprocessor definitions, that result could be different. Merge the results.
+  std::shared_ptr<std::vector<Occurrence>> sharedVector(new std::vector<Occurrence>());
+  sharedVector->swap(occurrences);
+  
+  std::unique_lock<std::mutex> lock(resultsMutex);
+  if (occurrenceMap.count(path) > 0) {
+    return;
   }
+  occurrenceMap[path] = sharedVector;
+  lock.unlock();
+  
+  RunInQtThreadBlocking([&]() {
+    // If there is already a new search request, do not add our results.
+    if (haveNewSearchRequest) {
+      return;
+    }
+    
+    // Insert the item for the file such that the files remain sorted by path.
+    int insertIndex = 0;
+    while (insertIndex < occurrencesTree->topLevelItemCount() &&
+           occurrencesTree->topLevelItem(insertIndex)->data(0, Qt::UserRole).toString() < path) {
+      ++ insertIndex;
+    }
+    
+    QTreeWidgetItem* fileItem = new QTreeWidgetItem();
+    fileItem->setData(0, Qt::UserRole, path);
+    occurrencesTree->insertTopLevelItem(insertIndex, fileItem);
+    occurrencesTree->setItemWidget(
+        fileItem, 0,
+        new QLabel(QStringLiteral("<b>%1</b>: %2 matches").arg(projectDir.relativeFilePath(path).toHtmlEscaped()).arg(sharedVector->size())));
+    fileItem->setExpanded(true);
+    
+    // TODO: Merge multiple occurrences in the same line into a single QTreeWidgetItem
+    QTreeWidgetItem* lastLineItem = nullptr;
+    for (const Occurrence& occ : *sharedVector) {
+      lastLineItem = new QTreeWidgetItem(fileItem, lastLineItem);
+      lastLineItem->setFlags(lastLineItem->flags() | Qt::ItemNeverHasChildren);
+      lastLineItem->setData(0, Qt::UserRole, QStringLiteral("file://%1:%2:%3").arg(path).arg(occ.line + 1).arg(occ.column + 1));
+      QString labelText =
+          tr("<span style=\"color:gray;\">Line %1:</span> %2").arg(occ.line + 1).arg(
+              occ.lineText.left(occ.column).toHtmlEscaped() +
+              QStringLiteral("<b style=\"background-color:#efedec;\">") + occ.lineText.mid(occ.column, occ.length).toHtmlEscaped() + QStringLiteral("</b>") +
+              occ.lineText.right(occ.lineText.size() - (occ.column + occ.length)).toHtmlEscaped());
+      QLabel* lineLabel = new QLabel(labelText);
+      occurrencesTree->setItemWidget(lastLineItem, 0, lineLabel);
+    }
+  });
 }
 
+void RenameDialog::AddSearchError(const QString& error) {
+  std::unique_lock<std::mutex> lock(resultsMutex);
+  searchErrors += error;
+}
 
 static void VisitInclusions(
     CXFile included_file,
@@ -642,6 +882,8 @@ void RenameDialog::SearchInFile(const QString& path, bool searchInIncludedFiles)
   
   std::shared_ptr<ClangTU> TU;
   CXTranslationUnit clangTU = nullptr;
+  int parseId = -1;
+  quint64 tuMemory = 0;
   if (pathWidget) {
     GetTUFromDocument(pathDocument, &TU);
     if (kDebug) {
@@ -652,13 +894,21 @@ void RenameDialog::SearchInFile(const QString& path, bool searchInIncludedFiles)
     }
     clangTU = TU->TU();
   } else {
+    // The parses run in addition to those of the ParseThreadPool, so they are
+    // subject to its memory budget.
+    parseId = ParseThreadPool::Instance().StartExternalParse(path, [&]() { return haveNewSearchRequest; });
+    if (parseId < 0) {
+      return;
+    }
     ParseFileToGetTU(path, &clangTU);
     if (kDebug) {
       qDebug() << "Search in" << path << ": Got TU by parsing:" << clangTU;
     }
     if (clangTU == nullptr) {
+      ParseThreadPool::Instance().FinishExternalParse(parseId, 0);
       return;
     }
+    tuMemory = GetTUMemoryUsage(clangTU);
   }
   
   // Search for a declaration cursor having the desired USR.
@@ -710,16 +960,13 @@ void RenameDialog::SearchInFile(const QString& path, bool searchInIncludedFiles)
         clang_findReferencesInFile(visitorData.result, clangFile, referencesVisitor);
         
         if (context.gotReferenceWithinMacro) {
-          searchErrors += tr("Found a possible occurrence in a macro in file: %1\n").arg(fileToSearch);
+          AddSearchError(tr("Found a possible occurrence in a macro in file: %1\n").arg(fileToSearch));
         }
         
-        // Store the occurrences in the occurrenceMap.
-        // TODO: We could already have a result from another TU. Due to different
-        //       preprocessor definitions, that result could be different. Merge the results.
+        // Store the occurrences in the occurrenceMap and show them.
         if (!occurrences.empty()) {
-          std::shared_ptr<std::vector<Occurrence>> sharedVector(new std::vector<Occurrence>());
-          sharedVector->swap(occurrences);
-          occurrenceMap[fileToSearch] = sharedVector;
+          AddOccurrences(fileToSearch, std::move(occurrences));
+          occurrences.clear();
         }
       }
     }
@@ -728,10 +975,11 @@ void RenameDialog::SearchInFile(const QString& path, bool searchInIncludedFiles)
   // Return / dispose the file's TU.
   if (TU) {
     RunInQtThreadBlocking([&]() {
-      widget->GetDocument()->GetTUPool()->PutTU(TU, false);
+      pathDocument->GetTUPool()->PutTU(TU, false);
     });
   } else {
     clang_disposeTranslationUnit(clangTU);
+    ParseThreadPool::Instance().FinishExternalParse(parseId, tuMemory);
   }
 }
 
@@ -765,7 +1013,7 @@ void RenameDialog::GetTUFromDocument(Document* document, std::shared_ptr<ClangTU
     RunInQtThreadBlocking([&]() {
       *TU = document->GetTUPool()->TakeMostUpToDateTU();
     });
-    if (TU) {
+    if (*TU) {
       break;
     }
     
@@ -780,6 +1028,7 @@ void RenameDialog::ParseFileToGetTU(const QString& path, CXTranslationUnit* clan
   std::vector<CXUnsavedFile> unsavedFiles;
   std::vector<std::string> unsavedFileContents;
   std::vector<std::string> unsavedFilePaths;
+  std::vector<QString> skippedUnsavedFilePaths;
   
   bool exit = false;
   RunInQtThreadBlocking([&]() {
@@ -800,8 +1049,14 @@ void RenameDialog::ParseFileToGetTU(const QString& path, CXTranslationUnit* clan
       commandLineArgPtrs[i] = commandLineArgs[i].data();
     }
     
-    // Get the contents of all unsaved files from the main window
-    GetAllUnsavedFiles(widget->GetMainWindow(), &unsavedFiles, &unsavedFileContents, &unsavedFilePaths);
+    // Get the contents of the unsaved files from the main window. If the file
+    // has been indexed, only those that it includes are relevant. If the parse
+    // turns out to include one of the skipped files, it is repeated below.
+    SourceFile* sourceFile = usedProject ? usedProject->GetSourceFile(path) : nullptr;
+    GetAllUnsavedFiles(
+        widget->GetMainWindow(), &unsavedFiles, &unsavedFileContents, &unsavedFilePaths,
+        (sourceFile && !sourceFile->includedPaths.empty()) ? &sourceFile->includedPaths : nullptr,
+        &skippedUnsavedFilePaths);
   });
   if (exit) {
     return;
@@ -829,6 +1084,20 @@ void RenameDialog::ParseFileToGetTU(const QString& path, CXTranslationUnit* clan
         parseOptions,
         clangTU);
     
+    // If the file now includes an unsaved file that was not passed to libclang
+    // since it was not included before, reparse with it.
+    if (parseResult == CXError_Success && TUContainsAnyOf(*clangTU, skippedUnsavedFilePaths)) {
+      RunInQtThreadBlocking([&]() {
+        GetAllUnsavedFiles(widget->GetMainWindow(), &unsavedFiles, &unsavedFileContents, &unsavedFilePaths);
+      });
+      skippedUnsavedFilePaths.clear();
+      parseResult = static_cast<CXErrorCode>(clang_reparseTranslationUnit(
+          *clangTU,
+          unsavedFiles.size(),
+          unsavedFiles.data(),
+          clang_defaultReparseOptions(*clangTU)));
+    }
+    
     if (parseResult == CXError_Success) {
       return;
     }
@@ -837,7 +1106,7 @@ void RenameDialog::ParseFileToGetTU(const QString& path, CXTranslationUnit* clan
     *clangTU = nullptr;
   }
   
-  searchErrors += tr("Failed to parse file: %1\n").arg(path);
+  AddSearchError(tr("Failed to parse file: %1\n").arg(path));
 }
 
 void RenameDialog::RenameInDocument(DocumentWidget* widget, const std::vector<Occurrence>& occurrences) {
@@ -13,6 +13,7 @@
 
 #include <clang-c/Index.h>
 #include <QDialog>
+#include <QDir>
 
 #include "cide/document_location.h"
 #include "cide/document_range.h"
@@ -73,9 +74,39 @@ class RenameDialog : public QDialog {
   void PerformSemiGlobalSearch();
   void PerformGlobalSearch();
   
+  /// Selects the files to search using the index: removes the files from
+  /// @p paths whose reference tables are up-to-date and neither contain a
+  /// reference to the search item nor declare it, and adds the files that
+  /// declare or reference it according to the index. Files that have not been
+  /// indexed in their current version, and open documents, are kept.
+  void FilterFilesUsingIndex(std::unordered_set<QString>* paths);
+  
+  /// Takes the occurrences of the search item from the reference tables of the
+  /// index for the files in @p paths that are not open and that have been
+  /// indexed in their current version, and removes these files from
+  /// @p paths. This is only done for items whose references are recorded
+  /// completely, i.e., functions, methods, fields, and variables.
+  void SearchUsingIndex(std::unordered_set<QString>* paths);
+  /// Takes the occurrences in a single file from the index. Returns false if
+  /// the file needs to be parsed instead. This is called by the worker threads.
+  bool SearchInFileUsingIndex(const QString& path);
+  
+  /// Returns the canonical paths of all open documents.
+  void GetOpenDocumentPaths(std::unordered_set<QString>* paths);
+  
+  /// Searches the given files in parallel on a pool of worker threads. Files
+  /// that are not open get parsed within the memory budget of the
+  /// ParseThreadPool.
   void SearchInFiles(const std::unordered_set<QString>& paths, bool searchInIncludedFiles);
+  /// Searches a single file. This is called by the worker threads.
   void SearchInFile(const QString& path, bool searchInIncludedFiles);
   
+  /// Adds the occurrences in a file to occurrenceMap and to the tree widget,
+  /// unless occurrences in this file were already found via another TU. Can
+  /// be called from any thread.
+  void AddOccurrences(const QString& path, std::vector<Occurrence>&& occurrences);
+  void AddSearchError(const QString& error);
+  
   void GetTUFromDocument(Document* document, std::shared_ptr<ClangTU>* TU);
   void ParseFileToGetTU(const QString& path, CXTranslationUnit* clangTU);
   
@@ -91,10 +122,21 @@ class RenameDialog : public QDialog {
   bool haveNewSearchRequest;
   std::condition_variable newSearchRequestCondition;
   bool exitThread;
+  
+  // Results of the running search. The worker threads access them with
+  // resultsMutex locked.
+  std::mutex resultsMutex;
   std::map<QString, std::shared_ptr<std::vector<Occurrence>>> occurrenceMap;
+  QString searchErrors;
+  
+  /// Directory relative to which the paths are displayed in the tree widget.
+  QDir projectDir;
+  
+  /// Number of threads to search with (see SearchInFiles()), as configured in
+  /// the settings when the search started. 0 means one per CPU core.
+  int searchThreadCount;
   
   // Search results
-  QString searchErrors;
   std::map<QString, std::shared_ptr<std::vector<Occurrence>>> resultMap;
   
   // The USR of the item to search for
@@ -12,6 +12,7 @@
 #include "cide/document_widget.h"
 #include "cide/qt_thread.h"
 #include "cide/text_utils.h"
+#include "cide/tracing.h"
 
 ScrollbarMinimap::ScrollbarMinimap(const std::shared_ptr<Document>& document, DocumentWidget* widget, int width, QWidget* parent)
   : QWidget(parent),
@@ -76,6 +77,7 @@ void ScrollbarMinimap::SetDiffLines(const std::vector<LineDiff>& diffLines) {
 }
 
 void ScrollbarMinimap::paintEvent(QPaintEvent* event) {
+  CIDE_TRACE_SPAN("ScrollbarMinimap::paintEvent");
   // Start painting
   QPainter painter(this);
   QRect rect = event->rect();
@@ -190,6 +192,8 @@ int ScrollbarMinimap::GetMapRenderHeight() {
 }
 
 void ScrollbarMinimap::MapUpdateThreadMain() {
+  SetTraceThreadName("Minimap update");
+  
   // TODO: Synchronize with editor colors?
   QColor bookmarkColor = qRgb(0, 0, 255);
   QColor errorColor = qRgb(255, 0, 0);
@@ -216,6 +220,7 @@ void ScrollbarMinimap::MapUpdateThreadMain() {
     lock.unlock();
     
     // Perform the update
+    CIDE_TRACE_SPAN("MinimapUpdate");
     QImage newMap(mapWidth, workingLayout.size(), QImage::Format_RGB888);
     std::vector<MapLine> newMapLines;
     
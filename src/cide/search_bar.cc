@@ -222,6 +222,7 @@ void SearchBar::GetCurrentContext() {
 void SearchBar::ComputeItems() {
   std::vector<SearchListItem> items;
   items.reserve(1024);
+  std::vector<SearchListIndexRange> indexRanges;
   
   DocumentWidget* widget = mainWindow->GetCurrentDocumentWidget();
   if (widget) {
@@ -239,35 +240,33 @@ void SearchBar::ComputeItems() {
   }
   
   // List the project files?
+  std::vector<std::shared_ptr<const ProjectFileList>> newFileLists;
   if (mode == Mode::Files) {
-    std::unordered_set<QString> addedPaths;
-    auto addPath = [&](const QString& path) {
-      if (addedPaths.count(path) == 0) {
-        addedPaths.insert(path);
-        items.emplace_back(SearchListItem::Type::ProjectFile, path, path);
-        items.back().displayTextBoldRange = DocumentRange::Invalid();
-      }
-    };
-    
     for (const auto& project : mainWindow->GetProjects()) {
-      QDir projectDir = QFileInfo(project->GetYAMLFilePath()).dir();
-      
-      int numTargets = project->GetNumTargets();
-      for (int targetIndex = 0; targetIndex < numTargets; ++ targetIndex) {
-        const Target& target = project->GetTarget(targetIndex);
-        for (const SourceFile& source : target.sources) {
-          addPath(source.path);
-          
-          for (const QString& includedPath : source.includedPaths) {
-            // Do not include external headers.
-            // TODO: Maybe these could be included as well as an option.
-            if (!includedPath.startsWith(projectDir.path())) {
-              continue;
-            }
-            
-            addPath(includedPath);
-          }
+      newFileLists.push_back(project->GetFileList());
+    }
+    
+    std::size_t numFiles = 0;
+    for (const auto& fileList : newFileLists) {
+      numFiles += fileList->files.size();
+    }
+    items.reserve(numFiles);
+    
+    // If multiple projects are open, they might share files. Skip the
+    // duplicates; the index cannot be used for lists with skipped files then.
+    std::unordered_set<QString> addedPaths;
+    for (const auto& fileList : newFileLists) {
+      int firstItem = items.size();
+      bool skippedFiles = false;
+      for (const ProjectFilePath& file : fileList->files) {
+        if (newFileLists.size() > 1 && !addedPaths.insert(file.path).second) {
+          skippedFiles = true;
+          continue;
         }
+        items.emplace_back(file);
+      }
+      if (!skippedFiles) {
+        indexRanges.emplace_back(firstItem, &fileList->index);
       }
     }
     
@@ -275,38 +274,26 @@ void SearchBar::ComputeItems() {
   }
   
   // List global symbols?
+  std::shared_ptr<const GlobalSymbolTableSnapshot> newGlobalSymbols;
   if (mode == Mode::GlobalSymbols) {
-    USRStorage::Instance().Lock();
+    newGlobalSymbols = GlobalSymbolTable::Instance().GetSnapshot();
     
-    const auto& USRs = USRStorage::Instance().GetAllUSRs();
-    for (auto fileIt = USRs.begin(), endFileIt = USRs.end(); fileIt != endFileIt; ++ fileIt) {
-      for (auto usrIt = fileIt->second->map.begin(), endUsrIt = fileIt->second->map.end(); usrIt != endUsrIt; ++ usrIt) {
-        if (usrIt->second.namePos < 0) {
-          continue;
-        }
-        bool isClassDeclLike = IsClassDeclLikeCursorKind(usrIt->second.kind);
-        if (!isClassDeclLike && !IsFunctionDeclLikeCursorKind(usrIt->second.kind)) {
-          continue;
-        }
-        if (isClassDeclLike && !usrIt->second.isDefinition) {
-          continue;
-        }
-        
-        items.emplace_back(
-            SearchListItem::Type::GlobalSymbol,
-            QObject::tr("%1 at %2:%3:%4").arg(usrIt->second.spelling).arg(fileIt->first).arg(usrIt->second.line).arg(usrIt->second.column),
-            usrIt->second.spelling.mid(usrIt->second.namePos, usrIt->second.nameSize));
-        // if (usrIt->second.namePos >= 0) {
-          items.back().displayTextBoldRange = DocumentRange(usrIt->second.namePos, usrIt->second.namePos + usrIt->second.nameSize);
-        // } else {
-        //   items.back().displayTextBoldRange = DocumentRange::Invalid();
-        // }
-      }
+    std::size_t numSymbols = 0;
+    for (const auto& file : *newGlobalSymbols) {
+      numSymbols += file->symbols.size();
     }
+    items.reserve(numSymbols);
     
-    USRStorage::Instance().Unlock();
+    for (const auto& file : *newGlobalSymbols) {
+      indexRanges.emplace_back(items.size(), &file->nameIndex);
+      for (const GlobalSymbol& symbol : file->symbols) {
+        items.emplace_back(file.get(), &symbol);
+      }
+    }
   }
   
-  mListWidget->SetItems(std::move(items));
+  mListWidget->SetItems(std::move(items), std::move(indexRanges));
+  globalSymbols = newGlobalSymbols;
+  fileLists = newFileLists;
   mListWidget->Relayout();
 }
@@ -4,11 +4,15 @@
 
 #pragma once
 
+#include <memory>
+
 #include <QLineEdit>
 
 #include "cide/document_range.h"
+#include "cide/global_symbol_table.h"
 
 class MainWindow;
+struct ProjectFileList;
 class SearchListWidget;
 
 class SearchBar : public QLineEdit {
@@ -62,6 +66,13 @@ class SearchBar : public QLineEdit {
   QString currentContexts;
   std::vector<DocumentRange> currentContextBoldRanges;
   
+  /// Snapshot of the global symbol table that the items of type GlobalSymbol
+  /// in mListWidget refer to.
+  std::shared_ptr<const GlobalSymbolTableSnapshot> globalSymbols;
+  
+  /// File lists that the items of type ProjectFile in mListWidget refer to.
+  std::vector<std::shared_ptr<const ProjectFileList>> fileLists;
+  
   Mode mode;
   SearchListWidget* mListWidget;
   MainWindow* mainWindow;
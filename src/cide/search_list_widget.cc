@@ -55,8 +55,9 @@ SearchListWidget::SearchListWidget(SearchBar* searchBarWidget, QWidget* parent)
 
 SearchListWidget::~SearchListWidget() {}
 
-void SearchListWidget::SetItems(const std::vector<SearchListItem>&& items) {
-  mItems = items;
+void SearchListWidget::SetItems(std::vector<SearchListItem>&& items, std::vector<SearchListIndexRange>&& indexRanges) {
+  mItems = std::move(items);
+  mIndexRanges = std::move(indexRanges);
   mSortOrder.resize(mItems.size());
   for (int i = 0, size = mItems.size(); i < size; ++ i) {
     mSortOrder[i] = i;
@@ -87,6 +88,9 @@ void SearchListWidget::SetFilterText(const QString& text) {
   }
   QString filepathFilterTextLowercase = filepathFilterText.toLower();
   
+  FuzzyTextMatchQuery defaultQuery(defaultFilterText, defaultFilterTextLowercase);
+  FuzzyTextMatchQuery filepathQuery(filepathFilterText, filepathFilterTextLowercase);
+  
   // Score each item according to how well it matches the new filter text.
   constexpr int kMaxNonMatchedCharacters = 2;
   int minMatchedCharactersDefault = std::max(0, defaultFilterText.size() - kMaxNonMatchedCharacters);
@@ -96,25 +100,54 @@ void SearchListWidget::SetFilterText(const QString& text) {
   numShownItemsAtomic = 0;
   int numItems = mItems.size();
   
+  // Use the indexes to determine which items need to be scored.
+  std::vector<quint8> isCandidate(numItems, 1);
+  int numIndexRanges = mIndexRanges.size();
+  
+  #pragma omp parallel for
+  for (int r = 0; r < numIndexRanges; ++ r) {
+    const SearchListIndexRange& range = mIndexRanges[r];
+    int rangeSize = range.index->GetItemCount();
+    if (rangeSize == 0) {
+      continue;
+    }
+    
+    bool isFilepathRange = mItems[range.firstItem].type == SearchListItem::Type::ProjectFile;
+    std::vector<int> candidates;
+    if (range.index->GetCandidates(
+            isFilepathRange ? filepathQuery : defaultQuery,
+            isFilepathRange ? minMatchedCharactersFilepath : minMatchedCharactersDefault,
+            &candidates)) {
+      std::fill(isCandidate.begin() + range.firstItem, isCandidate.begin() + range.firstItem + rangeSize, 0);
+      for (int candidate : candidates) {
+        isCandidate[range.firstItem + candidate] = 1;
+      }
+    }
+  }
+  
   #pragma omp parallel for
   for (int i = 0; i < numItems; ++ i) {
     SearchListItem& item = mItems[i];
     
-    QString* filterText;
-    QString* filterTextLowercase;
+    if (!isCandidate[i]) {
+      // The item cannot match well enough to be shown. Its score only needs to
+      // be worse than that of all shown items.
+      item.matchScore = FuzzyTextMatchScore(0, 0, true, 0);
+      continue;
+    }
+    
+    const FuzzyTextMatchQuery* query;
     int minMatchedCharacters;
     if (item.type == SearchListItem::Type::ProjectFile) {
-      filterText = &filepathFilterText;
-      filterTextLowercase = &filepathFilterTextLowercase;
+      query = &filepathQuery;
       minMatchedCharacters = minMatchedCharactersFilepath;
     } else {
-      filterText = &defaultFilterText;
-      filterTextLowercase = &defaultFilterTextLowercase;
+      query = &defaultQuery;
       minMatchedCharacters = minMatchedCharactersDefault;
     }
     
-    ComputeFuzzyTextMatch(*filterText, *filterTextLowercase, item.filterText, item.filterTextLowercase, &item.matchScore);
-    if (item.matchScore.matchedCharacters >= minMatchedCharacters) {
+    if (ComputeFuzzyTextMatch(*query, item.filterText, item.filterTextLowercase, item.filterTextSignature, minMatchedCharacters, &item.matchScore) &&
+        item.matchScore.matchedCharacters >= minMatchedCharacters) {
       ++ numShownItemsAtomic;
     }
   }
@@ -204,12 +237,8 @@ void SearchListWidget::Accept() {
     }
     searchBarWidget->GetMainWindow()->GotoDocumentLocation(jumpUrl);
   } else if (item.type == SearchListItem::Type::GlobalSymbol) {
-    QStringList words = item.displayText.split(" ");
-    if (words.empty()) {
-      qDebug() << "Error: Cannot parse jump location for a GlobalSymbol from display string:" << item.displayText;
-    } else {
-      searchBarWidget->GetMainWindow()->GotoDocumentLocation(QStringLiteral("file://") + words.back());
-    }
+    searchBarWidget->GetMainWindow()->GotoDocumentLocation(
+        QStringLiteral("file://%1:%2:%3").arg(item.symbolFile->path).arg(item.symbol->line).arg(item.symbol->column));
   } else {
     qDebug() << "Error: SearchListWidget::Accept(): Item type not handled.";
   }
@@ -261,8 +290,9 @@ void SearchListWidget::paintEvent(QPaintEvent* event) {
     painter.setFont(Settings::Instance().GetDefaultFont());
     bool usingBoldFont = false;
     
+    QString displayText = item.GetDisplayText();
     int xCoord = 1;
-    for (int c = 0, size = item.displayText.size(); c < size; ++ c) {
+    for (int c = 0, size = displayText.size(); c < size; ++ c) {
       int visibleWidth = std::min(width() - 1 - xCoord, charWidth);
       
       bool bold = item.displayTextBoldRange.ContainsCharacter(c);
@@ -272,7 +302,7 @@ void SearchListWidget::paintEvent(QPaintEvent* event) {
       }
       
       // Draw the character
-      painter.drawText(QRect(xCoord, currentY, visibleWidth, visibleHeight), Qt::AlignLeft | Qt::AlignTop | Qt::TextSingleLine, item.displayText.at(c));
+      painter.drawText(QRect(xCoord, currentY, visibleWidth, visibleHeight), Qt::AlignLeft | Qt::AlignTop | Qt::TextSingleLine, displayText.at(c));
       xCoord += charWidth;
     }
     
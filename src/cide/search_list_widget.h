@@ -9,6 +9,8 @@
 
 #include "cide/document_location.h"
 #include "cide/document_range.h"
+#include "cide/global_symbol_table.h"
+#include "cide/project.h"
 #include "cide/text_utils.h"
 
 class SearchBar;
@@ -31,12 +33,41 @@ struct SearchListItem {
         displayText(displayText),
         filterText(filterText),
         filterTextLowercase(filterText.toLower()),
+        filterTextSignature(filterTextLowercase),
         matchScore(FuzzyTextMatchScore(0, 0, true, 0)) {}
   
+  /// Creates an item of type GlobalSymbol. The symbol must remain valid while
+  /// the item is in use.
+  inline SearchListItem(const GlobalSymbolFile* symbolFile, const GlobalSymbol* symbol)
+      : type(Type::GlobalSymbol),
+        displayTextBoldRange(symbol->namePos, symbol->namePos + symbol->name.size()),
+        filterText(symbol->name),
+        filterTextLowercase(symbol->lowercaseName),
+        filterTextSignature(symbol->nameSignature),
+        symbolFile(symbolFile),
+        symbol(symbol),
+        matchScore(FuzzyTextMatchScore(0, 0, true, 0)) {}
+  
+  /// Creates an item of type ProjectFile.
+  inline SearchListItem(const ProjectFilePath& file)
+      : type(Type::ProjectFile),
+        displayText(file.path),
+        displayTextBoldRange(file.basenameOffset, file.path.size()),
+        filterText(file.path),
+        filterTextLowercase(file.lowercasePath),
+        filterTextSignature(file.lowercasePathSignature),
+        matchScore(FuzzyTextMatchScore(0, 0, true, 0)) {}
+  
+  /// Returns the text displayed in the list widget.
+  inline QString GetDisplayText() const {
+    return symbol ? symbol->GetDisplayText(symbolFile->path) : displayText;
+  }
+  
   /// Type of this item.
   Type type;
   
-  /// Text displayed in the list widget
+  /// Text displayed in the list widget. This is not set for items of type
+  /// GlobalSymbol, use GetDisplayText() instead.
   QString displayText;
   
   /// Range of text within displayText that should be displayed in bold
@@ -46,13 +77,36 @@ struct SearchListItem {
   QString filterText;
   QString filterTextLowercase;
   
+  /// Signature of filterTextLowercase for quickly rejecting non-matching items.
+  FuzzyTextMatchSignature filterTextSignature;
+  
   /// For type == LocalContext, the location to jump to on activating the item.
   DocumentLocation jumpLocation;
   
+  /// For type == GlobalSymbol, the symbol and the file containing it.
+  const GlobalSymbolFile* symbolFile = nullptr;
+  const GlobalSymbol* symbol = nullptr;
+  
   /// Match score between this item and the text input by the user.
   FuzzyTextMatchScore matchScore;
 };
 
+/// Associates a FuzzyTextMatchIndex over the lowercase filter texts of a range
+/// of items with these items.
+struct SearchListIndexRange {
+  inline SearchListIndexRange(int firstItem, const FuzzyTextMatchIndex* index)
+      : firstItem(firstItem),
+        index(index) {}
+  
+  /// Index of the item that corresponds to the first item of the index. The
+  /// range covers index->GetItemCount() items, which must all be of the same
+  /// type.
+  int firstItem;
+  
+  /// The index. It must remain valid while the items are in use.
+  const FuzzyTextMatchIndex* index;
+};
+
 class SearchListWidget : public QWidget {
  Q_OBJECT
  public:
@@ -62,8 +116,11 @@ class SearchListWidget : public QWidget {
   /// Destructor.
   ~SearchListWidget();
   
-  /// Sets the list of items displayed in the widget.
-  void SetItems(const std::vector<SearchListItem>&& items);
+  /// Sets the list of items displayed in the widget. Optionally, indexes may
+  /// be given for (parts of) the items, which allows to only score candidate
+  /// items when filtering. Items that are not covered by any index are always
+  /// scored.
+  void SetItems(std::vector<SearchListItem>&& items, std::vector<SearchListIndexRange>&& indexRanges = std::vector<SearchListIndexRange>());
   
   /// Updates the filter text (i.e., the text typed by the user) with which the
   /// items are filtered.
@@ -105,6 +162,9 @@ class SearchListWidget : public QWidget {
   /// item is mItems[mSortOrder[0]].
   std::vector<SearchListItem> mItems;
   
+  /// Indexes for ranges of mItems.
+  std::vector<SearchListIndexRange> mIndexRanges;
+  
   /// The order of items in this vector determines the order in which items are
   /// displayed. Indexes into mItems.
   std::vector<int> mSortOrder;
@@ -380,6 +380,21 @@ void Settings::ShowSettingsWindow(QWidget* parent) {
 }
 
 
+void HighlightingSettings::Read() {
+  Settings& settings = Settings::Instance();
+  textStyles.resize(settings.GetNumConfigurableTextStyles());
+  for (int i = 0; i < textStyles.size(); ++ i) {
+    textStyles[i] = settings.GetConfiguredTextStyle(static_cast<Settings::TextStyle>(i));
+  }
+  localVariableColors.resize(settings.GetLocalVariableColorPoolSize());
+  for (int i = 0; i < localVariableColors.size(); ++ i) {
+    localVariableColors[i] = settings.GetLocalVariableColor(i);
+  }
+  commentMarkers = settings.GetCommentMarkers();
+  usePerVariableColoring = settings.GetUsePerVariableColoring();
+}
+
+
 SettingsDialog::SettingsDialog(QWidget* parent)
     : QDialog(parent) {
   setWindowTitle(tr("Program settings"));
@@ -707,6 +722,48 @@ QWidget* SettingsDialog::CreateCodeParsingCategory() {
   defaultCompilerLayout->addWidget(defaultCompilerChoosePathButton);
   
   layout->addLayout(defaultCompilerLayout);
+  
+  QLabel* parseThreadCountLabel = new QLabel(tr("Number of parse threads (0 to use all cores; requires a restart): "));
+  QLineEdit* parseThreadCountEdit = new QLineEdit(QString::number(Settings::Instance().GetParseThreadCount()));
+  parseThreadCountEdit->setValidator(new QIntValidator(0, std::numeric_limits<int>::max(), parseThreadCountEdit));
+  QHBoxLayout* parseThreadCountLayout = new QHBoxLayout();
+  parseThreadCountLayout->addWidget(parseThreadCountLabel);
+  parseThreadCountLayout->addWidget(parseThreadCountEdit);
+  layout->addLayout(parseThreadCountLayout);
+  
+  QLabel* parseMemoryBudgetLabel = new QLabel(tr("Memory budget for concurrent parses in MiB (0 for 60% of the physical memory; requires a restart): "));
+  QLineEdit* parseMemoryBudgetEdit = new QLineEdit(QString::number(Settings::Instance().GetParseMemoryBudgetMiB()));
+  parseMemoryBudgetEdit->setValidator(new QIntValidator(0, std::numeric_limits<int>::max(), parseMemoryBudgetEdit));
+  QHBoxLayout* parseMemoryBudgetLayout = new QHBoxLayout();
+  parseMemoryBudgetLayout->addWidget(parseMemoryBudgetLabel);
+  parseMemoryBudgetLayout->addWidget(parseMemoryBudgetEdit);
+  layout->addLayout(parseMemoryBudgetLayout);
+  
+  QLabel* codeInfoThreadCountLabel = new QLabel(tr("Number of threads for code completion and code info (requires a restart): "));
+  QLineEdit* codeInfoThreadCountEdit = new QLineEdit(QString::number(Settings::Instance().GetCodeInfoThreadCount()));
+  codeInfoThreadCountEdit->setValidator(new QIntValidator(1, std::numeric_limits<int>::max(), codeInfoThreadCountEdit));
+  QHBoxLayout* codeInfoThreadCountLayout = new QHBoxLayout();
+  codeInfoThreadCountLayout->addWidget(codeInfoThreadCountLabel);
+  codeInfoThreadCountLayout->addWidget(codeInfoThreadCountEdit);
+  layout->addLayout(codeInfoThreadCountLayout);
+  
+  QLabel* tusPerDocumentLabel = new QLabel(tr("Number of libclang TUs per open document (at least 2; more TUs allow for concurrent code info requests within a document, but use more memory; applies to newly opened documents): "));
+  tusPerDocumentLabel->setWordWrap(true);
+  QLineEdit* tusPerDocumentEdit = new QLineEdit(QString::number(Settings::Instance().GetTUsPerDocument()));
+  tusPerDocumentEdit->setValidator(new QIntValidator(2, std::numeric_limits<int>::max(), tusPerDocumentEdit));
+  QHBoxLayout* tusPerDocumentLayout = new QHBoxLayout();
+  tusPerDocumentLayout->addWidget(tusPerDocumentLabel);
+  tusPerDocumentLayout->addWidget(tusPerDocumentEdit);
+  layout->addLayout(tusPerDocumentLayout);
+  
+  QCheckBox* useIndexingAPICheck = new QCheckBox(tr("Use libclang's indexing API for files that are not open (faster, skips function bodies in headers that were indexed already)"));
+  useIndexingAPICheck->setChecked(Settings::Instance().GetUseIndexingAPIForBackgroundIndexing());
+  layout->addWidget(useIndexingAPICheck);
+  
+  QCheckBox* useTargetPCHCheck = new QCheckBox(tr("Use a shared precompiled header per target for the system includes common to all of its source files (faster indexing and initial parsing)"));
+  useTargetPCHCheck->setChecked(Settings::Instance().GetUseTargetPCH());
+  layout->addWidget(useTargetPCHCheck);
+  
   layout->addStretch(1);
   
   // --- Connections ---
@@ -725,6 +782,20 @@ QWidget* SettingsDialog::CreateCodeParsingCategory() {
   connect(defaultCompilerEdit, &QLineEdit::textChanged, [&](const QString& path) {
     Settings::Instance().SetDefaultCompiler(path);
   });
+  connect(parseThreadCountEdit, &QLineEdit::textChanged, [&](const QString& text) {
+    Settings::Instance().SetParseThreadCount(text.toInt());
+  });
+  connect(parseMemoryBudgetEdit, &QLineEdit::textChanged, [&](const QString& text) {
+    Settings::Instance().SetParseMemoryBudgetMiB(text.toInt());
+  });
+  connect(codeInfoThreadCountEdit, &QLineEdit::textChanged, [&](const QString& text) {
+    Settings::Instance().SetCodeInfoThreadCount(text.toInt());
+  });
+  connect(tusPerDocumentEdit, &QLineEdit::textChanged, [&](const QString& text) {
+    Settings::Instance().SetTUsPerDocument(text.toInt());
+  });
+  connect(useIndexingAPICheck, &QCheckBox::stateChanged, &Settings::Instance(), &Settings::SetUseIndexingAPIForBackgroundIndexing);
+  connect(useTargetPCHCheck, &QCheckBox::stateChanged, &Settings::Instance(), &Settings::SetUseTargetPCH);
   
   QWidget* categoryWidget = new QWidget();
   categoryWidget->setLayout(layout);
@@ -291,6 +291,38 @@ class Settings : public QObject {
     return settings.value("gdb_path", "gdb").toString();
   }
   
+  /// Returns the number of parse threads. 0 means to use one thread per core.
+  inline int GetParseThreadCount() const {
+    return settings.value("parse_thread_count", 0).toInt();
+  }
+  
+  /// Returns the memory budget for concurrent parses in MiB. 0 means to
+  /// determine it from the physical memory size.
+  inline int GetParseMemoryBudgetMiB() const {
+    return settings.value("parse_memory_budget_mib", 0).toInt();
+  }
+  
+  /// Returns the number of threads that perform code info operations (such as
+  /// code completion) on the TUs of the open documents.
+  inline int GetCodeInfoThreadCount() const {
+    return settings.value("code_info_thread_count", 2).toInt();
+  }
+  
+  /// Returns the number of libclang TUs that are kept for each open document.
+  /// One of them remains available for reparsing, the others may be used by
+  /// concurrent code info operations.
+  inline int GetTUsPerDocument() const {
+    return settings.value("tus_per_document", 2).toInt();
+  }
+  
+  inline bool GetUseIndexingAPIForBackgroundIndexing() const {
+    return settings.value("use_indexing_api_for_background_indexing", true).toBool();
+  }
+  
+  inline bool GetUseTargetPCH() const {
+    return settings.value("use_target_pch", true).toBool();
+  }
+  
   inline bool GetUsePerVariableColoring() const {
     return settings.value("per_variable_coloring", true).toBool();
   }
@@ -402,6 +434,30 @@ class Settings : public QObject {
     settings.setValue("gdb_path", path);
   }
   
+  inline void SetParseThreadCount(int count) {
+    settings.setValue("parse_thread_count", count);
+  }
+  
+  inline void SetParseMemoryBudgetMiB(int budget) {
+    settings.setValue("parse_memory_budget_mib", budget);
+  }
+  
+  inline void SetCodeInfoThreadCount(int count) {
+    settings.setValue("code_info_thread_count", count);
+  }
+  
+  inline void SetTUsPerDocument(int count) {
+    settings.setValue("tus_per_document", count);
+  }
+  
+  inline void SetUseIndexingAPIForBackgroundIndexing(bool enable) {
+    settings.setValue("use_indexing_api_for_background_indexing", enable);
+  }
+  
+  inline void SetUseTargetPCH(bool enable) {
+    settings.setValue("use_target_pch", enable);
+  }
+  
   inline void SetUsePerVariableColoring(bool enable) {
     settings.setValue("per_variable_coloring", enable);
   }
@@ -486,6 +542,23 @@ class Settings : public QObject {
 };
 
 
+/// Copy of the settings that are used for syntax highlighting. Highlighting is
+/// computed in the parse threads, which must not access the Settings since they
+/// may be changed in the Qt thread at any time. Instead, the parse threads
+/// create this copy in the Qt thread before highlighting.
+struct HighlightingSettings {
+  /// Copies the current settings. Must be called from the Qt thread.
+  void Read();
+  
+  inline const Settings::ConfigurableTextStyle& GetTextStyle(Settings::TextStyle id) const { return textStyles[static_cast<int>(id)]; }
+  
+  std::vector<Settings::ConfigurableTextStyle> textStyles;
+  std::vector<QRgb> localVariableColors;
+  QStringList commentMarkers;
+  bool usePerVariableColoring = false;
+};
+
+
 class SettingsDialog : public QDialog {
  Q_OBJECT
  public:
@@ -0,0 +1,335 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/target_pch.h"
+
+#include <algorithm>
+
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QStandardPaths>
+
+#include "cide/clang_index.h"
+#include "cide/clang_utils.h"
+
+/// Only this many bytes are read from the start of each source file to find
+/// its leading system includes.
+constexpr int kMaxLeadingTextSize = 64 * 1024;
+
+/// The files of a PCH are checked for modifications at most once within this
+/// interval, since TargetPCH::IsUpToDate() is called for each parse.
+constexpr std::chrono::milliseconds kUpToDateCheckInterval(2000);
+
+std::vector<QByteArray> FindLeadingSystemIncludes(const QByteArray& text) {
+  std::vector<QByteArray> result;
+  
+  bool inBlockComment = false;
+  int lineStart = 0;
+  while (lineStart < text.size()) {
+    int lineEnd = text.indexOf('\n', lineStart);
+    if (lineEnd < 0) {
+      lineEnd = text.size();
+    }
+    QByteArray line = text.mid(lineStart, lineEnd - lineStart).trimmed();
+    lineStart = lineEnd + 1;
+    
+    // Skip comments.
+    if (inBlockComment) {
+      int commentEnd = line.indexOf("*/");
+      if (commentEnd < 0) {
+        continue;
+      }
+      line = line.mid(commentEnd + 2).trimmed();
+      inBlockComment = false;
+    }
+    while (line.startsWith("/*")) {
+      int commentEnd = line.indexOf("*/", 2);
+      if (commentEnd < 0) {
+        inBlockComment = true;
+        line.clear();
+        break;
+      }
+      line = line.mid(commentEnd + 2).trimmed();
+    }
+    if (line.isEmpty() || line.startsWith("//")) {
+      continue;
+    }
+    
+    // Anything else than a system #include or #pragma once ends the leading
+    // part, since it might affect the meaning of the following includes. This
+    // includes quoted includes, which may for example define macros.
+    if (!line.startsWith('#')) {
+      break;
+    }
+    line = line.mid(1).trimmed();
+    if (line.startsWith("include")) {
+      line = line.mid(7).trimmed();
+      if (line.startsWith('<')) {
+        int end = line.indexOf('>');
+        if (end < 0) {
+          break;
+        }
+        result.push_back(line.mid(1, end - 1));
+        continue;
+      }
+    } else if (line.startsWith("pragma") && line.mid(6).trimmed().startsWith("once")) {
+      continue;
+    }
+    break;
+  }
+  
+  return result;
+}
+
+
+TargetPCH::~TargetPCH() {
+  if (!pchPath.isEmpty()) {
+    QFile::remove(pchPath);
+  }
+  if (!headerPath.isEmpty()) {
+    QFile::remove(headerPath);
+  }
+}
+
+bool TargetPCH::IsUpToDate() const {
+  std::unique_lock<std::mutex> lock(upToDateMutex);
+  if (!isUpToDate) {
+    return false;
+  }
+  auto now = std::chrono::steady_clock::now();
+  if (lastUpToDateCheckTime != std::chrono::steady_clock::time_point() &&
+      now - lastUpToDateCheckTime < kUpToDateCheckInterval) {
+    return true;
+  }
+  
+  for (const ClangTU::IncludeWithModificationTime& file : files) {
+    QFileInfo info(QString::fromUtf8(file.path));
+    if (!info.exists() ||
+        info.lastModified().toSecsSinceEpoch() != file.lastModificationTime) {
+      isUpToDate = false;
+      return false;
+    }
+  }
+  lastUpToDateCheckTime = now;
+  return true;
+}
+
+bool TargetPCH::IsUsableFor(const std::vector<QByteArray>& fileIncludes) const {
+  return fileIncludes.size() >= includes.size() &&
+         std::equal(includes.begin(), includes.end(), fileIncludes.begin());
+}
+
+void TargetPCH::AppendCommandLineArgs(std::vector<QByteArray>* args) const {
+  args->emplace_back("-include-pch");
+  args->emplace_back(pchPath.toLocal8Bit());
+}
+
+
+static void VisitInclusions_GetPCHFiles(
+    CXFile included_file,
+    CXSourceLocation* /*inclusion_stack*/,
+    unsigned include_len,
+    CXClientData client_data) {
+  // Skip the generated header itself.
+  if (include_len == 0) {
+    return;
+  }
+  
+  std::vector<ClangTU::IncludeWithModificationTime>* files = reinterpret_cast<std::vector<ClangTU::IncludeWithModificationTime>*>(client_data);
+  files->emplace_back(
+      GetClangFilePathAsByteArray(included_file),
+      clang_getFileTime(included_file));
+}
+
+TargetPCHCache& TargetPCHCache::Instance() {
+  static TargetPCHCache instance;
+  return instance;
+}
+
+std::shared_ptr<TargetPCH> TargetPCHCache::GetPCH(
+    const std::vector<QByteArray>& commandLineArgs,
+    CompileSettings::Language language,
+    const std::vector<QString>& groupSourcePaths,
+    const QByteArray& fileText) {
+  if (language != CompileSettings::Language::C &&
+      language != CompileSettings::Language::CXX) {
+    return std::shared_ptr<TargetPCH>();
+  }
+  
+  std::vector<QByteArray> fileIncludes = FindLeadingSystemIncludes(fileText);
+  if (fileIncludes.empty()) {
+    return std::shared_ptr<TargetPCH>();
+  }
+  
+  QByteArray key;
+  for (const QByteArray& arg : commandLineArgs) {
+    key += arg;
+    key += '\0';
+  }
+  
+  std::shared_ptr<Entry> entry;
+  {
+    std::unique_lock<std::mutex> lock(accessMutex);
+    std::shared_ptr<Entry>& entryRef = entries[key];
+    if (!entryRef) {
+      entryRef.reset(new Entry());
+    }
+    entry = entryRef;
+  }
+  
+  // Other threads that need the same PCH wait here while it is being built,
+  // since they would otherwise have to parse the same headers themselves.
+  std::shared_ptr<TargetPCH> pch;
+  std::unique_lock<std::mutex> entryLock(entry->mutex);
+  // Note: If building the PCH failed, this is only retried if the list of
+  //       source files changes (for example, after reconfiguring the project).
+  bool buildPCH =
+      entry->sourcePaths != groupSourcePaths ||
+      (entry->pch && !entry->pch->IsUpToDate());
+  if (buildPCH) {
+    // TUs that have been parsed with the old PCH keep it alive until they are
+    // re-created.
+    entry->pch = BuildPCH(commandLineArgs, language, groupSourcePaths);
+    entry->sourcePaths = groupSourcePaths;
+  }
+  pch = entry->pch;
+  entryLock.unlock();
+  
+  if (pch && pch->IsUsableFor(fileIncludes)) {
+    return pch;
+  }
+  return std::shared_ptr<TargetPCH>();
+}
+
+std::shared_ptr<TargetPCH> TargetPCHCache::BuildPCH(
+    const std::vector<QByteArray>& commandLineArgs,
+    CompileSettings::Language language,
+    const std::vector<QString>& groupSourcePaths) {
+  // A PCH only pays off if it is shared by several source files.
+  if (groupSourcePaths.size() < 2) {
+    return std::shared_ptr<TargetPCH>();
+  }
+  
+  // Determine the system includes that all source files start with, in the
+  // same order. Only these can be moved into the PCH without changing the
+  // meaning of the files.
+  std::vector<QByteArray> commonIncludes;
+  for (int i = 0; i < groupSourcePaths.size(); ++ i) {
+    QFile file(groupSourcePaths[i]);
+    if (!file.open(QIODevice::ReadOnly)) {
+      return std::shared_ptr<TargetPCH>();
+    }
+    std::vector<QByteArray> includes = FindLeadingSystemIncludes(file.read(kMaxLeadingTextSize));
+    if (i == 0) {
+      commonIncludes.swap(includes);
+    } else {
+      std::size_t commonSize = 0;
+      while (commonSize < commonIncludes.size() &&
+             commonSize < includes.size() &&
+             commonIncludes[commonSize] == includes[commonSize]) {
+        ++ commonSize;
+      }
+      commonIncludes.resize(commonSize);
+    }
+    if (commonIncludes.empty()) {
+      return std::shared_ptr<TargetPCH>();
+    }
+  }
+  
+  // Write a header which includes them.
+  QString basePath;
+  bool directoryIsValid;
+  {
+    std::unique_lock<std::mutex> lock(accessMutex);
+    if (!directory) {
+      QDir cacheDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+      cacheDir.mkpath(".");
+      directory.reset(new QTemporaryDir(cacheDir.filePath(QStringLiteral("pch-XXXXXX"))));
+    }
+    directoryIsValid = directory->isValid();
+    basePath = directory->filePath(QString::number(numBuiltPCHs));
+    ++ numBuiltPCHs;
+  }
+  if (!directoryIsValid) {
+    qDebug() << "Error: Cannot create the directory for precompiled headers";
+    return std::shared_ptr<TargetPCH>();
+  }
+  
+  std::shared_ptr<TargetPCH> pch(new TargetPCH());
+  pch->headerPath = basePath + QStringLiteral(".h");
+  pch->pchPath = basePath + QStringLiteral(".pch");
+  pch->includes = commonIncludes;
+  
+  QFile headerFile(pch->headerPath);
+  if (!headerFile.open(QIODevice::WriteOnly)) {
+    qDebug() << "Error: Cannot write the precompiled header source:" << pch->headerPath;
+    return std::shared_ptr<TargetPCH>();
+  }
+  for (const QByteArray& include : commonIncludes) {
+    headerFile.write("#include <" + include + ">\n");
+  }
+  headerFile.close();
+  
+  // Parse the header with the same arguments as the files that will use the
+  // PCH, and save the result.
+  std::vector<const char*> commandLineArgPtrs(commandLineArgs.size());
+  for (int i = 0; i < commandLineArgs.size(); ++ i) {
+    commandLineArgPtrs[i] = commandLineArgs[i].data();
+  }
+  commandLineArgPtrs.push_back("-x");
+  commandLineArgPtrs.push_back((language == CompileSettings::Language::C) ? "c-header" : "c++-header");
+  
+  ClangIndex index;
+  CXTranslationUnit clangTU;
+  CXErrorCode parseResult = clang_parseTranslationUnit2(
+      index.index(),
+      pch->headerPath.toLocal8Bit().data(),
+      commandLineArgPtrs.data(),
+      commandLineArgPtrs.size(),
+      nullptr,
+      0,
+      CXTranslationUnit_DetailedPreprocessingRecord |
+          CXTranslationUnit_ForSerialization |
+          CXTranslationUnit_Incomplete,
+      &clangTU);
+  if (parseResult != CXError_Success) {
+    qDebug() << "Error: Failed to parse the precompiled header (libclang CXErrorCode:" << static_cast<int>(parseResult) << ")";
+    return std::shared_ptr<TargetPCH>();
+  }
+  
+  // Do not use the PCH if the headers cannot be parsed without errors with
+  // these settings, since the errors would then show up in every file.
+  bool hasErrors = false;
+  unsigned numDiagnostics = clang_getNumDiagnostics(clangTU);
+  for (unsigned i = 0; i < numDiagnostics; ++ i) {
+    CXDiagnostic diagnostic = clang_getDiagnostic(clangTU, i);
+    if (clang_getDiagnosticSeverity(diagnostic) >= CXDiagnostic_Error) {
+      hasErrors = true;
+    }
+    clang_disposeDiagnostic(diagnostic);
+  }
+  
+  bool success = false;
+  if (hasErrors) {
+    qDebug() << "Not using a precompiled header for" << groupSourcePaths.size() << "source files since parsing the common includes yields errors";
+  } else if (clang_saveTranslationUnit(clangTU, pch->pchPath.toLocal8Bit().data(), clang_defaultSaveOptions(clangTU)) != CXSaveError_None) {
+    qDebug() << "Error: Failed to save the precompiled header:" << pch->pchPath;
+  } else {
+    clang_getInclusions(clangTU, &VisitInclusions_GetPCHFiles, &pch->files);
+    for (const ClangTU::IncludeWithModificationTime& file : pch->files) {
+      pch->includedPaths.insert(QFileInfo(QString::fromUtf8(file.path)).canonicalFilePath());
+    }
+    IndexFile_CollectUSRs(clangTU, &pch->usrs);
+    success = true;
+  }
+  
+  clang_disposeTranslationUnit(clangTU);
+  if (!success) {
+    return std::shared_ptr<TargetPCH>();
+  }
+  return pch;
+}
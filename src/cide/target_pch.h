@@ -0,0 +1,139 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+#include <QTemporaryDir>
+
+#include "cide/clang_parser.h"
+#include "cide/clang_tu_pool.h"
+#include "cide/project.h"
+
+/// Returns the system includes (the paths within #include <...>) at the start
+/// of the given source file text, in the order in which they appear. Only the
+/// leading part of the file is considered that consists of comments, system
+/// #include directives, and #pragma once. Anything else, including a quoted
+/// include (#include "..."), ends this part.
+std::vector<QByteArray> FindLeadingSystemIncludes(const QByteArray& text);
+
+
+/// A precompiled header (PCH) containing the leading system includes that all
+/// source files of a group of compile settings have in common. Parsing a file with
+/// this PCH avoids re-parsing these (often large) headers for each file.
+/// The PCH file is deleted when the TargetPCH object is destroyed.
+class TargetPCH {
+ friend class TargetPCHCache;
+ public:
+  ~TargetPCH();
+  
+  /// Returns true if none of the files contained in the PCH has been modified
+  /// since the PCH was built. To avoid checking all files for each parse, a
+  /// positive result is re-used for a short time, and a negative result is
+  /// final.
+  bool IsUpToDate() const;
+  
+  /// Returns true if the PCH may be used for parsing a file with the given
+  /// leading system includes (as returned by FindLeadingSystemIncludes()),
+  /// i.e., if the file starts with exactly the includes in the PCH, in the
+  /// same order.
+  bool IsUsableFor(const std::vector<QByteArray>& fileIncludes) const;
+  
+  /// Appends the command line arguments for using the PCH to @p args.
+  void AppendCommandLineArgs(std::vector<QByteArray>* args) const;
+  
+  /// Returns the canonical paths of all files contained in the PCH.
+  inline const std::unordered_set<QString>& GetIncludedPaths() const { return includedPaths; }
+  
+  /// Returns the USRs of the files contained in the PCH. libclang's indexing
+  /// API does not report the declarations within a PCH, so these need to be
+  /// published separately for files that are indexed with it.
+  inline const CollectedUSRs& GetUSRs() const { return usrs; }
+  
+ private:
+  TargetPCH() = default;
+  
+  
+  /// Path of the generated header which includes the system includes.
+  QString headerPath;
+  
+  /// Path of the PCH file.
+  QString pchPath;
+  
+  /// The system includes contained in the PCH.
+  std::vector<QByteArray> includes;
+  
+  /// The files contained in the PCH, with their modification times at the time
+  /// the PCH was built.
+  std::vector<ClangTU::IncludeWithModificationTime> files;
+  
+  std::unordered_set<QString> includedPaths;
+  CollectedUSRs usrs;
+  
+  // Cached result of IsUpToDate().
+  mutable std::mutex upToDateMutex;
+  mutable bool isUpToDate = true;
+  mutable std::chrono::steady_clock::time_point lastUpToDateCheckTime;
+};
+
+
+/// Singleton which builds and stores the TargetPCHs. A PCH is built for each
+/// distinct set of compile arguments, when the first file with these arguments
+/// gets parsed. It is rebuilt if any of its files has been modified, or if the
+/// list of source files that it was built for changes.
+class TargetPCHCache {
+ public:
+  static TargetPCHCache& Instance();
+  
+  /// Returns the PCH for parsing a file with the given command line arguments
+  /// and language. @p groupSourcePaths are the source files of the file's
+  /// compile settings group, and @p fileText is the content of the file. If no
+  /// up-to-date PCH exists yet, it is built in the calling thread (which may
+  /// take some time). Returns null if no PCH can be used for the file. Can be
+  /// called from any thread.
+  std::shared_ptr<TargetPCH> GetPCH(
+      const std::vector<QByteArray>& commandLineArgs,
+      CompileSettings::Language language,
+      const std::vector<QString>& groupSourcePaths,
+      const QByteArray& fileText);
+  
+ private:
+  struct Entry {
+    /// Held while the PCH is being checked or built.
+    std::mutex mutex;
+    
+    /// Source paths for which the PCH was built (or for which building was
+    /// attempted if pch is null).
+    std::vector<QString> sourcePaths;
+    
+    std::shared_ptr<TargetPCH> pch;
+  };
+  
+  TargetPCHCache() = default;
+  
+  /// Builds a PCH. Returns null if no PCH could be built.
+  std::shared_ptr<TargetPCH> BuildPCH(
+      const std::vector<QByteArray>& commandLineArgs,
+      CompileSettings::Language language,
+      const std::vector<QString>& groupSourcePaths);
+  
+  
+  /// Protects the members below.
+  std::mutex accessMutex;
+  
+  /// Maps the command line arguments (joined with '\0') to the entry.
+  std::unordered_map<QByteArray, std::shared_ptr<Entry>> entries;
+  
+  /// Directory for the PCH files. Created on demand.
+  std::unique_ptr<QTemporaryDir> directory;
+  int numBuiltPCHs = 0;
+};
@@ -2,22 +2,42 @@
 // This file is part of CIDE, licensed under the new BSD license.
 // See the COPYING file in the project root for the license text.
 
+#include <algorithm>
 #include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
 
 #include <git2.h>
 #include <gtest/gtest.h>
 #include <QApplication>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
 #include <QStandardPaths>
+#include <QTemporaryDir>
 
+#include "cide/clang_index.h"
+#include "cide/clang_parser.h"
+#include "cide/clang_utils.h"
 #include "cide/code_completion_widget.h"
 #include "cide/code_info.h"
+#include "cide/code_info_cache.h"
 #include "cide/crash_backup.h"
 #include "cide/document.h"
 #include "cide/git_diff.h"
+#include "cide/global_symbol_table.h"
+#include "cide/glsl_parser.h"
 #include "cide/main_window.h"
+#include "cide/parse_statistics.h"
 #include "cide/parse_thread_pool.h"
 #include "cide/project.h"
 #include "cide/qt_thread.h"
+#include "cide/target_pch.h"
+#include "cide/text_utils.h"
+#include "cide/tracing.h"
+#include "cide/usr_decl_map.h"
 
 int main(int argc, char** argv) {
   // Initialize libgit2
@@ -395,6 +415,35 @@ TEST(Document, HighlightRanges3) {
   }
 }
 
+TEST(Document, ApplyHighlighting) {
+  std::vector<int> blockSizes = {1, 2, 3};
+  for (int blockSize : blockSizes) {
+    Document doc(NewlineFormat::Lf, blockSize);
+    doc.Replace(doc.FullDocumentRange(), QStringLiteral("ABC"));
+    doc.AddHighlightRange(DocumentRange(0, 1), false, qRgb(255, 0, 0), true);  // Make 'A' red and bold
+    doc.AddContext(QStringLiteral("old"), QStringLiteral("old"), DocumentRange::Invalid(), DocumentRange(0, 3));
+    
+    // Replace the highlighting: only 'C' shall be bold afterwards
+    HighlightingBuffer highlighting;
+    highlighting.AddHighlightRange(DocumentRange(2, 3), false, qRgb(255, 0, 0), true);
+    highlighting.AddContext(QStringLiteral("new"), QStringLiteral("new"), DocumentRange::Invalid(), DocumentRange(1, 3));
+    doc.ApplyHighlighting(&highlighting, /*layer*/ 0);
+    
+    Document::CharacterAndStyleIterator it(&doc, 0);
+    EXPECT_EQ(QChar('A'), it.GetChar());
+    EXPECT_FALSE(it.GetStyle().bold);
+    ++ it;
+    EXPECT_EQ(QChar('B'), it.GetChar());
+    EXPECT_FALSE(it.GetStyle().bold);
+    ++ it;
+    EXPECT_EQ(QChar('C'), it.GetChar());
+    EXPECT_TRUE(it.GetStyle().bold);
+    
+    ASSERT_EQ(1, doc.GetContexts().size());
+    EXPECT_EQ("new", doc.GetContexts().begin()->name.toStdString());
+  }
+}
+
 TEST(Document, HighlightRangeUpdatingOnEdits) {
   auto expectStyle = [](Document& doc, const QString& bold, const QString& testName) {
     ASSERT_EQ(bold.size(), doc.FullDocumentRange().size());
@@ -539,6 +588,110 @@ TEST(Document, UndoRedo) {
   }
 }
 
+TEST(Document, EditMapper) {
+  Document doc(NewlineFormat::Lf, /*desiredBlockSize*/ 4);
+  doc.Replace(doc.FullDocumentRange(), QStringLiteral("int a;\nint b;\n"));
+  std::vector<unsigned> oldLineOffsets = {0, 7, 14};
+  int oldEditCount = doc.editCount();
+  
+  doc.Replace(DocumentRange(4, 5), QStringLiteral("abc"));
+  doc.Replace(DocumentRange(0, 0), QStringLiteral("//\n"));
+  EXPECT_EQ("//\nint abc;\nint b;\n", doc.GetDocumentText().toStdString());
+  
+  std::unique_ptr<DocumentEditMapper> mapper = doc.CreateEditMapper(oldEditCount, oldLineOffsets);
+  ASSERT_TRUE(mapper != nullptr);
+  
+  // Ranges before, between, and after the edits
+  DocumentRange range(0, 3);  // int
+  EXPECT_TRUE(mapper->MapRange(&range, /*allowEditsInside*/ false));
+  EXPECT_EQ(3, range.start.offset);
+  EXPECT_EQ(6, range.end.offset);
+  
+  range = DocumentRange(11, 12);  // b
+  EXPECT_TRUE(mapper->MapRange(&range, /*allowEditsInside*/ false));
+  EXPECT_EQ(16, range.start.offset);
+  EXPECT_EQ(17, range.end.offset);
+  
+  // A range that was edited
+  range = DocumentRange(4, 5);  // a
+  EXPECT_FALSE(mapper->MapRange(&range, /*allowEditsInside*/ false));
+  
+  // A range that contains an edit
+  range = DocumentRange(0, 6);  // int a;
+  EXPECT_FALSE(mapper->MapRange(&range, /*allowEditsInside*/ false));
+  range = DocumentRange(0, 6);
+  EXPECT_TRUE(mapper->MapRange(&range, /*allowEditsInside*/ true));
+  EXPECT_EQ(3, range.start.offset);
+  EXPECT_EQ(11, range.end.offset);
+  
+  // Lines
+  int line = 0;
+  EXPECT_TRUE(mapper->MapLine(&line));
+  EXPECT_EQ(1, line);
+  line = 1;
+  EXPECT_TRUE(mapper->MapLine(&line));
+  EXPECT_EQ(2, line);
+  
+  // Mapping ranges that are added to the document
+  doc.SetParseResultMapper(mapper.get());
+  std::shared_ptr<Problem> problem(new Problem(Problem::Type::Error, 2, 5, 11, QStringLiteral("error"), QStringLiteral("")));
+  int problemIndex = doc.AddProblem(problem);
+  doc.AddProblemRange(problemIndex, DocumentRange(11, 12));
+  doc.AddProblemRange(problemIndex, DocumentRange(4, 5));
+  // The text before this problem's location was edited, so it is dropped
+  EXPECT_EQ(-1, doc.AddProblem(std::shared_ptr<Problem>(new Problem(Problem::Type::Error, 1, 6, 5, QStringLiteral("error"), QStringLiteral("")))));
+  doc.SetParseResultMapper(nullptr);
+  ASSERT_EQ(1, doc.problemRanges().size());
+  EXPECT_EQ(16, doc.problemRanges().begin()->range.start.offset);
+  ASSERT_EQ(1, doc.problems().size());
+  EXPECT_EQ(3u, problem->items().front().line);
+  EXPECT_EQ(5u, problem->items().front().col);
+  EXPECT_EQ(16u, problem->items().front().offset);
+  
+  // No mapper can be created anymore after the document text was re-assigned
+  Document otherDoc(NewlineFormat::Lf);
+  doc.AssignTextAndStyles(otherDoc);
+  EXPECT_TRUE(doc.CreateEditMapper(oldEditCount, oldLineOffsets) == nullptr);
+}
+
+TEST(Document, IsTextBeforeUnchangedSince) {
+  Document doc(NewlineFormat::Lf);
+  doc.Replace(doc.FullDocumentRange(), QStringLiteral("object."));
+  int oldEditCount = doc.editCount();
+  
+  // Typing after the location does not change the text before it
+  doc.Replace(DocumentRange(7, 7), QStringLiteral("mem"));
+  EXPECT_TRUE(doc.IsTextBeforeUnchangedSince(oldEditCount, DocumentLocation(7)));
+  
+  // Removing the "." does
+  doc.Replace(DocumentRange(6, 7), QStringLiteral(""));
+  EXPECT_FALSE(doc.IsTextBeforeUnchangedSince(oldEditCount, DocumentLocation(7)));
+  EXPECT_TRUE(doc.IsTextBeforeUnchangedSince(oldEditCount, DocumentLocation(6)));
+}
+
+TEST(CodeInfoCache, Lookup) {
+  CodeInfoCache cache(/*maxNumEntries*/ 2);
+  for (int i = 0; i < 3; ++ i) {
+    CodeInfoCacheEntry entry;
+    entry.parseStamp = 1;
+    entry.documentEditCount = 5;
+    entry.tokenRange = DocumentRange(10 * i, 10 * i + 3);
+    entry.htmlString = QString::number(i);
+    cache.Insert(std::move(entry));
+  }
+  
+  // The least recently used entry was dropped
+  EXPECT_TRUE(cache.Lookup(DocumentLocation(1), 1, 5) == nullptr);
+  const CodeInfoCacheEntry* entry = cache.Lookup(DocumentLocation(12), 1, 5);
+  ASSERT_TRUE(entry != nullptr);
+  EXPECT_EQ("1", entry->htmlString.toStdString());
+  EXPECT_TRUE(cache.Lookup(DocumentLocation(13), 1, 5) == nullptr);
+  
+  // A reparse invalidates all entries
+  EXPECT_TRUE(cache.Lookup(DocumentLocation(12), 2, 5) == nullptr);
+  EXPECT_TRUE(cache.Lookup(DocumentLocation(12), 1, 5) == nullptr);
+}
+
 
 TEST(CodeCompletion, Sorting) {
   for (int testIndex = 0; testIndex < 2; ++ testIndex) {
@@ -608,6 +761,516 @@ TEST(CodeCompletion, Sorting) {
   }
 }
 
+TEST(CodeCompletion, IncrementalFiltering) {
+  QStringList filterTexts = {"Test", "Something", "Tesla", "toast", "Temporary", "testing", "SetTest", "est"};
+  auto createWidget = [&]() {
+    std::vector<CompletionItem> items;
+    for (const QString& filterText : filterTexts) {
+      items.emplace_back();
+      items.back().filterText = filterText;
+      items.back().lowercaseFilterText = filterText.toLower();
+    }
+    return new CodeCompletionWidget(std::move(items), nullptr, QPoint(0, 0), nullptr);
+  };
+  
+  // Extend the filter text step by step (which only rescores the remaining
+  // candidates), and compare to filtering with the final text directly.
+  CodeCompletionWidget* incrementalWidget = createWidget();
+  incrementalWidget->SetFilterText(QStringLiteral("T"));
+  incrementalWidget->SetFilterText(QStringLiteral("Te"));
+  incrementalWidget->SetFilterText(QStringLiteral("Tes"));
+  incrementalWidget->SetFilterText(QStringLiteral("Test"));
+  std::vector<CompletionItem> incrementalItems = incrementalWidget->GetSortedItems();
+  
+  CodeCompletionWidget* directWidget = createWidget();
+  directWidget->SetFilterText(QStringLiteral("Test"));
+  std::vector<CompletionItem> directItems = directWidget->GetSortedItems();
+  
+  ASSERT_EQ(directItems.size(), incrementalItems.size());
+  for (int i = 0; i < directItems.size(); ++ i) {
+    // All items that match sufficiently well must be equal.
+    if (directItems[i].matchScore.matchedCharacters < 2) {
+      break;
+    }
+    EXPECT_EQ(directItems[i].filterText, incrementalItems[i].filterText);
+    EXPECT_EQ(directItems[i].matchScore.matchedCharacters, incrementalItems[i].matchScore.matchedCharacters);
+    EXPECT_EQ(directItems[i].matchScore.matchErrors, incrementalItems[i].matchScore.matchErrors);
+  }
+  
+  delete incrementalWidget;
+  delete directWidget;
+}
+
+TEST(CodeCompletion, SingleExactMatchWhileFiltering) {
+  // With this many items, the items are scored in chunks, so the exact match
+  // (which comes last) has not been scored yet after setting the filter text.
+  std::vector<CompletionItem> items(20000);
+  for (int i = 0; i < items.size(); ++ i) {
+    items[i].filterText = (i == items.size() - 1) ? QStringLiteral("uniqueName") : QStringLiteral("otherName%1").arg(i);
+    items[i].lowercaseFilterText = items[i].filterText.toLower();
+    items[i].clangCompletionIndex = -1;
+    items[i].priority = 0;
+  }
+  CodeCompletionWidget* widget = new CodeCompletionWidget(std::move(items), nullptr, QPoint(0, 0), nullptr);
+  
+  widget->SetFilterText(QStringLiteral("uniqueName"));
+  EXPECT_TRUE(widget->HasSingleExactMatch());
+  
+  widget->SetFilterText(QStringLiteral("uniqueNam"));
+  EXPECT_FALSE(widget->HasSingleExactMatch());
+  
+  delete widget;
+}
+
+
+/// Creates @p count pseudo-random symbol names such as "getWidgetCount2".
+static std::vector<QString> CreateSyntheticSymbolNames(int count) {
+  const char* parts[] = {"get", "set", "Widget", "count", "Value", "index", "Map", "update", "_", "Tree", "Node", "x", "2", "Parse", "file", "Qt", "Eigen", "Matrix", "d", "Buffer"};
+  constexpr int kNumParts = sizeof(parts) / sizeof(parts[0]);
+  
+  std::mt19937 generator(42);
+  std::vector<QString> names(count);
+  for (int i = 0; i < count; ++ i) {
+    int numParts = 1 + generator() % 4;
+    for (int p = 0; p < numParts; ++ p) {
+      names[i] += QString::fromLatin1(parts[generator() % kNumParts]);
+    }
+  }
+  return names;
+}
+
+TEST(TextUtils, FuzzyTextMatchQuery) {
+  std::vector<QString> items = CreateSyntheticSymbolNames(20000);
+  items.push_back(QStringLiteral(""));
+  QStringList texts = {"get", "GetWidget", "wdgt", "tree_node", "MatrixX", "qT", "valueindex", "zzz", "2d"};
+  
+  for (const QString& text : texts) {
+    QString lowercaseText = text.toLower();
+    FuzzyTextMatchQuery query(text, lowercaseText);
+    int minMatchedCharacters = text.size() - 2;
+    
+    for (const QString& item : items) {
+      QString lowercaseItem = item.toLower();
+      FuzzyTextMatchScore expectedScore;
+      ComputeFuzzyTextMatch(text, lowercaseText, item, lowercaseItem, &expectedScore);
+      
+      FuzzyTextMatchScore score;
+      if (ComputeFuzzyTextMatch(query, item, lowercaseItem, FuzzyTextMatchSignature(lowercaseItem), minMatchedCharacters, &score)) {
+        EXPECT_EQ(expectedScore.matchedCharacters, score.matchedCharacters) << text.toStdString() << " / " << item.toStdString();
+        EXPECT_EQ(expectedScore.matchErrors, score.matchErrors) << text.toStdString() << " / " << item.toStdString();
+        EXPECT_EQ(expectedScore.matchedCase, score.matchedCase) << text.toStdString() << " / " << item.toStdString();
+        EXPECT_EQ(expectedScore.matchedStartIndex, score.matchedStartIndex) << text.toStdString() << " / " << item.toStdString();
+      } else {
+        // The rejection must be correct, and the returned score must be an
+        // upper bound.
+        EXPECT_LT(expectedScore.matchedCharacters, minMatchedCharacters) << text.toStdString() << " / " << item.toStdString();
+        EXPECT_LE(expectedScore.matchedCharacters, score.matchedCharacters) << text.toStdString() << " / " << item.toStdString();
+      }
+    }
+  }
+}
+
+TEST(TextUtils, UTF8TextSearcher) {
+  QByteArray text = QString::fromUtf8("int \xc3\xa4Value = 1;\nfloat value = aValue + VALUE;\n").toUtf8();
+  
+  UTF8TextSearcher caseSensitive(QStringLiteral("Value"), Qt::CaseSensitive);
+  ASSERT_TRUE(caseSensitive.IsSupported());
+  EXPECT_EQ(5, caseSensitive.GetPatternSize());
+  qint64 first = caseSensitive.Find(text.constData(), text.size(), 0);
+  EXPECT_EQ(text.indexOf("Value"), first);
+  EXPECT_EQ(text.indexOf("aValue") + 1, caseSensitive.Find(text.constData(), text.size(), first + 1));
+  
+  // Collect all case-insensitive occurrences and compare them to the ones
+  // found by QByteArray::indexOf() on the lowercase text.
+  UTF8TextSearcher caseInsensitive(QStringLiteral("vALue"), Qt::CaseInsensitive);
+  ASSERT_TRUE(caseInsensitive.IsSupported());
+  QByteArray lowercaseText = text.toLower();
+  qint64 expected = -1;
+  qint64 pos = 0;
+  int numOccurrences = 0;
+  while (true) {
+    expected = lowercaseText.indexOf("value", expected + 1);
+    pos = caseInsensitive.Find(text.constData(), text.size(), pos);
+    EXPECT_EQ(expected, pos);
+    if (pos < 0) {
+      break;
+    }
+    ++ numOccurrences;
+    ++ pos;
+  }
+  EXPECT_EQ(4, numOccurrences);
+  
+  // Patterns that do not fit into the text, empty patterns, and
+  // case-insensitive non-ASCII patterns.
+  EXPECT_EQ(-1, caseSensitive.Find("Valu", 4, 0));
+  EXPECT_FALSE(UTF8TextSearcher(QString(), Qt::CaseSensitive).IsSupported());
+  EXPECT_TRUE(UTF8TextSearcher(QString::fromUtf8("\xc3\xa4"), Qt::CaseSensitive).IsSupported());
+  EXPECT_FALSE(UTF8TextSearcher(QString::fromUtf8("\xc3\xa4"), Qt::CaseInsensitive).IsSupported());
+}
+
+TEST(TextUtils, FuzzyTextMatchIndex) {
+  std::vector<QString> items = CreateSyntheticSymbolNames(20000);
+  items.push_back(QStringLiteral(""));
+  items.push_back(QStringLiteral("src/cide/main_window.cc"));
+  items.push_back(QStringLiteral("dWeIgtdWe"));
+  
+  FuzzyTextMatchIndex index;
+  for (const QString& item : items) {
+    index.AddItem(item.toLower());
+  }
+  index.Finish();
+  EXPECT_EQ(items.size(), index.GetItemCount());
+  
+  QStringList texts = {"GetWidget", "wdgtcnt", "tree_node", "MatrixXd", "cidemain", "widgetx", "zzzzzz"};
+  for (const QString& text : texts) {
+    QString lowercaseText = text.toLower();
+    FuzzyTextMatchQuery query(text, lowercaseText);
+    int minMatchedCharacters = text.size() - 2;
+    
+    std::vector<int> candidates;
+    ASSERT_TRUE(index.GetCandidates(query, minMatchedCharacters, &candidates));
+    EXPECT_LT(candidates.size(), items.size());
+    
+    // All items that match well enough must be candidates.
+    for (int i = 0; i < items.size(); ++ i) {
+      FuzzyTextMatchScore score;
+      ComputeFuzzyTextMatch(text, lowercaseText, items[i], items[i].toLower(), &score);
+      if (score.matchedCharacters >= minMatchedCharacters) {
+        EXPECT_TRUE(std::binary_search(candidates.begin(), candidates.end(), i)) << text.toStdString() << " / " << items[i].toStdString();
+      }
+    }
+  }
+  
+  // Short queries cannot be answered with the index.
+  std::vector<int> candidates;
+  EXPECT_FALSE(index.GetCandidates(FuzzyTextMatchQuery(QStringLiteral("get"), QStringLiteral("get")), 1, &candidates));
+}
+
+/// Benchmark, run with: CIDETest --gtest_also_run_disabled_tests --gtest_filter=*Benchmark*
+TEST(TextUtils, DISABLED_FuzzyTextMatchBenchmark) {
+  constexpr int kNumItems = 1000 * 1000;
+  std::vector<QString> items = CreateSyntheticSymbolNames(kNumItems);
+  std::vector<QString> lowercaseItems(kNumItems);
+  std::vector<FuzzyTextMatchSignature> signatures(kNumItems);
+  FuzzyTextMatchIndex index;
+  for (int i = 0; i < kNumItems; ++ i) {
+    lowercaseItems[i] = items[i].toLower();
+    signatures[i] = FuzzyTextMatchSignature(lowercaseItems[i]);
+    index.AddItem(lowercaseItems[i]);
+  }
+  index.Finish();
+  
+  QStringList texts = {"get", "GetWidget", "wdgtcnt", "tree_node", "MatrixXd", "buffer2"};
+  for (const QString& text : texts) {
+    QString lowercaseText = text.toLower();
+    int minMatchedCharacters = std::max(0, text.size() - 2);
+    
+    auto startTime = std::chrono::steady_clock::now();
+    int numMatches = 0;
+    FuzzyTextMatchScore score;
+    for (int i = 0; i < kNumItems; ++ i) {
+      ComputeFuzzyTextMatch(text, lowercaseText, items[i], lowercaseItems[i], &score);
+      numMatches += (score.matchedCharacters >= minMatchedCharacters) ? 1 : 0;
+    }
+    double fullSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    
+    startTime = std::chrono::steady_clock::now();
+    FuzzyTextMatchQuery query(text, lowercaseText);
+    int numQueryMatches = 0;
+    for (int i = 0; i < kNumItems; ++ i) {
+      if (ComputeFuzzyTextMatch(query, items[i], lowercaseItems[i], signatures[i], minMatchedCharacters, &score) &&
+          score.matchedCharacters >= minMatchedCharacters) {
+        ++ numQueryMatches;
+      }
+    }
+    double querySeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    
+    startTime = std::chrono::steady_clock::now();
+    std::vector<int> candidates;
+    int numIndexMatches = 0;
+    if (index.GetCandidates(query, minMatchedCharacters, &candidates)) {
+      for (int i : candidates) {
+        if (ComputeFuzzyTextMatch(query, items[i], lowercaseItems[i], signatures[i], minMatchedCharacters, &score) &&
+            score.matchedCharacters >= minMatchedCharacters) {
+          ++ numIndexMatches;
+        }
+      }
+    } else {
+      numIndexMatches = numQueryMatches;
+    }
+    double indexSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+    
+    EXPECT_EQ(numMatches, numQueryMatches);
+    EXPECT_EQ(numMatches, numIndexMatches);
+    std::cout << "Query \"" << text.toStdString() << "\" (" << numMatches << " matches): full scoring "
+              << (1000 * fullSeconds) << " ms, with prefilter " << (1000 * querySeconds) << " ms, with index "
+              << (1000 * indexSeconds) << " ms (" << candidates.size() << " candidates)" << std::endl;
+  }
+}
+
+TEST(USRDeclMap, BuildLookupAndMerge) {
+  USRStringPool& pool = USRStringPool::Instance();
+  quint32 usrA = pool.Intern(QByteArray("c:@S@TestClassA"));
+  quint32 usrB = pool.Intern(QByteArray("c:@F@testFunctionB#"));
+  EXPECT_EQ(usrA, pool.Intern(QByteArray("c:@S@TestClassA")));
+  EXPECT_NE(usrA, usrB);
+  EXPECT_EQ(QByteArray("c:@F@testFunctionB#"), pool.Get(usrB));
+  EXPECT_EQ(USRStringPool::kInvalidId, pool.Find(QByteArray("c:@S@NotInterned")));
+  
+  USRDeclMapBuilder builder;
+  builder.Add(usrB, QStringLiteral("void testFunctionB()"), 10, 6, false, CXCursor_FunctionDecl, 5, 13);
+  builder.Add(usrA, QStringLiteral("class TestClassA"), 3, 7, true, CXCursor_ClassDecl, 6, 10);
+  builder.Add(usrB, QStringLiteral("void testFunctionB()"), 20, 6, true, CXCursor_FunctionDecl, 5, 13);
+  EXPECT_TRUE(builder.Contains(usrB, 20, 6));
+  EXPECT_FALSE(builder.Contains(usrB, 20, 7));
+  std::shared_ptr<const USRDeclMap> map = builder.Finish();
+  EXPECT_TRUE(builder.empty());
+  
+  ASSERT_EQ(3, map->size());
+  int begin, end;
+  map->EqualRange(usrB, &begin, &end);
+  ASSERT_EQ(2, end - begin);
+  USRDecl decl = map->GetDecl(begin + 1);
+  EXPECT_EQ(QStringLiteral("void testFunctionB()"), decl.spelling);
+  EXPECT_EQ(20, decl.line);
+  EXPECT_EQ(6, decl.column);
+  EXPECT_TRUE(decl.isDefinition);
+  EXPECT_EQ(CXCursor_FunctionDecl, decl.kind);
+  EXPECT_EQ(5, decl.namePos);
+  EXPECT_EQ(13, decl.nameSize);
+  
+  // Merging only adds decls that do not exist yet.
+  EXPECT_FALSE(USRDeclMap::Merge(*map, *map));
+  USRDeclMapBuilder addedBuilder;
+  quint32 usrC = pool.Intern(QByteArray("c:@testVariableC"));
+  addedBuilder.Add(usrC, QStringLiteral("int testVariableC"), 1, 5, true, CXCursor_VarDecl, 4, 13);
+  addedBuilder.Add(usrA, QStringLiteral("class TestClassA"), 3, 7, true, CXCursor_ClassDecl, 6, 10);
+  std::shared_ptr<const USRDeclMap> merged = USRDeclMap::Merge(*map, *addedBuilder.Finish());
+  ASSERT_TRUE(merged != nullptr);
+  EXPECT_EQ(4, merged->size());
+  EXPECT_TRUE(merged->Contains(usrC, 1, 5));
+  EXPECT_TRUE(merged->Contains(usrB, 10, 6));
+  EXPECT_FALSE(merged->Contains(usrC, 1, 6));
+}
+
+TEST(USRReferenceMap, BuildLookupAndMerge) {
+  USRStringPool& pool = USRStringPool::Instance();
+  quint32 usrA = pool.Intern(QByteArray("c:@S@TestReferencedClassA"));
+  quint32 usrB = pool.Intern(QByteArray("c:@F@testReferencedFunctionB#"));
+  
+  USRReferenceMapBuilder builder;
+  builder.Add(usrB, 12, 3, CXCursor_DeclRefExpr);
+  builder.Add(usrA, 4, 1, CXCursor_TypeRef);
+  builder.Add(usrB, 8, 5, CXCursor_DeclRefExpr);
+  builder.Add(usrB, 12, 3, CXCursor_DeclRefExpr);  // duplicate
+  std::shared_ptr<const USRReferenceMap> map = builder.Finish();
+  EXPECT_TRUE(builder.empty());
+  
+  ASSERT_EQ(3, map->size());
+  int begin, end;
+  map->EqualRange(usrB, &begin, &end);
+  ASSERT_EQ(2, end - begin);
+  USRReference reference = map->GetReference(begin);
+  EXPECT_EQ(8, reference.line);
+  EXPECT_EQ(5, reference.column);
+  EXPECT_EQ(CXCursor_DeclRefExpr, reference.kind);
+  EXPECT_EQ(12, map->GetLine(begin + 1));
+  
+  // Merging only adds references that do not exist yet.
+  EXPECT_FALSE(USRReferenceMap::Merge(*map, *map));
+  USRReferenceMapBuilder addedBuilder;
+  addedBuilder.Add(usrA, 4, 1, CXCursor_TypeRef);
+  addedBuilder.Add(usrA, 30, 9, CXCursor_TypeRef);
+  std::shared_ptr<const USRReferenceMap> merged = USRReferenceMap::Merge(*map, *addedBuilder.Finish());
+  ASSERT_TRUE(merged != nullptr);
+  EXPECT_EQ(4, merged->size());
+  merged->EqualRange(usrA, &begin, &end);
+  ASSERT_EQ(2, end - begin);
+  EXPECT_EQ(4, merged->GetLine(begin));
+  EXPECT_EQ(30, merged->GetLine(begin + 1));
+}
+
+TEST(USRStorage, LookupUSRInFile) {
+  USRStringPool& pool = USRStringPool::Instance();
+  QByteArray usr("c:@F@testLookupUSRInFileFunction#");
+  quint32 usrId = pool.Intern(usr);
+  QString path = QStringLiteral("/lookup_usr_in_file_test.cc");
+  
+  USRDeclMapBuilder declBuilder;
+  declBuilder.Add(usrId, QStringLiteral("void testLookupUSRInFileFunction()"), 2, 6, true, CXCursor_FunctionDecl, 5, 27);
+  USRReferenceMapBuilder referenceBuilder;
+  referenceBuilder.Add(usrId, 7, 3, CXCursor_DeclRefExpr);
+  
+  USRStorage& storage = USRStorage::Instance();
+  storage.Lock();
+  storage.AddUSRMapReference(path);
+  USRMap* usrMap = storage.GetUSRMapForFile(path);
+  usrMap->map = declBuilder.Finish();
+  usrMap->references = referenceBuilder.Finish();
+  storage.Unlock();
+  
+  // Without a recorded version, the references are not known to be complete.
+  std::vector<USRDecl> decls;
+  std::vector<USRReference> references;
+  EXPECT_FALSE(storage.LookupUSRInFile(usr, path, 42, &decls, &references));
+  
+  storage.Lock();
+  storage.GetUSRMapForFile(path)->referencesVersion = 42;
+  storage.Unlock();
+  EXPECT_FALSE(storage.LookupUSRInFile(usr, path, 43, &decls, &references));
+  EXPECT_TRUE(decls.empty());
+  ASSERT_TRUE(storage.LookupUSRInFile(usr, path, 42, &decls, &references));
+  ASSERT_EQ(1, decls.size());
+  EXPECT_EQ(2, decls[0].line);
+  EXPECT_EQ(6, decls[0].column);
+  ASSERT_EQ(1, references.size());
+  EXPECT_EQ(7, references[0].line);
+  EXPECT_EQ(3, references[0].column);
+  
+  storage.Lock();
+  storage.RemoveUSRMapReference(path);
+  storage.Unlock();
+}
+
+TEST(GlobalSymbolTable, DropOutdatedUpdates) {
+  quint32 usrId = USRStringPool::Instance().Intern(QByteArray("c:@F@testGlobalSymbolTableFunction#"));
+  USRDeclMapBuilder builder;
+  builder.Add(usrId, QStringLiteral("void testGlobalSymbolTableFunction()"), 1, 6, true, CXCursor_FunctionDecl, 5, 29);
+  std::shared_ptr<const USRDeclMap> map = builder.Finish();
+  QString path = QStringLiteral("/global_symbol_table_test.cc");
+  
+  GlobalSymbolTable& table = GlobalSymbolTable::Instance();
+  auto containsFile = [&]() {
+    for (const auto& file : *table.GetSnapshot()) {
+      if (file->path == path) {
+        return true;
+      }
+    }
+    return false;
+  };
+  
+  // An update that was numbered before a removal is dropped.
+  quint64 outdatedNumber = table.GetNextUpdateNumber();
+  table.RemoveFile(path);
+  table.UpdateFile(path, *map, outdatedNumber);
+  EXPECT_FALSE(containsFile());
+  
+  // Later updates are applied.
+  table.UpdateFile(path, *map, table.GetNextUpdateNumber());
+  EXPECT_TRUE(containsFile());
+  
+  table.RemoveFile(path);
+  EXPECT_FALSE(containsFile());
+}
+
+TEST(TargetPCH, FindLeadingSystemIncludes) {
+  std::vector<QByteArray> includes = FindLeadingSystemIncludes(
+      "// Copyright header\n"
+      "/* Multi-line\n"
+      "   comment */\n"
+      "#pragma once\n"
+      "\n"
+      "#include <vector>\n"
+      "  #  include <Eigen/Core>  // comment\n"
+      "#define SOME_MACRO\n"
+      "#include <QString>\n");
+  ASSERT_EQ(2, includes.size());
+  EXPECT_EQ(QByteArray("vector"), includes[0]);
+  EXPECT_EQ(QByteArray("Eigen/Core"), includes[1]);
+  
+  // Code or a quoted include before the includes ends the leading part.
+  EXPECT_TRUE(FindLeadingSystemIncludes("int a;\n#include <vector>\n").empty());
+  EXPECT_TRUE(FindLeadingSystemIncludes("#include \"own_header.h\"\n#include <vector>\n").empty());
+}
+
+TEST(GLSL, IncludeFileCache) {
+  QTemporaryDir tmpDir;
+  ASSERT_TRUE(tmpDir.isValid());
+  QString path = QFileInfo(tmpDir.filePath("common.glsl")).absoluteFilePath();
+  
+  QFile file(path);
+  ASSERT_TRUE(file.open(QIODevice::WriteOnly));
+  file.write("float Square(float x) { return x * x; }\n");
+  file.close();
+  
+  std::shared_ptr<const std::string> content = GLSLIncludeFileCache::Instance().GetFileContent(path);
+  ASSERT_TRUE(content != nullptr);
+  EXPECT_EQ("float Square(float x) { return x * x; }\n", *content);
+  EXPECT_EQ(content, GLSLIncludeFileCache::Instance().GetFileContent(path));
+  
+  // Modifying the file must be noticed (the size differs here, so this does not
+  // depend on the resolution of the modification time).
+  ASSERT_TRUE(file.open(QIODevice::WriteOnly | QIODevice::Truncate));
+  file.write("float Cube(float x) { return x * x * x; }\n");
+  file.close();
+  
+  content = GLSLIncludeFileCache::Instance().GetFileContent(path);
+  ASSERT_TRUE(content != nullptr);
+  EXPECT_EQ("float Cube(float x) { return x * x * x; }\n", *content);
+  
+  EXPECT_TRUE(GLSLIncludeFileCache::Instance().GetFileContent(tmpDir.filePath("missing.glsl")) == nullptr);
+}
+
+TEST(Tracing, WriteTraceJSON) {
+  SetTracingEnabled(true);
+  {
+    CIDE_TRACE_SPAN("TestSpanOutside");
+    std::thread thread([]() {
+      SetTraceThreadName("Test thread");
+      CIDE_TRACE_SPAN("TestSpanInThread");
+    });
+    thread.join();
+  }
+  SetTracingEnabled(false);
+  {
+    CIDE_TRACE_SPAN("TestSpanWhileDisabled");
+  }
+  
+  QTemporaryDir tmpDir;
+  ASSERT_TRUE(tmpDir.isValid());
+  QString path = tmpDir.filePath("trace.json");
+  ASSERT_TRUE(WriteTraceJSON(path));
+  
+  QFile file(path);
+  ASSERT_TRUE(file.open(QIODevice::ReadOnly));
+  QJsonArray events = QJsonDocument::fromJson(file.readAll()).object()["traceEvents"].toArray();
+  
+  int outsideTid = -1;
+  int inThreadTid = -1;
+  bool threadNamed = false;
+  for (const QJsonValue& value : events) {
+    QJsonObject event = value.toObject();
+    if (event["name"].toString() == QStringLiteral("TestSpanOutside")) {
+      outsideTid = event["tid"].toInt();
+      EXPECT_EQ(QStringLiteral("X"), event["ph"].toString());
+    } else if (event["name"].toString() == QStringLiteral("TestSpanInThread")) {
+      inThreadTid = event["tid"].toInt();
+    } else if (event["name"].toString() == QStringLiteral("thread_name") &&
+               event["args"].toObject()["name"].toString() == QStringLiteral("Test thread")) {
+      threadNamed = true;
+    }
+    EXPECT_NE(QStringLiteral("TestSpanWhileDisabled"), event["name"].toString());
+  }
+  EXPECT_NE(-1, outsideTid);
+  EXPECT_NE(-1, inThreadTid);
+  EXPECT_NE(outsideTid, inThreadTid);
+  EXPECT_TRUE(threadNamed);
+}
+
+TEST(ParseStatistics, ToCSV) {
+  FileParseStatistics record;
+  record.path = QStringLiteral("/tmp/a \"b\".cc");
+  record.wasOpen = true;
+  record.parseSeconds = 0.5;
+  record.tuMemory = 1024;
+  
+  QList<QByteArray> lines = ParseStatistics::ToCSV({record}).split('\n');
+  ASSERT_EQ(3, lines.size());
+  EXPECT_TRUE(lines[0].startsWith("path,"));
+  EXPECT_EQ(lines[0].count(','), lines[1].count(','));
+  EXPECT_TRUE(lines[1].startsWith("\"/tmp/a \"\"b\"\".cc\",0,1,0,0,0,0.5,"));
+  EXPECT_TRUE(lines[2].isEmpty());
+}
 
 #ifndef _WIN32
 TEST(Project, Reconfigure) {
@@ -829,3 +1492,177 @@ TEST(Parsing, ParseFile) {
     EXPECT_EQ(document->GetContexts().begin()->name, "main");
   });
 }
+
+
+static void VisitInclusionsForBenchmark(
+    CXFile included_file,
+    CXSourceLocation* /*inclusion_stack*/,
+    unsigned /*include_len*/,
+    CXClientData client_data) {
+  std::unordered_set<QString>* includedPaths = reinterpret_cast<std::unordered_set<QString>*>(client_data);
+  includedPaths->insert(QFileInfo(GetClangFilePath(included_file)).canonicalFilePath());
+}
+
+/// Compares indexing via full TU parsing and AST traversal with indexing via
+/// libclang's indexing API, run with:
+/// CIDETest --gtest_also_run_disabled_tests --gtest_filter=*IndexingBenchmark*
+TEST(Parsing, DISABLED_IndexingBenchmark) {
+  constexpr int kNumSourceFiles = 16;
+  
+  QDir tmpDir(QStandardPaths::writableLocation(QStandardPaths::TempLocation));
+  QDir benchmarkDir = tmpDir.filePath("cide_indexing_benchmark");
+  if (benchmarkDir.exists()) {
+    benchmarkDir.removeRecursively();
+  }
+  ASSERT_TRUE(benchmarkDir.mkpath("."));
+  
+  // Create source files that share many (header) function bodies.
+  QFile headerFile(benchmarkDir.filePath("shared.h"));
+  ASSERT_TRUE(headerFile.open(QIODevice::WriteOnly | QIODevice::Text));
+  headerFile.write(
+      "#pragma once\n"
+      "#include <algorithm>\n"
+      "#include <functional>\n"
+      "#include <map>\n"
+      "#include <memory>\n"
+      "#include <sstream>\n"
+      "#include <string>\n"
+      "#include <unordered_map>\n"
+      "#include <vector>\n"
+      "struct Shared {\n"
+      "  std::string Describe() const { std::ostringstream s; for (auto& v : values) { s << v.first << v.second; } return s.str(); }\n"
+      "  std::map<std::string, int> values;\n"
+      "};\n");
+  headerFile.close();
+  
+  std::vector<QString> sourcePaths;
+  for (int i = 0; i < kNumSourceFiles; ++ i) {
+    QFile sourceFile(benchmarkDir.filePath(QStringLiteral("source%1.cc").arg(i)));
+    ASSERT_TRUE(sourceFile.open(QIODevice::WriteOnly | QIODevice::Text));
+    sourceFile.write(QStringLiteral(
+        "#include \"shared.h\"\n"
+        "int Function%1(const std::vector<int>& v) {\n"
+        "  std::vector<int> sorted = v;\n"
+        "  std::sort(sorted.begin(), sorted.end());\n"
+        "  return sorted.empty() ? 0 : sorted.back();\n"
+        "}\n").arg(i).toUtf8());
+    sourceFile.close();
+    sourcePaths.push_back(QFileInfo(sourceFile.fileName()).canonicalFilePath());
+  }
+  
+  std::vector<const char*> commandLineArgs = {"-x", "c++", "-std=c++11"};
+  std::vector<CXUnsavedFile> unsavedFiles;
+  
+  // Both variants add USRMap references for the included files, such that the
+  // USRs get stored.
+  std::vector<QString> referencedPaths;
+  auto addReferences = [&](const std::unordered_set<QString>& includedPaths) {
+    USRStorage::Instance().Lock();
+    for (const QString& path : includedPaths) {
+      USRStorage::Instance().AddUSRMapReference(path);
+      referencedPaths.push_back(path);
+    }
+    USRStorage::Instance().Unlock();
+  };
+  // Returns a sorted description of each decl in the USR maps of all
+  // referenced files, indexed by file path, and removes the references.
+  typedef std::unordered_map<QString, std::vector<std::string>> FileDecls;
+  auto removeReferencesAndGetDecls = [&]() {
+    USRStorage::Instance().Lock();
+    FileDecls fileDecls;
+    for (const QString& path : referencedPaths) {
+      if (fileDecls.count(path) > 0) {
+        continue;
+      }
+      const USRDeclMap& map = *USRStorage::Instance().GetUSRMapForFile(path)->map;
+      std::vector<std::string>& decls = fileDecls[path];
+      decls.reserve(map.size());
+      for (int i = 0; i < map.size(); ++ i) {
+        USRDecl decl = map.GetDecl(i);
+        decls.push_back(QStringLiteral("%1 %2 %3:%4 def=%5 kind=%6 name=%7+%8")
+            .arg(QString::fromUtf8(map.GetUSR(i))).arg(decl.spelling)
+            .arg(decl.line).arg(decl.column).arg(decl.isDefinition)
+            .arg(static_cast<int>(decl.kind)).arg(decl.namePos).arg(decl.nameSize).toStdString());
+      }
+      std::sort(decls.begin(), decls.end());
+    }
+    for (const QString& path : referencedPaths) {
+      USRStorage::Instance().RemoveUSRMapReference(path);
+    }
+    referencedPaths.clear();
+    USRStorage::Instance().Unlock();
+    return fileDecls;
+  };
+  auto countDecls = [](const FileDecls& fileDecls) {
+    int numUSRs = 0;
+    for (const auto& item : fileDecls) {
+      numUSRs += item.second.size();
+    }
+    return numUSRs;
+  };
+  
+  // Variant 1: Parse a TU for each file and traverse its AST.
+  auto startTime = std::chrono::steady_clock::now();
+  for (const QString& path : sourcePaths) {
+    ClangIndex index;
+    CXTranslationUnit TU;
+    ASSERT_EQ(CXError_Success, clang_parseTranslationUnit2(
+        index.index(),
+        path.toLocal8Bit().data(),
+        commandLineArgs.data(),
+        commandLineArgs.size(),
+        nullptr,
+        0,
+        CXTranslationUnit_Incomplete | CXTranslationUnit_KeepGoing,
+        &TU));
+    std::unordered_set<QString> includedPaths;
+    clang_getInclusions(TU, &VisitInclusionsForBenchmark, &includedPaths);
+    addReferences(includedPaths);
+    IndexFile_StoreUSRs(TU, false);
+    clang_disposeTranslationUnit(TU);
+  }
+  double parseSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  FileDecls parseDecls = removeReferencesAndGetDecls();
+  int parseNumUSRs = countDecls(parseDecls);
+  
+  // Variant 2: Use the indexing API with a shared session.
+  ClangIndexingSession::Reset();
+  std::shared_ptr<ClangIndexingSession> session = ClangIndexingSession::Get();
+  startTime = std::chrono::steady_clock::now();
+  for (const QString& path : sourcePaths) {
+    ASSERT_TRUE(IndexFile_WithIndexingAPI(
+        session->action(),
+        path,
+        commandLineArgs,
+        &unsavedFiles,
+        [&](std::unordered_set<QString>&& includedPaths) {
+          addReferences(includedPaths);
+          return true;
+        }));
+  }
+  double indexSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - startTime).count();
+  FileDecls indexDecls = removeReferencesAndGetDecls();
+  int indexNumUSRs = countDecls(indexDecls);
+  ClangIndexingSession::Reset();
+  
+  std::cout << "Parsing + AST traversal: " << parseSeconds << " s (" << parseNumUSRs << " USRs)" << std::endl;
+  std::cout << "Indexing API:            " << indexSeconds << " s (" << indexNumUSRs << " USRs)" << std::endl;
+  EXPECT_GT(parseNumUSRs, 0);
+  EXPECT_GT(indexNumUSRs, 0);
+  
+  // Both variants must store the same USRs for each file.
+  EXPECT_EQ(parseDecls.size(), indexDecls.size());
+  for (const auto& item : parseDecls) {
+    auto it = indexDecls.find(item.first);
+    if (it == indexDecls.end()) {
+      ADD_FAILURE() << "File only indexed by AST traversal: " << item.first.toStdString();
+      continue;
+    }
+    EXPECT_EQ(item.second, it->second) << "USR maps differ for file: " << item.first.toStdString();
+  }
+  for (const auto& item : indexDecls) {
+    if (parseDecls.count(item.first) == 0) {
+      ADD_FAILURE() << "File only indexed by the indexing API: " << item.first.toStdString();
+    }
+  }
+}
@@ -4,6 +4,9 @@
 
 #include "cide/text_utils.h"
 
+#include <algorithm>
+#include <cstring>
+#include <limits>
 #include <mutex>
 
 #include <QString>
@@ -147,3 +150,292 @@ void ComputeFuzzyTextMatch(const QString& text, const QString& lowercaseText, co
     }
   }
 }
+
+
+FuzzyTextMatchSignature::FuzzyTextMatchSignature(const QString& lowercaseText) {
+  characterMask = 0;
+  for (const QChar& c : lowercaseText) {
+    characterMask |= CharacterBit(c);
+  }
+  length = lowercaseText.size();
+}
+
+FuzzyTextMatchQuery::FuzzyTextMatchQuery()
+    : FuzzyTextMatchQuery(QString(), QString()) {}
+
+FuzzyTextMatchQuery::FuzzyTextMatchQuery(const QString& text, const QString& lowercaseText)
+    : mText(text),
+      mLowercaseText(lowercaseText),
+      signature(lowercaseText) {
+  characterBits.resize(lowercaseText.size());
+  for (int c = 0, size = lowercaseText.size(); c < size; ++ c) {
+    characterBits[c] = FuzzyTextMatchSignature::CharacterBit(lowercaseText[c]);
+  }
+  
+  constexpr int kMaxBitParallelQueryLength = 64;
+  useBitParallelSearch = !lowercaseText.isEmpty() && lowercaseText.size() <= kMaxBitParallelQueryLength;
+  for (const QChar& c : lowercaseText) {
+    if (c.unicode() >= 128) {
+      useBitParallelSearch = false;
+      break;
+    }
+  }
+  if (useBitParallelSearch) {
+    positionMasks.resize(128, 0);
+    for (int c = 0, size = lowercaseText.size(); c < size; ++ c) {
+      positionMasks[lowercaseText[c].unicode()] |= static_cast<quint64>(1) << c;
+    }
+  }
+}
+
+int FuzzyTextMatchQuery::GetMaxMatchedCharacters(const FuzzyTextMatchSignature& itemSignature) const {
+  // Each matched character corresponds to a distinct character of the query
+  // which also occurs in the item. Furthermore, each matched character
+  // consumes at least one character of the item.
+  int maxMatchedCharacters;
+  if ((signature.characterMask & ~itemSignature.characterMask) == 0) {
+    maxMatchedCharacters = characterBits.size();
+  } else {
+    maxMatchedCharacters = 0;
+    for (quint64 bit : characterBits) {
+      if (itemSignature.characterMask & bit) {
+        ++ maxMatchedCharacters;
+      }
+    }
+  }
+  return std::min(maxMatchedCharacters, itemSignature.length);
+}
+
+bool FuzzyTextMatchQuery::FindOccurrence(const QString& item, const QString& lowercaseItem, FuzzyTextMatchScore* score) const {
+  const int textSize = mLowercaseText.size();
+  const quint64 matchBit = static_cast<quint64>(1) << (textSize - 1);
+  
+  // Shift-and: bit i of state is set if the first (i + 1) characters of the
+  // query match the item (case-insensitively) ending at the current position.
+  int firstOccurrence = -1;
+  quint64 state = 0;
+  for (int pos = 0, size = lowercaseItem.size(); pos < size; ++ pos) {
+    const ushort unicode = lowercaseItem[pos].unicode();
+    state = (unicode < 128) ? (((state << 1) | 1) & positionMasks[unicode]) : 0;
+    if (state & matchBit) {
+      int start = pos - textSize + 1;
+      if (firstOccurrence < 0) {
+        firstOccurrence = start;
+      }
+      
+      // ComputeFuzzyTextMatch() prefers the first case-sensitive occurrence
+      // over the first case-insensitive one.
+      if (item.midRef(start, textSize) == mText) {
+        *score = FuzzyTextMatchScore(textSize, 0, true, start);
+        return true;
+      }
+    }
+  }
+  
+  if (firstOccurrence >= 0) {
+    *score = FuzzyTextMatchScore(textSize, 0, false, firstOccurrence);
+    return true;
+  }
+  return false;
+}
+
+bool ComputeFuzzyTextMatch(const FuzzyTextMatchQuery& query, const QString& item, const QString& lowercaseItem, const FuzzyTextMatchSignature& itemSignature, int minMatchedCharacters, FuzzyTextMatchScore* score) {
+  if (minMatchedCharacters > 0) {
+    int maxMatchedCharacters = query.GetMaxMatchedCharacters(itemSignature);
+    if (maxMatchedCharacters < minMatchedCharacters) {
+      *score = FuzzyTextMatchScore(maxMatchedCharacters, 0, true, 0);
+      return false;
+    }
+  }
+  
+  if (query.UsesBitParallelSearch() &&
+      query.FindOccurrence(item, lowercaseItem, score)) {
+    return true;
+  }
+  
+  ComputeFuzzyTextMatch(query.text(), query.lowercaseText(), item, lowercaseItem, score);
+  return true;
+}
+
+
+void FuzzyTextMatchIndex::AddItem(const QString& lowercaseText) {
+  std::size_t firstPair = pendingPairs.size();
+  for (int c = 0, size = lowercaseText.size(); c < size; ++ c) {
+    for (int offset = 1; offset <= 3 && c + offset < size; ++ offset) {
+      pendingPairs.emplace_back(GetPairKey(lowercaseText[c], lowercaseText[c + offset]), numItems);
+    }
+  }
+  
+  // Remove duplicate keys of this item.
+  std::sort(pendingPairs.begin() + firstPair, pendingPairs.end());
+  pendingPairs.erase(std::unique(pendingPairs.begin() + firstPair, pendingPairs.end()), pendingPairs.end());
+  
+  ++ numItems;
+}
+
+void FuzzyTextMatchIndex::Finish() {
+  // Sort the pairs by key with a counting sort. Since the items were added in
+  // increasing order, this yields the posting lists in increasing item order.
+  constexpr int kNumKeys = 64 * 64;
+  std::vector<quint32> keyCounts(kNumKeys, 0);
+  for (const auto& pair : pendingPairs) {
+    ++ keyCounts[pair.first];
+  }
+  
+  keys.clear();
+  postingOffsets.clear();
+  std::vector<quint32> writeOffsets(kNumKeys);
+  quint32 offset = 0;
+  for (int key = 0; key < kNumKeys; ++ key) {
+    writeOffsets[key] = offset;
+    if (keyCounts[key] > 0) {
+      keys.push_back(key);
+      postingOffsets.push_back(offset);
+      offset += keyCounts[key];
+    }
+  }
+  postingOffsets.push_back(offset);
+  
+  postings.resize(pendingPairs.size());
+  for (const auto& pair : pendingPairs) {
+    postings[writeOffsets[pair.first] ++] = pair.second;
+  }
+  
+  pendingPairs.clear();
+  pendingPairs.shrink_to_fit();
+  keys.shrink_to_fit();
+  postingOffsets.shrink_to_fit();
+}
+
+bool FuzzyTextMatchIndex::GetCandidates(const FuzzyTextMatchQuery& query, int minMatchedCharacters, std::vector<int>* candidates) const {
+  const QString& lowercaseText = query.lowercaseText();
+  int maxLostCharacters = lowercaseText.size() - minMatchedCharacters;
+  if (minMatchedCharacters <= 0 ||
+      lowercaseText.size() - 1 <= 2 * maxLostCharacters ||
+      lowercaseText.size() > std::numeric_limits<quint8>::max()) {
+    return false;
+  }
+  
+  // Look up the posting lists of all adjacent character pairs in the query.
+  std::vector<std::pair<quint32, quint32>> ranges(lowercaseText.size() - 1);  // pairs of (start, end)
+  for (int c = 0, size = ranges.size(); c < size; ++ c) {
+    quint16 key = GetPairKey(lowercaseText[c], lowercaseText[c + 1]);
+    auto it = std::lower_bound(keys.begin(), keys.end(), key);
+    if (it == keys.end() || *it != key) {
+      ranges[c] = std::make_pair(0, 0);
+    } else {
+      int keyIndex = it - keys.begin();
+      ranges[c] = std::make_pair(postingOffsets[keyIndex], postingOffsets[keyIndex + 1]);
+    }
+  }
+  
+  // Each pair which is not affected by a non-matched query character must be
+  // contained in a candidate. Count the contained pairs for each item.
+  int minContainedPairs = (lowercaseText.size() - 1) - 2 * maxLostCharacters;
+  std::vector<quint8> containedPairs(numItems, 0);
+  for (const auto& range : ranges) {
+    for (quint32 i = range.first; i < range.second; ++ i) {
+      ++ containedPairs[postings[i]];
+    }
+  }
+  
+  candidates->clear();
+  for (int item = 0; item < numItems; ++ item) {
+    if (containedPairs[item] >= minContainedPairs) {
+      candidates->push_back(item);
+    }
+  }
+  return true;
+}
+
+
+UTF8TextSearcher::UTF8TextSearcher(const QString& pattern, Qt::CaseSensitivity caseSensitivity)
+    : caseSensitive(caseSensitivity == Qt::CaseSensitive) {
+  supported = !pattern.isEmpty();
+  if (caseSensitive) {
+    this->pattern = pattern.toUtf8();
+  } else {
+    for (QChar c : pattern) {
+      if (c.unicode() >= 128) {
+        supported = false;
+      }
+    }
+    this->pattern = pattern.toLower().toUtf8();
+  }
+}
+
+qint64 UTF8TextSearcher::Find(const char* text, qint64 size, qint64 from) const {
+  qint64 lastStart = size - pattern.size();
+  if (!supported || from > lastStart) {
+    return -1;
+  }
+  
+  const char first = pattern[0];
+  const char firstUpper = (first >= 'a' && first <= 'z' && !caseSensitive) ? (first - 'a' + 'A') : first;
+  
+  if (first == firstUpper) {
+    // Search for the only possible first byte.
+    qint64 pos = from;
+    while (pos <= lastStart) {
+      const char* candidate = static_cast<const char*>(memchr(text + pos, first, lastStart - pos + 1));
+      if (!candidate) {
+        return -1;
+      }
+      if (MatchesAt(candidate)) {
+        return candidate - text;
+      }
+      pos = candidate - text + 1;
+    }
+    return -1;
+  }
+  
+  // Search for both cases of the first byte. The next candidate for each case
+  // is remembered, such that no part of the text is scanned twice.
+  qint64 nextLower = -2;
+  qint64 nextUpper = -2;
+  qint64 pos = from;
+  while (pos <= lastStart) {
+    if (nextLower != -1 && nextLower < pos) {
+      const char* candidate = static_cast<const char*>(memchr(text + pos, first, lastStart - pos + 1));
+      nextLower = candidate ? (candidate - text) : -1;
+    }
+    if (nextUpper != -1 && nextUpper < pos) {
+      const char* candidate = static_cast<const char*>(memchr(text + pos, firstUpper, lastStart - pos + 1));
+      nextUpper = candidate ? (candidate - text) : -1;
+    }
+    
+    qint64 candidate;
+    if (nextLower == -1 && nextUpper == -1) {
+      return -1;
+    } else if (nextLower == -1) {
+      candidate = nextUpper;
+    } else if (nextUpper == -1) {
+      candidate = nextLower;
+    } else {
+      candidate = std::min(nextLower, nextUpper);
+    }
+    
+    if (MatchesAt(text + candidate)) {
+      return candidate;
+    }
+    pos = candidate + 1;
+  }
+  return -1;
+}
+
+bool UTF8TextSearcher::MatchesAt(const char* text) const {
+  if (caseSensitive) {
+    return memcmp(text + 1, pattern.constData() + 1, pattern.size() - 1) == 0;
+  }
+  
+  for (int i = 1; i < pattern.size(); ++ i) {
+    char c = text[i];
+    if (c >= 'A' && c <= 'Z') {
+      c = c - 'A' + 'a';
+    }
+    if (c != pattern[i]) {
+      return false;
+    }
+  }
+  return true;
+}
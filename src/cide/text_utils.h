@@ -4,7 +4,9 @@
 
 #pragma once
 
+#include <QByteArray>
 #include <QChar>
+#include <QString>
 
 #include <vector>
 
@@ -135,3 +137,193 @@ struct FuzzyTextMatchScore {
 /// Computes how well the 'text' matches the 'item' while accounting for some
 /// possible spelling mistakes and being relatively quick to compute.
 void ComputeFuzzyTextMatch(const QString& text, const QString& lowercaseText, const QString& item, const QString& lowercaseItem, FuzzyTextMatchScore* score);
+
+/// Compact summary of a lowercase string that allows to quickly determine an
+/// upper bound on the number of characters that ComputeFuzzyTextMatch() can
+/// match in it. This is used to reject items that cannot match well enough
+/// before doing the full (comparatively expensive) fuzzy matching.
+struct FuzzyTextMatchSignature {
+  /// Constructor which leaves the struct uninitialized.
+  inline FuzzyTextMatchSignature() = default;
+  
+  /// Computes the signature of the given lowercase text.
+  explicit FuzzyTextMatchSignature(const QString& lowercaseText);
+  
+  /// Returns the bit in characterMask that represents the given (lowercase)
+  /// character. Letters, digits and the underscore have their own bits, while
+  /// other characters share bits.
+  static inline quint64 CharacterBit(QChar c) {
+    return static_cast<quint64>(1) << CharacterClass(c);
+  }
+  
+  /// Returns the index of the bit returned by CharacterBit(), in [0, 63].
+  static inline int CharacterClass(QChar c) {
+    const ushort unicode = c.unicode();
+    if (unicode >= 'a' && unicode <= 'z') {
+      return unicode - 'a';
+    } else if (unicode >= '0' && unicode <= '9') {
+      return 26 + unicode - '0';
+    } else if (unicode == '_') {
+      return 36;
+    } else if (unicode < 128) {
+      return 37 + unicode % 26;
+    } else {
+      return 63;
+    }
+  }
+  
+  /// Bitwise OR of CharacterBit() for all characters of the string.
+  quint64 characterMask;
+  
+  /// Length of the string.
+  int length;
+};
+
+/// A filter text that has been prepared for being matched against many items
+/// with the variant of ComputeFuzzyTextMatch() that takes a query.
+class FuzzyTextMatchQuery {
+ public:
+  /// Creates an empty query.
+  FuzzyTextMatchQuery();
+  
+  /// Prepares the query for the given text and its lowercase version.
+  FuzzyTextMatchQuery(const QString& text, const QString& lowercaseText);
+  
+  /// Returns an upper bound on the number of characters that
+  /// ComputeFuzzyTextMatch() can match for this query and an item with the
+  /// given signature.
+  int GetMaxMatchedCharacters(const FuzzyTextMatchSignature& itemSignature) const;
+  
+  /// Searches for occurrences of the query in the given item using a
+  /// bit-parallel (shift-and) matcher. If the query occurs in the item
+  /// (case-insensitively), returns true and sets @p score to the score that
+  /// ComputeFuzzyTextMatch() would return. Otherwise, returns false. Must only
+  /// be called if UsesBitParallelSearch() returns true.
+  bool FindOccurrence(const QString& item, const QString& lowercaseItem, FuzzyTextMatchScore* score) const;
+  
+  /// Returns whether the query is short enough (and restricted to ASCII
+  /// characters) such that FindOccurrence() can be used.
+  inline bool UsesBitParallelSearch() const { return useBitParallelSearch; }
+  
+  inline const QString& text() const { return mText; }
+  inline const QString& lowercaseText() const { return mLowercaseText; }
+  
+ private:
+  QString mText;
+  QString mLowercaseText;
+  
+  /// Signature of mLowercaseText.
+  FuzzyTextMatchSignature signature;
+  
+  /// FuzzyTextMatchSignature::CharacterBit() for each character of
+  /// mLowercaseText.
+  std::vector<quint64> characterBits;
+  
+  /// For the shift-and matcher: for each ASCII character, the bitmask of
+  /// positions in mLowercaseText at which this character occurs.
+  std::vector<quint64> positionMasks;
+  
+  bool useBitParallelSearch;
+};
+
+/// Variant of ComputeFuzzyTextMatch() for matching a prepared query against
+/// many items. If the item cannot match at least @p minMatchedCharacters
+/// characters (which is determined cheaply with the help of its signature),
+/// this returns false and sets @p score to an upper bound on the achievable
+/// score, without fully computing it. Otherwise, this returns true and computes the same score as the
+/// other variant of ComputeFuzzyTextMatch().
+bool ComputeFuzzyTextMatch(const FuzzyTextMatchQuery& query, const QString& item, const QString& lowercaseItem, const FuzzyTextMatchSignature& itemSignature, int minMatchedCharacters, FuzzyTextMatchScore* score);
+
+/// Inverted index over the lowercase filter texts of a list of items, which
+/// quickly determines a candidate subset of the items that may match a query
+/// well enough, such that only those need to be scored.
+/// 
+/// A plain n-gram index cannot be used for this, since ComputeFuzzyTextMatch()
+/// accepts matches with an arbitrary number of skipped item characters and
+/// swapped characters (for example, "cidemain" fully matches "cide/main").
+/// Instead, the index is keyed by unordered pairs of character classes
+/// (see FuzzyTextMatchSignature::CharacterClass()) which occur at a distance
+/// of at most 3 characters in an item. Every two adjacent query characters
+/// which are both matched by ComputeFuzzyTextMatch() are found at such a
+/// distance. Since each query character that is not matched affects at most
+/// two adjacent pairs, an item that loses at most k characters must contain at
+/// least one out of any (2 k + 1) pairs of the query.
+class FuzzyTextMatchIndex {
+ public:
+  /// Adds an item with the given lowercase filter text. Items are numbered in
+  /// the order in which they are added. Finish() must be called after adding
+  /// all items.
+  void AddItem(const QString& lowercaseText);
+  
+  /// Builds the index from the added items.
+  void Finish();
+  
+  /// Determines the items which may match at least @p minMatchedCharacters
+  /// characters of the query and returns their indices in @p candidates (in
+  /// increasing order). All other items are guaranteed to not reach this
+  /// threshold. Returns false if the query is too short for the index to
+  /// restrict the items; then all items must be considered to be candidates.
+  bool GetCandidates(const FuzzyTextMatchQuery& query, int minMatchedCharacters, std::vector<int>* candidates) const;
+  
+  inline int GetItemCount() const { return numItems; }
+  
+ private:
+  /// Returns the key for the given pair of lowercase characters.
+  static inline quint16 GetPairKey(QChar a, QChar b) {
+    int classA = FuzzyTextMatchSignature::CharacterClass(a);
+    int classB = FuzzyTextMatchSignature::CharacterClass(b);
+    return (classA < classB) ? (64 * classA + classB) : (64 * classB + classA);
+  }
+  
+  
+  /// Sorted list of the pair keys that occur in any item.
+  std::vector<quint16> keys;
+  
+  /// The items containing keys[i] are given by
+  /// postings[postingOffsets[i] .. postingOffsets[i + 1] - 1] (in increasing
+  /// order).
+  std::vector<quint32> postingOffsets;
+  std::vector<quint32> postings;
+  
+  /// (key, item) pairs collected by AddItem(), cleared by Finish().
+  std::vector<std::pair<quint16, quint32>> pendingPairs;
+  
+  int numItems = 0;
+};
+
+
+/// Searches for a pattern in UTF-8 encoded text directly on the bytes, without
+/// decoding the text to a QString. Candidate positions are found with memchr()
+/// (which the C library implements with SIMD instructions) and then verified
+/// with memcmp(), respectively an ASCII case-insensitive comparison.
+class UTF8TextSearcher {
+ public:
+  /// Prepares the search for the given pattern. For case-insensitive search,
+  /// only ASCII letters are folded, so this only supports patterns that
+  /// consist of ASCII characters (see IsSupported()).
+  UTF8TextSearcher(const QString& pattern, Qt::CaseSensitivity caseSensitivity);
+  
+  /// Returns false if the pattern is empty, or if it requires case-insensitive
+  /// matching of non-ASCII characters. Then, the text must be decoded and
+  /// searched with QString::indexOf() instead.
+  inline bool IsSupported() const { return supported; }
+  
+  /// Returns the byte offset of the first occurrence of the pattern in
+  /// @p text that starts at or after @p from, or -1 if there is none.
+  qint64 Find(const char* text, qint64 size, qint64 from) const;
+  
+  /// Returns the length of the UTF-8 encoded pattern in bytes.
+  inline int GetPatternSize() const { return pattern.size(); }
+  
+ private:
+  /// Returns whether the pattern occurs at @p text, assuming that the first
+  /// byte was matched already.
+  bool MatchesAt(const char* text) const;
+  
+  
+  /// The UTF-8 encoded pattern (in lowercase for case-insensitive search).
+  QByteArray pattern;
+  
+  bool caseSensitive;
+  bool supported;
+};
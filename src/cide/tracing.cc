@@ -0,0 +1,214 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/tracing.h"
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+
+std::atomic<bool> tracingEnabled(false);
+
+/// Number of events that each thread's ring buffer can hold.
+constexpr int kTraceBufferSize = 1 << 16;
+
+/// An event in a TraceBuffer. The members are atomic, since the buffer may be
+/// read by WriteTraceJSON() while its thread writes to it.
+struct TraceEvent {
+  std::atomic<const char*> name;
+  std::atomic<qint64> startNanoseconds;
+  std::atomic<qint64> durationNanoseconds;
+};
+
+/// Ring buffer of the events of one thread. Only its thread writes to it.
+struct TraceBuffer {
+  inline TraceBuffer(int threadIndex, const char* threadName)
+      : events(new TraceEvent[kTraceBufferSize]),
+        capacity(kTraceBufferSize),
+        writeCount(0),
+        threadIndex(threadIndex),
+        threadName(threadName) {}
+  
+  std::unique_ptr<TraceEvent[]> events;
+  int capacity;
+  
+  /// Number of events that have been written into the buffer so far. The
+  /// event with number i is stored at index (i % capacity).
+  std::atomic<qint64> writeCount;
+  
+  /// Number of events that were discarded by SetTracingEnabled(). The events
+  /// with smaller numbers than this must not be written out.
+  std::atomic<qint64> discardedCount{0};
+  
+  int threadIndex;
+  
+  /// Thread name, protected by traceBuffersMutex.
+  const char* threadName;
+};
+
+/// Buffers of all threads that recorded events since tracing was last
+/// enabled, protected by traceBuffersMutex. The buffers of exited threads are
+/// shrunk to their remaining events, such that these stay available until
+/// tracing gets enabled again.
+static std::vector<std::shared_ptr<TraceBuffer>> traceBuffers;
+static std::mutex traceBuffersMutex;
+static int nextThreadIndex = 0;
+
+/// Releases the buffer of an exited thread, keeping only the events that may
+/// still be written out. Must be called with traceBuffersMutex locked.
+static void ReleaseExitedThreadBuffer(const std::shared_ptr<TraceBuffer>& buffer) {
+  qint64 endCount = buffer->writeCount.load(std::memory_order_acquire);
+  qint64 startCount = std::max(buffer->discardedCount.load(), endCount - buffer->capacity + 1);
+  if (startCount >= endCount) {
+    traceBuffers.erase(std::find(traceBuffers.begin(), traceBuffers.end(), buffer));
+    return;
+  }
+  
+  // One more slot than the number of events is required, since the slot
+  // after the last written event is never read (see WriteTraceJSON()).
+  int newCapacity = endCount - startCount + 1;
+  std::unique_ptr<TraceEvent[]> newEvents(new TraceEvent[newCapacity]);
+  for (qint64 i = startCount; i < endCount; ++ i) {
+    const TraceEvent& event = buffer->events[i % buffer->capacity];
+    TraceEvent& newEvent = newEvents[i % newCapacity];
+    newEvent.name.store(event.name.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    newEvent.startNanoseconds.store(event.startNanoseconds.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    newEvent.durationNanoseconds.store(event.durationNanoseconds.load(std::memory_order_relaxed), std::memory_order_relaxed);
+  }
+  buffer->events.swap(newEvents);
+  buffer->capacity = newCapacity;
+}
+
+/// Tracing state of a thread. The buffer is only allocated once the thread
+/// records an event, such that threads which never do so while tracing is
+/// enabled only store their name.
+struct ThreadTraceState {
+  inline ~ThreadTraceState() {
+    if (buffer) {
+      std::unique_lock<std::mutex> lock(traceBuffersMutex);
+      ReleaseExitedThreadBuffer(buffer);
+    }
+  }
+  
+  const char* name = nullptr;
+  std::shared_ptr<TraceBuffer> buffer;
+};
+
+static thread_local ThreadTraceState threadTraceState;
+
+/// Returns the buffer of the calling thread, creating it if necessary.
+static TraceBuffer* GetThreadTraceBuffer() {
+  if (!threadTraceState.buffer) {
+    std::unique_lock<std::mutex> lock(traceBuffersMutex);
+    threadTraceState.buffer.reset(new TraceBuffer(nextThreadIndex, threadTraceState.name));
+    ++ nextThreadIndex;
+    traceBuffers.push_back(threadTraceState.buffer);
+  }
+  return threadTraceState.buffer.get();
+}
+
+static const std::chrono::steady_clock::time_point traceStartTime = std::chrono::steady_clock::now();
+
+qint64 TraceSpan::GetTraceTime() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - traceStartTime).count();
+}
+
+void TraceSpan::RecordTraceEvent(const char* name, qint64 startNanoseconds, qint64 durationNanoseconds) {
+  TraceBuffer* buffer = GetThreadTraceBuffer();
+  qint64 count = buffer->writeCount.load(std::memory_order_relaxed);
+  TraceEvent& event = buffer->events[count % buffer->capacity];
+  event.name.store(name, std::memory_order_relaxed);
+  event.startNanoseconds.store(startNanoseconds, std::memory_order_relaxed);
+  event.durationNanoseconds.store(durationNanoseconds, std::memory_order_relaxed);
+  buffer->writeCount.store(count + 1, std::memory_order_release);
+}
+
+void SetTracingEnabled(bool enabled) {
+  if (enabled) {
+    // The events of exited threads can be dropped now. The buffers of running
+    // threads are kept, since they may be writing to them.
+    std::unique_lock<std::mutex> lock(traceBuffersMutex);
+    traceBuffers.erase(std::remove_if(traceBuffers.begin(), traceBuffers.end(), [](const std::shared_ptr<TraceBuffer>& buffer) {
+      return buffer.use_count() == 1;
+    }), traceBuffers.end());
+    for (auto& buffer : traceBuffers) {
+      buffer->discardedCount = buffer->writeCount.load(std::memory_order_acquire);
+    }
+  }
+  tracingEnabled = enabled;
+}
+
+void SetTraceThreadName(const char* name) {
+  threadTraceState.name = name;
+  if (threadTraceState.buffer) {
+    std::unique_lock<std::mutex> lock(traceBuffersMutex);
+    threadTraceState.buffer->threadName = name;
+  }
+}
+
+bool WriteTraceJSON(const QString& path) {
+  QJsonArray events;
+  double pid = QCoreApplication::applicationPid();
+  
+  std::unique_lock<std::mutex> lock(traceBuffersMutex);
+  for (auto& buffer : traceBuffers) {
+    QJsonObject threadNameEvent;
+    threadNameEvent["name"] = QStringLiteral("thread_name");
+    threadNameEvent["ph"] = QStringLiteral("M");
+    threadNameEvent["pid"] = pid;
+    threadNameEvent["tid"] = buffer->threadIndex;
+    QJsonObject args;
+    args["name"] = buffer->threadName ? QString::fromUtf8(buffer->threadName) : QStringLiteral("Thread %1").arg(buffer->threadIndex);
+    threadNameEvent["args"] = args;
+    events.append(threadNameEvent);
+    
+    // The thread may continue writing while we read. Events that may have
+    // been overwritten during the copy are dropped by checking the write
+    // count again afterwards. The slot after the last written event may be
+    // in the process of being overwritten, so it is never used.
+    qint64 endCount = buffer->writeCount.load(std::memory_order_acquire);
+    qint64 startCount = std::max(buffer->discardedCount.load(), endCount - buffer->capacity + 1);
+    std::vector<std::pair<qint64, QJsonObject>> copiedEvents;
+    for (qint64 i = startCount; i < endCount; ++ i) {
+      const TraceEvent& event = buffer->events[i % buffer->capacity];
+      QJsonObject object;
+      object["name"] = QString::fromUtf8(event.name.load(std::memory_order_relaxed));
+      object["ph"] = QStringLiteral("X");
+      object["pid"] = pid;
+      object["tid"] = buffer->threadIndex;
+      // The format uses microseconds.
+      object["ts"] = 0.001 * event.startNanoseconds.load(std::memory_order_relaxed);
+      object["dur"] = 0.001 * event.durationNanoseconds.load(std::memory_order_relaxed);
+      copiedEvents.emplace_back(i, object);
+    }
+    qint64 firstValidCount = buffer->writeCount.load(std::memory_order_acquire) - buffer->capacity + 1;
+    for (const auto& item : copiedEvents) {
+      if (item.first >= firstValidCount) {
+        events.append(item.second);
+      }
+    }
+  }
+  lock.unlock();
+  
+  QJsonObject root;
+  root["traceEvents"] = events;
+  root["displayTimeUnit"] = QStringLiteral("ms");
+  
+  QFile file(path);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qDebug() << "Error: Cannot write trace file:" << path;
+    return false;
+  }
+  file.write(QJsonDocument(root).toJson(QJsonDocument::Compact));
+  return true;
+}
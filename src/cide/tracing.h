@@ -0,0 +1,75 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <atomic>
+
+#include <QString>
+
+/// Lightweight tracing of the work done by CIDE's threads. While tracing is
+/// enabled, each TraceSpan records its name, start time, and duration into a
+/// fixed-size ring buffer of the thread it runs in. Recording an event does not
+/// take any lock. The recorded events can be written as a JSON file in the
+/// Chrome trace event format, which can be viewed with chrome://tracing or
+/// Perfetto (ui.perfetto.dev).
+///
+/// If a thread records more events than its buffer can hold, its oldest events
+/// are overwritten. A thread's buffer is allocated when it records its first
+/// event, and is shrunk to the remaining events when the thread exits.
+
+/// Whether TraceSpans are recorded. Use IsTracingEnabled() to query this.
+extern std::atomic<bool> tracingEnabled;
+
+/// Returns whether TraceSpans are recorded currently.
+inline bool IsTracingEnabled() {
+  return tracingEnabled.load(std::memory_order_relaxed);
+}
+
+/// Enables or disables recording. Enabling discards all previously recorded
+/// events.
+void SetTracingEnabled(bool enabled);
+
+/// Sets the name under which the calling thread's events are shown. The name
+/// must be a string literal (or otherwise remain valid forever).
+void SetTraceThreadName(const char* name);
+
+/// Writes all recorded events to the given file in the Chrome trace event
+/// format. Returns true on success, false if the file cannot be written.
+bool WriteTraceJSON(const QString& path);
+
+/// Records a span covering its lifetime, if tracing was enabled when it was
+/// constructed. Use via the CIDE_TRACE_SPAN() macro. @p name must be a string
+/// literal (or otherwise remain valid forever).
+class TraceSpan {
+ public:
+  inline TraceSpan(const char* name)
+      : name(IsTracingEnabled() ? name : nullptr) {
+    if (this->name) {
+      startNanoseconds = GetTraceTime();
+    }
+  }
+  
+  inline ~TraceSpan() {
+    if (name) {
+      RecordTraceEvent(name, startNanoseconds, GetTraceTime() - startNanoseconds);
+    }
+  }
+  
+  /// Returns the time in nanoseconds since the start of the program.
+  static qint64 GetTraceTime();
+  
+ private:
+  static void RecordTraceEvent(const char* name, qint64 startNanoseconds, qint64 durationNanoseconds);
+  
+  const char* name;
+  qint64 startNanoseconds;
+};
+
+#define CIDE_TRACE_CONCAT_IMPL(a, b) a##b
+#define CIDE_TRACE_CONCAT(a, b) CIDE_TRACE_CONCAT_IMPL(a, b)
+
+/// Records a span with the given name that lasts until the end of the current
+/// scope.
+#define CIDE_TRACE_SPAN(name) TraceSpan CIDE_TRACE_CONCAT(traceSpan, __LINE__)(name)
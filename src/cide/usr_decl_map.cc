@@ -0,0 +1,430 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/usr_decl_map.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include <QDebug>
+
+const quint32 USRStringPool::kInvalidId = 0xffffffff;
+constexpr quint8 USRDeclMap::kIsDefinitionFlag;
+
+static inline quint32 HashUSRString(const char* data, int size) {
+  // FNV-1a
+  quint32 hash = 2166136261u;
+  for (int i = 0; i < size; ++ i) {
+    hash ^= static_cast<quint8>(data[i]);
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+
+USRStringPool& USRStringPool::Instance() {
+  static USRStringPool instance;
+  return instance;
+}
+
+USRStringPool::~USRStringPool() {
+  for (Shard& shard : shards) {
+    for (int chunk = 0; chunk < kMaxNumChunks; ++ chunk) {
+      delete[] shard.chunks[chunk];
+    }
+  }
+}
+
+quint32 USRStringPool::Intern(const char* data, int size) {
+  quint32 hash = HashUSRString(data, size);
+  quint32 shardIndex = hash & kShardMask;
+  Shard& shard = shards[shardIndex];
+  
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  
+  quint32* slot = FindSlot(&shard, data, size, hash);
+  if (*slot != 0) {
+    return ((*slot - 1) << kNumShardBits) | shardIndex;
+  }
+  
+  // Copy the string data.
+  const char* storedData;
+  if (size > kStringBlockSize / 4) {
+    shard.stringBlocks.emplace_back(new char[size]);
+    shard.memoryUsage += size;
+    storedData = shard.stringBlocks.back().get();
+  } else {
+    if (shard.stringBlockRemaining < size) {
+      shard.stringBlocks.emplace_back(new char[kStringBlockSize]);
+      shard.memoryUsage += kStringBlockSize;
+      shard.stringBlockCursor = shard.stringBlocks.back().get();
+      shard.stringBlockRemaining = kStringBlockSize;
+    }
+    storedData = shard.stringBlockCursor;
+    shard.stringBlockCursor += size;
+    shard.stringBlockRemaining -= size;
+  }
+  memcpy(const_cast<char*>(storedData), data, size);
+  
+  // Add the entry.
+  quint32 index = shard.size;
+  quint32 offsetIndex = index + (1 << kFirstChunkSizeBits);
+  int chunk = 31 - qCountLeadingZeroBits(offsetIndex) - kFirstChunkSizeBits;
+  if (chunk >= kMaxNumChunks) {
+    qFatal("USRStringPool: Exceeded the maximum number of strings");
+  }
+  if (!shard.chunks[chunk]) {
+    quint32 chunkSize = 1u << (kFirstChunkSizeBits + chunk);
+    shard.chunks[chunk] = new Entry[chunkSize];
+    shard.memoryUsage += chunkSize * sizeof(Entry);
+  }
+  Entry& entry = shard.chunks[chunk][offsetIndex - (1 << (kFirstChunkSizeBits + chunk))];
+  entry.data = storedData;
+  entry.size = size;
+  entry.hash = hash;
+  ++ shard.size;
+  *slot = index + 1;
+  
+  // Grow the hash table if it is more than half full.
+  if (2 * shard.size > shard.table.size()) {
+    shard.memoryUsage -= shard.table.size() * sizeof(quint32);
+    std::vector<quint32> newTable(2 * shard.table.size(), 0);
+    quint32 mask = newTable.size() - 1;
+    for (quint32 value : shard.table) {
+      if (value != 0) {
+        quint32 pos = (GetEntry(shard, value - 1).hash >> kNumShardBits) & mask;
+        while (newTable[pos] != 0) {
+          pos = (pos + 1) & mask;
+        }
+        newTable[pos] = value;
+      }
+    }
+    shard.table.swap(newTable);
+    shard.memoryUsage += shard.table.size() * sizeof(quint32);
+  }
+  
+  return (index << kNumShardBits) | shardIndex;
+}
+
+quint32 USRStringPool::Find(const QByteArray& string) {
+  quint32 hash = HashUSRString(string.data(), string.size());
+  quint32 shardIndex = hash & kShardMask;
+  Shard& shard = shards[shardIndex];
+  
+  std::unique_lock<std::mutex> lock(shard.mutex);
+  
+  quint32* slot = FindSlot(&shard, string.data(), string.size(), hash);
+  if (*slot == 0) {
+    return kInvalidId;
+  }
+  return ((*slot - 1) << kNumShardBits) | shardIndex;
+}
+
+quint64 USRStringPool::GetSize() {
+  quint64 result = 0;
+  for (Shard& shard : shards) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    result += shard.size;
+  }
+  return result;
+}
+
+quint64 USRStringPool::GetMemoryUsage() {
+  quint64 result = 0;
+  for (Shard& shard : shards) {
+    std::unique_lock<std::mutex> lock(shard.mutex);
+    result += shard.memoryUsage;
+  }
+  return result;
+}
+
+quint32* USRStringPool::FindSlot(Shard* shard, const char* data, int size, quint32 hash) {
+  if (shard->table.empty()) {
+    shard->table.resize(256, 0);
+    shard->memoryUsage += shard->table.size() * sizeof(quint32);
+  }
+  
+  // The lowest hash bits were used to select the shard, so they are skipped.
+  quint32 mask = shard->table.size() - 1;
+  quint32 pos = (hash >> kNumShardBits) & mask;
+  while (true) {
+    quint32* slot = &shard->table[pos];
+    if (*slot == 0) {
+      return slot;
+    }
+    const Entry& entry = GetEntry(*shard, *slot - 1);
+    if (entry.hash == hash &&
+        entry.size == static_cast<quint32>(size) &&
+        memcmp(entry.data, data, size) == 0) {
+      return slot;
+    }
+    pos = (pos + 1) & mask;
+  }
+}
+
+
+void USRDeclMap::EqualRange(quint32 usrId, int* begin, int* end) const {
+  auto range = std::equal_range(usrIds.begin(), usrIds.end(), usrId);
+  *begin = range.first - usrIds.begin();
+  *end = range.second - usrIds.begin();
+}
+
+bool USRDeclMap::Contains(quint32 usrId, int line, int column) const {
+  int begin, end;
+  EqualRange(usrId, &begin, &end);
+  for (int i = begin; i < end; ++ i) {
+    if (lines[i] == line && columns[i] == column) {
+      return true;
+    }
+  }
+  return false;
+}
+
+USRDecl USRDeclMap::GetDecl(int index) const {
+  return USRDecl(
+      USRStringPool::Instance().GetQString(spellingIds[index]),
+      lines[index],
+      columns[index],
+      IsDefinition(index),
+      GetKind(index),
+      namePositions[index],
+      nameSizes[index]);
+}
+
+quint64 USRDeclMap::GetMemoryUsage() const {
+  return sizeof(USRDeclMap) +
+         usrIds.capacity() * sizeof(quint32) +
+         spellingIds.capacity() * sizeof(quint32) +
+         lines.capacity() * sizeof(qint32) +
+         columns.capacity() * sizeof(qint32) +
+         namePositions.capacity() * sizeof(qint32) +
+         nameSizes.capacity() * sizeof(quint16) +
+         kinds.capacity() * sizeof(quint16) +
+         flags.capacity() * sizeof(quint8);
+}
+
+std::shared_ptr<const USRDeclMap> USRDeclMap::Merge(const USRDeclMap& base, const USRDeclMap& added) {
+  std::vector<int> newDecls;
+  for (int i = 0; i < added.size(); ++ i) {
+    if (!base.Contains(added.usrIds[i], added.lines[i], added.columns[i])) {
+      newDecls.push_back(i);
+    }
+  }
+  if (newDecls.empty()) {
+    return std::shared_ptr<const USRDeclMap>();
+  }
+  
+  // Both maps are sorted by USR id, so the result is obtained by merging them.
+  USRDeclMap* result = new USRDeclMap();
+  std::shared_ptr<const USRDeclMap> resultPtr(result);
+  result->Reserve(base.size() + newDecls.size());
+  int baseIndex = 0;
+  for (int addedIndex : newDecls) {
+    while (baseIndex < base.size() && base.usrIds[baseIndex] <= added.usrIds[addedIndex]) {
+      result->AppendDecl(base, baseIndex);
+      ++ baseIndex;
+    }
+    result->AppendDecl(added, addedIndex);
+  }
+  for (; baseIndex < base.size(); ++ baseIndex) {
+    result->AppendDecl(base, baseIndex);
+  }
+  return resultPtr;
+}
+
+void USRDeclMap::Reserve(int size) {
+  usrIds.reserve(size);
+  spellingIds.reserve(size);
+  lines.reserve(size);
+  columns.reserve(size);
+  namePositions.reserve(size);
+  nameSizes.reserve(size);
+  kinds.reserve(size);
+  flags.reserve(size);
+}
+
+void USRDeclMap::AppendDecl(const USRDeclMap& other, int index) {
+  usrIds.push_back(other.usrIds[index]);
+  spellingIds.push_back(other.spellingIds[index]);
+  lines.push_back(other.lines[index]);
+  columns.push_back(other.columns[index]);
+  namePositions.push_back(other.namePositions[index]);
+  nameSizes.push_back(other.nameSizes[index]);
+  kinds.push_back(other.kinds[index]);
+  flags.push_back(other.flags[index]);
+}
+
+
+void USRDeclMapBuilder::Add(quint32 usrId, quint32 spellingId, int line, int column, bool isDefinition, CXCursorKind kind, int namePos, int nameSize) {
+  // Name sizes are stored as 16-bit values. Longer names (which practically
+  // do not occur) are clamped such that the name position is retained.
+  if (nameSize < 0) {
+    namePos = -1;
+    nameSize = 0;
+  } else if (nameSize > 0xffff) {
+    nameSize = 0xffff;
+    ++ numClampedNameSizes;
+  }
+  
+  usrIndex.insert(std::make_pair(usrId, map.size()));
+  
+  map.usrIds.push_back(usrId);
+  map.spellingIds.push_back(spellingId);
+  map.lines.push_back(line);
+  map.columns.push_back(column);
+  map.namePositions.push_back(namePos);
+  map.nameSizes.push_back(nameSize);
+  map.kinds.push_back(kind);
+  map.flags.push_back(isDefinition ? USRDeclMap::kIsDefinitionFlag : 0);
+}
+
+bool USRDeclMapBuilder::Contains(quint32 usrId, int line, int column) const {
+  auto range = usrIndex.equal_range(usrId);
+  for (auto it = range.first; it != range.second; ++ it) {
+    if (map.lines[it->second] == line &&
+        map.columns[it->second] == column) {
+      return true;
+    }
+  }
+  return false;
+}
+
+std::shared_ptr<const USRDeclMap> USRDeclMapBuilder::Finish() {
+  if (numClampedNameSizes > 0) {
+    qDebug() << "Warning: Clamped the name sizes of" << numClampedNameSizes << "USR decls to" << 0xffff;
+    numClampedNameSizes = 0;
+  }
+  
+  // Sort the decls by USR id. The sort is stable such that the order of decls
+  // for the same USR is retained.
+  std::vector<int> order(map.size());
+  for (int i = 0; i < map.size(); ++ i) {
+    order[i] = i;
+  }
+  const std::vector<quint32>& usrIds = map.usrIds;
+  std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+    return usrIds[a] < usrIds[b];
+  });
+  
+  USRDeclMap* result = new USRDeclMap();
+  std::shared_ptr<const USRDeclMap> resultPtr(result);
+  result->Reserve(order.size());
+  for (int index : order) {
+    result->AppendDecl(map, index);
+  }
+  
+  map = USRDeclMap();
+  usrIndex.clear();
+  return resultPtr;
+}
+
+
+void USRReferenceMap::EqualRange(quint32 usrId, int* begin, int* end) const {
+  auto range = std::equal_range(usrIds.begin(), usrIds.end(), usrId);
+  *begin = range.first - usrIds.begin();
+  *end = range.second - usrIds.begin();
+}
+
+quint64 USRReferenceMap::GetMemoryUsage() const {
+  return sizeof(USRReferenceMap) +
+         usrIds.capacity() * sizeof(quint32) +
+         lines.capacity() * sizeof(qint32) +
+         columns.capacity() * sizeof(qint32) +
+         kinds.capacity() * sizeof(quint16);
+}
+
+std::shared_ptr<const USRReferenceMap> USRReferenceMap::Merge(const USRReferenceMap& base, const USRReferenceMap& added) {
+  // Both maps are sorted and free of duplicates, so the result is obtained by
+  // merging them.
+  USRReferenceMap* result = new USRReferenceMap();
+  std::shared_ptr<const USRReferenceMap> resultPtr(result);
+  result->Reserve(base.size() + added.size());
+  int baseIndex = 0;
+  int addedIndex = 0;
+  bool haveNewReferences = false;
+  while (baseIndex < base.size() && addedIndex < added.size()) {
+    int comparison = Compare(base, baseIndex, added, addedIndex);
+    if (comparison < 0) {
+      result->AppendReference(base, baseIndex);
+      ++ baseIndex;
+    } else if (comparison > 0) {
+      result->AppendReference(added, addedIndex);
+      ++ addedIndex;
+      haveNewReferences = true;
+    } else {
+      result->AppendReference(base, baseIndex);
+      ++ baseIndex;
+      ++ addedIndex;
+    }
+  }
+  for (; baseIndex < base.size(); ++ baseIndex) {
+    result->AppendReference(base, baseIndex);
+  }
+  for (; addedIndex < added.size(); ++ addedIndex) {
+    result->AppendReference(added, addedIndex);
+    haveNewReferences = true;
+  }
+  
+  if (!haveNewReferences) {
+    return std::shared_ptr<const USRReferenceMap>();
+  }
+  return resultPtr;
+}
+
+int USRReferenceMap::Compare(const USRReferenceMap& aMap, int a, const USRReferenceMap& bMap, int b) {
+  if (aMap.usrIds[a] != bMap.usrIds[b]) {
+    return (aMap.usrIds[a] < bMap.usrIds[b]) ? -1 : 1;
+  }
+  if (aMap.lines[a] != bMap.lines[b]) {
+    return (aMap.lines[a] < bMap.lines[b]) ? -1 : 1;
+  }
+  if (aMap.columns[a] != bMap.columns[b]) {
+    return (aMap.columns[a] < bMap.columns[b]) ? -1 : 1;
+  }
+  return 0;
+}
+
+void USRReferenceMap::Reserve(int size) {
+  usrIds.reserve(size);
+  lines.reserve(size);
+  columns.reserve(size);
+  kinds.reserve(size);
+}
+
+void USRReferenceMap::AppendReference(const USRReferenceMap& other, int index) {
+  usrIds.push_back(other.usrIds[index]);
+  lines.push_back(other.lines[index]);
+  columns.push_back(other.columns[index]);
+  kinds.push_back(other.kinds[index]);
+}
+
+
+void USRReferenceMapBuilder::Add(quint32 usrId, int line, int column, CXCursorKind kind) {
+  map.usrIds.push_back(usrId);
+  map.lines.push_back(line);
+  map.columns.push_back(column);
+  map.kinds.push_back(kind);
+}
+
+std::shared_ptr<const USRReferenceMap> USRReferenceMapBuilder::Finish() {
+  std::vector<int> order(map.size());
+  for (int i = 0; i < map.size(); ++ i) {
+    order[i] = i;
+  }
+  std::sort(order.begin(), order.end(), [&](int a, int b) {
+    return USRReferenceMap::Compare(map, a, map, b) < 0;
+  });
+  
+  USRReferenceMap* result = new USRReferenceMap();
+  std::shared_ptr<const USRReferenceMap> resultPtr(result);
+  result->Reserve(order.size());
+  for (int i = 0; i < order.size(); ++ i) {
+    if (i == 0 || USRReferenceMap::Compare(map, order[i - 1], map, order[i]) != 0) {
+      result->AppendReference(map, order[i]);
+    }
+  }
+  
+  map = USRReferenceMap();
+  return resultPtr;
+}
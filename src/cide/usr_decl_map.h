@@ -0,0 +1,337 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include <clang-c/Index.h>
+#include <QByteArray>
+#include <QString>
+#include <QtAlgorithms>
+
+/// Stores the location of a definition or declaration together with the "USR"
+/// (a string that uniquely determines the entity and can be used to
+/// cross-reference definitions / declarations across separate translation units.
+/// This is used to return the results of USR lookups. The USRs are stored in a
+/// more compact form, see USRDeclMap.
+struct USRDecl {
+  inline USRDecl(const QString& spelling, int line, int column, bool isDefinition, CXCursorKind kind, int namePos = -1, int nameSize = -1)
+      : spelling(spelling),
+        line(line),
+        column(column),
+        isDefinition(isDefinition),
+        kind(kind),
+        namePos(namePos),
+        nameSize(nameSize) {}
+  
+  
+  /// Spelling of the referenced definition / declaration.
+  QString spelling;
+  
+  /// Line of the definition / declaration (1-based)
+  int line;
+  
+  /// Column of the definition / declaration (1-based)
+  int column;
+  
+  /// True if this represents a definition, false if it represents a declaration
+  bool isDefinition;
+  
+  /// Cursor kind of the USR.
+  CXCursorKind kind;
+  
+  /// If the "name" of this entity is a sub-string within the spelling string,
+  /// this gives the first character of this sub-string. Otherwise, it is set to
+  /// -1.
+  int namePos;
+  
+  /// The length of the "name" sub-string, see @a namePos.
+  int nameSize;
+};
+
+
+/// Singleton which stores each distinct USR and spelling string only once and
+/// identifies it by a 32-bit id. The same headers are seen by many translation
+/// units, so without interning, the same strings would be stored many times in
+/// the USRDeclMaps of the different files.
+///
+/// Strings are never removed from the pool, which allows to access them
+/// without locking. The pool is split into shards with separate locks to reduce
+/// contention between the indexing threads.
+class USRStringPool {
+ public:
+  static USRStringPool& Instance();
+  
+  /// Returns the id of the given string, adding it to the pool if it is not
+  /// contained yet. Can be called from any thread.
+  quint32 Intern(const char* data, int size);
+  inline quint32 Intern(const QByteArray& string) { return Intern(string.data(), string.size()); }
+  
+  /// Returns the id of the given string, or kInvalidId if it is not contained
+  /// in the pool. Can be called from any thread.
+  quint32 Find(const QByteArray& string);
+  
+  /// Returns the string with the given id. The returned QByteArray references
+  /// the pool's memory instead of copying the string. This does not lock the
+  /// pool, so the id must have been passed to the calling thread in a
+  /// synchronized way (for example, via a USRDeclMap obtained from the locked
+  /// USRStorage).
+  inline QByteArray Get(quint32 id) const {
+    const Entry& entry = GetEntry(shards[id & kShardMask], id >> kNumShardBits);
+    return QByteArray::fromRawData(entry.data, entry.size);
+  }
+  
+  /// Returns the string with the given id, decoded from UTF-8.
+  inline QString GetQString(quint32 id) const {
+    const Entry& entry = GetEntry(shards[id & kShardMask], id >> kNumShardBits);
+    return QString::fromUtf8(entry.data, entry.size);
+  }
+  
+  /// Returns the number of strings in the pool.
+  quint64 GetSize();
+  
+  /// Returns the approximate number of bytes allocated by the pool.
+  quint64 GetMemoryUsage();
+  
+  static const quint32 kInvalidId;
+  
+ private:
+  struct Entry {
+    const char* data;
+    quint32 size;
+    quint32 hash;
+  };
+  
+  // The entries of a shard are stored in chunks which double in size, such
+  // that existing entries never move and can be read without locking.
+  static constexpr int kNumShardBits = 4;
+  static constexpr quint32 kShardMask = (1 << kNumShardBits) - 1;
+  static constexpr int kFirstChunkSizeBits = 8;
+  static constexpr int kMaxNumChunks = 32 - kNumShardBits - kFirstChunkSizeBits + 1;
+  static constexpr int kStringBlockSize = 64 * 1024;
+  
+  struct Shard {
+    /// Chunks of entries. Chunk i has (1 << (kFirstChunkSizeBits + i)) entries.
+    Entry* chunks[kMaxNumChunks] = {};
+    
+    /// Number of entries in this shard.
+    quint32 size = 0;
+    
+    /// Open-addressing hash table containing (entry index + 1), or 0 for
+    /// empty slots. Its size is always a power of two.
+    std::vector<quint32> table;
+    
+    /// Memory blocks storing the string data.
+    std::vector<std::unique_ptr<char[]>> stringBlocks;
+    char* stringBlockCursor = nullptr;
+    int stringBlockRemaining = 0;
+    
+    quint64 memoryUsage = 0;
+    
+    std::mutex mutex;
+  };
+  
+  USRStringPool() = default;
+  ~USRStringPool();
+  
+  static inline const Entry& GetEntry(const Shard& shard, quint32 index) {
+    quint32 offsetIndex = index + (1 << kFirstChunkSizeBits);
+    int chunk = 31 - qCountLeadingZeroBits(offsetIndex) - kFirstChunkSizeBits;
+    return shard.chunks[chunk][offsetIndex - (1 << (kFirstChunkSizeBits + chunk))];
+  }
+  
+  /// Returns the table slot for the given string in the given shard. This is
+  /// either the slot containing the string, or the empty slot where it should
+  /// be inserted. The shard must be locked.
+  quint32* FindSlot(Shard* shard, const char* data, int size, quint32 hash);
+  
+  
+  Shard shards[1 << kNumShardBits];
+};
+
+
+/// Stores the USRs of one file. To reduce memory usage, the strings are stored
+/// as ids into the USRStringPool, and the remaining attributes are stored in
+/// separate arrays (struct-of-arrays layout) instead of as USRDecl objects.
+/// The decls are sorted by USR id, so the decls for a USR are found by binary
+/// search.
+///
+/// USRDeclMaps are immutable. They are created with USRDeclMapBuilder.
+class USRDeclMap {
+ friend class USRDeclMapBuilder;
+ public:
+  /// Returns the number of stored decls.
+  inline int size() const { return usrIds.size(); }
+  inline bool empty() const { return usrIds.empty(); }
+  
+  /// Returns the range [*begin, *end) of the decls for the USR with the given
+  /// id.
+  void EqualRange(quint32 usrId, int* begin, int* end) const;
+  
+  /// Returns whether a decl for the given USR exists at the given location.
+  bool Contains(quint32 usrId, int line, int column) const;
+  
+  /// Returns the decl with the given index as a USRDecl.
+  USRDecl GetDecl(int index) const;
+  
+  inline quint32 GetUSRId(int index) const { return usrIds[index]; }
+  inline QByteArray GetUSR(int index) const { return USRStringPool::Instance().Get(usrIds[index]); }
+  inline quint32 GetSpellingId(int index) const { return spellingIds[index]; }
+  inline int GetLine(int index) const { return lines[index]; }
+  inline int GetColumn(int index) const { return columns[index]; }
+  inline bool IsDefinition(int index) const { return flags[index] & kIsDefinitionFlag; }
+  inline CXCursorKind GetKind(int index) const { return static_cast<CXCursorKind>(kinds[index]); }
+  inline int GetNamePos(int index) const { return namePositions[index]; }
+  inline int GetNameSize(int index) const { return nameSizes[index]; }
+  
+  /// Returns the approximate number of bytes allocated by this map (not
+  /// counting the strings in the USRStringPool).
+  quint64 GetMemoryUsage() const;
+  
+  /// Returns a new map containing the decls of @p base and those decls of
+  /// @p added that are not contained in @p base yet. Returns null if all decls
+  /// of @p added are contained in @p base already.
+  static std::shared_ptr<const USRDeclMap> Merge(const USRDeclMap& base, const USRDeclMap& added);
+  
+ private:
+  static constexpr quint8 kIsDefinitionFlag = 1 << 0;
+  
+  void Reserve(int size);
+  void AppendDecl(const USRDeclMap& other, int index);
+  
+  std::vector<quint32> usrIds;
+  std::vector<quint32> spellingIds;
+  std::vector<qint32> lines;
+  std::vector<qint32> columns;
+  std::vector<qint32> namePositions;
+  std::vector<quint16> nameSizes;
+  std::vector<quint16> kinds;
+  std::vector<quint8> flags;
+};
+
+
+/// Collects decls for creating a USRDeclMap.
+class USRDeclMapBuilder {
+ public:
+  /// Adds a decl. The USR and spelling (in UTF-8) must have been interned in
+  /// the USRStringPool.
+  void Add(quint32 usrId, quint32 spellingId, int line, int column, bool isDefinition, CXCursorKind kind, int namePos, int nameSize);
+  
+  /// Variant of Add() which interns the spelling.
+  inline void Add(quint32 usrId, const QString& spelling, int line, int column, bool isDefinition, CXCursorKind kind, int namePos, int nameSize) {
+    Add(usrId, USRStringPool::Instance().Intern(spelling.toUtf8()), line, column, isDefinition, kind, namePos, nameSize);
+  }
+  
+  /// Returns whether a decl for the given USR exists at the given location.
+  bool Contains(quint32 usrId, int line, int column) const;
+  
+  inline bool empty() const { return map.empty(); }
+  
+  /// Creates the USRDeclMap from the added decls. Afterwards, the builder is
+  /// empty.
+  std::shared_ptr<const USRDeclMap> Finish();
+  
+ private:
+  /// The unsorted decls.
+  USRDeclMap map;
+  
+  /// Maps USR id -> index of a decl in map.
+  std::unordered_multimap<quint32, int> usrIndex;
+  
+  /// Number of decls whose name size was clamped in Add(). This is reported
+  /// once in Finish().
+  int numClampedNameSizes = 0;
+};
+
+
+/// Location at which a USR is referenced (for example, a call of a function or
+/// a use of a type), as returned by USRStorage::LookupReferences().
+struct USRReference {
+  inline USRReference(int line, int column, CXCursorKind kind)
+      : line(line),
+        column(column),
+        kind(kind) {}
+  
+  /// Line of the reference (1-based)
+  int line;
+  
+  /// Column of the reference (1-based)
+  int column;
+  
+  /// Cursor kind of the reference (for example, CXCursor_DeclRefExpr or
+  /// CXCursor_TypeRef).
+  CXCursorKind kind;
+};
+
+
+/// Stores the reference sites of one file, in the same compact form as
+/// USRDeclMap: the referenced USRs are stored as ids into the USRStringPool,
+/// and the references are sorted by (USR id, line, column) without duplicates.
+///
+/// USRReferenceMaps are immutable. They are created with
+/// USRReferenceMapBuilder.
+class USRReferenceMap {
+ friend class USRReferenceMapBuilder;
+ public:
+  /// Returns the number of stored references.
+  inline int size() const { return usrIds.size(); }
+  inline bool empty() const { return usrIds.empty(); }
+  
+  /// Returns the range [*begin, *end) of the references to the USR with the
+  /// given id.
+  void EqualRange(quint32 usrId, int* begin, int* end) const;
+  
+  /// Returns the reference with the given index as a USRReference.
+  inline USRReference GetReference(int index) const { return USRReference(lines[index], columns[index], GetKind(index)); }
+  
+  inline quint32 GetUSRId(int index) const { return usrIds[index]; }
+  inline QByteArray GetUSR(int index) const { return USRStringPool::Instance().Get(usrIds[index]); }
+  inline int GetLine(int index) const { return lines[index]; }
+  inline int GetColumn(int index) const { return columns[index]; }
+  inline CXCursorKind GetKind(int index) const { return static_cast<CXCursorKind>(kinds[index]); }
+  
+  /// Returns the approximate number of bytes allocated by this map.
+  quint64 GetMemoryUsage() const;
+  
+  /// Returns a new map containing the references of @p base and @p added.
+  /// Returns null if all references of @p added are contained in @p base
+  /// already.
+  static std::shared_ptr<const USRReferenceMap> Merge(const USRReferenceMap& base, const USRReferenceMap& added);
+  
+ private:
+  /// Returns whether reference @p a of map @p aMap is ordered before reference
+  /// @p b of map @p bMap (-1), after it (1), or whether both are equal (0).
+  static int Compare(const USRReferenceMap& aMap, int a, const USRReferenceMap& bMap, int b);
+  
+  void Reserve(int size);
+  void AppendReference(const USRReferenceMap& other, int index);
+  
+  std::vector<quint32> usrIds;
+  std::vector<qint32> lines;
+  std::vector<qint32> columns;
+  std::vector<quint16> kinds;
+};
+
+
+/// Collects references for creating a USRReferenceMap.
+class USRReferenceMapBuilder {
+ public:
+  /// Adds a reference. The USR must have been interned in the USRStringPool.
+  /// Duplicates are removed in Finish().
+  void Add(quint32 usrId, int line, int column, CXCursorKind kind);
+  
+  inline bool empty() const { return map.empty(); }
+  
+  /// Creates the USRReferenceMap from the added references. Afterwards, the
+  /// builder is empty.
+  std::shared_ptr<const USRReferenceMap> Finish();
+  
+ private:
+  /// The unsorted references.
+  USRReferenceMap map;
+};
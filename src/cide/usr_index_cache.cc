@@ -0,0 +1,704 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#include "cide/usr_index_cache.h"
+
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDebug>
+#include <QDir>
+#include <QFile>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+#include "cide/clang_parser.h"
+#include "cide/clang_utils.h"
+#include "cide/global_symbol_table.h"
+#include "cide/project.h"
+
+// Layout of the cache file: a CacheHeader, followed by the sections listed in
+// it. All sections start at offsets that are multiples of 8, such that the
+// records can be accessed in-place in the memory-mapped file. Numbers are
+// stored in host byte order (which is verified with byteOrderMark).
+
+constexpr char kCacheMagic[8] = {'C', 'I', 'D', 'E', 'U', 'S', 'R', 'I'};
+constexpr quint32 kCacheVersion = 4;
+constexpr quint32 kCacheByteOrderMark = 0x01020304;
+
+/// Reference to a UTF-8 string in the string table section.
+struct CacheStringRef {
+  quint32 offset;
+  quint32 size;
+};
+
+struct CacheHeader {
+  char magic[8];
+  quint32 version;
+  quint32 byteOrderMark;
+  
+  /// Version of libclang that was used for indexing. USRs are not guaranteed
+  /// to be stable across different versions.
+  CacheStringRef clangVersion;
+  
+  quint64 stringsOffset;
+  quint64 stringsSize;
+  
+  /// CacheFileRecord array.
+  quint64 filesOffset;
+  quint64 numFiles;
+  
+  /// CacheDeclRecord array.
+  quint64 declsOffset;
+  quint64 numDecls;
+  
+  /// CacheReferenceRecord array.
+  quint64 referencesOffset;
+  quint64 numReferences;
+  
+  /// CacheSourceRecord array.
+  quint64 sourcesOffset;
+  quint64 numSources;
+  
+  /// CacheIncludeRecord array.
+  quint64 includesOffset;
+  quint64 numIncludes;
+};
+
+/// A file that is the source file or an included file of a cached source file.
+struct CacheFileRecord {
+  CacheStringRef path;
+  
+  /// Range of the file's USRs in the CacheDeclRecord array.
+  quint32 firstDecl;
+  quint32 numDecls;
+  
+  /// Range of the file's reference sites in the CacheReferenceRecord array.
+  quint32 firstReference;
+  quint32 numReferences;
+  
+  /// Version of the file content that the references were recorded for (see
+  /// USRMap::referencesVersion).
+  quint64 referencesVersion;
+};
+
+/// A stored USRDecl.
+struct CacheDeclRecord {
+  CacheStringRef usr;
+  CacheStringRef spelling;
+  qint32 line;
+  qint32 column;
+  qint32 kind;
+  qint32 namePos;
+  qint32 nameSize;
+  quint32 isDefinition;
+};
+
+/// A stored reference site (see USRReferenceMap).
+struct CacheReferenceRecord {
+  CacheStringRef usr;
+  qint32 line;
+  qint32 column;
+  qint32 kind;
+};
+
+/// A file that was involved in indexing a cached source file.
+struct CacheIncludeRecord {
+  /// Index into the CacheFileRecord array.
+  quint32 file;
+  quint32 padding;
+  
+  /// Modification time of the file when the source file was indexed, in
+  /// milliseconds since the epoch.
+  qint64 modificationTime;
+};
+
+/// A source file whose indexing information is cached.
+struct CacheSourceRecord {
+  CacheStringRef path;
+  
+  /// See ComputeCompileArgumentsHash().
+  quint64 compileArgumentsHash;
+  
+  /// Range of the source's included files (which include the source file
+  /// itself) in the includes array.
+  quint32 firstInclude;
+  quint32 numIncludes;
+};
+
+
+quint64 ComputeCompileArgumentsHash(const std::vector<QByteArray>& commandLineArgs) {
+  QCryptographicHash hash(QCryptographicHash::Md5);
+  for (const QByteArray& arg : commandLineArgs) {
+    hash.addData(arg);
+    hash.addData("\0", 1);
+  }
+  QByteArray result = hash.result();
+  quint64 value;
+  memcpy(&value, result.constData(), sizeof(value));
+  return value;
+}
+
+/// Returns the modification time of the given file in milliseconds since the
+/// epoch, or -1 if the file does not exist.
+static qint64 GetFileModificationTime(const QString& path) {
+  QFileInfo info(path);
+  if (!info.exists()) {
+    return -1;
+  }
+  return info.lastModified().toMSecsSinceEpoch();
+}
+
+/// Builds the string table section of the cache file, storing each distinct
+/// string once.
+class CacheStringTableWriter {
+ public:
+  CacheStringRef Add(const QByteArray& string) {
+    auto it = refs.find(string);
+    if (it != refs.end()) {
+      return it->second;
+    }
+    
+    CacheStringRef ref;
+    ref.offset = data.size();
+    ref.size = string.size();
+    data.append(string);
+    refs.insert(std::make_pair(string, ref));
+    return ref;
+  }
+  
+  inline const QByteArray& GetData() const { return data; }
+  
+ private:
+  QByteArray data;
+  std::unordered_map<QByteArray, CacheStringRef> refs;
+};
+
+/// Appends the given records to the cache file data, starting at an offset
+/// that is a multiple of 8. Returns this offset.
+template <typename T>
+static quint64 AppendCacheSection(const std::vector<T>& records, QByteArray* cacheData) {
+  while (cacheData->size() % 8 != 0) {
+    cacheData->append('\0');
+  }
+  quint64 offset = cacheData->size();
+  if (!records.empty()) {
+    cacheData->append(reinterpret_cast<const char*>(records.data()), records.size() * sizeof(T));
+  }
+  return offset;
+}
+
+
+QString GetUSRIndexCachePath(const Project* project) {
+  QString projectHash = QCryptographicHash::hash(project->GetYAMLFilePath().toUtf8(), QCryptographicHash::Md5).toHex();
+  QDir cacheDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation));
+  return cacheDir.filePath(QStringLiteral("usr_index/%1.cache").arg(projectHash));
+}
+
+bool SaveUSRIndexCache(Project* project) {
+  // The USRs of the files that are restored from the cache must be complete
+  // before they can be written again.
+  WaitForUSRIndexCacheLoading();
+  
+  CacheStringTableWriter strings;
+  std::vector<CacheFileRecord> files;
+  std::vector<CacheDeclRecord> decls;
+  std::vector<CacheReferenceRecord> references;
+  std::vector<CacheSourceRecord> sources;
+  std::vector<CacheIncludeRecord> includes;
+  
+  // Collect all source files that have been indexed, and the files that they
+  // include. Only source files for which the modification times of all
+  // involved files were recorded when indexing them can be restored later.
+  std::unordered_map<QString, int> fileIndices;
+  std::vector<QString> filePaths;
+  auto getFileIndex = [&](const QString& path) {
+    auto it = fileIndices.find(path);
+    if (it != fileIndices.end()) {
+      return it->second;
+    }
+    
+    int index = files.size();
+    files.emplace_back();
+    files.back().path = strings.Add(path.toUtf8());
+    filePaths.push_back(path);
+    fileIndices.insert(std::make_pair(path, index));
+    return index;
+  };
+  
+  for (int targetIndex = 0; targetIndex < project->GetNumTargets(); ++ targetIndex) {
+    for (const SourceFile& source : project->GetTarget(targetIndex).sources) {
+      if (source.compileSettingsIndex < 0 ||
+          source.includedPaths.empty() ||
+          source.indexedCompileArgumentsHash == 0) {
+        continue;
+      }
+      
+      bool allModificationTimesKnown = true;
+      for (const QString& includedPath : source.includedPaths) {
+        auto it = source.indexedModificationTimes.find(includedPath);
+        if (it == source.indexedModificationTimes.end() || it->second < 0) {
+          allModificationTimesKnown = false;
+          break;
+        }
+      }
+      if (!allModificationTimesKnown) {
+        continue;
+      }
+      
+      CacheSourceRecord record;
+      record.path = strings.Add(source.path.toUtf8());
+      record.compileArgumentsHash = source.indexedCompileArgumentsHash;
+      record.firstInclude = includes.size();
+      record.numIncludes = source.includedPaths.size();
+      for (const QString& includedPath : source.includedPaths) {
+        includes.emplace_back();
+        CacheIncludeRecord& include = includes.back();
+        include.file = getFileIndex(includedPath);
+        include.padding = 0;
+        include.modificationTime = source.indexedModificationTimes.at(includedPath);
+      }
+      sources.push_back(record);
+    }
+  }
+  
+  // Take references to the USRs of all files. The USRDeclMaps are not
+  // modified after they were stored, so they can be serialized afterwards
+  // without holding the lock.
+  std::vector<std::shared_ptr<const USRDeclMap>> fileUSRs(files.size());
+  std::vector<std::shared_ptr<const USRReferenceMap>> fileReferences(files.size());
+  std::vector<quint64> fileReferencesVersions(files.size(), 0);
+  USRStorage::Instance().Lock();
+  for (int fileIndex = 0; fileIndex < files.size(); ++ fileIndex) {
+    USRMap* usrMap = USRStorage::Instance().GetUSRMapForFile(filePaths[fileIndex]);
+    if (usrMap) {
+      fileUSRs[fileIndex] = usrMap->map;
+      fileReferences[fileIndex] = usrMap->references;
+      fileReferencesVersions[fileIndex] = usrMap->referencesVersion;
+    }
+  }
+  USRStorage::Instance().Unlock();
+  
+  // Copy the USRs and references of all files.
+  for (int fileIndex = 0; fileIndex < files.size(); ++ fileIndex) {
+    CacheFileRecord& file = files[fileIndex];
+    file.firstDecl = decls.size();
+    file.numDecls = 0;
+    file.firstReference = references.size();
+    file.numReferences = 0;
+    file.referencesVersion = fileReferencesVersions[fileIndex];
+    
+    if (!fileUSRs[fileIndex]) {
+      continue;
+    }
+    const USRDeclMap& usrs = *fileUSRs[fileIndex];
+    for (int i = 0; i < usrs.size(); ++ i) {
+      decls.emplace_back();
+      CacheDeclRecord& record = decls.back();
+      record.usr = strings.Add(usrs.GetUSR(i));
+      record.spelling = strings.Add(USRStringPool::Instance().Get(usrs.GetSpellingId(i)));
+      record.line = usrs.GetLine(i);
+      record.column = usrs.GetColumn(i);
+      record.kind = usrs.GetKind(i);
+      record.namePos = usrs.GetNamePos(i);
+      record.nameSize = usrs.GetNameSize(i);
+      record.isDefinition = usrs.IsDefinition(i) ? 1 : 0;
+    }
+    file.numDecls = decls.size() - file.firstDecl;
+    
+    const USRReferenceMap& fileRefs = *fileReferences[fileIndex];
+    for (int i = 0; i < fileRefs.size(); ++ i) {
+      references.emplace_back();
+      CacheReferenceRecord& record = references.back();
+      record.usr = strings.Add(fileRefs.GetUSR(i));
+      record.line = fileRefs.GetLine(i);
+      record.column = fileRefs.GetColumn(i);
+      record.kind = fileRefs.GetKind(i);
+    }
+    file.numReferences = references.size() - file.firstReference;
+  }
+  
+  // Assemble the cache file.
+  CacheHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.magic, kCacheMagic, sizeof(header.magic));
+  header.version = kCacheVersion;
+  header.byteOrderMark = kCacheByteOrderMark;
+  header.clangVersion = strings.Add(ClangString(clang_getClangVersion()).ToQByteArray());
+  header.numFiles = files.size();
+  header.numDecls = decls.size();
+  header.numReferences = references.size();
+  header.numSources = sources.size();
+  header.numIncludes = includes.size();
+  
+  QByteArray cacheData(reinterpret_cast<const char*>(&header), sizeof(header));
+  header.filesOffset = AppendCacheSection(files, &cacheData);
+  header.declsOffset = AppendCacheSection(decls, &cacheData);
+  header.referencesOffset = AppendCacheSection(references, &cacheData);
+  header.sourcesOffset = AppendCacheSection(sources, &cacheData);
+  header.includesOffset = AppendCacheSection(includes, &cacheData);
+  header.stringsOffset = cacheData.size();
+  header.stringsSize = strings.GetData().size();
+  cacheData.append(strings.GetData());
+  memcpy(cacheData.data(), &header, sizeof(header));
+  
+  // Write the file.
+  QString cachePath = GetUSRIndexCachePath(project);
+  QFileInfo(cachePath).dir().mkpath(".");
+  QSaveFile file(cachePath);
+  if (!file.open(QIODevice::WriteOnly)) {
+    qDebug() << "Error: Cannot write USR index cache file:" << cachePath;
+    return false;
+  }
+  if (file.write(cacheData) != cacheData.size() ||
+      !file.commit()) {
+    qDebug() << "Error: Failed to write USR index cache file:" << cachePath;
+    return false;
+  }
+  return true;
+}
+
+
+/// Provides access to the sections of a memory-mapped cache file.
+class CacheReader {
+ public:
+  /// Verifies the header and the section bounds. Returns false if the data is
+  /// not a valid cache file for the current libclang version.
+  bool Initialize(const uchar* data, qint64 size) {
+    this->data = data;
+    if (size < static_cast<qint64>(sizeof(CacheHeader))) {
+      return false;
+    }
+    header = reinterpret_cast<const CacheHeader*>(data);
+    if (memcmp(header->magic, kCacheMagic, sizeof(header->magic)) != 0 ||
+        header->version != kCacheVersion ||
+        header->byteOrderMark != kCacheByteOrderMark) {
+      return false;
+    }
+    
+    quint64 fileSize = size;
+    auto isValidSection = [&](quint64 offset, quint64 count, quint64 recordSize) {
+      return offset % 8 == 0 && offset <= fileSize && count <= (fileSize - offset) / recordSize;
+    };
+    if (!isValidSection(header->stringsOffset, header->stringsSize, 1) ||
+        !isValidSection(header->filesOffset, header->numFiles, sizeof(CacheFileRecord)) ||
+        !isValidSection(header->declsOffset, header->numDecls, sizeof(CacheDeclRecord)) ||
+        !isValidSection(header->referencesOffset, header->numReferences, sizeof(CacheReferenceRecord)) ||
+        !isValidSection(header->sourcesOffset, header->numSources, sizeof(CacheSourceRecord)) ||
+        !isValidSection(header->includesOffset, header->numIncludes, sizeof(CacheIncludeRecord))) {
+      return false;
+    }
+    
+    return GetBytes(header->clangVersion) == ClangString(clang_getClangVersion()).ToQByteArray();
+  }
+  
+  /// Returns the referenced string. Returns an empty string for invalid
+  /// references. The returned QByteArray references the mapped file, so it
+  /// must not be used after the file has been closed.
+  inline QByteArray GetBytes(const CacheStringRef& ref) const {
+    if (static_cast<quint64>(ref.offset) + ref.size > header->stringsSize) {
+      return QByteArray();
+    }
+    return QByteArray::fromRawData(reinterpret_cast<const char*>(data + header->stringsOffset + ref.offset), ref.size);
+  }
+  
+  inline QString GetString(const CacheStringRef& ref) const {
+    if (static_cast<quint64>(ref.offset) + ref.size > header->stringsSize) {
+      return QString();
+    }
+    return QString::fromUtf8(reinterpret_cast<const char*>(data + header->stringsOffset + ref.offset), ref.size);
+  }
+  
+  inline const CacheHeader& GetHeader() const { return *header; }
+  inline const CacheFileRecord* GetFiles() const { return reinterpret_cast<const CacheFileRecord*>(data + header->filesOffset); }
+  inline const CacheDeclRecord* GetDecls() const { return reinterpret_cast<const CacheDeclRecord*>(data + header->declsOffset); }
+  inline const CacheReferenceRecord* GetReferences() const { return reinterpret_cast<const CacheReferenceRecord*>(data + header->referencesOffset); }
+  inline const CacheSourceRecord* GetSources() const { return reinterpret_cast<const CacheSourceRecord*>(data + header->sourcesOffset); }
+  inline const CacheIncludeRecord* GetIncludes() const { return reinterpret_cast<const CacheIncludeRecord*>(data + header->includesOffset); }
+  
+ private:
+  const uchar* data;
+  const CacheHeader* header;
+};
+
+/// A file whose USRs are restored from the cache.
+struct CachedFileToDecode {
+  /// Canonical path of the file.
+  QString path;
+  
+  /// Index into the CacheFileRecord array.
+  quint32 fileIndex;
+  
+  /// Current modification time of the file.
+  qint64 modificationTime;
+};
+
+/// Background threads started by LoadUSRIndexCache() to decode the restored
+/// USRs (see DecodeCachedFiles()).
+struct CacheDecodingThreads {
+  static CacheDecodingThreads& Instance() {
+    static CacheDecodingThreads instance;
+    return instance;
+  }
+  
+  ~CacheDecodingThreads() {
+    for (std::thread& thread : threads) {
+      thread.join();
+    }
+  }
+  
+  std::mutex mutex;
+  std::vector<std::thread> threads;
+};
+
+/// Decodes the USRs and references of the given files from the cache file and
+/// publishes them in the USRStorage, all at once. The files may have been
+/// indexed as included files of other sources in the meantime, so the decoded
+/// USRs are merged into the existing ones.
+static void DecodeCachedFiles(std::shared_ptr<QFile> file, CacheReader reader, std::vector<CachedFileToDecode> filesToDecode) {
+  const CacheHeader& header = reader.GetHeader();
+  const CacheFileRecord* files = reader.GetFiles();
+  const CacheDeclRecord* decls = reader.GetDecls();
+  const CacheReferenceRecord* references = reader.GetReferences();
+  
+  struct DecodedFile {
+    QString path;
+    std::shared_ptr<const USRDeclMap> map;
+    std::shared_ptr<const USRReferenceMap> references;
+    quint64 referencesVersion;
+  };
+  std::vector<DecodedFile> decodedFiles;
+  decodedFiles.reserve(filesToDecode.size());
+  
+  for (const CachedFileToDecode& fileToDecode : filesToDecode) {
+    const CacheFileRecord& fileRecord = files[fileToDecode.fileIndex];
+    if (static_cast<quint64>(fileRecord.firstDecl) + fileRecord.numDecls > header.numDecls ||
+        static_cast<quint64>(fileRecord.firstReference) + fileRecord.numReferences > header.numReferences) {
+      continue;
+    }
+    
+    decodedFiles.emplace_back();
+    DecodedFile& decodedFile = decodedFiles.back();
+    decodedFile.path = fileToDecode.path;
+    
+    if (fileRecord.numReferences > 0) {
+      USRReferenceMapBuilder fileReferences;
+      for (quint32 i = fileRecord.firstReference, end = fileRecord.firstReference + fileRecord.numReferences; i < end; ++ i) {
+        const CacheReferenceRecord& reference = references[i];
+        fileReferences.Add(
+            USRStringPool::Instance().Intern(reader.GetBytes(reference.usr)),
+            reference.line, reference.column, static_cast<CXCursorKind>(reference.kind));
+      }
+      decodedFile.references = fileReferences.Finish();
+    }
+    
+    // The references are only complete for the file content that they were
+    // recorded for. Since the restored sources are up-to-date, this is the
+    // case if they were recorded for the current modification time (and not
+    // for unsaved content).
+    decodedFile.referencesVersion =
+        (fileRecord.referencesVersion == static_cast<quint64>(fileToDecode.modificationTime)) ?
+        fileRecord.referencesVersion : 0;
+    
+    if (fileRecord.numDecls > 0) {
+      USRDeclMapBuilder fileUSRs;
+      for (quint32 i = fileRecord.firstDecl, end = fileRecord.firstDecl + fileRecord.numDecls; i < end; ++ i) {
+        const CacheDeclRecord& decl = decls[i];
+        fileUSRs.Add(
+            USRStringPool::Instance().Intern(reader.GetBytes(decl.usr)),
+            USRStringPool::Instance().Intern(reader.GetBytes(decl.spelling)),
+            decl.line, decl.column, decl.isDefinition != 0, static_cast<CXCursorKind>(decl.kind), decl.namePos, decl.nameSize);
+      }
+      decodedFile.map = fileUSRs.Finish();
+    }
+  }
+  
+  // The cache file is not accessed anymore.
+  file.reset();
+  
+  // Publish the decoded files.
+  struct GlobalSymbolUpdate {
+    QString path;
+    std::shared_ptr<const USRDeclMap> map;
+    quint64 updateNumber;
+  };
+  std::vector<GlobalSymbolUpdate> globalSymbolUpdates;
+  USRStorage::Instance().Lock();
+  for (const DecodedFile& decodedFile : decodedFiles) {
+    USRMap* usrMap = USRStorage::Instance().GetUSRMapForFile(decodedFile.path);
+    if (!usrMap) {
+      // The project has been closed in the meantime.
+      continue;
+    }
+    
+    if (decodedFile.map) {
+      std::shared_ptr<const USRDeclMap> newMap =
+          usrMap->map->empty() ? decodedFile.map : USRDeclMap::Merge(*usrMap->map, *decodedFile.map);
+      if (newMap) {
+        usrMap->map = newMap;
+        globalSymbolUpdates.push_back({decodedFile.path, newMap, GlobalSymbolTable::Instance().GetNextUpdateNumber()});
+      }
+    }
+    
+    // If the file has been indexed in a different version in the meantime,
+    // then its new references take precedence.
+    if (usrMap->referencesVersion == 0) {
+      if (decodedFile.references) {
+        usrMap->references = decodedFile.references;
+      }
+      usrMap->referencesVersion = decodedFile.referencesVersion;
+    } else if (usrMap->referencesVersion == decodedFile.referencesVersion && decodedFile.references) {
+      std::shared_ptr<const USRReferenceMap> mergedReferences = USRReferenceMap::Merge(*usrMap->references, *decodedFile.references);
+      if (mergedReferences) {
+        usrMap->references = mergedReferences;
+      }
+    }
+  }
+  USRStorage::Instance().Unlock();
+  
+  // Extracting the global symbols is comparatively slow, so it is done after
+  // unlocking the USRStorage.
+  for (const GlobalSymbolUpdate& update : globalSymbolUpdates) {
+    GlobalSymbolTable::Instance().UpdateFile(update.path, *update.map, update.updateNumber);
+  }
+}
+
+int LoadUSRIndexCache(Project* project) {
+  std::shared_ptr<QFile> file(new QFile(GetUSRIndexCachePath(project)));
+  if (!file->exists()) {
+    return 0;
+  }
+  if (!file->open(QIODevice::ReadOnly)) {
+    qDebug() << "Error: Cannot open USR index cache file:" << file->fileName();
+    return 0;
+  }
+  const uchar* data = file->map(0, file->size());
+  if (!data) {
+    qDebug() << "Error: Cannot map USR index cache file:" << file->fileName();
+    return 0;
+  }
+  CacheReader reader;
+  if (!reader.Initialize(data, file->size())) {
+    qDebug() << "USR index cache file is invalid or outdated, ignoring it:" << file->fileName();
+    return 0;
+  }
+  
+  const CacheHeader& header = reader.GetHeader();
+  const CacheFileRecord* files = reader.GetFiles();
+  const CacheSourceRecord* sources = reader.GetSources();
+  const CacheIncludeRecord* includes = reader.GetIncludes();
+  
+  std::unordered_map<QString, const CacheSourceRecord*> cachedSources;
+  cachedSources.reserve(header.numSources);
+  for (quint64 i = 0; i < header.numSources; ++ i) {
+    const CacheSourceRecord& source = sources[i];
+    if (static_cast<quint64>(source.firstInclude) + source.numIncludes > header.numIncludes) {
+      qDebug() << "Error: Invalid source record in USR index cache file:" << file->fileName();
+      return 0;
+    }
+    cachedSources.insert(std::make_pair(reader.GetString(source.path), &source));
+  }
+  
+  // Determine the source files that can be restored. The current modification
+  // times of the files are cached in fileModificationTimes, with -2 meaning
+  // that the file has not been checked yet.
+  std::vector<qint64> fileModificationTimes(header.numFiles, -2);
+  std::vector<QString> filePaths(header.numFiles);
+  auto isUpToDate = [&](const CacheIncludeRecord& include) {
+    if (include.file >= header.numFiles) {
+      return false;
+    }
+    if (fileModificationTimes[include.file] == -2) {
+      filePaths[include.file] = reader.GetString(files[include.file].path);
+      fileModificationTimes[include.file] = GetFileModificationTime(filePaths[include.file]);
+    }
+    return fileModificationTimes[include.file] >= 0 &&
+           fileModificationTimes[include.file] == include.modificationTime;
+  };
+  
+  std::vector<std::pair<SourceFile*, const CacheSourceRecord*>> restoredSources;
+  for (int targetIndex = 0; targetIndex < project->GetNumTargets(); ++ targetIndex) {
+    Target& target = project->GetTarget(targetIndex);
+    for (SourceFile& source : target.sources) {
+      if (source.compileSettingsIndex < 0 ||
+          source.hasBeenIndexed ||
+          !source.includedPaths.empty()) {
+        continue;
+      }
+      
+      auto it = cachedSources.find(source.path);
+      if (it == cachedSources.end()) {
+        continue;
+      }
+      const CacheSourceRecord& record = *it->second;
+      if (record.compileArgumentsHash != ComputeCompileArgumentsHash(
+              target.compileSettings[source.compileSettingsIndex].BuildCommandLineArgs(true, source.path, project))) {
+        continue;
+      }
+      
+      bool upToDate = true;
+      for (quint32 i = record.firstInclude, end = record.firstInclude + record.numIncludes; i < end; ++ i) {
+        if (!isUpToDate(includes[i])) {
+          upToDate = false;
+          break;
+        }
+      }
+      if (upToDate) {
+        restoredSources.emplace_back(&source, &record);
+      }
+    }
+  }
+  
+  // Restore the included files of the sources. The modification times and the
+  // compile arguments hash are restored as well, such that the sources get
+  // cached again on the next save. The USRMaps of the included files are
+  // created here, such that the files are known to the USRStorage, but they
+  // are only filled in by the decoding thread below.
+  std::vector<CachedFileToDecode> filesToDecode;
+  USRStorage::Instance().Lock();
+  for (const auto& item : restoredSources) {
+    SourceFile* source = item.first;
+    const CacheSourceRecord& record = *item.second;
+    for (quint32 i = record.firstInclude, end = record.firstInclude + record.numIncludes; i < end; ++ i) {
+      const CacheIncludeRecord& include = includes[i];
+      const QString& path = filePaths[include.file];
+      source->includedPaths.insert(path);
+      source->indexedModificationTimes[path] = include.modificationTime;
+      if (USRStorage::Instance().AddUSRMapReference(path)) {
+        filesToDecode.push_back({path, include.file, fileModificationTimes[include.file]});
+      }
+      project->IncludedPathChanged(path);
+    }
+    source->indexedCompileArgumentsHash = record.compileArgumentsHash;
+    source->hasBeenIndexed = true;
+  }
+  USRStorage::Instance().Unlock();
+  
+  // Decoding the USRs and interning their strings takes a while for large
+  // projects, so it is done on a background thread, without blocking the Qt
+  // thread or the USRStorage. The thread keeps the cache file mapped.
+  if (!filesToDecode.empty()) {
+    CacheDecodingThreads& decoding = CacheDecodingThreads::Instance();
+    std::unique_lock<std::mutex> lock(decoding.mutex);
+    decoding.threads.emplace_back(&DecodeCachedFiles, std::move(file), reader, std::move(filesToDecode));
+  }
+  
+  return restoredSources.size();
+}
+
+void WaitForUSRIndexCacheLoading() {
+  CacheDecodingThreads& decoding = CacheDecodingThreads::Instance();
+  std::vector<std::thread> threads;
+  std::unique_lock<std::mutex> lock(decoding.mutex);
+  threads.swap(decoding.threads);
+  lock.unlock();
+  
+  for (std::thread& thread : threads) {
+    thread.join();
+  }
+}
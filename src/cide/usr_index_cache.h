@@ -0,0 +1,53 @@
+// Copyright 2020 Thomas Schöps
+// This file is part of CIDE, licensed under the new BSD license.
+// See the COPYING file in the project root for the license text.
+
+#pragma once
+
+#include <vector>
+
+#include <QByteArray>
+#include <QString>
+
+class Project;
+
+// The USR index cache stores the indexing information of a project (the USRs
+// and reference sites of all indexed files, and the included files of each
+// source file) on disk, such that it does not need to be recomputed on the next
+// start of CIDE. The cache file is designed to be memory-mapped: it consists of
+// fixed-size records that are read in-place, and of a string table, so only the
+// information for files that are still up-to-date gets decoded when loading.
+//
+// A source file is restored from the cache only if its compile arguments are
+// unchanged and none of the files involved in parsing it (the source file
+// itself and all files included by it) have a different modification time
+// than when the source file was indexed (see
+// SourceFile::indexedModificationTimes). All other source files get indexed as
+// usual.
+
+/// Returns a hash of the given compile arguments, as stored in
+/// SourceFile::indexedCompileArgumentsHash.
+quint64 ComputeCompileArgumentsHash(const std::vector<QByteArray>& commandLineArgs);
+
+/// Returns the path of the cache file for the given project.
+QString GetUSRIndexCachePath(const Project* project);
+
+/// Writes the indexing information of the given project to its cache file.
+/// Waits for restored USRs that are still being decoded (see
+/// WaitForUSRIndexCacheLoading()) first. Must be called from the main (Qt)
+/// thread, with the USRStorage not being locked. Returns true if successful.
+bool SaveUSRIndexCache(Project* project);
+
+/// Restores the indexing information of all source files of the given project
+/// that have not been indexed yet and that are up-to-date in the cache file.
+/// These source files are marked as indexed, such that
+/// Project::IndexAllNewFiles() skips them. The USRs and reference sites of the
+/// restored files are decoded on a background thread, which publishes them in
+/// the USRStorage when it is done. Must be called from the main (Qt) thread,
+/// with the USRStorage not being locked. Returns the number of restored source
+/// files.
+int LoadUSRIndexCache(Project* project);
+
+/// Waits until the USRs restored by all previous calls to LoadUSRIndexCache()
+/// have been published in the USRStorage.
+void WaitForUSRIndexCacheLoading();
@@ -4,6 +4,23 @@
 
 #include "cide/util.h"
 
+#ifdef WIN32
+  #define NOMINMAX
+  #include <windows.h>
+  #include <psapi.h>
+#elif defined(__APPLE__)
+  #include <sys/resource.h>
+  #include <sys/sysctl.h>
+#else
+  #include <sys/resource.h>
+  #include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+
 #include <QDir>
 #include <QPushButton>
 #include <QProcessEnvironment>
@@ -76,6 +93,82 @@ QString FindDefaultClangBinaryPath() {
 }
 
 
+quint64 GetProcessPeakResidentMemory() {
+#ifdef WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  if (!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+    return 0;
+  }
+  return counters.PeakWorkingSetSize;
+#else
+  rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) != 0) {
+    return 0;
+  }
+  #ifdef __APPLE__
+    // On macOS, ru_maxrss is given in bytes.
+    return usage.ru_maxrss;
+  #else
+    // On Linux, ru_maxrss is given in kilobytes.
+    return static_cast<quint64>(usage.ru_maxrss) * 1024;
+  #endif
+#endif
+}
+
+quint64 GetPhysicalMemorySize() {
+#ifdef WIN32
+  MEMORYSTATUSEX status;
+  status.dwLength = sizeof(status);
+  if (!GlobalMemoryStatusEx(&status)) {
+    return 0;
+  }
+  return status.ullTotalPhys;
+#elif defined(__APPLE__)
+  quint64 size = 0;
+  std::size_t sizeLength = sizeof(size);
+  if (sysctlbyname("hw.memsize", &size, &sizeLength, nullptr, 0) != 0) {
+    return 0;
+  }
+  return size;
+#else
+  long numPages = sysconf(_SC_PHYS_PAGES);
+  long pageSize = sysconf(_SC_PAGESIZE);
+  if (numPages <= 0 || pageSize <= 0) {
+    return 0;
+  }
+  return static_cast<quint64>(numPages) * pageSize;
+#endif
+}
+
+
+void ParallelFor(int count, int threadCount, const std::function<bool()>& isCanceled, const std::function<void(int)>& function) {
+  std::atomic<int> nextIndex(0);
+  auto threadFunction = [&]() {
+    while (!isCanceled()) {
+      int index = nextIndex.fetch_add(1);
+      if (index >= count) {
+        return;
+      }
+      function(index);
+    }
+  };
+  
+  if (threadCount <= 0) {
+    threadCount = std::max<int>(1, std::thread::hardware_concurrency());
+  }
+  threadCount = std::max(1, std::min(threadCount, count));
+  
+  std::vector<std::thread> workerThreads;
+  for (int i = 1; i < threadCount; ++ i) {
+    workerThreads.emplace_back(threadFunction);
+  }
+  threadFunction();
+  for (std::thread& thread : workerThreads) {
+    thread.join();
+  }
+}
+
+
 QRgb ParseHexColor(const QString& text) {
   if (text.size() != 6) {
     qDebug() << "Warning: Failed to parse hex color string (size != 6):" << text;
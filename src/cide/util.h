@@ -53,6 +53,26 @@ void MinimizeButtonSize(QPushButton* button, float factor);
 QString FindDefaultClangBinaryPath();
 
 
+/// Returns the peak resident memory (working set) of the current process in
+/// bytes, or 0 if it cannot be determined.
+quint64 GetProcessPeakResidentMemory();
+
+/// Returns the total physical memory of the system in bytes, or 0 if it cannot
+/// be determined.
+quint64 GetPhysicalMemorySize();
+
+
+/// Calls @p function for each index in [0, count), distributing the indices
+/// over @p threadCount threads (with the calling thread being one of them).
+/// If @p threadCount is 0 or less, one thread per CPU core is used. Once
+/// @p isCanceled returns true, no further indices are started. Returns after
+/// all threads finished.
+/// 
+/// Notice that if the thread count is taken from the settings, it must be read
+/// in the Qt thread and passed in here.
+void ParallelFor(int count, int threadCount, const std::function<bool()>& isCanceled, const std::function<void(int)>& function);
+
+
 /// Returns a set of Qt::WindowFlags that allow for making custom tooltip-style widgets.
 /// Using Qt::ToolTip worked on Linux but failed on Windows, since those tooltips
 /// automatically close under a variety of conditions there, such as any mouse clicks.